@@ -0,0 +1,78 @@
+// Log-linear latency histogram (HDR histogram layout): values below 2*HIST_SUB are exact, above that
+// every power of 2 is split into HIST_SUB buckets, so percentiles are within 1/HIST_SUB of the true value.
+
+#ifndef LATENCY_HIST_H
+#define LATENCY_HIST_H
+
+#include <stdint.h>
+#include <string.h>
+
+const int      HIST_SUB_BITS = 5;
+const uint64_t HIST_SUB      = 1ull << HIST_SUB_BITS;
+/// Exact values, then HIST_SUB buckets for each of 64 - HIST_SUB_BITS - 1 remaining powers of 2
+const size_t   HIST_BUCKETS  = 2*HIST_SUB + (64 - HIST_SUB_BITS - 1)*HIST_SUB;
+
+struct latency_hist_t
+{
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;                     /// Recorded values
+    uint64_t max;                       /// Exact max
+};
+
+static inline size_t hist_index (uint64_t value)
+{
+    if (value < 2*HIST_SUB) return (size_t) value;
+
+    int shift = 63 - __builtin_clzll (value) - HIST_SUB_BITS;      // >= 1
+    uint64_t top = value >> shift;                                  // HIST_SUB .. 2*HIST_SUB-1
+
+    return (size_t) (2*HIST_SUB + (uint64_t) (shift - 1)*HIST_SUB + (top - HIST_SUB));
+}
+
+/// Largest value of bucket
+static inline uint64_t hist_bucket_max (size_t index)
+{
+    if (index < 2*HIST_SUB) return index;
+
+    uint64_t shift = (index - 2*HIST_SUB) / HIST_SUB + 1;
+    uint64_t top   = (index - 2*HIST_SUB) % HIST_SUB + HIST_SUB;
+
+    return ((top + 1) << shift) - 1;
+}
+
+static inline void hist_reset (latency_hist_t *hist)
+{
+    memset (hist, 0, sizeof (*hist));
+}
+
+static inline void hist_record (latency_hist_t *hist, uint64_t value)
+{
+    hist->counts[hist_index (value)]++;
+    hist->total++;
+    if (value > hist->max) hist->max = value;
+}
+
+/// Value at quantile q (0..1): upper bound of the bucket holding it, 0 for empty histogram
+static inline uint64_t hist_quantile (const latency_hist_t *hist, double q)
+{
+    if (hist->total == 0) return 0;
+
+    uint64_t rank = (uint64_t) (q * (double) hist->total + 0.5);
+    if (rank < 1)           rank = 1;
+    if (rank > hist->total) rank = hist->total;
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HIST_BUCKETS; ++i)
+    {
+        seen += hist->counts[i];
+        if (seen >= rank)
+        {
+            uint64_t bucket_max = hist_bucket_max (i);
+            return (bucket_max < hist->max) ? bucket_max : hist->max;
+        }
+    }
+
+    return hist->max;
+}
+
+#endif // LATENCY_HIST_H
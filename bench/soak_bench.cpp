@@ -0,0 +1,267 @@
+// Tail latency soak of stack_t for the protection set it is compiled with (see make soak).
+// Long-lived randomized push/pop traces (random walk, sawtooth, bursts) on one stack with default growth
+// policy. Every operation is timed with trace_clock into a log-linear histogram, operations that changed
+// capacity (grow or shrink inside push/pop) separately from the others.
+// Usage: soak_bench [--json] [--no-header] [--label <text>] [--ops <n>] [--size <bytes>] [--seed <n>]
+//   --ops   Operations per pattern (default SOAK_OPS, less if SOAK_BUDGET_NS runs out)
+//   --size  Element size (default SOAK_OBJ_SIZE)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "../stack.h"
+#include "../log.h"
+#include "latency_hist.h"
+
+const size_t   SOAK_OPS       = 1ul << 21;
+const size_t   SOAK_OBJ_SIZE  = 64;
+/// Max depth of traces
+const size_t   SOAK_MAX_DEPTH = 1ul << 15;
+/// Depth of steady part of burst pattern & burst probability (1/SOAK_BURST_RATE per operation)
+const size_t   SOAK_BASE_DEPTH = 256;
+const uint64_t SOAK_BURST_RATE = 4096;
+/// Time after which pattern stops (mprotect per operation makes memory protected sets ~1000x slower)
+const double   SOAK_BUDGET_NS = 3e9;
+
+enum soak_pattern
+{
+    SOAK_RANDOM   = 0,                  /// Random walk drifting around half of max depth
+    SOAK_SAWTOOTH = 1,                  /// Fill to random peak, drain to random trough
+    SOAK_BURST    = 2,                  /// Steady oscillation with rare bursts of up to max depth pushes & pops
+};
+
+static const char *const PATTERN_NAMES[] = {"random", "sawtooth", "burst"};
+
+/// Operation classes reported
+enum soak_class
+{
+    CLASS_ALL     = 0,
+    CLASS_RESIZE  = 1,                  /// Capacity changed during operation
+    CLASS_STEADY  = 2,
+
+    CLASS_COUNT
+};
+
+static const char *const CLASS_NAMES[] = {"all", "resize", "steady"};
+
+struct trace_gen_t
+{
+    soak_pattern pattern;
+    uint64_t rng;
+    bool rising;                        /// Sawtooth direction & burst phase
+    size_t target;                      /// Sawtooth peak or trough
+    size_t burst_len;                   /// Pushes of current burst
+    size_t burst_left;                  /// Operations left in current burst phase
+};
+
+struct options_t
+{
+    bool json;
+    bool header;
+    const char *label;
+    size_t ops;
+    size_t obj_size;
+    uint64_t seed;
+};
+
+// ------------------------------------------------------------------------------------
+
+static uint64_t next_random (trace_gen_t *gen)
+{
+    // xorshift64*
+    gen->rng ^= gen->rng >> 12;
+    gen->rng ^= gen->rng << 25;
+    gen->rng ^= gen->rng >> 27;
+    return gen->rng * 2685821657736338717ull;
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Next operation of trace: true for push
+static bool next_is_push (trace_gen_t *gen, size_t depth)
+{
+    if (depth == 0)              return true;
+    if (depth >= SOAK_MAX_DEPTH) return false;
+
+    switch (gen->pattern)
+    {
+        case SOAK_RANDOM:
+            return next_random (gen) % 100 < ((depth < SOAK_MAX_DEPTH / 2) ? 55u : 45u);
+
+        case SOAK_SAWTOOTH:
+            if (gen->rising && depth >= gen->target)
+            {
+                gen->rising = false;
+                gen->target = next_random (gen) % (SOAK_MAX_DEPTH / 8);
+            }
+            else if (!gen->rising && depth <= gen->target)
+            {
+                gen->rising = true;
+                gen->target = SOAK_MAX_DEPTH / 4 + next_random (gen) % (3 * SOAK_MAX_DEPTH / 4);
+            }
+            return gen->rising;
+
+        case SOAK_BURST:
+            if (gen->burst_left > 0)
+            {
+                gen->burst_left--;
+                bool push = gen->rising;
+
+                // Pushes of burst are followed by as many pops
+                if (gen->burst_left == 0 && gen->rising)
+                {
+                    gen->rising     = false;
+                    gen->burst_left = gen->burst_len;
+                }
+                return push;
+            }
+            if (next_random (gen) % SOAK_BURST_RATE == 0)
+            {
+                gen->burst_len  = 1 + next_random (gen) % (SOAK_MAX_DEPTH - SOAK_BASE_DEPTH);
+                gen->burst_left = gen->burst_len;
+                gen->rising     = true;
+            }
+            if (depth < SOAK_BASE_DEPTH) return true;
+            return (next_random (gen) & 1) != 0;
+
+        default:
+            return false;
+    }
+}
+
+// ------------------------------------------------------------------------------------
+
+/// trace_clock ticks per ns
+static double calibrate_ticks ()
+{
+    auto     start_time  = std::chrono::steady_clock::now ();
+    uint64_t start_ticks = trace_clock ();
+
+    while (std::chrono::steady_clock::now () - start_time < std::chrono::milliseconds (20)) {}
+
+    uint64_t ticks = trace_clock () - start_ticks;
+    double   ns    = std::chrono::duration<double, std::nano> (std::chrono::steady_clock::now () - start_time).count ();
+
+    return (double) ticks / ns;
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Run pattern, histograms get trace_clock ticks of every operation
+static void run_pattern (const options_t *opts, soak_pattern pattern, latency_hist_t *hists)
+{
+    trace_gen_t gen = {pattern, opts->seed * 2 + 1, true, SOAK_MAX_DEPTH / 2, 0, 0};
+
+    char *elem = (char *) calloc (opts->obj_size, 1);
+    if (elem == nullptr) return;
+
+    stack_t stk = {};
+    stack_ctor (&stk, opts->obj_size, 1, nullptr, nullptr, VERIFY_OFF);
+
+    auto start = std::chrono::steady_clock::now ();
+
+    for (size_t i = 0; i < opts->ops; ++i)
+    {
+        if ((i & 0xFFF) == 0 && std::chrono::steady_clock::now () - start > std::chrono::nanoseconds ((long) SOAK_BUDGET_NS))
+        {
+            break;
+        }
+
+        bool   push     = next_is_push (&gen, stk.size);
+        size_t capacity = stk.capacity;
+
+        uint64_t op_start = trace_clock ();
+        if (push) { elem[0] = (char) i; stack_push (&stk, elem); }
+        else      {                     stack_pop  (&stk, elem); }
+        uint64_t ticks = trace_clock () - op_start;
+
+        hist_record (&hists[CLASS_ALL], ticks);
+        hist_record (&hists[(stk.capacity != capacity) ? CLASS_RESIZE : CLASS_STEADY], ticks);
+    }
+
+    stack_dtor (&stk);
+    free (elem);
+}
+
+// ------------------------------------------------------------------------------------
+
+static void print_result (const options_t *opts, soak_pattern pattern, soak_class cls,
+                          const latency_hist_t *hist, double ticks_per_ns)
+{
+    double p50  = (double) hist_quantile (hist, 0.5)   / ticks_per_ns;
+    double p99  = (double) hist_quantile (hist, 0.99)  / ticks_per_ns;
+    double p999 = (double) hist_quantile (hist, 0.999) / ticks_per_ns;
+    double max  = (double) hist->max                   / ticks_per_ns;
+
+    if (opts->json)
+    {
+        printf ("{\"label\": \"%s\", \"ksp\": %d, \"canary\": %d, \"hash\": %d, \"memory\": %d, "
+                "\"pattern\": \"%s\", \"obj_size\": %zu, \"class\": \"%s\", \"count\": %llu, "
+                "\"p50_ns\": %.0f, \"p99_ns\": %.0f, \"p999_ns\": %.0f, \"max_ns\": %.0f}\n",
+                opts->label, STACK_KSP_PROTECT, STACK_DUNGEON_MASTER_PROTECT, STACK_HASH_PROTECT, STACK_MEMORY_PROTECT,
+                PATTERN_NAMES[pattern], opts->obj_size, CLASS_NAMES[cls], (unsigned long long) hist->total,
+                p50, p99, p999, max);
+    }
+    else
+    {
+        printf ("%s,%d,%d,%d,%d,%s,%zu,%s,%llu,%.0f,%.0f,%.0f,%.0f\n",
+                opts->label, STACK_KSP_PROTECT, STACK_DUNGEON_MASTER_PROTECT, STACK_HASH_PROTECT, STACK_MEMORY_PROTECT,
+                PATTERN_NAMES[pattern], opts->obj_size, CLASS_NAMES[cls], (unsigned long long) hist->total,
+                p50, p99, p999, max);
+    }
+
+    fflush (stdout);
+}
+
+// ------------------------------------------------------------------------------------
+
+int main (int argc, char **argv)
+{
+    set_log_stream (stderr);
+
+    options_t opts = {false, true, "", SOAK_OPS, SOAK_OBJ_SIZE, 1};
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if      (strcmp (argv[i], "--json")      == 0) opts.json   = true;
+        else if (strcmp (argv[i], "--no-header") == 0) opts.header = false;
+        else if (strcmp (argv[i], "--label") == 0 && i + 1 < argc) opts.label    = argv[++i];
+        else if (strcmp (argv[i], "--ops")   == 0 && i + 1 < argc) opts.ops      = strtoul  (argv[++i], nullptr, 10);
+        else if (strcmp (argv[i], "--size")  == 0 && i + 1 < argc) opts.obj_size = strtoul  (argv[++i], nullptr, 10);
+        else if (strcmp (argv[i], "--seed")  == 0 && i + 1 < argc) opts.seed     = strtoull (argv[++i], nullptr, 10);
+        else
+        {
+            fprintf (stderr, "Usage: %s [--json] [--no-header] [--label <text>] [--ops <n>] [--size <bytes>] [--seed <n>]\n",
+                     argv[0]);
+            return 2;
+        }
+    }
+
+    if (opts.obj_size == 0) opts.obj_size = 1;
+
+    if (opts.header && !opts.json)
+    {
+        printf ("label,ksp,canary,hash,memory,pattern,obj_size,class,count,p50_ns,p99_ns,p999_ns,max_ns\n");
+    }
+
+    double ticks_per_ns = calibrate_ticks ();
+
+    latency_hist_t *hists = (latency_hist_t *) calloc (CLASS_COUNT, sizeof (latency_hist_t));
+    if (hists == nullptr) return 1;
+
+    for (soak_pattern pattern : {SOAK_RANDOM, SOAK_SAWTOOTH, SOAK_BURST})
+    {
+        for (int cls = 0; cls < CLASS_COUNT; ++cls) hist_reset (&hists[cls]);
+
+        run_pattern (&opts, pattern, hists);
+
+        for (int cls = 0; cls < CLASS_COUNT; ++cls)
+        {
+            print_result (&opts, pattern, (soak_class) cls, &hists[cls], ticks_per_ns);
+        }
+    }
+
+    free (hists);
+    return 0;
+}
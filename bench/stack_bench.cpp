@@ -0,0 +1,261 @@
+// Throughput benchmark of stack_t for the protection set it is compiled with (see make bench).
+// Workloads: push, pop, push/pop oscillation, resize-heavy and verify-heavy, element sizes 1 B .. 4 KB.
+// Every workload runs up to BENCH_RUNS times within BENCH_BUDGET_NS (at least once), min & median ns per
+// operation are reported. Operation counts do not depend on protection set, so results of all sets compare.
+// Usage: stack_bench [--json] [--no-header] [--label <text>] [--quick]
+//   --json       JSON Lines (one object per result) instead of CSV
+//   --no-header  No CSV header (results of several binaries go to one file)
+//   --label      First column of every result (commit id etc.)
+//   --quick      8x less operations
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include "../stack.h"
+#include "../log.h"
+
+const size_t ELEM_SIZES[] = {1, 8, 64, 512, 4096};
+
+/// Bytes pushed by push, pop & resize workloads (ops = BENCH_BYTES / obj_size within BENCH_MIN_OPS..BENCH_MAX_OPS)
+const size_t BENCH_BYTES   = 1ul << 20;
+const size_t BENCH_MIN_OPS = 256;
+const size_t BENCH_MAX_OPS = 1ul << 15;
+
+/// Depth & operations of oscillation and verify workloads
+const size_t OSC_DEPTH      = 64;
+const size_t OSC_OPS        = 1ul << 15;
+const size_t VERIFY_OPS     = 1ul << 10;
+
+const int    BENCH_RUNS      = 5;
+/// Time after which no more runs start (mprotect per operation makes memory protected sets ~1000x slower)
+const double BENCH_BUDGET_NS = 250e6;
+
+/// Workload: runs ops operations on stack of obj_size elements, returns elapsed ns
+typedef double (*workload_f) (size_t obj_size, size_t ops, char *elem);
+
+struct workload_t
+{
+    const char *name;
+    workload_f run;
+    bool per_byte_ops;                  /// ops scale with 1/obj_size (else fixed)
+};
+
+struct options_t
+{
+    bool json;
+    bool header;
+    bool quick;
+    const char *label;
+};
+
+// ------------------------------------------------------------------------------------
+
+static double now_ns ()
+{
+    return std::chrono::duration<double, std::nano> (std::chrono::steady_clock::now ().time_since_epoch ()).count ();
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Push into preallocated stack: no resizes
+static double bench_push (size_t obj_size, size_t ops, char *elem)
+{
+    stack_t stk = {};
+    stack_ctor (&stk, obj_size, ops, nullptr, nullptr, VERIFY_OFF, &STACK_NEVER_SHRINK);
+
+    double start = now_ns ();
+    for (size_t i = 0; i < ops; ++i)
+    {
+        elem[0] = (char) i;
+        stack_push (&stk, elem);
+    }
+    double elapsed = now_ns () - start;
+
+    stack_dtor (&stk);
+    return elapsed;
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Pop of prefilled stack that never shrinks
+static double bench_pop (size_t obj_size, size_t ops, char *elem)
+{
+    stack_t stk = {};
+    stack_ctor (&stk, obj_size, ops, nullptr, nullptr, VERIFY_OFF, &STACK_NEVER_SHRINK);
+
+    for (size_t i = 0; i < ops; ++i) stack_push (&stk, elem);
+
+    double start = now_ns ();
+    for (size_t i = 0; i < ops; ++i)
+    {
+        stack_pop (&stk, elem);
+    }
+    double elapsed = now_ns () - start;
+
+    stack_dtor (&stk);
+    return elapsed;
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Push & pop pairs at constant depth (ops counts both)
+static double bench_oscillate (size_t obj_size, size_t ops, char *elem)
+{
+    stack_t stk = {};
+    stack_ctor (&stk, obj_size, OSC_DEPTH + 1, nullptr, nullptr, VERIFY_OFF);
+
+    for (size_t i = 0; i < OSC_DEPTH; ++i) stack_push (&stk, elem);
+
+    double start = now_ns ();
+    for (size_t i = 0; i < ops / 2; ++i)
+    {
+        stack_push (&stk, elem);
+        stack_pop  (&stk, elem);
+    }
+    double elapsed = now_ns () - start;
+
+    stack_dtor (&stk);
+    return elapsed;
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Fill from capacity 1 and drain with default growth policy: every doubling and shrink resizes (ops counts both)
+static double bench_resize (size_t obj_size, size_t ops, char *elem)
+{
+    stack_t stk = {};
+    stack_ctor (&stk, obj_size, 1, nullptr, nullptr, VERIFY_OFF);
+
+    double start = now_ns ();
+    for (size_t i = 0; i < ops / 2; ++i) stack_push (&stk, elem);
+    for (size_t i = 0; i < ops / 2; ++i) stack_pop  (&stk, elem);
+    double elapsed = now_ns () - start;
+
+    stack_dtor (&stk);
+    return elapsed;
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Oscillation with full check before & after every operation
+static double bench_verify (size_t obj_size, size_t ops, char *elem)
+{
+    stack_t stk = {};
+    stack_ctor (&stk, obj_size, OSC_DEPTH + 1, nullptr, nullptr, VERIFY_FULL);
+
+    for (size_t i = 0; i < OSC_DEPTH; ++i) stack_push (&stk, elem);
+
+    double start = now_ns ();
+    for (size_t i = 0; i < ops / 2; ++i)
+    {
+        stack_push (&stk, elem);
+        stack_pop  (&stk, elem);
+    }
+    double elapsed = now_ns () - start;
+
+    stack_dtor (&stk);
+    return elapsed;
+}
+
+// ------------------------------------------------------------------------------------
+
+static const workload_t WORKLOADS[] =
+{
+    {"push",      bench_push,      true},
+    {"pop",       bench_pop,       true},
+    {"oscillate", bench_oscillate, false},
+    {"resize",    bench_resize,    true},
+    {"verify",    bench_verify,    false},
+};
+
+// ------------------------------------------------------------------------------------
+
+static size_t workload_ops (const workload_t *workload, size_t obj_size, bool quick)
+{
+    size_t ops = (workload->run == bench_verify) ? VERIFY_OPS :
+                 (!workload->per_byte_ops)       ? OSC_OPS    :
+                 std::clamp (BENCH_BYTES / obj_size, BENCH_MIN_OPS, BENCH_MAX_OPS);
+
+    return quick ? std::max (ops / 8, (size_t) 2) : ops;
+}
+
+// ------------------------------------------------------------------------------------
+
+static void print_result (const options_t *opts, const workload_t *workload, size_t obj_size, size_t ops,
+                          double min_ns, double median_ns)
+{
+    double ns_per_op = min_ns / (double) ops;
+    double mb_per_s  = (double) (ops * obj_size) / min_ns * 1e3;
+
+    if (opts->json)
+    {
+        printf ("{\"label\": \"%s\", \"ksp\": %d, \"canary\": %d, \"hash\": %d, \"memory\": %d, "
+                "\"workload\": \"%s\", \"obj_size\": %zu, \"ops\": %zu, "
+                "\"ns_per_op_min\": %.2f, \"ns_per_op_median\": %.2f, \"mb_per_s\": %.1f}\n",
+                opts->label, STACK_KSP_PROTECT, STACK_DUNGEON_MASTER_PROTECT, STACK_HASH_PROTECT, STACK_MEMORY_PROTECT,
+                workload->name, obj_size, ops, ns_per_op, median_ns / (double) ops, mb_per_s);
+    }
+    else
+    {
+        printf ("%s,%d,%d,%d,%d,%s,%zu,%zu,%.2f,%.2f,%.1f\n",
+                opts->label, STACK_KSP_PROTECT, STACK_DUNGEON_MASTER_PROTECT, STACK_HASH_PROTECT, STACK_MEMORY_PROTECT,
+                workload->name, obj_size, ops, ns_per_op, median_ns / (double) ops, mb_per_s);
+    }
+
+    fflush (stdout);
+}
+
+// ------------------------------------------------------------------------------------
+
+int main (int argc, char **argv)
+{
+    set_log_stream (stderr);
+
+    options_t opts = {false, true, false, ""};
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if      (strcmp (argv[i], "--json")      == 0) opts.json   = true;
+        else if (strcmp (argv[i], "--no-header") == 0) opts.header = false;
+        else if (strcmp (argv[i], "--quick")     == 0) opts.quick  = true;
+        else if (strcmp (argv[i], "--label")     == 0 && i + 1 < argc) opts.label = argv[++i];
+        else
+        {
+            fprintf (stderr, "Usage: %s [--json] [--no-header] [--label <text>] [--quick]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (opts.header && !opts.json)
+    {
+        printf ("label,ksp,canary,hash,memory,workload,obj_size,ops,ns_per_op_min,ns_per_op_median,mb_per_s\n");
+    }
+
+    char *elem = (char *) calloc (ELEM_SIZES[sizeof (ELEM_SIZES) / sizeof (ELEM_SIZES[0]) - 1], 1);
+    if (elem == nullptr) return 1;
+
+    for (const workload_t &workload : WORKLOADS)
+    {
+        for (size_t obj_size : ELEM_SIZES)
+        {
+            size_t ops = workload_ops (&workload, obj_size, opts.quick);
+
+            double runs[BENCH_RUNS] = {};
+            double total = 0;
+            int    count = 0;
+            while (count < BENCH_RUNS && (count == 0 || total < BENCH_BUDGET_NS))
+            {
+                runs[count] = workload.run (obj_size, ops, elem);
+                total += runs[count++];
+            }
+            std::sort (runs, runs + count);
+
+            print_result (&opts, &workload, obj_size, ops, runs[0], runs[count / 2]);
+        }
+    }
+
+    free (elem);
+    return 0;
+}
@@ -0,0 +1,137 @@
+// Fork-join benchmark of work-stealing deques: N workers count leaves of fib(n) call tree.
+// Every task above the cutoff forks two subtasks into its worker's deque, idle workers steal.
+// Usage: ws_bench [max_workers] [n]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "../ws_deque.h"
+#include "../log.h"
+
+/// Tasks below it are computed serially
+const int SERIAL_CUTOFF = 12;
+
+const int MAX_WORKERS = 64;
+
+struct worker_t
+{
+    ws_deque_t deque;                   /// Own tasks
+    long leaves;                        /// Leaves counted by worker
+    long steals;                        /// Tasks stolen by worker
+};
+
+static worker_t workers[MAX_WORKERS];
+static std::atomic<long> pending = 0;   /// Forked tasks not finished yet
+
+// ------------------------------------------------------------------------------------
+
+static long leaves_serial (int n)
+{
+    return (n < 2) ? 1 : leaves_serial (n - 1) + leaves_serial (n - 2);
+}
+
+// ------------------------------------------------------------------------------------
+
+static void run_task (worker_t *self, int n)
+{
+    if (n < SERIAL_CUTOFF)
+    {
+        self->leaves += leaves_serial (n);
+        pending.fetch_sub (1, std::memory_order_release);
+        return;
+    }
+
+    int left = n - 1, right = n - 2;
+
+    // Two forks replace the task itself
+    pending.fetch_add (1, std::memory_order_relaxed);
+    stack_push (&self->deque, &left);
+    stack_push (&self->deque, &right);
+}
+
+// ------------------------------------------------------------------------------------
+
+static void worker_loop (int id, int count)
+{
+    worker_t *self = &workers[id];
+    unsigned seed  = (unsigned) id * 2654435761u + 1;
+    int task = 0;
+
+    while (pending.load (std::memory_order_acquire) > 0)
+    {
+        if (stack_pop (&self->deque, &task) == res::OK)
+        {
+            run_task (self, task);
+            continue;
+        }
+
+        seed = seed * 1103515245u + 12345u;
+        int victim = (int) ((seed >> 16) % (unsigned) count);
+
+        if (victim != id && stack_steal (&workers[victim].deque, &task) == res::OK)
+        {
+            self->steals++;
+            run_task (self, task);
+        }
+    }
+}
+
+// ------------------------------------------------------------------------------------
+
+int main (int argc, char **argv)
+{
+    set_log_stream (stderr);
+
+    int max_workers = (argc > 1) ? atoi (argv[1]) : (int) std::thread::hardware_concurrency ();
+    int n           = (argc > 2) ? atoi (argv[2]) : 32;
+
+    if (max_workers < 1)           max_workers = 1;
+    if (max_workers > MAX_WORKERS) max_workers = MAX_WORKERS;
+
+    long expected = leaves_serial (n);
+    printf ("workers,n,time_ms,leaves,steals,ok\n");
+
+    // 1, 2, 4, ... workers and max_workers
+    for (int count = 1; ; count = (count*2 < max_workers) ? count*2 : max_workers)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            stack_ctor (&workers[i].deque, sizeof (int));
+            workers[i].leaves = 0;
+            workers[i].steals = 0;
+        }
+
+        pending = 1;
+        stack_push (&workers[0].deque, &n);
+
+        auto start = std::chrono::steady_clock::now ();
+
+        std::thread threads[MAX_WORKERS];
+        for (int i = 0; i < count; ++i)
+        {
+            threads[i] = std::thread (worker_loop, i, count);
+        }
+        for (int i = 0; i < count; ++i)
+        {
+            threads[i].join ();
+        }
+
+        double ms = std::chrono::duration<double, std::milli> (std::chrono::steady_clock::now () - start).count ();
+
+        long leaves = 0, steals = 0;
+        for (int i = 0; i < count; ++i)
+        {
+            leaves += workers[i].leaves;
+            steals += workers[i].steals;
+            stack_dtor (&workers[i].deque);
+        }
+
+        printf ("%d,%d,%.2f,%ld,%ld,%s\n", count, n, ms, leaves, steals, (leaves == expected) ? "yes" : "no");
+
+        if (count == max_workers) break;
+    }
+
+    return 0;
+}
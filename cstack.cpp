@@ -0,0 +1,592 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <new>
+#include "log.h"
+#include "cstack.h"
+
+STACK_NAMESPACE_BEGIN
+
+// ---- ---- ---- --- CONSTS ---- ---- ---- ----
+
+/// Size of struct part covered by struct hash
+#if STACK_HASH_PROTECT
+const size_t CSTACK_PROTECTED_STRUCT_SIZE = offsetof (cstack_t, struct_hash);
+#endif
+
+const size_t NODE_CANARY_SIZE = STACK_DUNGEON_MASTER_PROTECT ? sizeof (dungeon_master_t) : 0;
+
+// ---- ---- ---- --- MACROS ---- ---- ---- ----
+
+/// stack_assert for concurrent operations: reports failed stack_check without stack_dump (it runs full verify)
+#define cstack_assert(stk)                                          \
+{                                                                   \
+    err_flags check_res = stack_check(stk);                         \
+    if (check_res != res::OK)                                       \
+    {                                                               \
+        log(log::ERR,                                               \
+            "Failed concurrent stack check with err flags: ");      \
+        stack_perror (check_res, get_log_stream(), "->");           \
+        return check_res;                                           \
+    }                                                               \
+}
+
+// ---- ---- ---- --- PROTOTYPES ---- ---- ---- ----
+
+static inline uint64_t head_pack  (uint32_t index, uint64_t old_head);
+static inline uint32_t head_index (uint64_t head);
+
+static inline cstack_node_t *node_at   (const cstack_t *stk, uint32_t index);
+static inline char          *node_elem (const cstack_node_t *node);
+
+static uint32_t list_pop  (const cstack_t *stk, std::atomic<uint64_t> *list);
+static bool     list_push (const cstack_t *stk, std::atomic<uint64_t> *list, uint32_t index);
+
+static uint32_t node_take    (cstack_t *stk);
+static bool     segment_init (cstack_t *stk, size_t segment);
+static void     node_check   (const cstack_t *stk, const cstack_node_t *node, bool used, err_flags *errs);
+
+static bool     eliminate_push (cstack_t *stk, uint32_t index);
+static uint32_t eliminate_pop  (cstack_t *stk);
+static std::atomic<uint64_t> *elimination_slot (cstack_t *stk);
+
+static inline hash_t elem_hash (const cstack_t *stk, const void *elem);
+static inline hash_t calc_struct_hash (const cstack_t *stk);
+
+// ---- ---- ---- --- IMPLEMENTATIONS ---- ---- ---- ----
+
+err_flags __stack_ctor (cstack_t *stk, size_t obj_size, elem_print_f print_func, hash_f hash_func)
+{
+    assert (obj_size > 0   && "object size cant be 0");
+    assert (stk != nullptr && "pointer can't be null");
+
+    stk->obj_size  = obj_size;
+    stk->node_size = (sizeof (cstack_node_t) + obj_size + NODE_CANARY_SIZE + alignof (cstack_node_t) - 1)
+                     / alignof (cstack_node_t) * alignof (cstack_node_t);
+
+    stk->head.store      (head_pack (CSTACK_NIL, 0), std::memory_order_relaxed);
+    stk->free_head.store (head_pack (CSTACK_NIL, 0), std::memory_order_relaxed);
+    stk->size.store      (0, std::memory_order_relaxed);
+    stk->next_node.store (0, std::memory_order_relaxed);
+    stk->offer_tag.store (0, std::memory_order_relaxed);
+
+    for (size_t i = 0; i < CSTACK_SEGMENTS; ++i)
+    {
+        stk->segments[i].store (nullptr, std::memory_order_relaxed);
+    }
+    for (size_t i = 0; i < CSTACK_ELIMINATION; ++i)
+    {
+        stk->elimination[i].store (0, std::memory_order_relaxed);
+    }
+
+    #ifndef NDEBUG
+        stk->print_func = (print_func != nullptr) ? print_func : byte_fprintf;
+    #else
+        (void) print_func;
+    #endif
+
+    #if STACK_HASH_PROTECT
+        stk->hash_func = (hash_func != nullptr) ? hash_func : STACK_DEFAULT_HASH;
+    #else
+        (void) hash_func;
+    #endif
+
+    #if STACK_DUNGEON_MASTER_PROTECT
+        stk->two_blocks_up   = dungeon_master_val;
+        stk->two_blocks_down = dungeon_master_val;
+    #endif
+
+    #if STACK_HASH_PROTECT
+        stk->struct_hash = calc_struct_hash (stk);
+    #endif
+
+    stack_assert (stk);
+    return res::OK;
+}
+
+// ------------------------------------------------------------------------------------
+
+#ifndef NDEBUG
+err_flags __stack_ctor_with_debug (cstack_t *stk, const stack_debug_t *debug_data,
+                                size_t obj_size, elem_print_f print_func, hash_f hash_func)
+{
+    assert (stk != nullptr && "pointer can't be NULL");
+
+    stk->debug_data = debug_data;
+
+    return __stack_ctor (stk, obj_size, print_func, hash_func);
+}
+#endif
+
+// ------------------------------------------------------------------------------------
+
+err_flags stack_push (cstack_t *stk, const void *value)
+{
+    cstack_assert (stk);
+    assert (value != nullptr && "pointer can't be null");
+
+    uint32_t index = node_take (stk);
+    if (index == CSTACK_NIL) return res::NOMEM;
+
+    cstack_node_t *node = node_at (stk, index);
+    memcpy (node_elem (node), value, stk->obj_size);
+    node->hash = elem_hash (stk, node_elem (node));
+
+    // Counted before publishing, so concurrent pops never take size below zero
+    stk->size.fetch_add (1, std::memory_order_relaxed);
+
+    while (!list_push (stk, &stk->head, index))
+    {
+        // Top is contended: try to hand the element to a pop directly
+        if (eliminate_push (stk, index))
+        {
+            stk->size.fetch_sub (1, std::memory_order_relaxed);
+            break;
+        }
+    }
+
+    return res::OK;
+}
+
+// ------------------------------------------------------------------------------------
+
+err_flags stack_pop (cstack_t *stk, void *value)
+{
+    cstack_assert (stk);
+    assert (value != nullptr && "pointer can't be NULL");
+
+    uint32_t index = CSTACK_NIL;
+
+    for (;;)
+    {
+        uint64_t head = stk->head.load (std::memory_order_acquire);
+        if (head_index (head) == CSTACK_NIL) return res::EMPTY;
+
+        index = list_pop (stk, &stk->head);
+        if (index != CSTACK_NIL)
+        {
+            stk->size.fetch_sub (1, std::memory_order_relaxed);
+            break;
+        }
+
+        index = eliminate_pop (stk);
+        if (index != CSTACK_NIL) break;
+    }
+
+    cstack_node_t *node = node_at (stk, index);
+
+    err_flags errs = res::OK;
+    node_check (stk, node, true, &errs);
+
+    memcpy (value, node_elem (node), stk->obj_size);
+
+    #if STACK_KSP_PROTECT
+        poison_fill (node_elem (node), stk->obj_size);
+    #endif
+
+    while (!list_push (stk, &stk->free_head, index)) {}
+
+    if (errs != res::OK)
+    {
+        log (log::ERR, "Popped corrupted node of concurrent stack with err flags: ");
+        stack_perror (errs, get_log_stream(), "->");
+    }
+
+    return errs;
+}
+
+// ------------------------------------------------------------------------------------
+
+err_flags stack_dtor (cstack_t *stk)
+{
+    if (stk == nullptr) { return res::OK; }
+
+    #ifndef NDEBUG
+        err_flags check_res = stack_verify (stk);
+        if (check_res != OK) log(log::WRN, "Destructor called on invalid object with error flags: 0x%x, see stack_perror", check_res);
+    #endif
+
+    for (size_t i = 0; i < CSTACK_SEGMENTS; ++i)
+    {
+        free (stk->segments[i].exchange (nullptr, std::memory_order_relaxed));
+    }
+
+    stk->head.store      (head_pack (CSTACK_NIL, 0), std::memory_order_relaxed);
+    stk->free_head.store (head_pack (CSTACK_NIL, 0), std::memory_order_relaxed);
+    stk->next_node.store (0, std::memory_order_relaxed);
+
+    #if STACK_KSP_PROTECT
+        // Poisoning
+        stk->size.store (-1u, std::memory_order_relaxed);
+        stk->obj_size  = 0;
+        stk->node_size = 0;
+    #endif
+
+    return res::OK;
+}
+
+// ------------------------------------------------------------------------------------
+
+void stack_dump (cstack_t *stk, FILE *stream)
+{
+    fprintf (stream, R Bold "\n======== CONCURRENT STACK DUMP =======\n" Plain D);
+
+    if (stk == nullptr)
+    {
+        fprintf (stream, "Stack ptr is nullptr\n");
+        return;
+    }
+
+    err_flags check_res = stack_verify (stk);
+
+    if (check_res != OK)
+    {
+        fprintf (stream, "Stack has errors: \n");
+        stack_perror(check_res, stream, "-> ");
+    }
+
+    if (check_res & (res::POISONED | res::INVALID_OBJ_SIZE | res::STRUCT_CORRUPTED)) { return; }
+
+    #ifndef NDEBUG
+        fprintf (stream, "Stack[%p] with name " Bold "%s" Plain
+            " allocated at " Bold "%s" Plain " at file " Bold "%s:(%u)\n" Plain,
+            stk, stk->debug_data->var_name, stk->debug_data->func_name, stk->debug_data->file, stk->debug_data->line
+        );
+    #else
+        fprintf (stream, "Stack[%p]\n", stk);
+    #endif
+
+    fprintf (stream, "Parameters:\n"
+                     "    size: %lu\n"
+                     "    nodes: %u\n"
+                     "    object size: %lu\n\n",
+                     stk->size.load (), stk->next_node.load (), stk->obj_size);
+
+    size_t index = stk->size.load ();
+    uint32_t nodes = stk->next_node.load ();
+
+    for (uint32_t cur = head_index (stk->head.load ()); cur < nodes && index > 0; cur = node_at (stk, cur)->next.load ())
+    {
+        const char *elem = node_elem (node_at (stk, cur));
+        fprintf (stream, "* data[%03lu] (node %u): ", --index, cur);
+
+        #ifndef NDEBUG
+            stk->print_func (elem, stk->obj_size, stream);
+        #else
+            byte_fprintf (elem, stk->obj_size, stream);
+        #endif
+
+        fputc ('\n', stream);
+    }
+
+    fprintf (stream, R Bold "======== END CONCURRENT STACK DUMP =======\n\n" Plain D);
+}
+
+// ------------------------------------------------------------------------------------
+
+err_flags stack_check (cstack_t *stk)
+{
+    if (stk == nullptr) return res::NULLPTR;
+
+    err_flags ret = res::OK;
+
+    if (stk->obj_size == 0) return res::INVALID_OBJ_SIZE;
+
+    #ifndef NDEBUG
+        if (stk->print_func == nullptr) ret |= res::INVALID_FUNC;
+    #endif
+
+    #if STACK_DUNGEON_MASTER_PROTECT
+        if (stk->two_blocks_up != dungeon_master_val || stk->two_blocks_down != dungeon_master_val)
+        {
+            ret |= res::STRUCT_CORRUPTED;
+        }
+    #endif
+
+    #if STACK_HASH_PROTECT
+        if (stk->hash_func == nullptr)                  ret |= res::INVALID_FUNC;
+        else if (calc_struct_hash (stk) != stk->struct_hash) ret |= res::STRUCT_CORRUPTED;
+    #endif
+
+    return ret;
+}
+
+// ------------------------------------------------------------------------------------
+
+err_flags stack_verify (cstack_t *stk)
+{
+    if (stk == nullptr) return res::NULLPTR;
+
+    err_flags ret = stack_check (stk);
+    if (ret != res::OK) return ret;
+
+    uint32_t nodes = stk->next_node.load (std::memory_order_acquire);
+    size_t used = 0, free_nodes = 0;
+
+    // Walks are bounded by nodes count, so a cycle made by corruption ends too
+    uint32_t cur = head_index (stk->head.load (std::memory_order_acquire));
+    for (; cur != CSTACK_NIL && cur < nodes && used <= nodes; cur = node_at (stk, cur)->next.load (std::memory_order_relaxed))
+    {
+        node_check (stk, node_at (stk, cur), true, &ret);
+        used++;
+    }
+    if (cur != CSTACK_NIL) ret |= res::STRUCT_CORRUPTED;
+
+    cur = head_index (stk->free_head.load (std::memory_order_acquire));
+    for (; cur != CSTACK_NIL && cur < nodes && free_nodes <= nodes; cur = node_at (stk, cur)->next.load (std::memory_order_relaxed))
+    {
+        node_check (stk, node_at (stk, cur), false, &ret);
+        free_nodes++;
+    }
+    if (cur != CSTACK_NIL) ret |= res::STRUCT_CORRUPTED;
+
+    if (used != stk->size.load (std::memory_order_relaxed)) ret |= res::INVALID_SIZE;
+    if (used + free_nodes > nodes)                          ret |= res::STRUCT_CORRUPTED;
+
+    return ret;
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Head with index and the next tag
+static inline uint64_t head_pack (uint32_t index, uint64_t old_head)
+{
+    return ((old_head >> 32) + 1) << 32 | index;
+}
+
+// ------------------------------------------------------------------------------------
+
+static inline uint32_t head_index (uint64_t head)
+{
+    return (uint32_t) head;
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Node by index: segment k holds indexes [F*(2^k - 1), F*(2^(k+1) - 1)), F = CSTACK_FIRST_SEGMENT
+static inline cstack_node_t *node_at (const cstack_t *stk, uint32_t index)
+{
+    assert (stk != nullptr && "pointer can't be null");
+
+    size_t shifted = (size_t) index + CSTACK_FIRST_SEGMENT;
+    size_t segment = (size_t) (63 - __builtin_clzll (shifted)) - (size_t) __builtin_ctz (CSTACK_FIRST_SEGMENT);
+    size_t offset  = shifted - ((size_t) CSTACK_FIRST_SEGMENT << segment);
+
+    unsigned char *mem = stk->segments[segment].load (std::memory_order_acquire);
+    assert (mem != nullptr && "node of not allocated segment");
+
+    return (cstack_node_t *) (void *) (mem + offset*stk->node_size);
+}
+
+// ------------------------------------------------------------------------------------
+
+static inline char *node_elem (const cstack_node_t *node)
+{
+    assert (node != nullptr && "pointer can't be null");
+
+    return (char *) const_cast<cstack_node_t *>(node + 1);
+}
+
+// ------------------------------------------------------------------------------------
+
+/// One CAS attempt to take the top node of list (CSTACK_NIL if list is empty or CAS failed)
+static uint32_t list_pop (const cstack_t *stk, std::atomic<uint64_t> *list)
+{
+    uint64_t head  = list->load (std::memory_order_acquire);
+    uint32_t index = head_index (head);
+
+    if (index == CSTACK_NIL) return CSTACK_NIL;
+
+    // Node may be taken & reused meanwhile: its memory stays valid and the tag fails CAS
+    uint32_t next = node_at (stk, index)->next.load (std::memory_order_relaxed);
+
+    if (!list->compare_exchange_strong (head, head_pack (next, head), std::memory_order_acquire, std::memory_order_relaxed))
+    {
+        return CSTACK_NIL;
+    }
+
+    return index;
+}
+
+// ------------------------------------------------------------------------------------
+
+/// One CAS attempt to put node on top of list
+static bool list_push (const cstack_t *stk, std::atomic<uint64_t> *list, uint32_t index)
+{
+    uint64_t head = list->load (std::memory_order_relaxed);
+
+    node_at (stk, index)->next.store (head_index (head), std::memory_order_relaxed);
+
+    return list->compare_exchange_strong (head, head_pack (index, head), std::memory_order_release, std::memory_order_relaxed);
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Free node or a new one from segments (CSTACK_NIL if out of memory)
+static uint32_t node_take (cstack_t *stk)
+{
+    assert (stk != nullptr && "pointer can't be null");
+
+    while (head_index (stk->free_head.load (std::memory_order_acquire)) != CSTACK_NIL)
+    {
+        uint32_t index = list_pop (stk, &stk->free_head);
+        if (index != CSTACK_NIL) return index;
+    }
+
+    uint32_t index = stk->next_node.fetch_add (1, std::memory_order_relaxed);
+
+    size_t shifted = (size_t) index + CSTACK_FIRST_SEGMENT;
+    size_t segment = (size_t) (63 - __builtin_clzll (shifted)) - (size_t) __builtin_ctz (CSTACK_FIRST_SEGMENT);
+
+    if (segment >= CSTACK_SEGMENTS || index == CSTACK_NIL) return CSTACK_NIL;
+    if (!segment_init (stk, segment)) return CSTACK_NIL;
+
+    return index;
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Allocate segment with canaries & poisoned elements if nobody did it yet
+static bool segment_init (cstack_t *stk, size_t segment)
+{
+    assert (stk != nullptr && "pointer can't be null");
+
+    if (stk->segments[segment].load (std::memory_order_acquire) != nullptr) return true;
+
+    size_t nodes = (size_t) CSTACK_FIRST_SEGMENT << segment;
+    unsigned char *mem = (unsigned char *) calloc (nodes, stk->node_size);
+    if (mem == nullptr) return false;
+
+    for (size_t i = 0; i < nodes; ++i)
+    {
+        cstack_node_t *node = new (mem + i*stk->node_size) cstack_node_t {dungeon_master_val, CSTACK_NIL, 0};
+
+        #if STACK_DUNGEON_MASTER_PROTECT
+            // Trailing canary may be unaligned (obj_size % 8 != 0)
+            memcpy (node_elem (node) + stk->obj_size, &dungeon_master_val, sizeof (dungeon_master_t));
+        #endif
+
+        #if STACK_KSP_PROTECT
+            poison_fill (node_elem (node), stk->obj_size);
+        #endif
+
+        (void) node;
+    }
+
+    unsigned char *expected = nullptr;
+    if (!stk->segments[segment].compare_exchange_strong (expected, mem, std::memory_order_acq_rel))
+    {
+        free (mem); // Other thread was faster
+    }
+
+    return true;
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Check node canaries, its element hash & poison (used) or poison (free)
+static void node_check (const cstack_t *stk, const cstack_node_t *node, bool used, err_flags *errs)
+{
+    assert (stk  != nullptr && "pointer can't be null");
+    assert (node != nullptr && "pointer can't be null");
+    assert (errs != nullptr && "pointer can't be null");
+
+    #if STACK_DUNGEON_MASTER_PROTECT
+        dungeon_master_t back = 0;
+        memcpy (&back, node_elem (node) + stk->obj_size, sizeof (dungeon_master_t));
+
+        if (node->canary != dungeon_master_val || back != dungeon_master_val) *errs |= res::DATA_CORRUPTED;
+    #endif
+
+    #if STACK_KSP_PROTECT
+        if (used  && poison_has_elem (node_elem (node), 1, stk->obj_size))  *errs |= res::POISONED;
+        if (!used && !poison_is_range (node_elem (node), stk->obj_size))    *errs |= res::DATA_CORRUPTED;
+    #endif
+
+    #if STACK_HASH_PROTECT
+        if (used && elem_hash (stk, node_elem (node)) != node->hash) *errs |= res::DATA_CORRUPTED;
+    #endif
+
+    (void) used;
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Offer pushed node to pops for a while (true if a pop took it)
+static bool eliminate_push (cstack_t *stk, uint32_t index)
+{
+    std::atomic<uint64_t> *slot = elimination_slot (stk);
+    uint64_t offer    = (uint64_t) stk->offer_tag.fetch_add (1, std::memory_order_relaxed) << 32 | ((uint64_t) index + 1);
+    uint64_t expected = 0;
+
+    if (!slot->compare_exchange_strong (expected, offer, std::memory_order_release, std::memory_order_relaxed))
+    {
+        return false;
+    }
+
+    for (unsigned spin = 0; spin < CSTACK_ELIMINATION_SPINS; ++spin)
+    {
+        if (slot->load (std::memory_order_relaxed) != offer) return true;
+    }
+
+    // Withdraw, unless a pop takes it right now
+    expected = offer;
+    return !slot->compare_exchange_strong (expected, 0, std::memory_order_relaxed, std::memory_order_relaxed);
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Take node offered by a push (CSTACK_NIL if there is none)
+static uint32_t eliminate_pop (cstack_t *stk)
+{
+    std::atomic<uint64_t> *slot = elimination_slot (stk);
+    uint64_t offer = slot->load (std::memory_order_acquire);
+
+    if (offer == 0) return CSTACK_NIL;
+    if (!slot->compare_exchange_strong (offer, 0, std::memory_order_acquire, std::memory_order_relaxed)) return CSTACK_NIL;
+
+    return (uint32_t) offer - 1;
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Random elimination slot (xorshift per thread)
+static std::atomic<uint64_t> *elimination_slot (cstack_t *stk)
+{
+    static thread_local uint32_t seed = 0;
+
+    if (seed == 0) seed = (uint32_t) (uintptr_t) &seed | 1;
+
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+
+    return &stk->elimination[seed % CSTACK_ELIMINATION];
+}
+
+// ------------------------------------------------------------------------------------
+
+static inline hash_t elem_hash (const cstack_t *stk, const void *elem)
+{
+    #if STACK_HASH_PROTECT
+        return stk->hash_func (elem, stk->obj_size);
+    #else
+        (void) stk;
+        (void) elem;
+        return 0;
+    #endif
+}
+
+// ------------------------------------------------------------------------------------
+
+static inline hash_t calc_struct_hash (const cstack_t *stk)
+{
+    #if STACK_HASH_PROTECT
+        return hash_fixed<CSTACK_PROTECTED_STRUCT_SIZE> (stk);
+    #else
+        (void) stk;
+        return 0;
+    #endif
+}
+
+STACK_NAMESPACE_END
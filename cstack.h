@@ -0,0 +1,132 @@
+#ifndef CSTACK_H
+#define CSTACK_H
+
+#include <atomic>
+#include "stack.h"
+#include "variant.h"
+
+STACK_NAMESPACE_BEGIN
+
+#ifndef CSTACK_FIRST_SEGMENT
+/// Nodes in the first node segment (power of 2), segment k holds CSTACK_FIRST_SEGMENT << k nodes
+#define CSTACK_FIRST_SEGMENT            64
+#endif
+
+#ifndef CSTACK_SEGMENTS
+/// Node segments limit (CSTACK_FIRST_SEGMENT << CSTACK_SEGMENTS nodes must fit in 32-bit index)
+#define CSTACK_SEGMENTS                 24
+#endif
+
+#ifndef CSTACK_ELIMINATION
+/// Slots of elimination array
+#define CSTACK_ELIMINATION              8
+#endif
+
+#ifndef CSTACK_ELIMINATION_SPINS
+/// Spins of push waiting in elimination slot for a pop
+#define CSTACK_ELIMINATION_SPINS        128
+#endif
+
+/// Index of no node
+const uint32_t CSTACK_NIL = UINT32_MAX;
+
+/**
+ * @brief Node of concurrent stack
+ *
+ * Header is followed by element and trailing canary (STACK_DUNGEON_MASTER_PROTECT).
+ * Free nodes' elements are poisoned (STACK_KSP_PROTECT), hash of element is set on push
+ * and checked on pop (STACK_HASH_PROTECT).
+ */
+struct cstack_node_t
+{
+    dungeon_master_t canary;            /// Node header canary
+    std::atomic<uint32_t> next;         /// Node below (CSTACK_NIL for the bottom one)
+    hash_t hash;                        /// Element hash (STACK_HASH_PROTECT)
+};
+
+/**
+ * @brief Lock-free multi-producer multi-consumer stack (Treiber stack)
+ *
+ * Top and free node list heads are 32-bit node index & 32-bit ABA tag, changed by one CAS.
+ * Nodes live in segments that are freed only by destructor, so a node read by a thread that lost
+ * the race is still valid memory (type-stable reclamation). Pushes and pops that lose CAS meet
+ * in the elimination array and exchange the element without touching the top.
+ *
+ * Works with stack_ctor, stack_push, stack_pop, stack_dtor, stack_dump, stack_verify, stack_check.
+ * Every push & pop checks struct (canaries, hash of immutable fields) and its node (canaries, element hash)
+ * and only logs failures: stack_verify & stack_dump walk all nodes and need no concurrent operations. Memory protection is not supported.
+ */
+struct cstack_t
+{
+    #if STACK_DUNGEON_MASTER_PROTECT
+    dungeon_master_t two_blocks_up;     /// Struct canary
+    #endif
+
+    size_t obj_size;                    /// Stack object size
+    size_t node_size;                   /// Node stride in segment
+
+    #ifndef NDEBUG
+    elem_print_f print_func;            /// Function for printing elements
+    const stack_debug_t *debug_data;    /// Debug data
+    #endif
+
+    #if STACK_HASH_PROTECT
+    hash_f hash_func;                   /// Hash function
+    #endif
+
+    #if STACK_DUNGEON_MASTER_PROTECT
+    dungeon_master_t two_blocks_down;   /// Struct canary
+    #endif
+
+    #if STACK_HASH_PROTECT
+    hash_t struct_hash;                 /// Hash of fields above (they never change, so it is checked without locks)
+    #endif
+
+    // Shared state, not protected
+    alignas (64) std::atomic<uint64_t> head;                       /// Top node index & tag
+    alignas (64) std::atomic<uint64_t> free_head;                  /// Free node list index & tag
+    alignas (64) std::atomic<size_t>   size;                       /// Elements count (exact without concurrent operations)
+    std::atomic<uint32_t> next_node;                               /// Nodes ever taken from segments
+    std::atomic<unsigned char *> segments[CSTACK_SEGMENTS];        /// Node segments
+    alignas (64) std::atomic<uint64_t> elimination[CSTACK_ELIMINATION]; /// Offer tag & pushed node index + 1 (0 - empty)
+    std::atomic<uint32_t> offer_tag;                               /// Tag of next offer (reused node can't be mistaken for own offer)
+};
+
+/**
+ * @brief      Concurrent stack constructor (not thread safe)
+ *
+ * @param[out] stk         Pointer to stack
+ * @param[in]  obj_size    Object size
+ * @param[in]  print_func  Function for printing elements (can be nullptr -> per byte print)
+ * @param[in]  hash_func   Hash function (can be nullptr -> STACK_DEFAULT_HASH)
+ *
+ * @return     Error flags (bitor of res enum)
+ */
+err_flags __stack_ctor (cstack_t *stk, size_t obj_size, elem_print_f print_func = nullptr, hash_f hash_func = nullptr);
+
+#ifndef NDEBUG
+    err_flags __stack_ctor_with_debug (cstack_t *stk, const stack_debug_t *debug_data,
+                                    size_t obj_size, elem_print_f print_func = nullptr, hash_f hash_func = nullptr);
+#endif
+
+/// Thread safe push
+err_flags stack_push (cstack_t *stk, const void *value);
+
+/// Thread safe pop, DATA_CORRUPTED or POISONED if popped node is corrupted (value is copied anyway)
+err_flags stack_pop (cstack_t *stk, void *value);
+
+/// Destructor (not thread safe)
+err_flags stack_dtor (cstack_t *stk);
+
+/// Dump (no concurrent operations)
+void stack_dump (cstack_t *stk, FILE *stream);
+
+/// Full check of struct, stack & free nodes (no concurrent operations)
+err_flags stack_verify (cstack_t *stk);
+
+/// Thread safe O(1) check: struct canaries & hash
+err_flags stack_check (cstack_t *stk);
+
+STACK_NAMESPACE_END
+
+#endif // CSTACK_H
@@ -1,6 +1,74 @@
 #include <assert.h>
+#include <string.h>
 #include "hash.h"
 
+#if (__x86_64__ || __i386__)
+#include <immintrin.h>
+#define HASH_X86 1
+#else
+#define HASH_X86 0
+#endif
+
+STACK_NAMESPACE_BEGIN
+
+const uint64_t HASH_K1 = 0x9E3779B97F4A7C15ull;
+const uint64_t HASH_K2 = 0xC2B2AE3D27D4EB4Full;
+const uint64_t HASH_K3 = 0xFF51AFD7ED558CCDull;
+
+/// simd_hash lane keys
+static const uint64_t SIMD_HASH_KEYS[8] =
+{
+    0xBE4BA423396CFEB8ull, 0x1CAD21F72C81017Cull, 0xDB979083E96DD4DEull, 0x1F67B3B7A4A44072ull,
+    0x78E5C0CC4EE679CBull, 0x2172FFCC7DD05A82ull, 0x8E2443F7744608B8ull, 0x4C263A81E69035E0ull,
+};
+
+/// Registered hash functions
+struct hash_entry_t
+{
+    const char *name;
+    hash_f func;
+};
+
+static const hash_entry_t HASH_REGISTRY[] =
+{
+    {"djb2",   djb2_hash},
+    {"word",   word_hash},
+    {"simd",   simd_hash},
+    {"crc32c", crc32c_hash},
+};
+
+static inline uint64_t load64 (const unsigned char *ptr)
+{
+    uint64_t word = 0;
+    memcpy (&word, ptr, sizeof (uint64_t));
+
+    return word;
+}
+
+static inline uint64_t rotl64 (uint64_t x, unsigned int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+/// Hash of last (size % 8) bytes and size
+static inline hash_t tail_hash (hash_t hash, const unsigned char *bytes, size_t size)
+{
+    size_t i = 0;
+    for (; i + sizeof (uint64_t) <= size; i += sizeof (uint64_t))
+    {
+        hash = rotl64 (hash ^ (load64 (bytes + i) * HASH_K2), 31) * HASH_K1;
+    }
+
+    if (i < size)
+    {
+        uint64_t word = 0;
+        memcpy (&word, bytes + i, size - i);
+        hash = rotl64 (hash ^ (word * HASH_K2), 31) * HASH_K1;
+    }
+
+    return hash_mix64 (hash ^ (size * HASH_K3));
+}
+
 hash_t djb2_hash (const void *obj, size_t obj_size)
 {
     assert (obj != nullptr && "Pointer can't be null");
@@ -30,4 +98,316 @@ hash_t strhash (const void *str, size_t obj_size)
     }
 
     return hash;
-}
\ No newline at end of file
+}
+
+// ------------------------------------------------------------------------------------
+
+hash_t slot_hash (hash_f hash_func, size_t index, const void *slot, size_t obj_size)
+{
+    assert (hash_func != nullptr && "Pointer can't be null");
+    assert (slot      != nullptr && "Pointer can't be null");
+
+    return hash_mix64 (hash_func (slot, obj_size) + (index + 1) * 0x9E3779B97F4A7C15ull);
+}
+
+// ------------------------------------------------------------------------------------
+
+hash_t slots_hash (hash_f hash_func, const void *data, size_t first, size_t count, size_t obj_size)
+{
+    assert (hash_func != nullptr && "Pointer can't be null");
+    assert (data      != nullptr && "Pointer can't be null");
+
+    const char *data_c = (const char *) data;
+    hash_t hash = 0;
+
+    for (size_t i = first; i < first + count; ++i)
+    {
+        hash += slot_hash (hash_func, i, data_c + i*obj_size, obj_size);
+    }
+
+    return hash;
+}
+
+// ---- ---- ---- --- WORD HASH ---- ---- ---- ----
+
+hash_t word_hash (const void *obj, size_t obj_size)
+{
+    assert (obj != nullptr && "Pointer can't be null");
+
+    const unsigned char *bytes = (const unsigned char *) obj;
+
+    uint64_t h0 = HASH_K1, h1 = HASH_K2, h2 = HASH_K3, h3 = HASH_K1 ^ HASH_K2;
+
+    size_t i = 0;
+    for (; i + 4*sizeof (uint64_t) <= obj_size; i += 4*sizeof (uint64_t))
+    {
+        h0 = rotl64 (h0 ^ (load64 (bytes + i)      * HASH_K2), 31) * HASH_K1;
+        h1 = rotl64 (h1 ^ (load64 (bytes + i + 8)  * HASH_K2), 31) * HASH_K1;
+        h2 = rotl64 (h2 ^ (load64 (bytes + i + 16) * HASH_K2), 31) * HASH_K1;
+        h3 = rotl64 (h3 ^ (load64 (bytes + i + 24) * HASH_K2), 31) * HASH_K1;
+    }
+
+    hash_t hash = h0 ^ rotl64 (h1, 7) ^ rotl64 (h2, 13) ^ rotl64 (h3, 29);
+
+    return tail_hash (hash, bytes + i, obj_size - i);
+}
+
+// ---- ---- ---- --- SIMD HASH ---- ---- ---- ----
+// 8 lanes of 64 bits per 64-byte block, for each lane l with input word d:
+//     acc[l]     += lo32 (d ^ key[l]) * hi32 (d ^ key[l])
+//     acc[l ^ 1] += d
+// SSE2 and AVX2 kernels compute exactly the same lanes as the portable one.
+
+static void simd_acc_portable (uint64_t *acc, const unsigned char *bytes, size_t blocks)
+{
+    for (size_t b = 0; b < blocks; ++b)
+    {
+        for (size_t l = 0; l < 8; ++l)
+        {
+            uint64_t data     = load64 (bytes + b*64 + l*8);
+            uint64_t data_key = data ^ SIMD_HASH_KEYS[l];
+
+            acc[l]     += (data_key & 0xFFFFFFFFull) * (data_key >> 32);
+            acc[l ^ 1] += data;
+        }
+    }
+}
+
+#if HASH_X86
+
+__attribute__((target("sse2")))
+static void simd_acc_sse2 (uint64_t *acc, const unsigned char *bytes, size_t blocks)
+{
+    __m128i acc_v[4] = {};
+    __m128i keys [4] = {};
+
+    for (size_t j = 0; j < 4; ++j)
+    {
+        acc_v[j] = _mm_loadu_si128 ((const __m128i *) (acc + 2*j));
+        keys [j] = _mm_loadu_si128 ((const __m128i *) (SIMD_HASH_KEYS + 2*j));
+    }
+
+    for (size_t b = 0; b < blocks; ++b)
+    {
+        for (size_t j = 0; j < 4; ++j)
+        {
+            __m128i data     = _mm_loadu_si128 ((const __m128i *) (bytes + b*64 + j*16));
+            __m128i data_key = _mm_xor_si128 (data, keys[j]);
+            __m128i product  = _mm_mul_epu32 (data_key, _mm_shuffle_epi32 (data_key, _MM_SHUFFLE (0, 3, 0, 1)));
+            __m128i swapped  = _mm_shuffle_epi32 (data, _MM_SHUFFLE (1, 0, 3, 2));
+
+            acc_v[j] = _mm_add_epi64 (acc_v[j], _mm_add_epi64 (product, swapped));
+        }
+    }
+
+    for (size_t j = 0; j < 4; ++j)
+    {
+        _mm_storeu_si128 ((__m128i *) (acc + 2*j), acc_v[j]);
+    }
+}
+
+__attribute__((target("avx2")))
+static void simd_acc_avx2 (uint64_t *acc, const unsigned char *bytes, size_t blocks)
+{
+    __m256i acc_v[2] = {};
+    __m256i keys [2] = {};
+
+    for (size_t j = 0; j < 2; ++j)
+    {
+        acc_v[j] = _mm256_loadu_si256 ((const __m256i *) (acc + 4*j));
+        keys [j] = _mm256_loadu_si256 ((const __m256i *) (SIMD_HASH_KEYS + 4*j));
+    }
+
+    for (size_t b = 0; b < blocks; ++b)
+    {
+        for (size_t j = 0; j < 2; ++j)
+        {
+            __m256i data     = _mm256_loadu_si256 ((const __m256i *) (bytes + b*64 + j*32));
+            __m256i data_key = _mm256_xor_si256 (data, keys[j]);
+            __m256i product  = _mm256_mul_epu32 (data_key, _mm256_shuffle_epi32 (data_key, _MM_SHUFFLE (0, 3, 0, 1)));
+            __m256i swapped  = _mm256_shuffle_epi32 (data, _MM_SHUFFLE (1, 0, 3, 2));
+
+            acc_v[j] = _mm256_add_epi64 (acc_v[j], _mm256_add_epi64 (product, swapped));
+        }
+    }
+
+    for (size_t j = 0; j < 2; ++j)
+    {
+        _mm256_storeu_si256 ((__m256i *) (acc + 4*j), acc_v[j]);
+    }
+}
+
+#endif // HASH_X86
+
+typedef void (*simd_acc_f) (uint64_t *acc, const unsigned char *bytes, size_t blocks);
+
+static simd_acc_f simd_acc_kernel ()
+{
+    #if HASH_X86
+        static const simd_acc_f selected = __builtin_cpu_supports ("avx2") ? simd_acc_avx2 :
+                                           __builtin_cpu_supports ("sse2") ? simd_acc_sse2 : simd_acc_portable;
+        return selected;
+    #else
+        return simd_acc_portable;
+    #endif
+}
+
+hash_t simd_hash (const void *obj, size_t obj_size)
+{
+    assert (obj != nullptr && "Pointer can't be null");
+
+    const unsigned char *bytes = (const unsigned char *) obj;
+
+    uint64_t acc[8] = {HASH_K1, HASH_K2, HASH_K3, HASH_K1 ^ HASH_K3, HASH_K2 ^ HASH_K3, HASH_K1 + HASH_K2, HASH_K2 + HASH_K3, HASH_K1 + HASH_K3};
+
+    size_t blocks = obj_size / 64;
+    if (blocks > 0)
+    {
+        simd_acc_kernel () (acc, bytes, blocks);
+    }
+
+    hash_t hash = 0;
+    for (size_t l = 0; l < 8; ++l)
+    {
+        hash = rotl64 (hash ^ hash_mix64 (acc[l]), 27) * HASH_K1;
+    }
+
+    return tail_hash (hash, bytes + blocks*64, obj_size - blocks*64);
+}
+
+// ---- ---- ---- --- CRC32C ---- ---- ---- ----
+
+/// Castagnoli polynomial (reflected)
+const uint32_t CRC32C_POLY = 0x82F63B78u;
+
+const uint32_t CRC32C_SEED_LO = 0xFFFFFFFFu;
+const uint32_t CRC32C_SEED_HI = 0x9E3779B9u;
+
+// CRC of the same bytes with another seed differs only by a function of length,
+// so high lane reads every 8-byte block rotated by one byte and the tail backwards
+
+struct crc32c_table_t
+{
+    uint32_t values[256];
+};
+
+static constexpr crc32c_table_t crc32c_make_table ()
+{
+    crc32c_table_t table = {};
+
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        table.values[i] = crc;
+    }
+
+    return table;
+}
+
+static constexpr crc32c_table_t CRC32C_TABLE = crc32c_make_table ();
+
+static inline uint32_t crc32c_byte (uint32_t crc, unsigned char byte)
+{
+    return CRC32C_TABLE.values[(crc ^ byte) & 0xFF] ^ (crc >> 8);
+}
+
+static void crc32c_portable (const unsigned char *bytes, size_t size, uint32_t *lo, uint32_t *hi)
+{
+    size_t i = 0;
+    for (; i + sizeof (uint64_t) <= size; i += sizeof (uint64_t))
+    {
+        for (size_t j = 0; j < sizeof (uint64_t); ++j)
+        {
+            *lo = crc32c_byte (*lo, bytes[i + j]);
+            *hi = crc32c_byte (*hi, bytes[i + (j + 1) % sizeof (uint64_t)]);
+        }
+    }
+
+    for (size_t j = i; j < size; ++j)
+    {
+        *lo = crc32c_byte (*lo, bytes[j]);
+        *hi = crc32c_byte (*hi, bytes[size - 1 - (j - i)]);
+    }
+}
+
+#if HASH_X86 && __x86_64__
+
+__attribute__((target("sse4.2")))
+static void crc32c_sse42 (const unsigned char *bytes, size_t size, uint32_t *lo, uint32_t *hi)
+{
+    uint64_t crc_lo = *lo, crc_hi = *hi;
+
+    size_t i = 0;
+    for (; i + sizeof (uint64_t) <= size; i += sizeof (uint64_t))
+    {
+        uint64_t word = load64 (bytes + i);
+
+        crc_lo = _mm_crc32_u64 (crc_lo, word);
+        crc_hi = _mm_crc32_u64 (crc_hi, rotl64 (word, 56));
+    }
+
+    for (size_t j = i; j < size; ++j)
+    {
+        crc_lo = _mm_crc32_u8 ((uint32_t) crc_lo, bytes[j]);
+        crc_hi = _mm_crc32_u8 ((uint32_t) crc_hi, bytes[size - 1 - (j - i)]);
+    }
+
+    *lo = (uint32_t) crc_lo;
+    *hi = (uint32_t) crc_hi;
+}
+
+#endif
+
+typedef void (*crc32c_f) (const unsigned char *bytes, size_t size, uint32_t *lo, uint32_t *hi);
+
+static crc32c_f crc32c_kernel ()
+{
+    #if HASH_X86 && __x86_64__
+        static const crc32c_f selected = __builtin_cpu_supports ("sse4.2") ? crc32c_sse42 : crc32c_portable;
+        return selected;
+    #else
+        return crc32c_portable;
+    #endif
+}
+
+hash_t crc32c_hash (const void *obj, size_t obj_size)
+{
+    assert (obj != nullptr && "Pointer can't be null");
+
+    uint32_t lo = CRC32C_SEED_LO, hi = CRC32C_SEED_HI;
+    crc32c_kernel () ((const unsigned char *) obj, obj_size, &lo, &hi);
+
+    return hash_mix64 ((((hash_t) hi << 32) | lo) ^ (obj_size * HASH_K1));
+}
+
+// ---- ---- ---- --- REGISTRY ---- ---- ---- ----
+
+hash_f hash_find (const char *name)
+{
+    assert (name != nullptr && "Pointer can't be null");
+
+    for (size_t i = 0; i < sizeof (HASH_REGISTRY) / sizeof (HASH_REGISTRY[0]); ++i)
+    {
+        if (strcmp (HASH_REGISTRY[i].name, name) == 0) return HASH_REGISTRY[i].func;
+    }
+
+    return nullptr;
+}
+
+// ------------------------------------------------------------------------------------
+
+const char *hash_name (hash_f func)
+{
+    for (size_t i = 0; i < sizeof (HASH_REGISTRY) / sizeof (HASH_REGISTRY[0]); ++i)
+    {
+        if (HASH_REGISTRY[i].func == func) return HASH_REGISTRY[i].name;
+    }
+
+    return nullptr;
+}
+
+STACK_NAMESPACE_END
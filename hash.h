@@ -3,6 +3,10 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include "variant.h"
+
+STACK_NAMESPACE_BEGIN
 
 typedef uint64_t hash_t;
 typedef hash_t (*hash_f) (const void *obj, size_t obj_size);
@@ -10,4 +14,91 @@ typedef hash_t (*hash_f) (const void *obj, size_t obj_size);
 hash_t djb2_hash (const void *obj, size_t obj_size);
 hash_t strhash (const void *str, size_t obj_size);
 
+/// Word-at-a-time multiplicative hash (4 independent lanes of 8 bytes)
+hash_t word_hash (const void *obj, size_t obj_size);
+
+/// SIMD accumulate hash (AVX2 / SSE2 chosen at runtime, same result with portable fallback)
+hash_t simd_hash (const void *obj, size_t obj_size);
+
+/// Two CRC32C lanes, second over byte-rotated input (hardware SSE4.2 crc32 if available, table otherwise) mixed into 64 bits
+hash_t crc32c_hash (const void *obj, size_t obj_size);
+
+// ---------------- Hash registry ----------------
+
+/**
+ * @brief      Find hash function by name
+ *
+ * Names: "djb2", "word", "simd", "crc32c".
+ * Example: stack_ctor (&stk, sizeof (int), 0, nullptr, hash_find ("crc32c"));
+ *
+ * @return     Hash function or nullptr if name is unknown
+ */
+hash_f hash_find (const char *name);
+
+/// Name of registered hash function (nullptr if not registered)
+const char *hash_name (hash_f func);
+
+// ---------------- Fixed-size kernel ----------------
+
+/// splitmix64 finalizer
+static inline hash_t hash_mix64 (hash_t x)
+{
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBull;
+    x ^= x >> 31;
+
+    return x;
+}
+
+/**
+ * @brief      Word hash of object with compile-time size (used for struct hashes)
+ *
+ * Loop over N/8 words is fully unrolled by compiler.
+ */
+template <size_t N>
+static inline hash_t hash_fixed (const void *obj)
+{
+    const unsigned char *bytes = (const unsigned char *) obj;
+    hash_t hash = N * 0x9E3779B97F4A7C15ull;
+
+    for (size_t i = 0; i + sizeof (uint64_t) <= N; i += sizeof (uint64_t))
+    {
+        uint64_t word = 0;
+        memcpy (&word, bytes + i, sizeof (uint64_t));
+
+        hash = (hash ^ word) * 0xFF51AFD7ED558CCDull;
+        hash ^= hash >> 29;
+    }
+
+    if constexpr (N % sizeof (uint64_t) != 0)
+    {
+        uint64_t word = 0;
+        memcpy (&word, bytes + N - N % sizeof (uint64_t), N % sizeof (uint64_t));
+
+        hash = (hash ^ word) * 0xFF51AFD7ED558CCDull;
+    }
+
+    return hash_mix64 (hash);
+}
+
+/**
+ * @brief      Position-keyed hash of one element slot
+ *
+ * Slot hashes of different positions are combined by wrapping addition, so the hash of a
+ * buffer can be updated from a single changed slot: h += slot_hash (new) - slot_hash (old).
+ *
+ * @param[in]  hash_func  Hash function for the element bytes
+ * @param[in]  index      Slot index
+ * @param[in]  slot       Pointer to slot
+ * @param[in]  obj_size   Slot size
+ */
+hash_t slot_hash (hash_f hash_func, size_t index, const void *slot, size_t obj_size);
+
+/// Sum of slot_hash over slots [first, first+count) of buffer data (full rescan of incremental hash with first = 0)
+hash_t slots_hash (hash_f hash_func, const void *data, size_t first, size_t count, size_t obj_size);
+
+STACK_NAMESPACE_END
+
 #endif
\ No newline at end of file
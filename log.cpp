@@ -1,50 +1,468 @@
 #define __LOG_CPP
 
 #include <assert.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <new>
 #include "log.h"
 
+STACK_NAMESPACE_BEGIN
+
 log __LOG_LEVEL = log::WRN;
 FILE *__LOG_OUT_STREAM = stdout;
 
+// ---- ---- ---- --- ASYNC MODE ---- ---- ---- ----
+
+/// Compact record written by caller: formatting of time & prefix is left to the writer
+struct log_record_t
+{
+    time_t time;                        /// Cached clock at the call
+    const char *file;                   /// Callsite file (string literal)
+    unsigned int line;                  /// Callsite line
+    log lvl;                            /// Level
+    char msg[LOG_RECORD_MSG];           /// Formatted message
+};
+
+/// Single producer (owner thread) single consumer (writer under drain_lock) ring
+struct log_ring_t
+{
+    alignas (64) std::atomic<size_t> head {0};      /// Next record to write out (consumer)
+    alignas (64) std::atomic<size_t> tail {0};      /// Next free record (producer)
+    std::atomic<bool> dead {false};                 /// Owner thread exited, free after drain
+    log_ring_t *next {nullptr};                     /// Registry list
+    log_record_t records[LOG_RING_RECORDS];
+};
+
+static_assert ((LOG_RING_RECORDS & (LOG_RING_RECORDS - 1)) == 0, "LOG_RING_RECORDS must be power of 2");
+
+/// Marks ring of exiting thread as dead
+struct log_ring_holder
+{
+    log_ring_t *ring = nullptr;
+
+    log_ring_holder () = default;
+    log_ring_holder (const log_ring_holder &) = delete;
+    log_ring_holder &operator= (const log_ring_holder &) = delete;
+
+    ~log_ring_holder ()
+    {
+        if (ring != nullptr) ring->dead.store (true, std::memory_order_release);
+    }
+};
+
+/// Guards rings list and draining
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static log_ring_t *rings = nullptr;
+
+static std::atomic<bool>   async_on {false};
+static std::atomic<time_t> cached_time {0};
+static pthread_t writer_thread;
+
+/// UTC offset of local time, taken when crash handler is installed (handler can't call localtime_r)
+static std::atomic<long> crash_utc_offset {0};
+/// Descriptor of __LOG_OUT_STREAM for crash handler writes
+static std::atomic<int>  crash_fd {STDOUT_FILENO};
+
+// ---- ---- ---- --- PROTOTYPES ---- ---- ---- ----
+
+static size_t format_line (char *buf, size_t buf_size, log lvl, time_t time,
+                           const char *file, unsigned int line, const char *msg);
+static size_t format_line_raw (char *buf, size_t buf_size, log lvl, time_t time,
+                               const char *file, unsigned int line, const char *msg);
+static const char *level_str (log lvl);
+static void append_str  (char *buf, size_t buf_size, size_t *len, const char *str);
+static void append_uint (char *buf, size_t buf_size, size_t *len, unsigned long val, size_t min_digits);
+
+static log_ring_t *thread_ring ();
+static void drain (bool exclusive);
+static void *writer (void *);
+static void crash_handler (int sig);
+
+// ------------------------------------------------------------------------------------
+
 void set_log_level (log level)
 {
     __LOG_LEVEL = level;
 }
 
+// ------------------------------------------------------------------------------------
+
 void set_log_stream (FILE *stream)
 {
     assert (stream != NULL);
 
+    // Pending records belong to the old stream
+    if (async_on.load (std::memory_order_acquire)) log_flush ();
+
     __LOG_OUT_STREAM = stream;
+    crash_fd.store (fileno (stream), std::memory_order_relaxed);
 }
 
+// ------------------------------------------------------------------------------------
+
 FILE *get_log_stream ()
 {
+    if (async_on.load (std::memory_order_acquire)) log_flush ();
+
     return __LOG_OUT_STREAM;
 }
 
+// ------------------------------------------------------------------------------------
+
 void _log (log lvl, const char *fmt, const char *file, unsigned int line...)
 {
+    if (lvl < __LOG_LEVEL) return;
+
     va_list args;
     va_start (args, line);
 
-    if (lvl >= __LOG_LEVEL)                                             
-    {                                                                   
-        char time_buf[__TIME_BUF_SIZE] = "";                            
-        current_time (time_buf, __TIME_BUF_SIZE);                       
-        fprintf (__LOG_OUT_STREAM, "%s ", time_buf);                    
-                                                                        
-        if      (lvl == log::DBG) { fprintf (__LOG_OUT_STREAM, "DEBUG"); }                 
-        else if (lvl == log::INF) { fprintf (__LOG_OUT_STREAM, Cyan "INFO " D); }          
-        else if (lvl == log::WRN) { fprintf (__LOG_OUT_STREAM, Y "WARN " D); fflush (__LOG_OUT_STREAM); }             
-        else if (lvl == log::ERR) { fprintf (__LOG_OUT_STREAM, R "ERROR" D); fflush (__LOG_OUT_STREAM); }             
-                                                                        
-        fprintf (__LOG_OUT_STREAM, " [%s:%u] ", file, line);    
-        vfprintf (__LOG_OUT_STREAM, fmt, args);                        
-        fputc   ('\n', __LOG_OUT_STREAM);                               
-    }       
-
-    va_end (args);                                                            
-}
\ No newline at end of file
+    log_ring_t *ring = async_on.load (std::memory_order_acquire) ? thread_ring () : nullptr;
+
+    if (ring != nullptr)
+    {
+        size_t tail = ring->tail.load (std::memory_order_relaxed);
+
+        // Full ring: caller writes pending records itself instead of waiting for the writer
+        if (tail - ring->head.load (std::memory_order_acquire) >= LOG_RING_RECORDS) log_flush ();
+
+        log_record_t *rec = &ring->records[tail & (LOG_RING_RECORDS - 1)];
+        rec->time = cached_time.load (std::memory_order_relaxed);
+        rec->file = file;
+        rec->line = line;
+        rec->lvl  = lvl;
+        vsnprintf (rec->msg, LOG_RECORD_MSG, fmt, args);
+
+        ring->tail.store (tail + 1, std::memory_order_release);
+    }
+    else
+    {
+        char msg[LOG_RECORD_MSG]  = "";
+        char buf[LOG_RECORD_MSG + 64] = "";
+
+        va_list retry;
+        va_copy (retry, args);
+
+        int msg_len = vsnprintf (msg, LOG_RECORD_MSG, fmt, args);
+        if (msg_len >= LOG_RECORD_MSG)
+        {
+            // Sync mode has no record size limit: prefix without '\n', then the whole message
+            size_t len = format_line (buf, sizeof (buf), lvl, time (nullptr), file, line, "");
+
+            if (len > 0) fwrite (buf, 1, len - 1, __LOG_OUT_STREAM);
+            vfprintf (__LOG_OUT_STREAM, fmt, retry);
+            fputc ('\n', __LOG_OUT_STREAM);
+        }
+        else
+        {
+            size_t len = format_line (buf, sizeof (buf), lvl, time (nullptr), file, line, msg);
+
+            fwrite (buf, 1, len, __LOG_OUT_STREAM);
+        }
+
+        va_end (retry);
+        if (lvl >= log::WRN) fflush (__LOG_OUT_STREAM);
+    }
+
+    va_end (args);
+}
+
+// ------------------------------------------------------------------------------------
+
+bool log_async_start ()
+{
+    static bool atexit_set = false;
+
+    if (async_on.load (std::memory_order_acquire)) return true;
+
+    cached_time.store (time (nullptr), std::memory_order_relaxed);
+    async_on.store (true, std::memory_order_release);
+
+    if (pthread_create (&writer_thread, nullptr, writer, nullptr) != 0)
+    {
+        async_on.store (false, std::memory_order_release);
+        return false;
+    }
+
+    if (!atexit_set)
+    {
+        atexit (log_flush);
+        atexit_set = true;
+    }
+
+    return true;
+}
+
+// ------------------------------------------------------------------------------------
+
+void log_async_stop ()
+{
+    if (!async_on.exchange (false, std::memory_order_acq_rel)) return;
+
+    pthread_join (writer_thread, nullptr);
+    log_flush ();
+}
+
+// ------------------------------------------------------------------------------------
+
+void log_flush ()
+{
+    pthread_mutex_lock (&drain_lock);
+    drain (true);
+    pthread_mutex_unlock (&drain_lock);
+}
+
+// ------------------------------------------------------------------------------------
+
+void log_flush_on_crash ()
+{
+    time_t now = time (nullptr);
+    struct tm timeinfo = {};
+    localtime_r (&now, &timeinfo);
+    crash_utc_offset.store (timeinfo.tm_gmtoff, std::memory_order_relaxed);
+    crash_fd.store (fileno (__LOG_OUT_STREAM), std::memory_order_relaxed);
+
+    struct sigaction act = {};
+    act.sa_handler = crash_handler;
+    act.sa_flags   = (int) SA_RESETHAND;
+    sigemptyset (&act.sa_mask);
+
+    const int signals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+    for (int sig : signals)
+    {
+        sigaction (sig, &act, nullptr);
+    }
+}
+
+// ------------------------------------------------------------------------------------
+
+/// "HH:MM:SS LEVEL [file:line] msg\n" into buf, returns length
+static size_t format_line (char *buf, size_t buf_size, log lvl, time_t time,
+                           const char *file, unsigned int line, const char *msg)
+{
+    assert (buf  != nullptr && "pointer can't be null");
+    assert (file != nullptr && "pointer can't be null");
+    assert (msg  != nullptr && "pointer can't be null");
+
+    char time_buf[__TIME_BUF_SIZE] = "";
+    struct tm timeinfo = {};
+    localtime_r (&time, &timeinfo);
+    strftime (time_buf, __TIME_BUF_SIZE, "%H:%M:%S", &timeinfo);
+
+    int len = snprintf (buf, buf_size, "%s %s [%s:%u] %s\n", time_buf, level_str (lvl), file, line, msg);
+    if (len < 0) return 0;
+
+    if ((size_t) len >= buf_size)
+    {
+        buf[buf_size - 2] = '\n';
+        return buf_size - 1;
+    }
+
+    return (size_t) len;
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Async-signal-safe format_line: no locale or time zone calls (local time from offset cached at install)
+static size_t format_line_raw (char *buf, size_t buf_size, log lvl, time_t time,
+                               const char *file, unsigned int line, const char *msg)
+{
+    long day_sec = (time + crash_utc_offset.load (std::memory_order_relaxed)) % 86400;
+    if (day_sec < 0) day_sec += 86400;
+
+    size_t len = 0;
+    append_uint (buf, buf_size, &len, (unsigned long) day_sec / 3600, 2);
+    append_str  (buf, buf_size, &len, ":");
+    append_uint (buf, buf_size, &len, (unsigned long) day_sec / 60 % 60, 2);
+    append_str  (buf, buf_size, &len, ":");
+    append_uint (buf, buf_size, &len, (unsigned long) day_sec % 60, 2);
+    append_str  (buf, buf_size, &len, " ");
+    append_str  (buf, buf_size, &len, level_str (lvl));
+    append_str  (buf, buf_size, &len, " [");
+    append_str  (buf, buf_size, &len, file);
+    append_str  (buf, buf_size, &len, ":");
+    append_uint (buf, buf_size, &len, line, 1);
+    append_str  (buf, buf_size, &len, "] ");
+    append_str  (buf, buf_size, &len, msg);
+
+    buf[len++] = '\n';
+    return len;
+}
+
+// ------------------------------------------------------------------------------------
+
+static const char *level_str (log lvl)
+{
+    if      (lvl == log::DBG) { return "DEBUG"; }
+    else if (lvl == log::INF) { return Cyan "INFO " D; }
+    else if (lvl == log::WRN) { return Y "WARN " D; }
+    else if (lvl == log::ERR) { return R "ERROR" D; }
+
+    return "";
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Appends str, keeping last byte of buf for line end
+static void append_str (char *buf, size_t buf_size, size_t *len, const char *str)
+{
+    while (*str != '\0' && *len + 1 < buf_size)
+    {
+        buf[(*len)++] = *str++;
+    }
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Appends decimal val padded with zeros to min_digits
+static void append_uint (char *buf, size_t buf_size, size_t *len, unsigned long val, size_t min_digits)
+{
+    char digits[24] = "";
+    size_t count = 0;
+
+    do
+    {
+        digits[count++] = (char) ('0' + val % 10);
+        val /= 10;
+    }
+    while (val != 0 || count < min_digits);
+
+    while (count > 0 && *len + 1 < buf_size)
+    {
+        buf[(*len)++] = digits[--count];
+    }
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Ring of current thread, registered on first use (nullptr if out of memory)
+static log_ring_t *thread_ring ()
+{
+    static thread_local log_ring_holder holder;
+
+    if (holder.ring == nullptr)
+    {
+        log_ring_t *ring = new (std::nothrow) log_ring_t;
+        if (ring == nullptr) return nullptr;
+
+        pthread_mutex_lock (&drain_lock);
+        ring->next = rings;
+        rings = ring;
+        pthread_mutex_unlock (&drain_lock);
+
+        holder.ring = ring;
+    }
+
+    return holder.ring;
+}
+
+// ------------------------------------------------------------------------------------
+
+/**
+ * @brief      Writes all pending records in batches
+ *
+ * With exclusive access (drain_lock is held) consumes records and frees drained rings of exited threads.
+ * Otherwise (crash handler) only reads them and stays async-signal-safe: no locks, frees, locale calls
+ * or stdio, lines go straight to the stream fd. A concurrent drain may write records twice.
+ */
+static void drain (bool exclusive)
+{
+    char batch[4096] = "";
+    size_t batch_len = 0;
+    bool wrote = false;
+
+    int fd = crash_fd.load (std::memory_order_relaxed);
+
+    log_ring_t **link = &rings;
+    while (*link != nullptr)
+    {
+        log_ring_t *ring = *link;
+        bool dead = ring->dead.load (std::memory_order_acquire);
+
+        size_t head = ring->head.load (std::memory_order_relaxed);
+        size_t tail = ring->tail.load (std::memory_order_acquire);
+
+        for (; head != tail; ++head)
+        {
+            const log_record_t *rec = &ring->records[head & (LOG_RING_RECORDS - 1)];
+
+            char line[LOG_RECORD_MSG + 64] = "";
+            size_t len = exclusive ? format_line     (line, sizeof (line), rec->lvl, rec->time, rec->file, rec->line, rec->msg)
+                                   : format_line_raw (line, sizeof (line), rec->lvl, rec->time, rec->file, rec->line, rec->msg);
+
+            if (batch_len + len > sizeof (batch))
+            {
+                if (exclusive) fwrite (batch, 1, batch_len, __LOG_OUT_STREAM);
+                else           (void) !write (fd, batch, batch_len);
+                batch_len = 0;
+            }
+
+            memcpy (batch + batch_len, line, len);
+            batch_len += len;
+            wrote = true;
+        }
+
+        if (!exclusive)
+        {
+            link = &ring->next;
+            continue;
+        }
+
+        ring->head.store (tail, std::memory_order_release);
+
+        if (dead && ring->tail.load (std::memory_order_acquire) == tail)
+        {
+            *link = ring->next;
+            delete ring;
+        }
+        else
+        {
+            link = &ring->next;
+        }
+    }
+
+    if (!exclusive)
+    {
+        if (batch_len > 0) (void) !write (fd, batch, batch_len);
+        return;
+    }
+
+    if (batch_len > 0) fwrite (batch, 1, batch_len, __LOG_OUT_STREAM);
+    if (wrote) fflush (__LOG_OUT_STREAM);
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Background writer: refreshes cached clock and drains rings every LOG_ASYNC_PERIOD_US
+static void *writer (void *)
+{
+    const struct timespec period = {0, LOG_ASYNC_PERIOD_US * 1000L};
+
+    while (async_on.load (std::memory_order_acquire))
+    {
+        cached_time.store (time (nullptr), std::memory_order_relaxed);
+        log_flush ();
+        nanosleep (&period, nullptr);
+    }
+
+    return nullptr;
+}
+
+// ------------------------------------------------------------------------------------
+
+static void crash_handler (int sig)
+{
+    // Never takes drain_lock: the crashed thread or the writer may hold it in the middle of a drain,
+    // and a ring freed here could still be in use. Read-only drain leaves heads & ring list to them
+    drain (false);
+
+    raise (sig);
+}
+
+STACK_NAMESPACE_END
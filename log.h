@@ -4,6 +4,9 @@
 #include <assert.h>
 #include <stdio.h>
 #include <time.h>
+#include "variant.h"
+
+STACK_NAMESPACE_BEGIN
 
 enum class log
 {
@@ -15,6 +18,26 @@ enum class log
 
 const size_t __TIME_BUF_SIZE = 10;
 
+#ifndef LOG_MIN_LEVEL
+/// Compile-time minimum level: log() calls below it are removed with their arguments
+#define LOG_MIN_LEVEL       1
+#endif
+
+#ifndef LOG_RECORD_MSG
+/// Max formatted message length in async record (longer messages are truncated)
+#define LOG_RECORD_MSG      256
+#endif
+
+#ifndef LOG_RING_RECORDS
+/// Records in per-thread ring of async mode (power of 2)
+#define LOG_RING_RECORDS    256
+#endif
+
+#ifndef LOG_ASYNC_PERIOD_US
+/// Background writer wake up period
+#define LOG_ASYNC_PERIOD_US 1000
+#endif
+
 #ifndef __LOG_CPP
 extern enum log __LOG_LEVEL;
 extern FILE *__LOG_OUT_STREAM;
@@ -35,6 +58,9 @@ static inline void current_time (char *buf, size_t buf_size);
 /**
  * @brief      Write to log stream time, file&line and your formatted message
  *
+ * In async mode message is formatted into caller's ring record, and the line is written
+ * later by the background writer.
+ *
  * @param      lvl   Log level
  * @param[in]  fmt   Format string
  * @param[in]  file  File where log is called  
@@ -43,12 +69,14 @@ static inline void current_time (char *buf, size_t buf_size);
  */
 #ifndef DISABLE_LOGS
 
-void _log (enum log lvl, const char *fmt, const char *file, unsigned int line, ...);
+void _log (enum log lvl, const char *fmt, const char *file, unsigned int line, ...)
+    __attribute__ ((format (printf, 2, 5)));
 
-#define log(lvl, fmt, ...)                               \
-{                                                        \
-    _log (lvl, fmt, __FILE__, __LINE__, ##__VA_ARGS__);  \
-}                                                       
+#define log(lvl, fmt, ...)                                      \
+{                                                               \
+    if ((int) (lvl) >= LOG_MIN_LEVEL)                           \
+        _log (lvl, fmt, __FILE__, __LINE__, ##__VA_ARGS__);     \
+}
 
 #else
 
@@ -70,8 +98,34 @@ void set_log_level (enum log level);
  */
 void set_log_stream (FILE *stream);
 
+/**
+ * @brief      Gets the output log stream
+ *
+ * In async mode pending records are written first, so direct writes to the stream
+ * (stack_perror, stack_dump) keep their order with log() calls.
+ */
 FILE *get_log_stream ();
 
+/**
+ * @brief      Starts async mode: callers write records into per-thread lock-free rings,
+ *             background thread formats and writes them in batches
+ *
+ * @return     false if writer thread can't be started (logging stays synchronous)
+ */
+bool log_async_start ();
+
+/// Stops async mode: joins background writer and writes pending records
+void log_async_stop ();
+
+/// Writes pending async records now (any thread)
+void log_flush ();
+
+/**
+ * @brief      Installs SIGSEGV, SIGBUS, SIGFPE, SIGILL & SIGABRT handlers writing pending
+ *             async records before the default action (best effort: stream may be broken by the crash)
+ */
+void log_flush_on_crash ();
+
 /**
  * @brief      Write current time in HH:MM:SS format to given buffer
  *
@@ -91,4 +145,7 @@ static inline void current_time (char *buf, size_t buf_size)
 
     strftime (buf, buf_size, "%H:%M:%S", timeinfo);
 }
+
+STACK_NAMESPACE_END
+
 #endif //LOG_H
\ No newline at end of file
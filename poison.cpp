@@ -0,0 +1,299 @@
+#include <assert.h>
+#include <string.h>
+#include <stdint.h>
+#include "poison.h"
+
+#if (__x86_64__ || __i386__)
+#include <immintrin.h>
+#define POISON_X86 1
+#else
+#define POISON_X86 0
+#endif
+
+STACK_NAMESPACE_BEGIN
+
+/// Random const variable
+static const unsigned char __const_memory_val = 228;
+const void *const POISON_PTR = &__const_memory_val;
+
+/// Ranges at least this large are filled with non-temporal stores
+const size_t POISON_STREAM_THRESHOLD = 4 << 20;
+
+/// Scan kernels of one instruction set
+struct poison_kernels_t
+{
+    bool (*is_range) (const unsigned char *mem, size_t size);
+    bool (*has_elem) (const unsigned char *mem, size_t count, size_t obj_size);
+    void (*fill)     (unsigned char *mem, size_t size);
+};
+
+static const poison_kernels_t *poison_kernels ();
+
+// ---- ---- ---- --- SCALAR ---- ---- ---- ----
+
+static bool is_range_scalar (const unsigned char *mem, size_t size)
+{
+    const uint64_t poison_word = 0x0101010101010101ull * POISON_BYTE;
+
+    size_t i = 0;
+    for (; i + sizeof (uint64_t) <= size; i += sizeof (uint64_t))
+    {
+        uint64_t word = 0;
+        memcpy (&word, mem + i, sizeof (uint64_t));
+
+        if (word != poison_word) return false;
+    }
+
+    for (; i < size; ++i)
+    {
+        if (mem[i] != POISON_BYTE) return false;
+    }
+
+    return true;
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Check elements [first, last] with given range kernel
+static bool elems_poisoned (const unsigned char *mem, size_t first, size_t last, size_t obj_size,
+                            bool (*is_range) (const unsigned char *mem, size_t size))
+{
+    for (size_t n = first; n <= last; ++n)
+    {
+        if (is_range (mem + n*obj_size, obj_size)) return true;
+    }
+
+    return false;
+}
+
+// ------------------------------------------------------------------------------------
+
+static bool has_elem_scalar (const unsigned char *mem, size_t count, size_t obj_size)
+{
+    return count > 0 && elems_poisoned (mem, 0, count - 1, obj_size, is_range_scalar);
+}
+
+// ------------------------------------------------------------------------------------
+
+static void fill_scalar (unsigned char *mem, size_t size)
+{
+    memset (mem, POISON_BYTE, size);
+}
+
+// ---- ---- ---- --- SSE2 ---- ---- ---- ----
+
+#if POISON_X86
+
+__attribute__((target("sse2")))
+static bool is_range_sse2 (const unsigned char *mem, size_t size)
+{
+    const __m128i poison = _mm_set1_epi8 ((char) POISON_BYTE);
+
+    size_t i = 0;
+    for (; i + 64 <= size; i += 64)
+    {
+        __m128i a = _mm_cmpeq_epi8 (_mm_loadu_si128 ((const __m128i *) (mem + i)),      poison);
+        __m128i b = _mm_cmpeq_epi8 (_mm_loadu_si128 ((const __m128i *) (mem + i + 16)), poison);
+        __m128i c = _mm_cmpeq_epi8 (_mm_loadu_si128 ((const __m128i *) (mem + i + 32)), poison);
+        __m128i d = _mm_cmpeq_epi8 (_mm_loadu_si128 ((const __m128i *) (mem + i + 48)), poison);
+
+        __m128i all = _mm_and_si128 (_mm_and_si128 (a, b), _mm_and_si128 (c, d));
+        if (_mm_movemask_epi8 (all) != 0xFFFF) return false;
+    }
+
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i a = _mm_cmpeq_epi8 (_mm_loadu_si128 ((const __m128i *) (mem + i)), poison);
+        if (_mm_movemask_epi8 (a) != 0xFFFF) return false;
+    }
+
+    return is_range_scalar (mem + i, size - i);
+}
+
+// ------------------------------------------------------------------------------------
+
+__attribute__((target("sse2")))
+static bool has_elem_sse2 (const unsigned char *mem, size_t count, size_t obj_size)
+{
+    const __m128i poison = _mm_set1_epi8 ((char) POISON_BYTE);
+    const size_t total = count * obj_size;
+
+    // Block without poison bytes can't intersect fully poisoned element
+    size_t i = 0;
+    while (i + 16 <= total)
+    {
+        __m128i a = _mm_cmpeq_epi8 (_mm_loadu_si128 ((const __m128i *) (mem + i)), poison);
+        if (_mm_movemask_epi8 (a) == 0)
+        {
+            i += 16;
+            continue;
+        }
+
+        size_t last = (i + 15) / obj_size;
+        if (elems_poisoned (mem, i / obj_size, last, obj_size, is_range_sse2)) return true;
+
+        // Elements up to last are checked whole: each element is scanned at most once
+        i = (last + 1) * obj_size;
+    }
+
+    return i < total && elems_poisoned (mem, i / obj_size, count - 1, obj_size, is_range_sse2);
+}
+
+// ------------------------------------------------------------------------------------
+
+__attribute__((target("sse2")))
+static void fill_sse2 (unsigned char *mem, size_t size)
+{
+    if (size < POISON_STREAM_THRESHOLD)
+    {
+        memset (mem, POISON_BYTE, size);
+        return;
+    }
+
+    const __m128i poison = _mm_set1_epi8 ((char) POISON_BYTE);
+
+    size_t head = (16 - (uintptr_t) mem % 16) % 16;
+    memset (mem, POISON_BYTE, head);
+
+    size_t i = head;
+    for (; i + 16 <= size; i += 16)
+    {
+        _mm_stream_si128 ((__m128i *) (mem + i), poison);
+    }
+    _mm_sfence ();
+
+    memset (mem + i, POISON_BYTE, size - i);
+}
+
+// ---- ---- ---- --- AVX2 ---- ---- ---- ----
+
+__attribute__((target("avx2")))
+static bool is_range_avx2 (const unsigned char *mem, size_t size)
+{
+    const __m256i poison = _mm256_set1_epi8 ((char) POISON_BYTE);
+
+    size_t i = 0;
+    for (; i + 128 <= size; i += 128)
+    {
+        __m256i a = _mm256_cmpeq_epi8 (_mm256_loadu_si256 ((const __m256i *) (mem + i)),      poison);
+        __m256i b = _mm256_cmpeq_epi8 (_mm256_loadu_si256 ((const __m256i *) (mem + i + 32)), poison);
+        __m256i c = _mm256_cmpeq_epi8 (_mm256_loadu_si256 ((const __m256i *) (mem + i + 64)), poison);
+        __m256i d = _mm256_cmpeq_epi8 (_mm256_loadu_si256 ((const __m256i *) (mem + i + 96)), poison);
+
+        __m256i all = _mm256_and_si256 (_mm256_and_si256 (a, b), _mm256_and_si256 (c, d));
+        if ((uint32_t) _mm256_movemask_epi8 (all) != 0xFFFFFFFFu) return false;
+    }
+
+    for (; i + 32 <= size; i += 32)
+    {
+        __m256i a = _mm256_cmpeq_epi8 (_mm256_loadu_si256 ((const __m256i *) (mem + i)), poison);
+        if ((uint32_t) _mm256_movemask_epi8 (a) != 0xFFFFFFFFu) return false;
+    }
+
+    return is_range_scalar (mem + i, size - i);
+}
+
+// ------------------------------------------------------------------------------------
+
+__attribute__((target("avx2")))
+static bool has_elem_avx2 (const unsigned char *mem, size_t count, size_t obj_size)
+{
+    const __m256i poison = _mm256_set1_epi8 ((char) POISON_BYTE);
+    const size_t total = count * obj_size;
+
+    // Block without poison bytes can't intersect fully poisoned element
+    size_t i = 0;
+    while (i + 32 <= total)
+    {
+        __m256i a = _mm256_cmpeq_epi8 (_mm256_loadu_si256 ((const __m256i *) (mem + i)), poison);
+        if (_mm256_movemask_epi8 (a) == 0)
+        {
+            i += 32;
+            continue;
+        }
+
+        size_t last = (i + 31) / obj_size;
+        if (elems_poisoned (mem, i / obj_size, last, obj_size, is_range_avx2)) return true;
+
+        // Elements up to last are checked whole: each element is scanned at most once
+        i = (last + 1) * obj_size;
+    }
+
+    return i < total && elems_poisoned (mem, i / obj_size, count - 1, obj_size, is_range_avx2);
+}
+
+// ------------------------------------------------------------------------------------
+
+__attribute__((target("avx2")))
+static void fill_avx2 (unsigned char *mem, size_t size)
+{
+    if (size < POISON_STREAM_THRESHOLD)
+    {
+        memset (mem, POISON_BYTE, size);
+        return;
+    }
+
+    const __m256i poison = _mm256_set1_epi8 ((char) POISON_BYTE);
+
+    size_t head = (32 - (uintptr_t) mem % 32) % 32;
+    memset (mem, POISON_BYTE, head);
+
+    size_t i = head;
+    for (; i + 32 <= size; i += 32)
+    {
+        _mm256_stream_si256 ((__m256i *) (mem + i), poison);
+    }
+    _mm_sfence ();
+
+    memset (mem + i, POISON_BYTE, size - i);
+}
+
+#endif // POISON_X86
+
+// ---- ---- ---- --- DISPATCH ---- ---- ---- ----
+
+static const poison_kernels_t *poison_kernels ()
+{
+    static const poison_kernels_t scalar = {is_range_scalar, has_elem_scalar, fill_scalar};
+
+    #if POISON_X86
+        static const poison_kernels_t sse2 = {is_range_sse2, has_elem_sse2, fill_sse2};
+        static const poison_kernels_t avx2 = {is_range_avx2, has_elem_avx2, fill_avx2};
+
+        static const poison_kernels_t *selected = __builtin_cpu_supports ("avx2") ? &avx2 :
+                                                  __builtin_cpu_supports ("sse2") ? &sse2 : &scalar;
+        return selected;
+    #else
+        return &scalar;
+    #endif
+}
+
+// ------------------------------------------------------------------------------------
+
+bool poison_is_range (const void *mem, size_t size)
+{
+    assert ((mem != nullptr || size == 0) && "pointer can't be null");
+
+    return poison_kernels ()->is_range ((const unsigned char *) mem, size);
+}
+
+// ------------------------------------------------------------------------------------
+
+bool poison_has_elem (const void *mem, size_t count, size_t obj_size)
+{
+    assert ((mem != nullptr || count == 0) && "pointer can't be null");
+    assert (obj_size > 0 && "invalid obj size");
+
+    return poison_kernels ()->has_elem ((const unsigned char *) mem, count, obj_size);
+}
+
+// ------------------------------------------------------------------------------------
+
+void poison_fill (void *mem, size_t size)
+{
+    assert ((mem != nullptr || size == 0) && "pointer can't be null");
+
+    poison_kernels ()->fill ((unsigned char *) mem, size);
+}
+
+STACK_NAMESPACE_END
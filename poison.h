@@ -0,0 +1,45 @@
+#ifndef POISON_H
+#define POISON_H
+
+#include <stdlib.h>
+#include "variant.h"
+
+STACK_NAMESPACE_BEGIN
+
+/// Byte filling all unused data bytes (KSP)
+const unsigned char POISON_BYTE = (unsigned char) -7u;
+
+/// Pointer to const memory, data pointer of destructed stacks (KSP)
+extern const void *const POISON_PTR;
+
+/**
+ * @brief      Check that all bytes of range are POISON_BYTE
+ *
+ * Vectorized (AVX2 / SSE2, chosen at runtime) with scalar fallback.
+ *
+ * @param[in]  mem   Range start
+ * @param[in]  size  Range size in bytes
+ */
+bool poison_is_range (const void *mem, size_t size);
+
+/**
+ * @brief      Check if any of count elements of obj_size bytes consists entirely of POISON_BYTE
+ *
+ * Skips whole vector blocks without any POISON_BYTE, elements are compared only around poison bytes.
+ *
+ * @param[in]  mem       Elements
+ * @param[in]  count     Elements count
+ * @param[in]  obj_size  Element size
+ */
+bool poison_has_elem (const void *mem, size_t count, size_t obj_size);
+
+/**
+ * @brief      Fill range with POISON_BYTE
+ *
+ * Large ranges are filled with non-temporal stores to keep them out of cache.
+ */
+void poison_fill (void *mem, size_t size);
+
+STACK_NAMESPACE_END
+
+#endif // POISON_H
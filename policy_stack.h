@@ -0,0 +1,520 @@
+#ifndef POLICY_STACK_H
+#define POLICY_STACK_H
+
+#include <string.h>
+#include <stddef.h>
+#include <type_traits>
+#include "stack.h"
+#include "hash.h"
+#include "poison.h"
+#include "variant.h"
+
+#if (__linux__ || __unix__)
+#define POLICY_STACK_HAS_MMAP 1
+#else
+#define POLICY_STACK_HAS_MMAP 0
+#endif
+
+STACK_NAMESPACE_BEGIN
+
+// ---------------- Protection policies ----------------
+
+/**
+ * @brief Compile-time protection set of policy_stack
+ *
+ * Fields have the same meaning as STACK_*_PROTECT macros, but are chosen per stack type,
+ * so differently protected stacks coexist in one program. Disabled layers take no space and no code.
+ * Operations check stack by level as stack_t does, in release builds too.
+ */
+struct stack_protection
+{
+    bool ksp;           /// Poison protection
+    bool canary;        /// Canary protection (DUNGEON_MASTER)
+    bool hash;          /// Hash protection (data & struct)
+    bool memory;        /// Memory protection (mmap & mprotect, linux only)
+    verify_level level; /// Check of every operation (VERIFY_SAMPLED: full one every STACK_DEFAULT_VERIFY_PERIOD checks)
+};
+
+/// All protections (memory protection only where mprotect exists), full check of every operation
+inline constexpr stack_protection STACK_PROTECT_ALL    = {true,  true,  true,  POLICY_STACK_HAS_MMAP, VERIFY_FULL};
+/// All protections except memory protection (stacks without own pages, see small_stack)
+inline constexpr stack_protection STACK_PROTECT_INLINE = {true,  true,  true,  false, VERIFY_FULL};
+/// Cheap protections: poison & canaries, O(1) checks of operations
+inline constexpr stack_protection STACK_PROTECT_CANARY = {true,  true,  false, false, VERIFY_CHEAP};
+/// No protection, plain dynamic array
+inline constexpr stack_protection STACK_PROTECT_NONE   = {false, false, false, false, VERIFY_OFF};
+
+/// Placeholder of disabled protection field (tag keeps several empty fields at distinct addresses)
+template <int tag>
+struct stack_no_field {};
+
+/// Field of type V if enabled, empty otherwise
+template <bool enabled, typename V, int tag>
+using stack_opt_field = std::conditional_t<enabled, V, stack_no_field<tag>>;
+
+// ---------------- Policy stack ----------------
+
+/**
+ * @brief      Stack of trivially copyable T with compile-time protection set P
+ *
+ * Same invariants, error flags and growth policy as stack_t with matching STACK_*_PROTECT macros.
+ * Growth, canary, page and dump code is shared with stack_t (see "Shared layers" in stack.h).
+ */
+template <typename T, stack_protection P = STACK_PROTECT_ALL>
+class policy_stack
+{
+    static_assert (std::is_trivially_copyable_v<T>, "policy_stack element must be trivially copyable");
+    static_assert (!P.memory || POLICY_STACK_HAS_MMAP, "memory protection works only on linux");
+
+public:
+    explicit policy_stack (size_t reserved_capacity = 0, hash_f hash = nullptr, const stack_growth_t *growth_policy = nullptr):
+        two_blocks_up (),
+        data (nullptr),
+        size (0),
+        capacity (0),
+        reserved (0),
+        growth ((growth_policy != nullptr) ? *growth_policy : STACK_DEFAULT_GROWTH),
+        hash_func (),
+        data_hash (),
+        struct_hash (),
+        struct_copy (),
+        copy_page (),
+        two_blocks_down (),
+        growth_state (),
+        verify_state ()
+    {
+        assert (stack_growth_is_valid (&growth) && "invalid growth factor");
+
+        if constexpr (P.memory)
+        {
+            size_t objects_in_mempage = stack_page_size () / sizeof (T);
+            if (reserved_capacity < objects_in_mempage) reserved_capacity = objects_in_mempage;
+        }
+
+        if constexpr (P.canary)
+        {
+            two_blocks_up   = dungeon_master_val;
+            two_blocks_down = dungeon_master_val;
+        }
+
+        if constexpr (P.hash)
+        {
+            hash_func = (hash != nullptr) ? hash : STACK_DEFAULT_HASH;
+        }
+        else
+        {
+            (void) hash;
+        }
+
+        char *mem = (char *) map_data (data_size (reserved_capacity));
+        if (mem == nullptr) return;
+
+        if constexpr (P.memory)
+        {
+            struct_copy = (unsigned char *) shadow_alloc (protected_size (), &copy_page);
+            if (struct_copy == nullptr)
+            {
+                unmap_data (mem, data_size (reserved_capacity));
+                return;
+            }
+        }
+
+        data     = (T *) (mem + canary_size ());
+        capacity = reserved_capacity;
+        reserved = reserved_capacity;
+
+        set_canaries ();
+        poison (0, capacity);
+        update_hash ();
+        lock ();
+    }
+
+    policy_stack (const policy_stack &) = delete;
+    policy_stack &operator= (const policy_stack &) = delete;
+
+    ~policy_stack ()
+    {
+        if (data == nullptr) return;
+
+        unlock_data ();
+        poison (0, capacity);
+
+        unmap_data ((char *) data - canary_size (), data_size (capacity));
+
+        if constexpr (P.memory)
+        {
+            shadow_free (struct_copy, copy_page);
+        }
+
+        data = nullptr;
+    }
+
+    err_flags push (const T &value)
+    {
+        size_t new_capacity = capacity;
+        UNWRAP (stack_growth_grow (&growth, &growth_state, size, capacity, 0, size + 1, &new_capacity));
+
+        if (new_capacity != capacity)
+        {
+            UNWRAP (resize (new_capacity));
+        }
+
+        hash_t old_slot_hash = slot (size);
+
+        unlock_data ();
+        memcpy (data + size, &value, sizeof (T));
+        size++;
+        lock_data ();
+
+        rehash_slot (size - 1, old_slot_hash);
+        return check ();
+    }
+
+    err_flags pop (T *value)
+    {
+        assert (value != nullptr && "pointer can't be null");
+
+        if (size == 0) return res::EMPTY;
+
+        size--;
+        memcpy (value, data + size, sizeof (T));
+
+        if constexpr (P.ksp)
+        {
+            hash_t old_slot_hash = slot (size);
+
+            unlock_data ();
+            poison (size, 1);
+            lock_data ();
+
+            rehash_slot (size, old_slot_hash);
+        }
+        else
+        {
+            rehash_slot (size, slot (size));
+        }
+
+        size_t new_capacity = stack_growth_shrink (&growth, &growth_state, size, capacity, reserved, 1);
+        if (new_capacity != capacity)
+        {
+            UNWRAP (resize (new_capacity));
+        }
+
+        return check ();
+    }
+
+    err_flags resize (size_t new_capacity)
+    {
+        assert (size <= new_capacity);
+
+        if (new_capacity < reserved) return res::BAD_CAPACITY;
+
+        char *old_mem = (char *) data - canary_size ();
+        char *new_mem = (char *) remap_data (old_mem, data_size (capacity), data_size (new_capacity));
+        if (new_mem == nullptr) return res::NOMEM;
+
+        if constexpr (P.memory)
+        {
+            stack_pages_protect (new_mem, data_size (new_capacity), true);
+        }
+
+        size_t old_capacity = capacity;
+
+        data     = (T *) (new_mem + canary_size ());
+        capacity = new_capacity;
+
+        set_canaries ();
+        if (new_capacity > old_capacity) poison (old_capacity, new_capacity - old_capacity);
+
+        update_hash ();
+        lock ();
+
+        return check ();
+    }
+
+    /// O(1) subset of verify: bounds and canaries
+    err_flags verify_fast () const
+    {
+        err_flags ret = res::OK;
+
+        if (size > capacity)        ret |= res::INVALID_SIZE;
+        if (capacity < reserved)    ret |= res::BAD_CAPACITY;
+        if (data == nullptr)        return ret | res::DATA_NULL;
+
+        if constexpr (P.canary)
+        {
+            if (two_blocks_up != dungeon_master_val || two_blocks_down != dungeon_master_val) ret |= res::STRUCT_CORRUPTED;
+            if (!stack_canaries_ok (data, capacity * sizeof (T)))                             ret |= res::DATA_CORRUPTED;
+        }
+
+        return ret;
+    }
+
+    /// Full check of all enabled protections
+    err_flags verify () const
+    {
+        err_flags ret = verify_fast ();
+
+        if (ret & (res::INVALID_SIZE | res::DATA_NULL)) return ret;
+
+        if constexpr (P.ksp)
+        {
+            if (!poison_is_range (data + size, (capacity - size) * sizeof (T))) ret |= res::DATA_CORRUPTED;
+            if (poison_has_elem (data, size, sizeof (T)))                       ret |= res::POISONED;
+        }
+
+        if constexpr (P.hash)
+        {
+            if (calc_struct_hash () != struct_hash)                                   ret |= res::STRUCT_CORRUPTED;
+            if (slots_hash (hash_func, data, 0, capacity, sizeof (T)) != data_hash)   ret |= res::DATA_CORRUPTED;
+        }
+
+        if constexpr (P.memory)
+        {
+            if (memcmp (this, struct_copy, protected_size ()) != 0) ret |= res::STRUCT_CORRUPTED;
+        }
+
+        return ret;
+    }
+
+    void dump (FILE *stream) const
+    {
+        assert (stream != nullptr && "pointer can't be null");
+
+        fprintf (stream, R Bold "\n======== POLICY STACK DUMP =======\n" Plain D);
+
+        err_flags check_res = verify ();
+        if (check_res != res::OK)
+        {
+            fprintf (stream, "Stack has errors: \n");
+            stack_perror (check_res, stream, "-> ");
+        }
+
+        fprintf (stream, "Stack[%p]\n"
+                         "Parameters:\n"
+                         "    size: %zu\n"
+                         "    capacity: %zu\n"
+                         "    object size: %zu\n"
+                         "    reserved size: %zu\n"
+                         "    growth: x%u/%u, shrink at 1/%u load after %u pops & %zu elements since growth\n",
+                         (const void *) this, size, capacity, sizeof (T), reserved,
+                         growth.grow_num, growth.grow_den, growth.shrink_ratio, growth.shrink_delay, growth.shrink_interval);
+
+        hash_f dump_hash = nullptr;
+        if constexpr (P.hash) dump_hash = hash_func;
+
+        stack_dump_protection (stream, P.memory, P.canary, dump_hash, P.ksp);
+        stack_dump_data (stream, data, size, capacity, sizeof (T), byte_fprintf, P.ksp);
+
+        fprintf (stream, R Bold "======== END POLICY STACK DUMP =======\n\n" Plain D);
+    }
+
+    size_t get_size     () const { return size;     }
+    size_t get_capacity () const { return capacity; }
+
+    /// NOMEM if construction failed
+    err_flags status () const { return (data == nullptr) ? res::NOMEM : res::OK; }
+
+private:
+    [[no_unique_address]] stack_opt_field<P.canary, dungeon_master_t, 0>  two_blocks_up;     /// Struct canary
+
+    T *data;                                                                                /// Stack data
+    size_t size;                                                                            /// Stack size (used)
+    size_t capacity;                                                                        /// Stack allocated capacity
+    size_t reserved;                                                                        /// Reserved capacity
+    stack_growth_t growth;                                                                  /// Growth & shrink policy
+
+    [[no_unique_address]] stack_opt_field<P.hash,   hash_f,           1>  hash_func;         /// Hash function
+    [[no_unique_address]] stack_opt_field<P.hash,   hash_t,           2>  data_hash;         /// Data hash (incremental)
+    [[no_unique_address]] stack_opt_field<P.hash,   hash_t,           3>  struct_hash;       /// Struct hash (calculated with struct_hash=0)
+    [[no_unique_address]] stack_opt_field<P.memory, unsigned char *,  4>  struct_copy;       /// Struct copy (slot of shared read-only page)
+    [[no_unique_address]] stack_opt_field<P.memory, shadow_page_t *,  6>  copy_page;         /// Shadow page of struct copy
+
+    [[no_unique_address]] stack_opt_field<P.canary, dungeon_master_t, 5>  two_blocks_down;   /// Struct canary
+
+    // Runtime state, must be the last fields (not protected)
+    stack_growth_state_t growth_state;                                                      /// Growth policy state
+    [[no_unique_address]] stack_opt_field<P.level == VERIFY_SAMPLED, stack_verify_state_t, 7> verify_state; /// VERIFY_SAMPLED state
+
+    /// Check settings of level
+    static constexpr stack_verify_cfg_t VERIFY_CFG = {P.level, (P.level == VERIFY_SAMPLED) ? STACK_DEFAULT_VERIFY_PERIOD : 0, 0};
+
+    // ---------------- Layer helpers ----------------
+
+    static constexpr size_t canary_size ()
+    {
+        return P.canary ? sizeof (dungeon_master_t) : 0;
+    }
+
+    /// Size of struct part covered by struct hash & struct copy
+    static constexpr size_t protected_size ()
+    {
+        return offsetof (policy_stack, growth_state);
+    }
+
+    static size_t data_size (size_t n)
+    {
+        // Unprotected empty stack still owns data: realloc to 0 bytes would free it
+        size_t bytes = n * sizeof (T) + 2*canary_size ();
+        return (bytes > 0) ? bytes : 1;
+    }
+
+    static void *map_data (size_t bytes)
+    {
+        if constexpr (P.memory) return stack_pages_alloc (bytes);
+        else                    return calloc (bytes, 1);
+    }
+
+    static void *remap_data (void *mem, size_t old_bytes, size_t new_bytes)
+    {
+        if constexpr (P.memory) return stack_pages_realloc (mem, old_bytes, new_bytes);
+        else                    return realloc (mem, new_bytes);
+    }
+
+    static void unmap_data (void *mem, size_t bytes)
+    {
+        if constexpr (P.memory) stack_pages_free (mem, bytes);
+        else                    free (mem);
+    }
+
+    void set_canaries ()
+    {
+        if constexpr (P.canary)
+        {
+            stack_canaries_set (data, capacity * sizeof (T));
+        }
+    }
+
+    void poison (size_t first, size_t count)
+    {
+        if constexpr (P.ksp)
+        {
+            poison_fill ((void *) (data + first), count * sizeof (T));
+        }
+        else
+        {
+            (void) first;
+            (void) count;
+        }
+    }
+
+    hash_t slot (size_t index) const
+    {
+        if constexpr (P.hash)
+        {
+            return slot_hash (hash_func, index, data + index, sizeof (T));
+        }
+        else
+        {
+            (void) index;
+            return 0;
+        }
+    }
+
+    hash_t calc_struct_hash () const
+    {
+        if constexpr (P.hash)
+        {
+            policy_stack *self = const_cast<policy_stack *> (this);
+            hash_t saved = struct_hash;
+
+            self->struct_hash = 0;
+            hash_t hash = hash_fixed<protected_size ()> (this);
+            self->struct_hash = saved;
+
+            return hash;
+        }
+        else
+        {
+            return 0;
+        }
+    }
+
+    void update_hash ()
+    {
+        if constexpr (P.hash)
+        {
+            data_hash   = slots_hash (hash_func, data, 0, capacity, sizeof (T));
+            struct_hash = calc_struct_hash ();
+        }
+    }
+
+    void rehash_slot (size_t index, hash_t old_slot_hash)
+    {
+        if constexpr (P.hash)
+        {
+            data_hash  += slot (index) - old_slot_hash;
+            struct_hash = calc_struct_hash ();
+        }
+        else
+        {
+            (void) index;
+            (void) old_slot_hash;
+        }
+
+        sync_copy ();
+    }
+
+    void sync_copy ()
+    {
+        if constexpr (P.memory)
+        {
+            shadow_unlock (copy_page);
+            memcpy (struct_copy, this, protected_size ());
+            shadow_lock (copy_page);
+        }
+    }
+
+    void unlock_data ()
+    {
+        if constexpr (P.memory)
+        {
+            stack_pages_protect ((char *) data - canary_size (), data_size (capacity), true);
+        }
+    }
+
+    void lock_data ()
+    {
+        if constexpr (P.memory)
+        {
+            stack_pages_protect ((char *) data - canary_size (), data_size (capacity), false);
+        }
+    }
+
+    void lock ()
+    {
+        sync_copy ();
+        lock_data ();
+    }
+
+    /// Check by level of policy
+    err_flags check ()
+    {
+        verify_level level = P.level;
+        if constexpr (P.level == VERIFY_SAMPLED) level = stack_verify_due (&VERIFY_CFG, &verify_state);
+
+        err_flags check_res = res::OK;
+
+        switch (level)
+        {
+            case VERIFY_OFF:        return res::OK;
+            case VERIFY_CHEAP:      check_res = verify_fast (); break;
+            case VERIFY_SAMPLED:    check_res = verify_fast (); break;
+            case VERIFY_FULL:       check_res = verify ();      break;
+            default:                check_res = res::STRUCT_CORRUPTED; break;
+        }
+
+        if (check_res != res::OK)
+        {
+            log (log::ERR, "Failed policy stack check with err flags: ");
+            stack_perror (check_res, get_log_stream(), "->");
+            dump (get_log_stream());
+        }
+
+        return check_res;
+    }
+};
+
+STACK_NAMESPACE_END
+
+#endif // POLICY_STACK_H
@@ -0,0 +1,241 @@
+#include <assert.h>
+#include <stdlib.h>
+#include "profile.h"
+#include "trace.h"
+
+STACK_NAMESPACE_BEGIN
+
+std::atomic<bool> __PROFILE_ON {false};
+
+/// Global counters of one operation kind
+struct profile_counters_t
+{
+    std::atomic<uint64_t> calls {0};
+    std::atomic<uint64_t> ticks {0};
+    std::atomic<uint64_t> layer_ticks[PROFILE_LAYERS] = {};
+    std::atomic<uint64_t> layer_bytes[PROFILE_LAYERS] = {};
+};
+
+static profile_counters_t global_counters[PROFILE_OPS];
+
+/// Outermost operation of thread (PROFILE_OPS -> none)
+static thread_local profile_op current_op = PROFILE_OPS;
+/// Time of layer scopes nested into the innermost open scope
+static thread_local uint64_t child_ticks = 0;
+
+static const char *const op_names[PROFILE_OPS] =
+    {"ctor", "dtor", "push", "pop", "push_n", "pop_n", "resize", "verify", "other"};
+
+static const char *const layer_names[PROFILE_LAYERS] = {"poison", "canary", "hash", "memory"};
+
+// ---- ---- ---- --- PROTOTYPES ---- ---- ---- ----
+
+static void report_at_exit ();
+static double per_call (uint64_t value, uint64_t calls);
+
+// ------------------------------------------------------------------------------------
+
+profile_op_scope::profile_op_scope (stack_profile_t *stk_profile, profile_op scope_op) :
+    profile (stk_profile), op (scope_op), start (0), outermost (false)
+{
+    if (!__PROFILE_ON.load (std::memory_order_relaxed)) return;
+    if (current_op != PROFILE_OPS) return;
+
+    current_op  = op;
+    child_ticks = 0;
+    outermost   = true;
+    start       = trace_clock ();
+}
+
+// ------------------------------------------------------------------------------------
+
+profile_op_scope::~profile_op_scope ()
+{
+    if (!outermost) return;
+
+    uint64_t elapsed = trace_clock () - start;
+
+    global_counters[op].calls.fetch_add (1, std::memory_order_relaxed);
+    global_counters[op].ticks.fetch_add (elapsed, std::memory_order_relaxed);
+
+    if (profile != nullptr)
+    {
+        profile->calls++;
+        profile->ticks += elapsed;
+    }
+
+    current_op = PROFILE_OPS;
+}
+
+// ------------------------------------------------------------------------------------
+
+profile_layer_scope::profile_layer_scope (stack_profile_t *stk_profile, profile_layer scope_layer, uint64_t scope_bytes) :
+    profile (stk_profile), layer (scope_layer), bytes (scope_bytes), start (0), outer_child (0), active (false)
+{
+    if (!__PROFILE_ON.load (std::memory_order_relaxed)) return;
+
+    outer_child = child_ticks;
+    child_ticks = 0;
+    active      = true;
+    start       = trace_clock ();
+}
+
+// ------------------------------------------------------------------------------------
+
+profile_layer_scope::~profile_layer_scope ()
+{
+    if (!active) return;
+
+    uint64_t elapsed = trace_clock () - start;
+    uint64_t self    = (elapsed > child_ticks) ? elapsed - child_ticks : 0;
+
+    // Layer work outside of public operations (profiling turned on mid-operation)
+    profile_op op = (current_op != PROFILE_OPS) ? current_op : PROFILE_OTHER;
+
+    global_counters[op].layer_ticks[layer].fetch_add (self,  std::memory_order_relaxed);
+    global_counters[op].layer_bytes[layer].fetch_add (bytes, std::memory_order_relaxed);
+
+    if (profile != nullptr)
+    {
+        profile->layer_ticks[layer] += self;
+        profile->layer_bytes[layer] += bytes;
+    }
+
+    child_ticks = outer_child + elapsed;
+}
+
+// ------------------------------------------------------------------------------------
+
+void stack_profile_enable (bool enabled, bool report)
+{
+    static std::atomic<bool> atexit_set {false};
+
+    if (report && !atexit_set.exchange (true)) atexit (report_at_exit);
+
+    __PROFILE_ON.store (enabled, std::memory_order_relaxed);
+}
+
+// ------------------------------------------------------------------------------------
+
+void stack_profile_reset ()
+{
+    for (profile_counters_t &counters : global_counters)
+    {
+        counters.calls.store (0, std::memory_order_relaxed);
+        counters.ticks.store (0, std::memory_order_relaxed);
+
+        for (int layer = 0; layer < PROFILE_LAYERS; ++layer)
+        {
+            counters.layer_ticks[layer].store (0, std::memory_order_relaxed);
+            counters.layer_bytes[layer].store (0, std::memory_order_relaxed);
+        }
+    }
+}
+
+// ------------------------------------------------------------------------------------
+
+stack_profile_t stack_profile_global (profile_op op)
+{
+    assert (op < PROFILE_OPS && "invalid operation");
+
+    stack_profile_t snapshot = {};
+    const profile_counters_t *counters = &global_counters[op];
+
+    snapshot.calls = counters->calls.load (std::memory_order_relaxed);
+    snapshot.ticks = counters->ticks.load (std::memory_order_relaxed);
+
+    for (int layer = 0; layer < PROFILE_LAYERS; ++layer)
+    {
+        snapshot.layer_ticks[layer] = counters->layer_ticks[layer].load (std::memory_order_relaxed);
+        snapshot.layer_bytes[layer] = counters->layer_bytes[layer].load (std::memory_order_relaxed);
+    }
+
+    return snapshot;
+}
+
+// ------------------------------------------------------------------------------------
+
+void stack_profile_report (FILE *stream)
+{
+    assert (stream != nullptr && "pointer can't be null");
+
+    fprintf (stream, "Protection cost per call (trace_clock ticks, %% of call):\n");
+    fprintf (stream, "%-8s %10s %10s", "op", "calls", "ticks");
+    for (const char *name : layer_names) fprintf (stream, " %15s", name);
+    fprintf (stream, " %15s\n", "rest");
+
+    stack_profile_t ops[PROFILE_OPS] = {};
+    for (int op = 0; op < PROFILE_OPS; ++op)
+    {
+        ops[op] = stack_profile_global ((profile_op) op);
+        const stack_profile_t *prof = &ops[op];
+
+        if (prof->calls == 0) continue;
+
+        fprintf (stream, "%-8s %10llu %10.1f", op_names[op], (unsigned long long) prof->calls,
+                 per_call (prof->ticks, prof->calls));
+
+        uint64_t layers_ticks = 0;
+        for (int layer = 0; layer < PROFILE_LAYERS; ++layer)
+        {
+            layers_ticks += prof->layer_ticks[layer];
+            fprintf (stream, " %8.1f (%3.0f%%)", per_call (prof->layer_ticks[layer], prof->calls),
+                     100.0 * per_call (prof->layer_ticks[layer], prof->ticks));
+        }
+
+        uint64_t rest = (prof->ticks > layers_ticks) ? prof->ticks - layers_ticks : 0;
+        fprintf (stream, " %8.1f (%3.0f%%)\n", per_call (rest, prof->calls), 100.0 * per_call (rest, prof->ticks));
+    }
+
+    fprintf (stream, "Protection bytes per call:\n");
+    fprintf (stream, "%-8s", "op");
+    for (const char *name : layer_names) fprintf (stream, " %12s", name);
+    fprintf (stream, "\n");
+
+    for (int op = 0; op < PROFILE_OPS; ++op)
+    {
+        if (ops[op].calls == 0) continue;
+
+        fprintf (stream, "%-8s", op_names[op]);
+        for (int layer = 0; layer < PROFILE_LAYERS; ++layer)
+        {
+            fprintf (stream, " %12.1f", per_call (ops[op].layer_bytes[layer], ops[op].calls));
+        }
+        fprintf (stream, "\n");
+    }
+}
+
+// ------------------------------------------------------------------------------------
+
+void stack_profile_print (const stack_profile_t *profile, FILE *stream)
+{
+    assert (profile != nullptr && "pointer can't be null");
+    assert (stream  != nullptr && "pointer can't be null");
+
+    fprintf (stream, "calls %llu, ticks/call %.1f", (unsigned long long) profile->calls,
+             per_call (profile->ticks, profile->calls));
+
+    for (int layer = 0; layer < PROFILE_LAYERS; ++layer)
+    {
+        fprintf (stream, ", %s %.0f%%", layer_names[layer], 100.0 * per_call (profile->layer_ticks[layer], profile->ticks));
+    }
+
+    fprintf (stream, "\n");
+}
+
+// ------------------------------------------------------------------------------------
+
+static void report_at_exit ()
+{
+    stack_profile_report (stderr);
+}
+
+// ------------------------------------------------------------------------------------
+
+/// value / calls, 0 for no calls
+static double per_call (uint64_t value, uint64_t calls)
+{
+    return (calls != 0) ? (double) value / (double) calls : 0.0;
+}
+
+STACK_NAMESPACE_END
@@ -0,0 +1,115 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include "variant.h"
+
+STACK_NAMESPACE_BEGIN
+
+/// Protection layer whose cost is attributed
+enum profile_layer
+{
+    PROFILE_POISON  = 0,                /// Poison fills & poison checks (STACK_KSP_PROTECT)
+    PROFILE_CANARY  = 1,                /// Canary writes & checks (STACK_DUNGEON_MASTER_PROTECT)
+    PROFILE_HASH    = 2,                /// Data & struct hashing (STACK_HASH_PROTECT)
+    PROFILE_MEMORY  = 3,                /// mprotect & struct copy (STACK_MEMORY_PROTECT)
+
+    PROFILE_LAYERS
+};
+
+/// Public operation the cost is charged to (the outermost one, nested calls are its part)
+enum profile_op
+{
+    PROFILE_CTOR    = 0,
+    PROFILE_DTOR    = 1,
+    PROFILE_PUSH    = 2,                /// stack_push, stack_push_slot & stack_push_commit
+    PROFILE_POP     = 3,                /// stack_pop, stack_pop_slot & stack_pop_commit
+    PROFILE_PUSH_N  = 4,
+    PROFILE_POP_N   = 5,
+    PROFILE_RESIZE  = 6,                /// stack_resize & stack_shrink_to_fit
+    PROFILE_VERIFY  = 7,                /// stack_verify & stack_check called directly
+    PROFILE_OTHER   = 8,                /// Setters, write sections
+
+    PROFILE_OPS
+};
+
+/// Cost counters of one operation kind
+struct stack_profile_t
+{
+    uint64_t calls;                             /// Outermost calls
+    uint64_t ticks;                             /// trace_clock ticks of whole calls
+    uint64_t layer_ticks[PROFILE_LAYERS];       /// Ticks spent in layer (exclusive of nested layers)
+    uint64_t layer_bytes[PROFILE_LAYERS];       /// Bytes filled, checked, hashed or protected by layer
+};
+
+/// Profiling switch, read by every scope (use stack_profile_enable)
+extern std::atomic<bool> __PROFILE_ON;
+
+/**
+ * @brief Times public operation (see PROFILE_OP in stack.cpp)
+ *
+ * Only the outermost scope of a thread counts: stack_check inside stack_push is charged to push.
+ */
+struct profile_op_scope
+{
+    stack_profile_t *profile;           /// Per-stack counters (nullptr -> global only)
+    profile_op op;
+    uint64_t start;
+    bool outermost;
+
+    profile_op_scope (stack_profile_t *stk_profile, profile_op scope_op);
+    ~profile_op_scope ();
+
+    profile_op_scope (const profile_op_scope &) = delete;
+    profile_op_scope &operator= (const profile_op_scope &) = delete;
+};
+
+/**
+ * @brief Times protection layer work (see PROFILE_LAYER in stack.cpp)
+ *
+ * Layer time is exclusive: time of layer scopes nested into this one (hash of struct copy
+ * inside memory protection) is charged to the nested layer only.
+ */
+struct profile_layer_scope
+{
+    stack_profile_t *profile;           /// Per-stack counters of current op (nullptr -> global only)
+    profile_layer layer;
+    uint64_t bytes;
+    uint64_t start;
+    uint64_t outer_child;               /// Nested time of enclosing scope
+    bool active;
+
+    profile_layer_scope (stack_profile_t *stk_profile, profile_layer scope_layer, uint64_t scope_bytes);
+    ~profile_layer_scope ();
+
+    profile_layer_scope (const profile_layer_scope &) = delete;
+    profile_layer_scope &operator= (const profile_layer_scope &) = delete;
+};
+
+/**
+ * @brief      Turn profiling on or off (STACK_PROFILE builds, off by default)
+ *
+ * Disabled scopes cost one relaxed atomic load each.
+ *
+ * @param[in]  enabled         Switch
+ * @param[in]  report_at_exit  Print stack_profile_report to stderr at exit
+ */
+void stack_profile_enable (bool enabled, bool report_at_exit = false);
+
+/// Zero global counters (per-stack counters are zeroed by constructor)
+void stack_profile_reset ();
+
+/// Global counters of operation (relaxed snapshot)
+stack_profile_t stack_profile_global (profile_op op);
+
+/// Print breakdown of global counters: ticks per call, per-layer share and bytes of every operation
+void stack_profile_report (FILE *stream);
+
+/// Print per-stack counters (one line, totals of all operations)
+void stack_profile_print (const stack_profile_t *profile, FILE *stream);
+
+STACK_NAMESPACE_END
+
+#endif // PROFILE_H
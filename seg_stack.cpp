@@ -0,0 +1,530 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "log.h"
+#include "seg_stack.h"
+
+STACK_NAMESPACE_BEGIN
+
+// ---- ---- ---- --- CONSTS ---- ---- ---- ----
+
+/// Size of struct part covered by struct hash (check counter is not protected)
+const size_t SEG_PROTECTED_STRUCT_SIZE = offsetof (seg_stack_t, verify_checks);
+
+// ---- ---- ---- --- PROTOTYPES ---- ---- ---- ----
+
+static inline char  *chunk_data (const stack_chunk_t *chunk);
+static inline size_t top_size   (const seg_stack_t *stk);
+
+static stack_chunk_t *chunk_take    (seg_stack_t *stk);
+static void           chunk_release (seg_stack_t *stk, stack_chunk_t *chunk);
+static void           chunk_check   (const seg_stack_t *stk, const stack_chunk_t *chunk, size_t used, err_flags *errs);
+
+static inline void update_slot_hash   (const seg_stack_t *stk, stack_chunk_t *chunk, size_t slot, hash_t old_slot_hash);
+static inline hash_t chunk_slot_hash  (const seg_stack_t *stk, const stack_chunk_t *chunk, size_t slot);
+static inline void update_struct_hash (seg_stack_t *stk);
+
+// ---- ---- ---- --- IMPLEMENTATIONS ---- ---- ---- ----
+
+err_flags __stack_ctor (seg_stack_t *stk, size_t obj_size, size_t chunk_capacity, elem_print_f print_func,
+                        hash_f hash_func, verify_level level)
+{
+    assert (obj_size > 0   && "object size cant be 0");
+    assert (stk != nullptr && "pointer can't be null");
+
+    if (chunk_capacity == 0)
+    {
+        chunk_capacity = (STACK_DEFAULT_CHUNK_SIZE > obj_size) ? STACK_DEFAULT_CHUNK_SIZE / obj_size : 1;
+    }
+
+    stk->top            = nullptr;
+    stk->spare          = nullptr;
+    stk->size           = 0;
+    stk->chunks         = 0;
+    stk->chunk_capacity = chunk_capacity;
+    stk->obj_size       = obj_size;
+
+    stk->level         = level;
+    stk->period_ops    = (level == VERIFY_SAMPLED) ? STACK_DEFAULT_VERIFY_PERIOD : 0;
+    stk->verify_checks = 0;
+
+    #ifndef NDEBUG
+        stk->print_func = (print_func != nullptr) ? print_func : byte_fprintf;
+    #else
+        (void) print_func;
+    #endif
+
+    #if STACK_HASH_PROTECT
+        stk->hash_func = (hash_func != nullptr) ? hash_func : STACK_DEFAULT_HASH;
+    #else
+        (void) hash_func;
+    #endif
+
+    #if STACK_DUNGEON_MASTER_PROTECT
+        stk->two_blocks_up   = dungeon_master_val;
+        stk->two_blocks_down = dungeon_master_val;
+    #endif
+
+    update_struct_hash (stk);
+
+    stack_assert (stk);
+    return res::OK;
+}
+
+// ------------------------------------------------------------------------------------
+
+#ifndef NDEBUG
+err_flags __stack_ctor_with_debug (seg_stack_t *stk, const stack_debug_t *debug_data,
+                                size_t obj_size, size_t chunk_capacity, elem_print_f print_func,
+                                hash_f hash_func, verify_level level)
+{
+    assert (stk != nullptr && "pointer can't be NULL");
+
+    stk->debug_data = debug_data;
+
+    return __stack_ctor (stk, obj_size, chunk_capacity, print_func, hash_func, level);
+}
+#endif
+
+// ------------------------------------------------------------------------------------
+
+err_flags stack_push (seg_stack_t *stk, const void *value)
+{
+    stack_assert (stk);
+    assert (value != nullptr && "pointer can't be null");
+
+    if (stk->chunks == 0 || top_size (stk) == stk->chunk_capacity)
+    {
+        stack_chunk_t *chunk = chunk_take (stk);
+        if (chunk == nullptr) return res::NOMEM;
+
+        chunk->prev = stk->top;
+        stk->top    = chunk;
+        stk->chunks++;
+    }
+
+    size_t slot = top_size (stk);
+    hash_t old_slot_hash = chunk_slot_hash (stk, stk->top, slot);
+
+    memcpy (chunk_data (stk->top) + slot*stk->obj_size, value, stk->obj_size);
+    update_slot_hash (stk, stk->top, slot, old_slot_hash);
+
+    stk->size++;
+    update_struct_hash (stk);
+
+    stack_assert (stk);
+    return res::OK;
+}
+
+// ------------------------------------------------------------------------------------
+
+err_flags stack_pop (seg_stack_t *stk, void *value)
+{
+    stack_assert (stk);
+    assert (value != nullptr && "pointer can't be NULL");
+
+    if (stk->size == 0)
+    {
+        return res::EMPTY;
+    }
+
+    size_t slot = top_size (stk) - 1;
+    char *elem  = chunk_data (stk->top) + slot*stk->obj_size;
+
+    memcpy (value, elem, stk->obj_size);
+
+    #if STACK_KSP_PROTECT
+        hash_t old_slot_hash = chunk_slot_hash (stk, stk->top, slot);
+        poison_fill (elem, stk->obj_size);
+        update_slot_hash (stk, stk->top, slot, old_slot_hash);
+    #endif
+
+    stk->size--;
+
+    if (slot == 0)
+    {
+        stack_chunk_t *chunk = stk->top;
+
+        stk->top = chunk->prev;
+        stk->chunks--;
+        chunk_release (stk, chunk);
+    }
+
+    update_struct_hash (stk);
+
+    stack_assert (stk);
+    return res::OK;
+}
+
+// ------------------------------------------------------------------------------------
+
+err_flags stack_dtor (seg_stack_t *stk)
+{
+    if (stk == nullptr) { return res::OK; }
+
+    #ifndef NDEBUG
+        err_flags check_res = stack_verify (stk);
+        if (check_res != OK) log(log::WRN, "Destructor called on invalid object with error flags: 0x%x, see stack_perror", check_res);
+    #endif
+
+    while (stk->top != nullptr && stk->chunks > 0)
+    {
+        stack_chunk_t *chunk = stk->top;
+        stk->top = chunk->prev;
+        stk->chunks--;
+
+        free (chunk);
+    }
+
+    free (stk->spare);
+    stk->spare = nullptr;
+
+    #if STACK_KSP_PROTECT
+        // Poisoning
+        stk->top            = (stack_chunk_t *) const_cast<void *>(POISON_PTR);
+        stk->size           = -1u;
+        stk->chunk_capacity = 0;
+        stk->obj_size       = 0;
+    #endif
+
+    return res::OK;
+}
+
+// ------------------------------------------------------------------------------------
+
+void stack_dump (seg_stack_t *stk, FILE *stream)
+{
+    fprintf (stream, R Bold "\n======== SEGMENTED STACK DUMP =======\n" Plain D);
+
+    if (stk == nullptr)
+    {
+        fprintf (stream, "Stack ptr is nullptr\n");
+        return;
+    }
+
+    err_flags check_res = stack_verify (stk);
+
+    if (check_res != OK)
+    {
+        fprintf (stream, "Stack has errors: \n");
+        stack_perror(check_res, stream, "-> ");
+    }
+
+    if (check_res & (res::POISONED | res::INVALID_SIZE | res::BAD_CAPACITY | res::INVALID_OBJ_SIZE)) { return; }
+
+    #ifndef NDEBUG
+        fprintf (stream, "Stack[%p] with name " Bold "%s" Plain
+            " allocated at " Bold "%s" Plain " at file " Bold "%s:(%u)\n" Plain,
+            stk, stk->debug_data->var_name, stk->debug_data->func_name, stk->debug_data->file, stk->debug_data->line
+        );
+    #else
+        fprintf (stream, "Stack[%p]\n", stk);
+    #endif
+
+    fprintf (stream, "Parameters:\n"
+                     "    size: %lu\n"
+                     "    chunks: %lu (+%d spare)\n"
+                     "    chunk capacity: %lu\n"
+                     "    object size: %lu\n\n",
+                     stk->size, stk->chunks, (stk->spare != nullptr) ? 1 : 0, stk->chunk_capacity, stk->obj_size);
+
+    size_t index = stk->size;
+    size_t used  = top_size (stk);
+
+    for (const stack_chunk_t *chunk = stk->top; chunk != nullptr; chunk = chunk->prev)
+    {
+        fprintf (stream, "Chunk[%p]\n", chunk);
+
+        for (size_t slot = used; slot-- > 0; )
+        {
+            const char *elem = chunk_data (chunk) + slot*stk->obj_size;
+            fprintf (stream, "* data[%03lu]: ", --index);
+
+            #ifndef NDEBUG
+                stk->print_func (elem, stk->obj_size, stream);
+            #else
+                byte_fprintf (elem, stk->obj_size, stream);
+            #endif
+
+            fputc ('\n', stream);
+        }
+
+        if (index == 0) break;
+        used = stk->chunk_capacity;
+    }
+
+    fprintf (stream, R Bold "======== END SEGMENTED STACK DUMP =======\n\n" Plain D);
+}
+
+// ------------------------------------------------------------------------------------
+
+err_flags stack_verify_fast (const seg_stack_t *stk)
+{
+    err_flags ret = res::OK;
+
+    if (stk == nullptr) return res::NULLPTR;
+
+    if (stk->size > stk->chunks*stk->chunk_capacity)                    ret |= res::INVALID_SIZE;
+    if (stk->chunks > 0 && stk->size <= (stk->chunks - 1)*stk->chunk_capacity) ret |= res::INVALID_SIZE;
+    if ((stk->chunks == 0) != (stk->top == nullptr))                    ret |= res::STRUCT_CORRUPTED;
+    if (stk->chunk_capacity == 0)                                       ret |= res::BAD_CAPACITY;
+    if (stk->obj_size == 0)                                             ret |= res::INVALID_OBJ_SIZE;
+
+    #ifndef NDEBUG
+        if (stk->print_func == nullptr) ret |= res::INVALID_FUNC;
+    #endif
+
+    #if STACK_KSP_PROTECT
+        if (stk->top == POISON_PTR) return ret | res::POISONED;
+    #endif
+
+    #if STACK_DUNGEON_MASTER_PROTECT
+        if (stk->two_blocks_up != dungeon_master_val || stk->two_blocks_down != dungeon_master_val)
+        {
+            ret |= res::STRUCT_CORRUPTED;
+        }
+
+        if (ret == res::OK && stk->top != nullptr && stk->top->canary != dungeon_master_val)
+        {
+            ret |= res::DATA_CORRUPTED;
+        }
+    #endif
+
+    return ret;
+}
+
+// ------------------------------------------------------------------------------------
+
+err_flags stack_verify (seg_stack_t *stk_mutable)
+{
+    const seg_stack_t *stk = stk_mutable;
+
+    if (stk == nullptr) return res::NULLPTR;
+
+    err_flags ret = stack_verify_fast (stk);
+    if (ret & (res::POISONED | res::INVALID_SIZE | res::BAD_CAPACITY | res::INVALID_OBJ_SIZE)) return ret;
+
+    #if STACK_HASH_PROTECT
+        if (stk->hash_func == nullptr) return ret | res::INVALID_FUNC;
+
+        const hash_t struct_hash = stk->struct_hash;
+        stk_mutable->struct_hash = 0;
+
+        if (hash_fixed<SEG_PROTECTED_STRUCT_SIZE> (stk) != struct_hash)
+        {
+            ret |= res::STRUCT_CORRUPTED;
+        }
+        stk_mutable->struct_hash = struct_hash;
+    #endif
+
+    if (ret & res::STRUCT_CORRUPTED) return ret;
+
+    size_t used   = top_size (stk);
+    size_t chunks = 0;
+    const stack_chunk_t *chunk = stk->top;
+
+    for (; chunk != nullptr && chunks < stk->chunks; chunk = chunk->prev, ++chunks)
+    {
+        chunk_check (stk, chunk, used, &ret);
+        used = stk->chunk_capacity;
+    }
+
+    if (chunk != nullptr || chunks != stk->chunks)
+    {
+        ret |= res::STRUCT_CORRUPTED;
+    }
+
+    if (stk->spare != nullptr)
+    {
+        chunk_check (stk, stk->spare, 0, &ret);
+    }
+
+    return ret;
+}
+
+// ------------------------------------------------------------------------------------
+
+err_flags stack_check (seg_stack_t *stk)
+{
+    if (stk == nullptr) return res::NULLPTR;
+
+    switch (stk->level)
+    {
+        case VERIFY_OFF:        return res::OK;
+        case VERIFY_CHEAP:      return stack_verify_fast (stk);
+        case VERIFY_FULL:       return stack_verify (stk);
+        case VERIFY_SAMPLED:
+            if (++stk->verify_checks < stk->period_ops) return stack_verify_fast (stk);
+
+            stk->verify_checks = 0;
+            return stack_verify (stk);
+        default:                return res::STRUCT_CORRUPTED;
+    }
+}
+
+// ------------------------------------------------------------------------------------
+
+static inline char *chunk_data (const stack_chunk_t *chunk)
+{
+    assert (chunk != nullptr && "pointer can't be null");
+
+    return (char *) const_cast<stack_chunk_t *>(chunk + 1);
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Elements in top chunk
+static inline size_t top_size (const seg_stack_t *stk)
+{
+    assert (stk != nullptr && "pointer can't be null");
+
+    return (stk->chunks == 0) ? 0 : stk->size - (stk->chunks - 1)*stk->chunk_capacity;
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Spare chunk or a new one with canaries, poisoned data and its hash
+static stack_chunk_t *chunk_take (seg_stack_t *stk)
+{
+    assert (stk != nullptr && "pointer can't be null");
+
+    if (stk->spare != nullptr)
+    {
+        stack_chunk_t *chunk = stk->spare;
+        stk->spare = nullptr;
+
+        return chunk;
+    }
+
+    size_t data_size  = stk->chunk_capacity*stk->obj_size;
+    size_t chunk_size = sizeof (stack_chunk_t) + data_size;
+    #if STACK_DUNGEON_MASTER_PROTECT
+        chunk_size += sizeof (dungeon_master_t);
+    #endif
+
+    stack_chunk_t *chunk = (stack_chunk_t *) calloc (chunk_size, 1);
+    if (chunk == nullptr) return nullptr;
+
+    chunk->canary    = dungeon_master_val;
+    chunk->prev      = nullptr;
+    chunk->data_hash = 0;
+
+    #if STACK_DUNGEON_MASTER_PROTECT
+        // Trailing canary may be unaligned (capacity * obj_size % 8 != 0)
+        memcpy (chunk_data (chunk) + data_size, &dungeon_master_val, sizeof (dungeon_master_t));
+    #endif
+
+    #if STACK_KSP_PROTECT
+        poison_fill (chunk_data (chunk), data_size);
+    #endif
+
+    #if STACK_HASH_PROTECT
+        chunk->data_hash = slots_hash (stk->hash_func, chunk_data (chunk), 0, stk->chunk_capacity, stk->obj_size);
+    #endif
+
+    return chunk;
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Keep emptied chunk as spare (the previous spare is freed)
+static void chunk_release (seg_stack_t *stk, stack_chunk_t *chunk)
+{
+    assert (stk   != nullptr && "pointer can't be null");
+    assert (chunk != nullptr && "pointer can't be null");
+
+    free (stk->spare);
+
+    chunk->prev = nullptr;
+    stk->spare  = chunk;
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Canaries, poison and hash of chunk with used elements
+static void chunk_check (const seg_stack_t *stk, const stack_chunk_t *chunk, size_t used, err_flags *errs)
+{
+    assert (stk   != nullptr && "pointer can't be null");
+    assert (chunk != nullptr && "pointer can't be null");
+    assert (errs  != nullptr && "pointer can't be null");
+
+    const char *data = chunk_data (chunk);
+
+    #if STACK_DUNGEON_MASTER_PROTECT
+        dungeon_master_t back_canary = 0;
+        memcpy (&back_canary, data + stk->chunk_capacity*stk->obj_size, sizeof (dungeon_master_t));
+
+        if (chunk->canary != dungeon_master_val || back_canary != dungeon_master_val)
+        {
+            *errs |= res::DATA_CORRUPTED;
+            return;
+        }
+    #endif
+
+    #if STACK_KSP_PROTECT
+        if (!poison_is_range (data + used*stk->obj_size, (stk->chunk_capacity - used)*stk->obj_size))
+        {
+            *errs |= res::DATA_CORRUPTED;
+        }
+
+        if (poison_has_elem (data, used, stk->obj_size))
+        {
+            *errs |= res::POISONED;
+        }
+    #endif
+
+    #if STACK_HASH_PROTECT
+        if (slots_hash (stk->hash_func, data, 0, stk->chunk_capacity, stk->obj_size) != chunk->data_hash)
+        {
+            *errs |= res::DATA_CORRUPTED;
+        }
+    #endif
+
+    (void) data;
+    (void) used;
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Slot hash part of chunk data hash (0 without hash protection)
+static inline hash_t chunk_slot_hash (const seg_stack_t *stk, const stack_chunk_t *chunk, size_t slot)
+{
+    assert (stk   != nullptr && "pointer can't be null");
+    assert (chunk != nullptr && "pointer can't be null");
+
+    #if STACK_HASH_PROTECT
+        return slot_hash (stk->hash_func, slot, chunk_data (chunk) + slot*stk->obj_size, stk->obj_size);
+    #else
+        (void) slot;
+        return 0;
+    #endif
+}
+
+// ------------------------------------------------------------------------------------
+
+static inline void update_slot_hash (const seg_stack_t *stk, stack_chunk_t *chunk, size_t slot, hash_t old_slot_hash)
+{
+    assert (stk   != nullptr && "pointer can't be null");
+    assert (chunk != nullptr && "pointer can't be null");
+
+    #if STACK_HASH_PROTECT
+        chunk->data_hash += chunk_slot_hash (stk, chunk, slot) - old_slot_hash;
+    #else
+        (void) slot;
+        (void) old_slot_hash;
+    #endif
+}
+
+// ------------------------------------------------------------------------------------
+
+static inline void update_struct_hash (seg_stack_t *stk)
+{
+    assert (stk != nullptr && "pointer can't be null");
+
+    #if STACK_HASH_PROTECT
+        stk->struct_hash = 0;
+        stk->struct_hash = hash_fixed<SEG_PROTECTED_STRUCT_SIZE> (stk);
+    #endif
+}
+
+STACK_NAMESPACE_END
@@ -0,0 +1,110 @@
+#ifndef SEG_STACK_H
+#define SEG_STACK_H
+
+#include "stack.h"
+#include "variant.h"
+
+STACK_NAMESPACE_BEGIN
+
+#ifndef STACK_DEFAULT_CHUNK_SIZE
+/// Chunk data size (bytes) of segmented stacks constructed without chunk capacity
+#define STACK_DEFAULT_CHUNK_SIZE        4096
+#endif
+
+/**
+ * @brief Chunk of segmented stack
+ *
+ * Header is followed by chunk_capacity elements and trailing canary (STACK_DUNGEON_MASTER_PROTECT).
+ * Unused slots are poisoned (STACK_KSP_PROTECT), data_hash is a sum of slot hashes of all chunk slots
+ * (see slot_hash), so push & pop update it in O(obj_size).
+ */
+struct stack_chunk_t
+{
+    dungeon_master_t canary;            /// Chunk header canary
+    stack_chunk_t *prev;                /// Chunk below (nullptr for the bottom one)
+    hash_t data_hash;                   /// Chunk data hash (STACK_HASH_PROTECT)
+};
+
+/**
+ * @brief Segmented stack: list of fixed-size chunks
+ *
+ * Push that fills the top chunk only takes a new chunk, existing elements are never moved,
+ * poisoned or rehashed, so push & pop are O(1) in the worst case. One emptied chunk is kept as spare,
+ * so push & pop around a chunk boundary don't allocate. Works with the stack API functions
+ * (stack_ctor, stack_push, stack_pop, stack_dtor, stack_dump, stack_verify, stack_check).
+ * Protections are the same as of stack_t except memory protection (chunks are not mprotect'ed).
+ */
+struct seg_stack_t
+{
+    #if STACK_DUNGEON_MASTER_PROTECT
+    dungeon_master_t two_blocks_up;     /// Struct canary
+    #endif
+
+    stack_chunk_t *top;                 /// Top chunk (nullptr while stack is empty)
+    stack_chunk_t *spare;               /// Empty chunk for the next chunk crossing (can be nullptr)
+    size_t size;                        /// Stack size (used)
+    size_t chunks;                      /// Chunks count in stack (spare is not counted)
+    size_t chunk_capacity;              /// Elements in chunk
+    size_t obj_size;                    /// Stack object size
+
+    verify_level level;                 /// Verification level
+    unsigned int period_ops;            /// VERIFY_SAMPLED: full check every period_ops checks
+
+    #ifndef NDEBUG
+    elem_print_f print_func;            /// Function for printing elements
+    const stack_debug_t *debug_data;    /// Debug data
+    #endif
+
+    #if STACK_HASH_PROTECT
+    hash_f hash_func;                   /// Hash function
+    hash_t struct_hash;                 /// Struct hash (calculated with struct_hash=0)
+    #endif
+
+    #if STACK_DUNGEON_MASTER_PROTECT
+    dungeon_master_t two_blocks_down;   /// Struct canary
+    #endif
+
+    size_t verify_checks;               /// Checks since last full check, must be the last field (not protected)
+};
+
+/**
+ * @brief      Segmented stack constructor
+ *
+ * @param[out] stk             Pointer to stack
+ * @param[in]  obj_size        Object size
+ * @param[in]  chunk_capacity  Elements in chunk (0 -> STACK_DEFAULT_CHUNK_SIZE bytes of elements)
+ * @param[in]  print_func      Function for printing elements (can be nullptr -> per byte print)
+ * @param[in]  hash_func       Hash function (can be nullptr -> STACK_DEFAULT_HASH)
+ * @param[in]  level           Verification level (VERIFY_SAMPLED: full check every STACK_DEFAULT_VERIFY_PERIOD checks)
+ *
+ * @return     Error flags (bitor of res enum)
+ */
+err_flags __stack_ctor (seg_stack_t *stk, size_t obj_size, size_t chunk_capacity = 0, elem_print_f print_func = nullptr,
+                        hash_f hash_func = nullptr, verify_level level = STACK_DEFAULT_VERIFY_LEVEL);
+
+#ifndef NDEBUG
+    err_flags __stack_ctor_with_debug (seg_stack_t *stk, const stack_debug_t *debug_data,
+                                    size_t obj_size, size_t chunk_capacity = 0, elem_print_f print_func = nullptr,
+                                    hash_f hash_func = nullptr, verify_level level = STACK_DEFAULT_VERIFY_LEVEL);
+#endif
+
+err_flags stack_push (seg_stack_t *stk, const void *value);
+
+err_flags stack_pop (seg_stack_t *stk, void *value);
+
+err_flags stack_dtor (seg_stack_t *stk);
+
+void stack_dump (seg_stack_t *stk, FILE *stream);
+
+/// Full check: struct and every chunk (canaries, poison, hash)
+err_flags stack_verify (seg_stack_t *stk_mutable);
+
+/// O(1) subset of stack_verify: bounds, struct & top chunk canaries, poisoned stack
+err_flags stack_verify_fast (const seg_stack_t *stk);
+
+/// Verify stack according to its verification level (used by stack_assert)
+err_flags stack_check (seg_stack_t *stk);
+
+STACK_NAMESPACE_END
+
+#endif // SEG_STACK_H
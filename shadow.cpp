@@ -0,0 +1,249 @@
+#include <assert.h>
+#include <pthread.h>
+#include "shadow.h"
+
+#if (__linux__ || __unix__)
+#define STACK_HAS_MMAP 1
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#define STACK_HAS_MMAP 0
+#endif
+
+STACK_NAMESPACE_BEGIN
+
+// ---- ---- ---- --- REGISTRY ---- ---- ---- ----
+
+/// Guards page list, slot bitmaps and pages count (page access changes take page lock)
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/// Pages with free slots
+static shadow_page_t *partial_pages = nullptr;
+
+/// Mapped pages count
+static size_t pages_count = 0;
+
+// ---- ---- ---- --- PROTOTYPES ---- ---- ---- ----
+
+static size_t page_size ();
+static uint64_t full_mask (const shadow_page_t *page);
+
+static shadow_page_t *page_new (size_t slot_size);
+static void page_delete (shadow_page_t *page);
+
+static void partial_add    (shadow_page_t *page);
+static void partial_remove (shadow_page_t *page);
+
+static void set_page_access (shadow_page_t *page, bool writable);
+
+// ------------------------------------------------------------------------------------
+
+void *shadow_alloc (size_t size, shadow_page_t **page)
+{
+    assert (page != nullptr && "pointer can't be null");
+    assert (size > 0 && size <= page_size () && "shadow slot must fit in page");
+
+    size_t slot_size = (size + SHADOW_SLOT_ALIGN - 1) / SHADOW_SLOT_ALIGN * SHADOW_SLOT_ALIGN;
+
+    pthread_mutex_lock (&registry_lock);
+
+    shadow_page_t *cur = partial_pages;
+    while (cur != nullptr && cur->slot_size != slot_size)
+    {
+        cur = cur->next;
+    }
+
+    if (cur == nullptr)
+    {
+        cur = page_new (slot_size);
+        if (cur == nullptr)
+        {
+            pthread_mutex_unlock (&registry_lock);
+            return nullptr;
+        }
+
+        partial_add (cur);
+    }
+
+    size_t index = (size_t) __builtin_ctzll (~cur->used);
+    cur->used |= 1ull << index;
+
+    if (cur->used == full_mask (cur)) partial_remove (cur);
+
+    pthread_mutex_unlock (&registry_lock);
+
+    *page = cur;
+    return cur->mem + index*slot_size;
+}
+
+// ------------------------------------------------------------------------------------
+
+void shadow_free (void *slot, shadow_page_t *page)
+{
+    assert (slot != nullptr && "pointer can't be null");
+    assert (page != nullptr && "pointer can't be null");
+
+    size_t index = (size_t) ((unsigned char *) slot - page->mem) / page->slot_size;
+
+    pthread_mutex_lock (&registry_lock);
+
+    // Bitmap is shared with slots of other threads
+    assert (index < page->slots && (page->used & (1ull << index)) && "slot is not from this page");
+
+    bool was_full = page->used == full_mask (page);
+    page->used &= ~(1ull << index);
+
+    if (page->used == 0)
+    {
+        if (!was_full) partial_remove (page);
+        page_delete (page);
+    }
+    else if (was_full)
+    {
+        partial_add (page);
+    }
+
+    pthread_mutex_unlock (&registry_lock);
+}
+
+// ------------------------------------------------------------------------------------
+
+void shadow_unlock (shadow_page_t *page)
+{
+    assert (page != nullptr && "pointer can't be null");
+
+    pthread_mutex_lock (&page->lock);
+    if (page->writers++ == 0) set_page_access (page, true);
+    pthread_mutex_unlock (&page->lock);
+}
+
+// ------------------------------------------------------------------------------------
+
+void shadow_lock (shadow_page_t *page)
+{
+    assert (page != nullptr && "pointer can't be null");
+
+    pthread_mutex_lock (&page->lock);
+    assert (page->writers > 0 && "shadow_lock without shadow_unlock");
+    if (--page->writers == 0) set_page_access (page, false);
+    pthread_mutex_unlock (&page->lock);
+}
+
+// ------------------------------------------------------------------------------------
+
+size_t shadow_pages ()
+{
+    pthread_mutex_lock (&registry_lock);
+    size_t count = pages_count;
+    pthread_mutex_unlock (&registry_lock);
+
+    return count;
+}
+
+// ------------------------------------------------------------------------------------
+
+static size_t page_size ()
+{
+    #if STACK_HAS_MMAP
+        static const size_t pagesize = (size_t) sysconf (_SC_PAGESIZE);
+        return pagesize;
+    #else
+        return 4096;
+    #endif
+}
+
+// ------------------------------------------------------------------------------------
+
+static uint64_t full_mask (const shadow_page_t *page)
+{
+    return (page->slots == 64) ? ~0ull : (1ull << page->slots) - 1;
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Map read-only page of slot_size slots
+static shadow_page_t *page_new (size_t slot_size)
+{
+    shadow_page_t *page = (shadow_page_t *) calloc (1, sizeof (shadow_page_t));
+    if (page == nullptr) return nullptr;
+
+    #if STACK_HAS_MMAP
+        void *mem = mmap (nullptr, page_size (), PROT_READ, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED)
+        {
+            free (page);
+            return nullptr;
+        }
+    #else
+        void *mem = calloc (1, page_size ());
+        if (mem == nullptr)
+        {
+            free (page);
+            return nullptr;
+        }
+    #endif
+
+    page->mem       = (unsigned char *) mem;
+    page->slot_size = slot_size;
+    page->slots     = (page_size () / slot_size < 64) ? page_size () / slot_size : 64;
+
+    pthread_mutex_init (&page->lock, nullptr);
+
+    pages_count++;
+    return page;
+}
+
+// ------------------------------------------------------------------------------------
+
+static void page_delete (shadow_page_t *page)
+{
+    assert (page->writers == 0 && "page is unlocked");
+
+    #if STACK_HAS_MMAP
+        munmap (page->mem, page_size ());
+    #else
+        free (page->mem);
+    #endif
+
+    pthread_mutex_destroy (&page->lock);
+    free (page);
+    pages_count--;
+}
+
+// ------------------------------------------------------------------------------------
+
+static void partial_add (shadow_page_t *page)
+{
+    page->prev = nullptr;
+    page->next = partial_pages;
+
+    if (partial_pages != nullptr) partial_pages->prev = page;
+    partial_pages = page;
+}
+
+// ------------------------------------------------------------------------------------
+
+static void partial_remove (shadow_page_t *page)
+{
+    if (page->prev != nullptr) page->prev->next = page->next;
+    else                       partial_pages    = page->next;
+
+    if (page->next != nullptr) page->next->prev = page->prev;
+
+    page->prev = nullptr;
+    page->next = nullptr;
+}
+
+// ------------------------------------------------------------------------------------
+
+static void set_page_access (shadow_page_t *page, bool writable)
+{
+    #if STACK_HAS_MMAP
+        mprotect (page->mem, page_size (), writable ? PROT_READ|PROT_WRITE : PROT_READ);
+    #else
+        (void) page;
+        (void) writable;
+    #endif
+}
+
+STACK_NAMESPACE_END
@@ -0,0 +1,57 @@
+#ifndef SHADOW_H
+#define SHADOW_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "variant.h"
+
+STACK_NAMESPACE_BEGIN
+
+/// Alignment of shadow slots (bytes)
+const size_t SHADOW_SLOT_ALIGN = 64;
+
+/**
+ * @brief Shared read-only page with shadow copies of several stacks
+ *
+ * Slots of one page have the same size. Page is writable while any of its slots is unlocked:
+ * unlocks nest, so the whole mutation costs one mprotect pair however many fields it updates.
+ * Access changes take only the page lock, so stacks with copies in different pages don't contend.
+ */
+struct shadow_page_t
+{
+    unsigned char *mem;                 /// Page
+    size_t slot_size;                   /// Slot size (multiple of SHADOW_SLOT_ALIGN)
+    size_t slots;                       /// Slots in page (<= 64)
+    uint64_t used;                      /// Bitmap of used slots
+    size_t writers;                     /// Unlocks not locked back yet (guarded by lock)
+    pthread_mutex_t lock;               /// Guards writers & page access
+    shadow_page_t *prev;                /// Previous page with free slots
+    shadow_page_t *next;                /// Next page with free slots
+};
+
+/**
+ * @brief      Take read-only slot of at least size bytes
+ *
+ * @param[in]  size  Slot size
+ * @param[out] page  Page of slot
+ *
+ * @return     Slot or nullptr if out of memory
+ */
+void *shadow_alloc (size_t size, shadow_page_t **page);
+
+/// Return slot, page is unmapped when its last slot is freed
+void shadow_free (void *slot, shadow_page_t *page);
+
+/// Make page writable (nested, pair with shadow_lock)
+void shadow_unlock (shadow_page_t *page);
+
+/// Make page read-only again once all unlocks are locked back
+void shadow_lock (shadow_page_t *page);
+
+/// Mapped shadow pages count
+size_t shadow_pages ();
+
+STACK_NAMESPACE_END
+
+#endif // SHADOW_H
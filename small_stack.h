@@ -0,0 +1,352 @@
+#ifndef SMALL_STACK_H
+#define SMALL_STACK_H
+
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <type_traits>
+#include "stack.h"
+#include "policy_stack.h"
+#include "typed_stack.h"
+#include "variant.h"
+
+STACK_NAMESPACE_BEGIN
+
+// ---------------- Small stack ----------------
+
+/**
+ * @brief      Stack of trivially copyable T with first N elements stored inline
+ *
+ * Made for huge numbers of short stacks: construction allocates nothing, data spills to heap
+ * only when N+1-th element is pushed (and stays there until destruction). Compact header:
+ * 32-bit size & capacity, no debug data, print or hash function fields (hash is STACK_DEFAULT_HASH).
+ *
+ * Canaries guard struct and heap data, two_blocks_down directly follows inline storage.
+ * Unused inline bytes (all of them after spill) and heap slots are poisoned, data hash covers
+ * used slots wherever they are. Memory protection needs whole pages, so it is not supported.
+ */
+template <typename T, size_t N, stack_protection P = STACK_PROTECT_INLINE>
+class small_stack
+{
+    static_assert (std::is_trivially_copyable_v<T>, "small_stack element must be trivially copyable");
+    static_assert (N > 0 && N <= UINT32_MAX / 2, "inline capacity must be in [1, UINT32_MAX / 2]");
+    static_assert (!P.memory, "small_stack doesn't support memory protection");
+
+public:
+    small_stack ():
+        two_blocks_up (),
+        size (0),
+        capacity (N),
+        heap (nullptr),
+        data_hash (),
+        struct_hash (),
+        inline_data (),
+        two_blocks_down ()
+    {
+        if constexpr (P.canary)
+        {
+            two_blocks_up   = dungeon_master_val;
+            two_blocks_down = dungeon_master_val;
+        }
+
+        if constexpr (P.ksp)
+        {
+            poison_fill (inline_data, sizeof (inline_data));
+        }
+
+        update_struct_hash ();
+    }
+
+    small_stack (const small_stack &) = delete;
+    small_stack &operator= (const small_stack &) = delete;
+
+    ~small_stack ()
+    {
+        if (heap != nullptr)
+        {
+            poison (heap_data (), 0, capacity);
+            free (heap_data () - canary_size ());
+            heap = nullptr;
+        }
+    }
+
+    err_flags push (const T &value)
+    {
+        if (size == capacity)
+        {
+            UNWRAP (grow ());
+        }
+
+        memcpy (elems () + size*sizeof (T), &value, sizeof (T));
+        size++;
+
+        rehash_slot (size - 1, 0); // Unused slots are not hashed
+        return check ();
+    }
+
+    err_flags pop (T *value)
+    {
+        assert (value != nullptr && "pointer can't be null");
+
+        if (size == 0) return res::EMPTY;
+
+        size--;
+        unsigned char *slot = elems () + size*sizeof (T);
+        memcpy (value, slot, sizeof (T));
+
+        hash_t old_slot_hash = slot_part (size, slot);
+        poison (elems (), size, 1);
+
+        // Data hash covers used slots only: popped slot leaves it
+        if constexpr (P.hash) data_hash -= old_slot_hash;
+
+        update_struct_hash ();
+        return check ();
+    }
+
+    /// Full check of all enabled protections
+    err_flags verify () const
+    {
+        err_flags ret = res::OK;
+
+        if (size > capacity)                        ret |= res::INVALID_SIZE;
+        if (capacity < N)                           ret |= res::BAD_CAPACITY;
+        if ((heap == nullptr) != (capacity == N))   ret |= res::BAD_CAPACITY;
+
+        if constexpr (P.canary)
+        {
+            if (two_blocks_up != dungeon_master_val || two_blocks_down != dungeon_master_val) ret |= res::STRUCT_CORRUPTED;
+        }
+
+        if constexpr (P.hash)
+        {
+            if (calc_struct_hash () != struct_hash) ret |= res::STRUCT_CORRUPTED;
+        }
+
+        if (ret != res::OK) return ret;
+
+        const unsigned char *data = elems ();
+
+        if constexpr (P.canary)
+        {
+            if (heap != nullptr)
+            {
+                dungeon_master_t front = 0, back = 0;
+                memcpy (&front, data - sizeof (dungeon_master_t), sizeof (dungeon_master_t));
+                memcpy (&back,  data + capacity*sizeof (T),       sizeof (dungeon_master_t));
+
+                if (front != dungeon_master_val || back != dungeon_master_val) ret |= res::DATA_CORRUPTED;
+            }
+        }
+
+        if constexpr (P.ksp)
+        {
+            size_t inline_used = (heap == nullptr) ? size*sizeof (T) : 0;
+
+            if (!poison_is_range (inline_data + inline_used, sizeof (inline_data) - inline_used)) ret |= res::DATA_CORRUPTED;
+            if (heap != nullptr && !poison_is_range (data + size*sizeof (T), (capacity - size)*sizeof (T)))
+            {
+                ret |= res::DATA_CORRUPTED;
+            }
+            if (poison_has_elem (data, size, sizeof (T))) ret |= res::POISONED;
+        }
+
+        if constexpr (P.hash)
+        {
+            if (slots_hash (STACK_DEFAULT_HASH, data, 0, size, sizeof (T)) != data_hash) ret |= res::DATA_CORRUPTED;
+        }
+
+        return ret;
+    }
+
+    void dump (FILE *stream) const
+    {
+        assert (stream != nullptr && "pointer can't be null");
+
+        fprintf (stream, R Bold "\n======== SMALL STACK DUMP =======\n" Plain D);
+
+        err_flags check_res = verify ();
+        if (check_res != res::OK)
+        {
+            fprintf (stream, "Stack has errors: \n");
+            stack_perror (check_res, stream, "-> ");
+        }
+
+        fprintf (stream, "Stack[%p]\n"
+                         "Parameters:\n"
+                         "    size: %u\n"
+                         "    capacity: %u (%zu inline)\n"
+                         "    object size: %zu\n"
+                         "    storage: %s\n\n",
+                         (const void *) this, size, capacity, N, sizeof (T), (heap == nullptr) ? "inline" : "heap");
+
+        for (size_t i = 0; !(check_res & res::INVALID_SIZE) && i < size; ++i)
+        {
+            fprintf (stream, "* data[%03zu]: ", i);
+            typed_elem_print<T> (elems () + i*sizeof (T), sizeof (T), stream);
+            fputc ('\n', stream);
+        }
+
+        fprintf (stream, R Bold "======== END SMALL STACK DUMP =======\n\n" Plain D);
+    }
+
+    size_t get_size     () const { return size;     }
+    size_t get_capacity () const { return capacity; }
+    bool   is_inline    () const { return heap == nullptr; }
+
+private:
+    [[no_unique_address]] stack_opt_field<P.canary, dungeon_master_t, 0>  two_blocks_up;     /// Struct canary
+
+    uint32_t size;                                                                          /// Stack size (used)
+    uint32_t capacity;                                                                      /// N while inline, heap capacity after spill
+    T *heap;                                                                                /// Spilled data (nullptr while inline)
+
+    [[no_unique_address]] stack_opt_field<P.hash,   hash_t,           1>  data_hash;         /// Sum of used slot hashes
+    [[no_unique_address]] stack_opt_field<P.hash,   hash_t,           2>  struct_hash;       /// Header hash (calculated with struct_hash=0)
+
+    /// Inline storage, padded to canary alignment (padding is poisoned too)
+    alignas (T) alignas (dungeon_master_t) unsigned char inline_data[(N*sizeof (T) + sizeof (dungeon_master_t) - 1)
+                                                                      / sizeof (dungeon_master_t) * sizeof (dungeon_master_t)];
+
+    [[no_unique_address]] stack_opt_field<P.canary, dungeon_master_t, 3>  two_blocks_down;   /// Struct canary & inline storage canary
+
+    // ---------------- Layer helpers ----------------
+
+    static constexpr size_t canary_size ()
+    {
+        return P.canary ? sizeof (dungeon_master_t) : 0;
+    }
+
+    unsigned char *heap_data () const
+    {
+        return (unsigned char *) heap;
+    }
+
+    unsigned char *elems () const
+    {
+        return (heap != nullptr) ? heap_data () : const_cast<unsigned char *> (inline_data);
+    }
+
+    /// Spill to heap or double heap capacity
+    err_flags grow ()
+    {
+        if (capacity > UINT32_MAX / 2) return res::NOMEM;
+
+        uint32_t new_capacity = capacity * 2;
+        unsigned char *old_mem = (heap != nullptr) ? heap_data () - canary_size () : nullptr;
+
+        unsigned char *new_mem = (unsigned char *) realloc (old_mem, new_capacity*sizeof (T) + 2*canary_size ());
+        if (new_mem == nullptr) return res::NOMEM;
+
+        unsigned char *data = new_mem + canary_size ();
+
+        if (heap == nullptr)
+        {
+            memcpy (data, inline_data, size*sizeof (T));
+            poison (inline_data, 0, size);
+        }
+
+        poison (data, size, new_capacity - size);
+
+        if constexpr (P.canary)
+        {
+            memcpy (new_mem,                        &dungeon_master_val, sizeof (dungeon_master_t));
+            memcpy (data + new_capacity*sizeof (T), &dungeon_master_val, sizeof (dungeon_master_t));
+        }
+
+        heap     = (T *) (void *) data;
+        capacity = new_capacity;
+
+        update_struct_hash ();
+        return res::OK;
+    }
+
+    void poison (unsigned char *data, size_t first, size_t count)
+    {
+        if constexpr (P.ksp)
+        {
+            poison_fill (data + first*sizeof (T), count*sizeof (T));
+        }
+        else
+        {
+            (void) data;
+            (void) first;
+            (void) count;
+        }
+    }
+
+    hash_t slot_part (size_t index, const unsigned char *slot) const
+    {
+        if constexpr (P.hash)
+        {
+            return slot_hash (STACK_DEFAULT_HASH, index, slot, sizeof (T));
+        }
+        else
+        {
+            (void) index;
+            (void) slot;
+            return 0;
+        }
+    }
+
+    void rehash_slot (size_t index, hash_t old_slot_hash)
+    {
+        if constexpr (P.hash)
+        {
+            data_hash += slot_part (index, elems () + index*sizeof (T)) - old_slot_hash;
+        }
+        else
+        {
+            (void) index;
+            (void) old_slot_hash;
+        }
+
+        update_struct_hash ();
+    }
+
+    hash_t calc_struct_hash () const
+    {
+        if constexpr (P.hash)
+        {
+            small_stack *self = const_cast<small_stack *> (this);
+            hash_t saved = struct_hash;
+
+            self->struct_hash = 0;
+            hash_t hash = hash_fixed<offsetof (small_stack, inline_data)> (this);
+            self->struct_hash = saved;
+
+            return hash;
+        }
+        else
+        {
+            return 0;
+        }
+    }
+
+    void update_struct_hash ()
+    {
+        if constexpr (P.hash)
+        {
+            struct_hash = calc_struct_hash ();
+        }
+    }
+
+    /// Check by level of policy: stack is short, every level but VERIFY_OFF runs full verify
+    err_flags check () const
+    {
+        if constexpr (P.level == VERIFY_OFF) return res::OK;
+
+        err_flags check_res = verify ();
+        if (check_res != res::OK)
+        {
+            log (log::ERR, "Failed small stack check with err flags: ");
+            stack_perror (check_res, get_log_stream(), "->");
+            dump (get_log_stream());
+        }
+        return check_res;
+    }
+};
+
+STACK_NAMESPACE_END
+
+#endif // SMALL_STACK_H
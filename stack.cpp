@@ -3,50 +3,142 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
 #include "log.h"
 #include "stack.h"
 
-#if STACK_MEMORY_PROTECT
+#if (__linux__ || __unix__)
+#define STACK_HAS_MMAP 1
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
 #include <unistd.h>
+#else
+#define STACK_HAS_MMAP 0
 #endif
 
+STACK_NAMESPACE_BEGIN
+
 // ---- ---- ---- --- CONSTS ---- ---- ---- ----
-#if STACK_KSP_PROTECT
-/// Random const variable
-const unsigned char __const_memory_val = 228;
-/// Pointer to const memory
-const void *const POISON_PTR = &__const_memory_val;
-const unsigned char POISON_BYTE = (unsigned char) -7u;
+const err_flags DATA_NOT_OKAY = DATA_NULL | DATA_CORRUPTED | POISONED | BAD_CAPACITY | INVALID_OBJ_SIZE | STRUCT_CORRUPTED;
+
+/// Size of struct part covered by struct_copy (runtime state is not protected)
+const size_t PROTECTED_STRUCT_SIZE = offsetof (stack_t, runtime);
+
+#if STACK_MEMORY_PROTECT
+/// Field of struct copy (it holds PROTECTED_STRUCT_SIZE bytes, not a whole stack_t)
+#define COPY_FIELD(stk, field) (*(decltype (&(stk)->field)) (void *) ((stk)->struct_copy + offsetof (stack_t, field)))
 #endif
 
-const err_flags DATA_NOT_OKAY = DATA_NULL | DATA_CORRUPTED | POISONED | BAD_CAPACITY | INVALID_OBJ_SIZE | STRUCT_CORRUPTED;
+// ---- ---- ---- --- REGISTRY ---- ---- ---- ----
+
+#if STACK_STATS
+/// Guards registry list
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
 
-/// Canary value
-const dungeon_master_t dungeon_master_val = 0x1000DEAD7;
+/// Live stacks list
+static stack_t *registry_head = nullptr;
+#endif
+
+// ---- ---- ---- --- PROFILER ---- ---- ---- ----
+
+#if STACK_PROFILE
+/// Charge the rest of enclosing block to public operation of stk (see profile.h)
+#define PROFILE_OP(stk, op)                 profile_op_scope    __profile_op    (profile_of (stk), op)
+/// Charge the rest of enclosing block to protection layer of stk, which processes bytes
+#define PROFILE_LAYER(stk, layer, bytes)    profile_layer_scope __profile_layer (profile_of (stk), layer, bytes)
+#else
+#define PROFILE_OP(stk, op)                 (void) (stk)
+#define PROFILE_LAYER(stk, layer, bytes)    (void) (stk)
+#endif
 
 // ---- ---- ---- --- PROTOTYPES ---- ---- ---- ----
 
-/// Memory protection: mprotect wrappers with #ifdef compilation
+/// Memory protection: mprotect wrappers with #ifdef compilation (no-op inside write session)
 static inline void unlock_copy (stack_t *stk);
 static inline void   lock_copy (stack_t *stk);
 static inline void unlock_data (stack_t *stk);
 static inline void   lock_data (stack_t *stk);
 
-static inline void update_hash (stack_t *stk);
+/// Memory protection: mprotect wrappers ignoring write session
+static inline void set_copy_access (stack_t *stk, bool writable);
+static inline void set_data_access (stack_t *stk, bool writable);
+
+static inline void sync_struct_copy   (stack_t *stk);
+
+static inline void update_hash        (stack_t *stk);
+static inline void update_hash_range  (stack_t *stk, size_t first, size_t count, hash_t old_range_hash);
+static inline void update_struct_hash (stack_t *stk);
+static inline hash_t range_hash       (const stack_t *stk, size_t first, size_t count);
+#if STACK_HASH_PROTECT
+static hash_t data_hash_calc          (const stack_t *stk);
+#endif
 
 /// Protection checkers with #ufdef compilation
+static void bounds_check         (const stack_t *stk, err_flags *errs);
 static void dungeon_master_check (const stack_t *stk, err_flags *errs);
 static void data_poison_check    (const stack_t *stk, err_flags *errs);
 static void hash_check           (      stack_t *stk, err_flags *errs);
 static void memory_check         (const stack_t *stk, err_flags *errs);
 
-static size_t get_data_size (size_t capacity, size_t obj_size);
+static err_flags auto_shrink (stack_t *stk, size_t popped);
+static err_flags auto_grow   (stack_t *stk, size_t min_capacity);
 
-static void *cust_realloc (void *prev_ptr, size_t prev_size, size_t new_size);
+static err_flags level_verify (stack_t *stk);
+static err_flags sampled_verify (stack_t *stk);
+static uint64_t monotonic_us ();
 
-static err_flags stack_data_init (stack_t *stk, size_t reserved, size_t obj_size);
-static void init_dungeon_master_protection (stack_t *stk);
+/// Flight recorder hooks with #if compilation: one branch without recorder
+static inline void     trace_hook (const stack_t *stk, trace_op op, size_t count, uint32_t fingerprint, err_flags errors);
+static inline uint32_t trace_top  (const stack_t *stk);
+
+/// Operation counters & registry with #if compilation
+static inline void stats_init   (stack_t *stk);
+static inline void stats_push   (stack_t *stk, size_t pushed);
+static inline void stats_pop    (stack_t *stk, size_t popped);
+static inline void stats_resize (stack_t *stk, size_t bytes_copied);
+static inline void stats_check  (stack_t *stk, err_flags check_res);
+static void registry_add    (stack_t *stk);
+static void registry_remove (stack_t *stk);
+
+/// Protection cost profiler with #if compilation
+static inline stack_profile_t *profile_of (const stack_t *stk);
+static inline void profile_init (stack_t *stk);
+static inline void poison_range (const stack_t *stk, void *mem, size_t size);
+
+static size_t get_data_size (size_t capacity, size_t obj_size);
+static size_t get_reserve_size (const stack_t *stk);
+static size_t commit_round (const stack_t *stk, size_t size);
+static void   set_backing  (stack_t *stk, unsigned int backing);
+static size_t huge_page_size ();
+
+static void *cust_realloc   (const stack_t *stk, void *prev_ptr, size_t prev_size, size_t new_size);
+static void *reserve_commit (const stack_t *stk, void *data_start, size_t prev_size, size_t new_size);
+static void *pool_realloc   (stack_t *stk, void *data_start, size_t prev_size, size_t new_size);
+static stack_pool_t *data_pool (const stack_t *stk);
+static void *data_alloc   (stack_t *stk, size_t data_size);
+static void *data_reserve (stack_t *stk, size_t data_size, int map_flags);
+static void  data_free    (stack_t *stk, void *data_start);
+static void  data_advise  (stack_t *stk, void *mem, size_t size);
+static void  prefault     (void *mem, size_t size);
+
+/// File backing (STACK_ALLOC_FILE) with #if compilation
+static err_flags file_open        (stack_t *stk, const char *path, void **mem_ptr, bool *adopted);
+static err_flags file_header_read (stack_t *stk, int fd, size_t file_size);
+static err_flags file_attach      (stack_t *stk, bool adopted, verify_level level);
+static void *file_realloc         (stack_t *stk, void *data_start, size_t prev_size, size_t new_size);
+static err_flags file_sync        (const stack_t *stk);
+static void file_release          (stack_t *stk);
+static inline void file_header_update (stack_t *stk);
+static size_t file_header_size ();
+static size_t file_map_size    (const stack_t *stk, size_t capacity);
+static uint32_t file_layout    ();
+
+static err_flags stack_data_init (stack_t *stk, size_t reserved, size_t obj_size, const stack_alloc_t *alloc, bool *adopted);
+static void init_dungeon_master_protection (stack_t *stk, bool data_canaries);
 
 // ---- ---- ---- --- IMPLEMENTATIONS ---- ---- ---- ----
 
@@ -54,19 +146,13 @@ err_flags stack_verify (stack_t *stk_mutable) // We need mutable stk for hash
 { 
     const stack_t *stk = (const stack_t *) stk_mutable;
 
+    PROFILE_OP (stk, PROFILE_VERIFY);
+
     err_flags ret = res::OK;
 
     if (stk == nullptr) return res::NULLPTR;
 
-    if (stk->size > stk->capacity)      ret |= res::INVALID_SIZE;
-    if (stk->capacity < stk->reserved)  ret |= res::BAD_CAPACITY;
-    if (stk->obj_size == 0)             ret |= res::INVALID_OBJ_SIZE;
-    if (stk->data == nullptr)           ret |= res::DATA_NULL;
-
-    #ifndef NDEBUG 
-        if (stk->print_func == nullptr) ret |= res::INVALID_FUNC;
-    #endif
-
+    bounds_check (stk, &ret);
     data_poison_check (stk, &ret);
     dungeon_master_check (stk, &ret);
     hash_check (stk_mutable, &ret);
@@ -77,13 +163,139 @@ err_flags stack_verify (stack_t *stk_mutable) // We need mutable stk for hash
 
 // ------------------------------------------------------------------------------------
 
-err_flags __stack_ctor (stack_t *stk, size_t obj_size, size_t capacity, elem_print_f print_func, hash_f hash_func)
+err_flags stack_verify_fast (const stack_t *stk)
+{
+    PROFILE_OP (stk, PROFILE_VERIFY);
+
+    err_flags ret = res::OK;
+
+    if (stk == nullptr) return res::NULLPTR;
+
+    bounds_check (stk, &ret);
+
+    #if STACK_KSP_PROTECT
+        if (!(ret & DATA_NOT_OKAY) && stk->data == POISON_PTR) ret |= POISONED;
+    #endif
+
+    dungeon_master_check (stk, &ret);
+
+    return ret;
+}
+
+// ------------------------------------------------------------------------------------
+
+err_flags stack_check (stack_t *stk)
+{
+    PROFILE_OP (stk, PROFILE_VERIFY);
+
+    if (stk == nullptr) return res::NULLPTR;
+
+    err_flags check_res = (stk->verify.level != VERIFY_SAMPLED || stk->write_depth > 0) ? level_verify   (stk) :
+                                                                                          sampled_verify (stk);
+
+    stats_check (stk, check_res);
+
+    // Destroyed stack may outlive its recorder
+    if (check_res != res::OK && !(check_res & res::POISONED))
+    {
+        trace_hook (stk, TRACE_CHECK_FAILED, 0, 0, check_res);
+    }
+
+    return check_res;
+}
+
+// ------------------------------------------------------------------------------------
+
+err_flags stack_set_verify_level (stack_t *stk, verify_level level, unsigned int period_ops, uint64_t period_us)
+{
+    PROFILE_OP (stk, PROFILE_OTHER);
+
+    stack_assert (stk);
+
+    if (level == VERIFY_SAMPLED && period_ops == 0 && period_us == 0)
+    {
+        period_ops = STACK_DEFAULT_VERIFY_PERIOD;
+    }
+
+    stk->verify.level      = level;
+    stk->verify.period_ops = period_ops;
+    stk->verify.period_us  = period_us;
+
+    stk->runtime.verify_state.checks  = 0;
+    stk->runtime.verify_state.last_us = (period_us != 0) ? monotonic_us () : 0;
+
+    sync_struct_copy (stk);
+    update_struct_hash (stk);
+
+    stack_assert (stk);
+    return res::OK;
+}
+
+// ------------------------------------------------------------------------------------
+
+err_flags stack_set_growth (stack_t *stk, const stack_growth_t *growth)
+{
+    PROFILE_OP (stk, PROFILE_OTHER);
+
+    stack_assert (stk);
+    assert (growth != nullptr && "pointer can't be null");
+
+    if (!stack_growth_is_valid (growth))
+    {
+        return res::BAD_CAPACITY;
+    }
+
+    stk->growth = *growth;
+
+    stk->runtime.growth_state = {};
+
+    sync_struct_copy (stk);
+    update_struct_hash (stk);
+
+    stack_assert (stk);
+    return res::OK;
+}
+
+// ------------------------------------------------------------------------------------
+
+err_flags stack_set_trace (stack_t *stk, stack_trace_t *trace)
+{
+    PROFILE_OP (stk, PROFILE_OTHER);
+
+    stack_assert (stk);
+
+    #if STACK_TRACE
+        stk->trace = trace;
+
+        sync_struct_copy (stk);
+        update_struct_hash (stk);
+
+        trace_hook (stk, TRACE_ATTACH, 0, 0, res::OK);
+    #else
+        (void) trace;
+    #endif
+
+    stack_assert (stk);
+    return res::OK;
+}
+
+// ------------------------------------------------------------------------------------
+
+err_flags __stack_ctor (stack_t *stk, size_t obj_size, size_t capacity, elem_print_f print_func, hash_f hash_func,
+                        verify_level level, const stack_growth_t *growth, const stack_alloc_t *alloc)
 {
     assert (obj_size > 0   && "object size cant be 0");
     assert (stk != nullptr && "pointer can't be null");
+    assert ((growth == nullptr || stack_growth_is_valid (growth)) && "invalid growth factor");
+
+    profile_init (stk);
+    stats_init   (stk);
 
-    // Data & fields initialisation
-    stack_data_init (stk, capacity, obj_size);
+    PROFILE_OP (stk, PROFILE_CTOR);
+
+    // Data & fields initialisation, data of reopened file is kept as it is
+    bool adopted = false;
+    UNWRAP (stack_data_init (stk, capacity, obj_size, alloc, &adopted));
 
     // Protection initialising
     #ifndef NDEBUG
@@ -91,27 +303,57 @@ err_flags __stack_ctor (stack_t *stk, size_t obj_size, size_t capacity, elem_pri
         else                        stk->print_func = byte_fprintf;
     #endif
 
-    init_dungeon_master_protection (stk);
+    init_dungeon_master_protection (stk, !adopted);
 
     #if STACK_KSP_PROTECT
-        memset (stk->data, POISON_BYTE, stk->capacity*obj_size);
+        // Pool blocks are poisoned already
+        if (!(stk->backing & BACKING_POOL) && !adopted) poison_range (stk, stk->data, stk->capacity*obj_size);
     #endif
 
     #if STACK_HASH_PROTECT
-        stk->hash_func   = (hash_func != nullptr) ? hash_func : djb2_hash;
+        stk->hash_func   = (hash_func != nullptr) ? hash_func : STACK_DEFAULT_HASH;
+
+        // Reopened file is hashed with the function it was written with
+        if (hash_func == nullptr && adopted && hash_find (stk->file_header->hash_name) != nullptr)
+        {
+            stk->hash_func = hash_find (stk->file_header->hash_name);
+        }
     #endif
+
+    // Reopened file is checked in full by file_attach, not by level checks in between
+    stk->verify.level      = adopted ? VERIFY_OFF : level;
+    stk->verify.period_ops = (level == VERIFY_SAMPLED) ? STACK_DEFAULT_VERIFY_PERIOD : 0;
+    stk->verify.period_us  = 0;
+    stk->runtime.verify_state.checks  = 0;
+    stk->runtime.verify_state.last_us = 0;
+
+    stk->growth = (growth != nullptr) ? *growth : STACK_DEFAULT_GROWTH;
+    stk->runtime.growth_state = {};
+
+    stk->write_depth = 0;
     
+    unlock_copy (stk); // Shadow slot stays writable until the end of construction
+
     #if STACK_MEMORY_PROTECT
-        memcpy (stk->struct_copy, stk, sizeof (stack_t));
+    {
+        PROFILE_LAYER (stk, PROFILE_MEMORY, PROTECTED_STRUCT_SIZE);
+        memcpy (stk->struct_copy, stk, PROTECTED_STRUCT_SIZE);
+    }
     #endif
 
-    update_hash (stk);
+    // Data hash of reopened file comes from its header
+    if (adopted) update_struct_hash (stk);
+    else         update_hash        (stk);
 
     lock_data   (stk);
     lock_copy (stk);
 
+    if (stk->backing & BACKING_FILE) UNWRAP (file_attach (stk, adopted, level));
+
     stack_assert (stk);
 
+    registry_add (stk);
+
     return res::OK;
 }
 
@@ -119,13 +361,14 @@ err_flags __stack_ctor (stack_t *stk, size_t obj_size, size_t capacity, elem_pri
 
 #ifndef NDEBUG
 err_flags __stack_ctor_with_debug (stack_t *stk, const stack_debug_t *debug_data,
-                                size_t obj_size, size_t capacity, elem_print_f print_func, hash_f hash_func)
+                                size_t obj_size, size_t capacity, elem_print_f print_func, hash_f hash_func,
+                                verify_level level, const stack_growth_t *growth, const stack_alloc_t *alloc)
 {
     assert (stk != nullptr && "pointer can't be NULL");
 
     stk->debug_data = debug_data;
 
-    return __stack_ctor (stk, obj_size, capacity, print_func, hash_func);
+    return __stack_ctor (stk, obj_size, capacity, print_func, hash_func, level, growth, alloc);
 }
 #endif
 
@@ -133,6 +376,8 @@ err_flags __stack_ctor_with_debug (stack_t *stk, const stack_debug_t *debug_data
 
 err_flags stack_resize (stack_t *stk, size_t new_capacity)
 {
+    PROFILE_OP (stk, PROFILE_RESIZE);
+
     stack_assert (stk);
     assert (stk->size <= new_capacity);
     
@@ -141,27 +386,52 @@ err_flags stack_resize (stack_t *stk, size_t new_capacity)
         return res::BAD_CAPACITY;
     }
 
-    size_t new_data_size = get_data_size (new_capacity, stk->obj_size);
+    if (stk->max_capacity != 0 && new_capacity > stk->max_capacity)
+    {
+        return res::NOMEM;
+    }
+
+    size_t old_data_size = get_data_size (stk->capacity, stk->obj_size);
+    size_t new_data_size = get_data_size (new_capacity,  stk->obj_size);
 
+    void *data_start = stk->data;
     #if STACK_DUNGEON_MASTER_PROTECT
-    stk->data = ((dungeon_master_t*) stk->data) - 1;
+    data_start = ((dungeon_master_t*) stk->data) - 1;
     #endif
 
-    void *new_data_ptr = cust_realloc (stk->data, get_data_size (stk->capacity, stk->obj_size), new_data_size);
+    // Reserved data never moves: pages are committed or decommitted in place
+    void *new_data_ptr = (stk->backing & BACKING_RESERVED) ? reserve_commit (stk, data_start, old_data_size, new_data_size) :
+                         (stk->backing & BACKING_POOL)     ? pool_realloc   (stk, data_start, old_data_size, new_data_size) :
+                         (stk->backing & BACKING_FILE)     ? file_realloc   (stk, data_start, old_data_size, new_data_size) :
+                                                             cust_realloc   (stk, data_start, old_data_size, new_data_size);
     if (new_data_ptr == nullptr) return res::NOMEM;
 
+    stats_resize (stk, (new_data_ptr != data_start) ? stk->size*stk->obj_size : 0);
+
+    #if STACK_MEMORY_PROTECT
+    {
+        PROFILE_LAYER (stk, PROFILE_MEMORY, commit_round (stk, new_data_size));
+        stack_pages_protect (new_data_ptr, commit_round (stk, new_data_size), true);
+    }
+    #endif
+
+    if ((stk->backing & BACKING_POPULATED) && new_data_size > old_data_size)
+    {
+        prefault ((char *) new_data_ptr + old_data_size, new_data_size - old_data_size);
+    }
+
     #if STACK_DUNGEON_MASTER_PROTECT
-        #if STACK_MEMORY_PROTECT
-        mprotect (new_data_ptr, new_data_size, PROT_WRITE|PROT_READ);
-        #endif
         new_data_ptr = ((dungeon_master_t*) new_data_ptr) + 1;
-        * ((dungeon_master_t *) ((char *)new_data_ptr + new_capacity * stk->obj_size)) = dungeon_master_val;
+
+        PROFILE_LAYER (stk, PROFILE_CANARY, sizeof (dungeon_master_t));
+        // Trailing canary may be unaligned (capacity * obj_size % 8 != 0)
+        memcpy ((char *)new_data_ptr + new_capacity * stk->obj_size, &dungeon_master_val, sizeof (dungeon_master_t));
     #endif
 
     #if STACK_KSP_PROTECT
         if (new_capacity > stk->capacity)
         {
-            memset ((char* ) new_data_ptr + stk->capacity*stk->obj_size, POISON_BYTE, (new_capacity - stk->capacity)*stk->obj_size);
+            poison_range (stk, (char* ) new_data_ptr + stk->capacity*stk->obj_size, (new_capacity - stk->capacity)*stk->obj_size);
         }
     #endif
 
@@ -170,14 +440,20 @@ err_flags stack_resize (stack_t *stk, size_t new_capacity)
 
     #if STACK_MEMORY_PROTECT
         unlock_copy (stk);
-        stk->struct_copy->data     = stk->data;
-        stk->struct_copy->capacity = stk->capacity;
+        if (stk->write_depth == 0) // Session copy is synced on commit
+        {
+            COPY_FIELD (stk, data)        = stk->data;
+            COPY_FIELD (stk, capacity)    = stk->capacity;
+            COPY_FIELD (stk, file_header) = stk->file_header;
+        }
         lock_copy (stk);
         lock_data (stk);
     #endif
 
     update_hash (stk);
 
+    trace_hook (stk, TRACE_RESIZE, 0, 0, res::OK);
+
     stack_assert (stk);
     return res::OK;
 }
@@ -186,6 +462,8 @@ err_flags stack_resize (stack_t *stk, size_t new_capacity)
 
 err_flags stack_shrink_to_fit (stack_t *stk)
 {
+    PROFILE_OP (stk, PROFILE_RESIZE);
+
     stack_assert (stk);
 
     stack_resize (stk, stk->size);
@@ -198,78 +476,93 @@ err_flags stack_shrink_to_fit (stack_t *stk)
 
 err_flags stack_pop (stack_t *stk, void *value)
 {
-    stack_assert (stk);
+    PROFILE_OP (stk, PROFILE_POP);
+
     assert (value != nullptr && "pointer can't be NULL");
 
-    if (stk->size == 0)
-    {
-        return res::EMPTY;
-    }
+    const void *slot = nullptr;
+    UNWRAP (stack_pop_slot (stk, &slot));
 
-    stk->size--;
-    #if STACK_MEMORY_PROTECT
-        unlock_copy (stk);
-        stk->struct_copy->size--;    
-        lock_copy (stk);
-    #endif
+    memcpy (value, slot, stk->obj_size);
 
-    memcpy (value, (char* ) stk->data + stk->size*stk->obj_size, stk->obj_size);
+    return stack_pop_commit (stk);
+}
 
-    #if STACK_KSP_PROTECT
-        unlock_data (stk);
-        memset ((char* ) stk->data + stk->size*stk->obj_size, POISON_BYTE, stk->obj_size);
-        lock_data (stk);
-    #endif
+// ------------------------------------------------------------------------------------
 
-    update_hash (stk);
+err_flags stack_pop_slot (stack_t *stk, const void **slot)
+{
+    PROFILE_OP (stk, PROFILE_POP);
 
-    if (stk->capacity >> 2 >= stk->size)
+    stack_assert (stk);
+    assert (slot != nullptr && "pointer can't be NULL");
+
+    if (stk->size == 0)
     {
-        if (stk->capacity >> 1 > stk->reserved)
-        {
-            UNWRAP (stack_resize (stk, stk->capacity >> 1));
-        }
-        else
-        {
-            UNWRAP (stack_resize (stk, stk->reserved));
-        }
+        return res::EMPTY;
     }
 
-    stack_assert (stk);
+    *slot = (const char *) stk->data + (stk->size - 1)*stk->obj_size;
+
     return res::OK;
 }
 
 // ------------------------------------------------------------------------------------
 
-err_flags stack_push (stack_t *stk, const void *value)
+err_flags stack_pop_slot_poison (stack_t *stk, void **slot)
 {
+    PROFILE_OP (stk, PROFILE_POP);
+
     stack_assert (stk);
-    assert (value != nullptr && "pointer can't be null");
+    assert (slot != nullptr && "pointer can't be NULL");
 
-    if (stk->size == stk->capacity)
+    if (stk->size == 0)
     {
-        if (stk->capacity == 0)
-        {
-            UNWRAP (stack_resize (stk, 1));
-        }
-        else
-        {
-            UNWRAP (stack_resize (stk, stk->capacity<<1));
-        }
+        return res::EMPTY;
     }
 
+    #if STACK_TRACE
+        stk->runtime.pop_fingerprint = trace_top (stk);
+    #endif
+
+    #if STACK_HASH_PROTECT && STACK_HASH_INCREMENTAL
+        // Struct hash is stale until stack_pop_commit_poisoned adds the poisoned slot hash
+        stk->data_hash -= range_hash (stk, stk->size - 1, 1);
+    #endif
+
     unlock_data (stk);
-    memcpy ((char* ) stk->data + stk->size*stk->obj_size, value, stk->obj_size);
+    *slot = (char *) stk->data + (stk->size - 1)*stk->obj_size;
+
+    return res::OK;
+}
+
+// ------------------------------------------------------------------------------------
+
+err_flags stack_pop_commit_poisoned (stack_t *stk)
+{
+    PROFILE_OP (stk, PROFILE_POP);
+
+    assert (stk != nullptr && "pointer can't be NULL");
+    assert (stk->size > 0 && "stack_pop_commit_poisoned without stack_pop_slot_poison");
+
     lock_data (stk);
 
-    stk->size++;
+    stk->size--;
+    unlock_copy (stk); // Size & hashes reach the copy under one unlock
+
     #if STACK_MEMORY_PROTECT
-        unlock_copy (stk);
-        stk->struct_copy->size++;
-        lock_copy (stk);
+        if (stk->write_depth == 0) COPY_FIELD (stk, size)--; // Session copy is synced on commit
     #endif
 
-    update_hash (stk);
+    update_hash_range (stk, stk->size, 1, 0); // Old slot hash is subtracted in stack_pop_slot_poison
+    lock_copy (stk);
+
+    #if STACK_TRACE
+        trace_hook (stk, TRACE_POP, 1, stk->runtime.pop_fingerprint, res::OK);
+    #endif
+    stats_pop (stk, 1);
+
+    UNWRAP (auto_shrink (stk, 1));
 
     stack_assert (stk);
     return res::OK;
@@ -277,119 +570,404 @@ err_flags stack_push (stack_t *stk, const void *value)
 
 // ------------------------------------------------------------------------------------
 
-err_flags stack_dtor (stack_t *stk)
+err_flags stack_pop_commit (stack_t *stk)
 {
-    if (stk == nullptr) { return res::OK; }
+    PROFILE_OP (stk, PROFILE_POP);
 
-    #ifndef NDEBUG
-        err_flags check_res = stack_verify (stk);
-        if (check_res != OK) log(log::WRN, "Destructor called on invalid object with error flags: 0x%x, see stack_perror", check_res);
-    #endif
+    assert (stk != nullptr && "pointer can't be NULL");
+    assert (stk->size > 0 && "stack_pop_commit without stack_pop_slot");
 
-    #if STACK_KSP_PROTECT
-        unlock_data (stk);
-        memset ((char* ) stk->data, POISON_BYTE, stk->obj_size * stk->capacity);
-    #endif
+    uint32_t fingerprint = trace_top (stk);
 
-    #if STACK_DUNGEON_MASTER_PROTECT
-        stk->data = ((dungeon_master_t*) stk->data) - 1;
-    #endif
+    stk->size--;
+    unlock_copy (stk); // Size & hashes reach the copy under one unlock
 
     #if STACK_MEMORY_PROTECT
-        munmap (stk->data,        get_data_size (stk->capacity, stk->obj_size));
-        munmap (stk->struct_copy, sizeof (stack_t));
-    #else
-        free (stk->data);
+        if (stk->write_depth == 0) COPY_FIELD (stk, size)--; // Session copy is synced on commit
     #endif
 
     #if STACK_KSP_PROTECT
-        // Poisoning
-        stk->data     = const_cast<void *>(POISON_PTR); // Write to POISON_PTR is SegFault, but this is main idea of poisoning
-        stk->size     = -1u;
-        stk->capacity =   0;
-        stk->obj_size =   0;
-        stk->reserved = -1u;
+        hash_t old_slot_hash = range_hash (stk, stk->size, 1);
+
+        unlock_data (stk);
+        poison_range (stk, (char* ) stk->data + stk->size*stk->obj_size, stk->obj_size);
+        lock_data (stk);
+
+        update_hash_range (stk, stk->size, 1, old_slot_hash);
+    #else
+        update_struct_hash (stk);
     #endif
 
+    lock_copy (stk);
+
+    trace_hook (stk, TRACE_POP, 1, fingerprint, res::OK);
+    stats_pop  (stk, 1);
+
+    UNWRAP (auto_shrink (stk, 1));
+
+    stack_assert (stk);
     return res::OK;
 }
 
 // ------------------------------------------------------------------------------------
 
-void stack_dump (stack_t *stk, FILE *stream)
+err_flags stack_pop_n (stack_t *stk, void *dst, size_t n)
 {
-    fprintf (stream, R Bold "\n======== STACK DUMP =======\n" Plain D);
+    PROFILE_OP (stk, PROFILE_POP_N);
 
-    if (stk == nullptr)
+    stack_assert (stk);
+    assert ((dst != nullptr || n == 0) && "pointer can't be NULL");
+
+    if (stk->size < n)
     {
-        fprintf (stream, "Stack ptr is nullptr\n");
-        return;
+        return res::EMPTY;
     }
 
-    err_flags check_res = stack_verify (stk);
-
-    if (check_res != OK)
+    if (n == 0)
     {
-        fprintf (stream, "Stack has errors: \n");
-        stack_perror(check_res, stream, "-> ");
+        return res::OK;
     }
 
-    if (check_res & res::POISONED) { return; }
+    uint32_t fingerprint = trace_top (stk);
 
-    #ifndef NDEBUG
-        fprintf (stream, "Stack[%p] with name " Bold "%s" Plain 
-            " allocated at " Bold "%s" Plain " at file " Bold "%s:(%u)\n" Plain,
-            stk, stk->debug_data->var_name, stk->debug_data->func_name, stk->debug_data->file, stk->debug_data->line
-        );
-    #else
-        fprintf (stream, "Stack[%p]\n", stk);
+    stk->size -= n;
+    unlock_copy (stk); // Size & hashes reach the copy under one unlock
+
+    #if STACK_MEMORY_PROTECT
+        if (stk->write_depth == 0) COPY_FIELD (stk, size) -= n; // Session copy is synced on commit
     #endif
 
-    fprintf (stream, "Parameters:\n"
-                     "    size: %lu\n"
-                     "    capacity: %lu\n"
-                     "    object size: %lu\n"
-                     "    reserved size: %lu\n\n",
-                     stk->size, stk->capacity, stk->obj_size, stk->reserved);
-    fprintf (stream, "Enabled security options:\n");
-    fprintf (stream, "[%c] Memory protection\n", STACK_MEMORY_PROTECT         ? '+' : '-');
-    fprintf (stream, "[%c] Canary protection\n", STACK_DUNGEON_MASTER_PROTECT ? '+' : '-');
-    fprintf (stream, "[%c] Hash protection\n",   STACK_HASH_PROTECT           ? '+' : '-');
-    fprintf (stream, "[%c] Poison protection\n", STACK_KSP_PROTECT            ? '+' : '-');
-    fprintf (stream, "\nStack data[%p]\n", stk->data);
+    // LIFO order: dst[0] is the former top
+    const char *src = (const char *) stk->data + (stk->size + n - 1)*stk->obj_size;
+    char *dst_c = (char *) dst;
+    for (size_t i = 0; i < n; ++i)
+    {
+        memcpy (dst_c + i*stk->obj_size, src - i*stk->obj_size, stk->obj_size);
+    }
 
-    #if VERBOSE_DUMP_LEVEL
-        size_t max_index = stk->capacity;
+    #if STACK_KSP_PROTECT
+        hash_t old_range_hash = range_hash (stk, stk->size, n);
+
+        unlock_data (stk);
+        poison_range (stk, (char* ) stk->data + stk->size*stk->obj_size, n*stk->obj_size);
+        lock_data (stk);
+
+        update_hash_range (stk, stk->size, n, old_range_hash);
     #else
-        size_t max_index = stk->size;
+        update_struct_hash (stk);
     #endif
 
-    for (size_t i = 0; i < max_index; ++i)
+    lock_copy (stk);
+
+    trace_hook (stk, TRACE_POP_N, n, fingerprint, res::OK);
+    stats_pop  (stk, n);
+
+    UNWRAP (auto_shrink (stk, n));
+
+    stack_assert (stk);
+    return res::OK;
+}
+
+// ------------------------------------------------------------------------------------
+
+err_flags stack_push (stack_t *stk, const void *value)
+{
+    PROFILE_OP (stk, PROFILE_PUSH);
+
+    assert (value != nullptr && "pointer can't be null");
+
+    void *slot = nullptr;
+    UNWRAP (stack_push_slot (stk, &slot));
+
+    memcpy (slot, value, stk->obj_size);
+
+    return stack_push_commit (stk);
+}
+
+// ------------------------------------------------------------------------------------
+
+err_flags stack_push_slot (stack_t *stk, void **slot)
+{
+    PROFILE_OP (stk, PROFILE_PUSH);
+
+    stack_assert (stk);
+    assert (slot != nullptr && "pointer can't be null");
+
+    UNWRAP (auto_grow (stk, stk->size + 1));
+
+    #if STACK_HASH_PROTECT && STACK_HASH_INCREMENTAL
+        // Struct hash is stale until stack_push_commit adds the new slot hash
+        stk->data_hash -= range_hash (stk, stk->size, 1);
+    #endif
+
+    unlock_data (stk);
+    *slot = (char *) stk->data + stk->size*stk->obj_size;
+
+    return res::OK;
+}
+
+// ------------------------------------------------------------------------------------
+
+err_flags stack_push_commit (stack_t *stk)
+{
+    PROFILE_OP (stk, PROFILE_PUSH);
+
+    assert (stk != nullptr && "pointer can't be null");
+    assert (stk->size < stk->capacity && "stack_push_commit without stack_push_slot");
+
+    lock_data (stk);
+
+    stk->size++;
+    unlock_copy (stk); // Size & hashes reach the copy under one unlock
+
+    #if STACK_MEMORY_PROTECT
+        if (stk->write_depth == 0) COPY_FIELD (stk, size)++; // Session copy is synced on commit
+    #endif
+
+    update_hash_range (stk, stk->size - 1, 1, 0); // Old slot hash is subtracted in stack_push_slot
+    lock_copy (stk);
+
+    trace_hook (stk, TRACE_PUSH, 1, trace_top (stk), res::OK);
+    stats_push (stk, 1);
+
+    stack_assert (stk);
+    return res::OK;
+}
+
+// ------------------------------------------------------------------------------------
+
+err_flags stack_push_n (stack_t *stk, const void *src, size_t n)
+{
+    PROFILE_OP (stk, PROFILE_PUSH_N);
+
+    stack_assert (stk);
+    assert ((src != nullptr || n == 0) && "pointer can't be null");
+
+    if (n == 0)
     {
-        fprintf (stream, "%c data[%03lu]: ", (i<stk->size ? '*' : ' '), i);
+        return res::OK;
+    }
 
-        #ifndef NDEBUG
-            stk->print_func ((char *) stk->data + i*stk->obj_size, stk->obj_size, stream);
-        #else
-            byte_fprintf((char *) stk->data + i*stk->obj_size, stk->obj_size, stream);
-        #endif
+    UNWRAP (auto_grow (stk, stk->size + n));
 
-        #if STACK_KSP_PROTECT
-            bool is_poison = true;
-            for (size_t j = 0; j < stk->obj_size; ++j)
-            {   
-                if (*((unsigned char *) stk->data + i*stk->obj_size +j) != POISON_BYTE) 
-                {
-                    is_poison = false;
-                }
-            }
+    hash_t old_range_hash = range_hash (stk, stk->size, n);
+
+    unlock_data (stk);
+    memcpy ((char* ) stk->data + stk->size*stk->obj_size, src, n*stk->obj_size);
+    lock_data (stk);
 
-            if (is_poison) fprintf (stream, "%s (POISON)" D, (i < stk->size) ? R : Cyan);
-        #endif   
+    stk->size += n;
+    unlock_copy (stk); // Size & hashes reach the copy under one unlock
 
-        fputc ('\n', stream);
+    #if STACK_MEMORY_PROTECT
+        if (stk->write_depth == 0) COPY_FIELD (stk, size) += n; // Session copy is synced on commit
+    #endif
+
+    update_hash_range (stk, stk->size - n, n, old_range_hash);
+    lock_copy (stk);
+
+    trace_hook (stk, TRACE_PUSH_N, n, trace_top (stk), res::OK);
+    stats_push (stk, n);
+
+    stack_assert (stk);
+    return res::OK;
+}
+
+// ------------------------------------------------------------------------------------
+
+err_flags stack_write_begin (stack_t *stk)
+{
+    PROFILE_OP (stk, PROFILE_OTHER);
+
+    stack_assert (stk);
+
+    // Struct copy stays locked: its shadow page is shared with other stacks
+    if (stk->write_depth == 0) set_data_access (stk, true);
+
+    stk->write_depth++;
+    sync_struct_copy (stk);
+
+    stack_assert (stk);
+    return res::OK;
+}
+
+// ------------------------------------------------------------------------------------
+
+err_flags stack_write_commit (stack_t *stk)
+{
+    PROFILE_OP (stk, PROFILE_OTHER);
+
+    stack_assert (stk);
+    assert (stk->write_depth > 0 && "commit without stack_write_begin");
+
+    stk->write_depth--;
+    sync_struct_copy (stk);
+
+    if (stk->write_depth > 0)
+    {
+        return res::OK;
+    }
+
+    update_hash (stk);
+    lock_data (stk);
+
+    if (stk->verify.level != VERIFY_OFF)
+    {
+        err_flags check_res = stack_verify (stk);
+        if (check_res != res::OK)
+        {
+            log (log::ERR, "Failed stack check on write commit with err flags: ");
+            stack_perror (check_res, get_log_stream(), "->");
+            stack_dump (stk, get_log_stream());
+            return check_res;
+        }
+    }
+
+    return res::OK;
+}
+
+// ------------------------------------------------------------------------------------
+
+err_flags stack_dtor (stack_t *stk)
+{
+    if (stk == nullptr) { return res::OK; }
+
+    PROFILE_OP (stk, PROFILE_DTOR);
+
+    #ifndef NDEBUG
+        err_flags check_res = stack_verify (stk);
+        if (check_res != OK) log(log::WRN, "Destructor called on invalid object with error flags: 0x%x, see stack_perror", check_res);
+    #endif
+
+    trace_hook (stk, TRACE_DTOR, 0, 0, res::OK);
+    registry_remove (stk);
+
+    err_flags sync_res = file_sync (stk); // Destruction is a durability point of file data
+
+    unlock_data (stk); // Data is poisoned or returned to pool
+
+    #if STACK_KSP_PROTECT
+        // Pool poisons returned blocks itself, file data outlives stack
+        if (!(stk->backing & (BACKING_POOL | BACKING_FILE))) poison_range (stk, stk->data, stk->obj_size * stk->capacity);
+    #endif
+
+    #if STACK_DUNGEON_MASTER_PROTECT
+        stk->data = ((dungeon_master_t*) stk->data) - 1;
+    #endif
+
+    data_free (stk, stk->data);
+
+    #if STACK_MEMORY_PROTECT
+        shadow_free (stk->struct_copy, stk->copy_page);
+    #endif
+
+    #if STACK_KSP_PROTECT
+        // Poisoning
+        stk->data     = const_cast<void *>(POISON_PTR); // Write to POISON_PTR is SegFault, but this is main idea of poisoning
+        stk->size     = -1u;
+        stk->capacity =   0;
+        stk->obj_size =   0;
+        stk->reserved = -1u;
+    #endif
+
+    return sync_res;
+}
+
+// ------------------------------------------------------------------------------------
+
+err_flags stack_sync (stack_t *stk)
+{
+    PROFILE_OP (stk, PROFILE_OTHER);
+
+    stack_assert (stk);
+
+    return file_sync (stk);
+}
+
+// ------------------------------------------------------------------------------------
+
+void stack_dump (stack_t *stk, FILE *stream)
+{
+    fprintf (stream, R Bold "\n======== STACK DUMP =======\n" Plain D);
+
+    if (stk == nullptr)
+    {
+        fprintf (stream, "Stack ptr is nullptr\n");
+        return;
+    }
+
+    err_flags check_res = stack_verify (stk);
+
+    if (check_res != OK)
+    {
+        fprintf (stream, "Stack has errors: \n");
+        stack_perror(check_res, stream, "-> ");
     }
 
+    if (check_res & res::POISONED) { return; }
+
+    #ifndef NDEBUG
+        fprintf (stream, "Stack[%p] with name " Bold "%s" Plain 
+            " allocated at " Bold "%s" Plain " at file " Bold "%s:(%u)\n" Plain,
+            stk, stk->debug_data->var_name, stk->debug_data->func_name, stk->debug_data->file, stk->debug_data->line
+        );
+    #else
+        fprintf (stream, "Stack[%p]\n", stk);
+    #endif
+
+    fprintf (stream, "Parameters:\n"
+                     "    size: %lu\n"
+                     "    capacity: %lu\n"
+                     "    object size: %lu\n"
+                     "    reserved size: %lu\n"
+                     "    max capacity: %lu\n"
+                     "    growth: x%u/%u, shrink at 1/%u load after %u pops & %lu elements since growth\n\n",
+                     stk->size, stk->capacity, stk->obj_size, stk->reserved, stk->max_capacity,
+                     stk->growth.grow_num, stk->growth.grow_den, stk->growth.shrink_ratio,
+                     stk->growth.shrink_delay, stk->growth.shrink_interval);
+    fprintf (stream, "Data backing: %s%s%s%s%s\n",
+                     (stk->backing & BACKING_FILE)      ? "file" :
+                     (stk->backing & BACKING_POOL)      ? "pool" :
+                     (stk->backing & BACKING_MMAP)      ? "mmap" : "heap",
+                     (stk->backing & BACKING_RESERVED)  ? ", reserved address range" : "",
+                     (stk->backing & BACKING_HUGETLB)   ? ", hugetlb pages" : "",
+                     (stk->backing & BACKING_THP)       ? ", transparent huge pages" : "",
+                     (stk->backing & BACKING_POPULATED) ? ", pre-faulted" : "");
+    #if STACK_STATS
+        stack_memory_t mem = stack_memory (stk);
+        fprintf (stream, "Memory: %zu of %zu committed bytes used\n"
+                         "Counters: %zu pushes, %zu pops, peak size %zu, %zu resizes (%zu bytes copied), %zu/%zu checks failed\n",
+                         mem.used, mem.committed, stk->runtime.stats.pushes, stk->runtime.stats.pops,
+                         stk->runtime.stats.peak_size, stk->runtime.stats.resizes, stk->runtime.stats.bytes_copied,
+                         stk->runtime.stats.verify_failures, stk->runtime.stats.verify_calls);
+    #endif
+    #if STACK_TRACE
+        if (stk->trace != nullptr)
+        {
+            fprintf (stream, "Flight recorder[%p]: %zu records\n", stk->trace, stack_trace_count (stk->trace));
+        }
+    #endif
+    #if STACK_PROFILE
+        if (stk->runtime.profile.calls != 0)
+        {
+            fprintf (stream, "Protection costs: ");
+            stack_profile_print (&stk->runtime.profile, stream);
+        }
+    #endif
+    #if STACK_HASH_PROTECT
+        hash_f hash_func = stk->hash_func;
+    #else
+        hash_f hash_func = nullptr;
+    #endif
+    stack_dump_protection (stream, STACK_MEMORY_PROTECT, STACK_DUNGEON_MASTER_PROTECT, hash_func, STACK_KSP_PROTECT);
+
+    #ifndef NDEBUG
+        elem_print_f print_func = stk->print_func;
+    #else
+        elem_print_f print_func = byte_fprintf;
+    #endif
+    stack_dump_data (stream, stk->data, stk->size, stk->capacity, stk->obj_size, print_func, STACK_KSP_PROTECT);
+
     fprintf (stream, R Bold "======== END STACK DUMP =======\n\n" Plain D);
 }
 
@@ -416,15 +994,35 @@ void stack_perror (err_flags errors, FILE *stream, const char *prefix)
     _if_log (INVALID_OBJ_SIZE, "Invalid object size = 0");
     _if_log (INVALID_FUNC    , "Nullptr function pointer");
     _if_log (DATA_NULL       , "Data pointer is nullptr");
+    _if_log (IO_ERROR        , "File operation failed");
 
     assert ((errors & ~(NULLPTR | INVALID_SIZE | POISONED | NOMEM | EMPTY | BAD_CAPACITY | DATA_CORRUPTED
-                    | STRUCT_CORRUPTED | INVALID_OBJ_SIZE | INVALID_FUNC | DATA_NULL)) == 0 && "Unexpected error");
+                    | STRUCT_CORRUPTED | INVALID_OBJ_SIZE | INVALID_FUNC | DATA_NULL | IO_ERROR)) == 0 && "Unexpected error");
 }
 
 #undef _if_log
 
 // ------------------------------------------------------------------------------------
 
+static void bounds_check (const stack_t *stk, err_flags *errs)
+{
+    assert (stk  != nullptr && "pointer can't be null");
+    assert (errs != nullptr && "pointer can't be null");
+
+    if (stk->size > stk->capacity)      *errs |= res::INVALID_SIZE;
+    if (stk->capacity < stk->reserved)  *errs |= res::BAD_CAPACITY;
+    if (stk->max_capacity != 0 &&
+        stk->capacity > stk->max_capacity) *errs |= res::BAD_CAPACITY;
+    if (stk->obj_size == 0)             *errs |= res::INVALID_OBJ_SIZE;
+    if (stk->data == nullptr)           *errs |= res::DATA_NULL;
+
+    #ifndef NDEBUG 
+        if (stk->print_func == nullptr) *errs |= res::INVALID_FUNC;
+    #endif
+}
+
+// ------------------------------------------------------------------------------------
+
 static void data_poison_check (const stack_t *stk, err_flags *errs)
 {
     assert (stk  != nullptr && "In this function stk can't be null");
@@ -436,41 +1034,26 @@ static void data_poison_check (const stack_t *stk, err_flags *errs)
         return;
     } 
 
+    PROFILE_LAYER (stk, PROFILE_POISON, (stk->data != POISON_PTR) ? stk->capacity*stk->obj_size : 0);
+
     if (stk->data == POISON_PTR)
     {
         *errs |= POISONED;
         return;
     }
 
-    for (size_t n = stk->size; n < stk->capacity; ++n)
+    const char *unused = (const char *) stk->data + stk->size*stk->obj_size;
+
+    if (!poison_is_range (unused, (stk->capacity - stk->size)*stk->obj_size))
     {
-        for (size_t i = 0; i < stk->obj_size; ++i)
-        {
-            if (((unsigned char *)stk->data)[stk->obj_size*n+i] != POISON_BYTE)
-            {
-                *errs |= res::DATA_CORRUPTED;
-                return;
-            }
-        }
+        *errs |= res::DATA_CORRUPTED;
+        return;
     }
 
-    for (size_t n = 0; n < stk->size; ++n)
+    if (poison_has_elem (stk->data, stk->size, stk->obj_size))
     {
-        bool elem_poisoned = true;
-
-        for (size_t i = 0; i < stk->obj_size; ++i)
-        {
-            if (((unsigned char *)stk->data)[stk->obj_size*n+i] != POISON_BYTE)
-            {
-                elem_poisoned = false;
-            }
-        }
-
-        if (elem_poisoned)
-        {
-            *errs |= POISONED;
-            return;
-        }
+        *errs |= POISONED;
+        return;
     }
 
     #endif
@@ -484,22 +1067,16 @@ static void dungeon_master_check (const stack_t *stk, err_flags *errs)
     assert (errs != nullptr && "pointer can't be null");
 
     #if STACK_DUNGEON_MASTER_PROTECT
+    PROFILE_LAYER (stk, PROFILE_CANARY, 4*sizeof (dungeon_master_t));
+
     if (stk->two_blocks_up != dungeon_master_val || stk->two_blocks_down != dungeon_master_val)
     {
         *errs |= STRUCT_CORRUPTED;
     }
 
-    if (!(*errs & DATA_NOT_OKAY))
+    if (!(*errs & DATA_NOT_OKAY) && !stack_canaries_ok (stk->data, stk->capacity * stk->obj_size))
     {
-        if (((dungeon_master_t *)stk->data)[-1] != dungeon_master_val)
-        {
-            *errs |= DATA_CORRUPTED;
-        }
-
-        if (* (dungeon_master_t *) ((char *)stk->data + stk->capacity * stk->obj_size) != dungeon_master_val)
-        {
-            *errs |= DATA_CORRUPTED;
-        }
+        *errs |= DATA_CORRUPTED;
     }
     #endif
 }
@@ -516,18 +1093,19 @@ static void hash_check (stack_t *stk_mutable, err_flags *errs)
 
     if (stk->hash_func == nullptr) { *errs |= INVALID_FUNC; }
     else {
+        PROFILE_LAYER (stk, PROFILE_HASH, PROTECTED_STRUCT_SIZE);
+
         const hash_t struct_hash = stk->struct_hash;
         
         stk_mutable->struct_hash = 0;
 
-        if (stk->hash_func (stk, sizeof (stk)) != struct_hash)
+        if (hash_fixed<PROTECTED_STRUCT_SIZE> (stk) != struct_hash)
         {
             *errs |= STRUCT_CORRUPTED;
         }
         stk_mutable->struct_hash = struct_hash;
 
-        size_t data_size = stk->capacity * stk->obj_size;
-        if ((!(*errs & DATA_NOT_OKAY)) & (stk->hash_func (stk->data, data_size) != stk->data_hash))
+        if ((!(*errs & DATA_NOT_OKAY)) && (data_hash_calc (stk) != stk->data_hash))
         {
             *errs |= DATA_CORRUPTED;
         }
@@ -545,7 +1123,9 @@ static void memory_check (const stack_t *stk, err_flags *errs)
     #if STACK_MEMORY_PROTECT
         if (!(*errs & STRUCT_CORRUPTED))
         {
-            if (memcmp (stk, stk->struct_copy, sizeof (stack_t)) != 0)
+            PROFILE_LAYER (stk, PROFILE_MEMORY, PROTECTED_STRUCT_SIZE);
+
+            if (memcmp (stk, stk->struct_copy, PROTECTED_STRUCT_SIZE) != 0)
             {
                 *errs |= STRUCT_CORRUPTED;
             }
@@ -555,13 +1135,109 @@ static void memory_check (const stack_t *stk, err_flags *errs)
 
 // ------------------------------------------------------------------------------------
 
-void byte_fprintf (const void *elem, size_t elem_size, FILE *stream)
+stack_memory_t stack_memory (const stack_t *stk)
 {
-    assert (elem   != nullptr && "pointer can't be null");
+    assert (stk != nullptr && "pointer can't be null");
+
+    stack_memory_t mem = {};
+    mem.used = stk->size*stk->obj_size;
+
+    size_t data_size = get_data_size (stk->capacity, stk->obj_size);
+    if (stk->backing & BACKING_POOL) data_size = stack_pool_block_size (data_size);
+
+    mem.committed = commit_round (stk, data_size);
+    if (stk->backing & BACKING_FILE) mem.committed += file_header_size ();
+
+    #if STACK_MEMORY_PROTECT
+        mem.committed += stk->copy_page->slot_size;
+    #endif
+
+    return mem;
+}
+
+// ------------------------------------------------------------------------------------
+
+stack_registry_stats_t stack_registry_stats ()
+{
+    stack_registry_stats_t totals = {};
+
+    #if STACK_STATS
+        pthread_mutex_lock (&registry_lock);
+
+        for (const stack_t *cur = registry_head; cur != nullptr; cur = cur->runtime.registry_next)
+        {
+            stack_memory_t mem = stack_memory (cur);
+            const stack_stats_t *stats = &cur->runtime.stats;
+
+            totals.stacks++;
+            totals.used_bytes      += mem.used;
+            totals.committed_bytes += mem.committed;
+
+            totals.ops.pushes          += stats->pushes;
+            totals.ops.pops            += stats->pops;
+            totals.ops.resizes         += stats->resizes;
+            totals.ops.bytes_copied    += stats->bytes_copied;
+            totals.ops.verify_calls    += stats->verify_calls;
+            totals.ops.verify_failures += stats->verify_failures;
+            if (stats->peak_size > totals.ops.peak_size) totals.ops.peak_size = stats->peak_size;
+        }
+
+        pthread_mutex_unlock (&registry_lock);
+
+        if (totals.committed_bytes != 0)
+        {
+            totals.wasted = 1.0 - (double) totals.used_bytes / (double) totals.committed_bytes;
+        }
+    #endif
+
+    return totals;
+}
+
+// ------------------------------------------------------------------------------------
+
+void stack_registry_dump (FILE *stream)
+{
+    assert (stream != nullptr && "pointer can't be null");
+
+    #if STACK_STATS
+        fprintf (stream, "Live stacks:\n");
+
+        pthread_mutex_lock (&registry_lock);
+
+        for (const stack_t *cur = registry_head; cur != nullptr; cur = cur->runtime.registry_next)
+        {
+            stack_memory_t mem = stack_memory (cur);
+            const stack_stats_t *stats = &cur->runtime.stats;
+
+            const char *name = "";
+            #ifndef NDEBUG
+                if (cur->debug_data != nullptr) name = cur->debug_data->var_name;
+            #endif
+
+            fprintf (stream, "    [%p] %-12s size %zu/%zu, %zu/%zu bytes used, "
+                             "%zu pushes, %zu pops, %zu resizes (%zu bytes copied), %zu/%zu checks failed\n",
+                             (const void *) cur, name, cur->size, cur->capacity, mem.used, mem.committed,
+                             stats->pushes, stats->pops, stats->resizes, stats->bytes_copied,
+                             stats->verify_failures, stats->verify_calls);
+        }
+
+        pthread_mutex_unlock (&registry_lock);
+    #endif
+
+    stack_registry_stats_t totals = stack_registry_stats ();
+    fprintf (stream, "Total: %zu stacks, %zu of %zu committed bytes used (%.1lf%% wasted)\n",
+                     totals.stacks, totals.used_bytes, totals.committed_bytes, totals.wasted * 100.0);
+}
+
+// ------------------------------------------------------------------------------------
+
+void byte_fprintf (const void *elem, size_t elem_size, FILE *stream)
+{
+    assert (elem   != nullptr && "pointer can't be null");
     assert (stream != nullptr && "pointer can't be null");
 
     #if STACK_KSP_PROTECT
-        bool is_poison = true;
+        bool is_poison = poison_is_range (elem, elem_size);
     #else
         bool is_poison = false;
     #endif
@@ -570,13 +1246,6 @@ void byte_fprintf (const void *elem, size_t elem_size, FILE *stream)
 
     for (size_t j = 0; j < elem_size; ++j)
     {   
-        #if STACK_KSP_PROTECT
-            if (elem_c[j] != POISON_BYTE) 
-            {
-                is_poison = false;
-            }
-        #endif
-
         fprintf (stream, "|0x%08x|", elem_c[j]);
     }
 
@@ -588,13 +1257,151 @@ void byte_fprintf (const void *elem, size_t elem_size, FILE *stream)
 
 // ------------------------------------------------------------------------------------
 
+void stack_dump_protection (FILE *stream, bool memory, bool canary, hash_f hash_func, bool ksp)
+{
+    assert (stream != nullptr && "pointer can't be null");
+
+    fprintf (stream, "\nEnabled security options:\n");
+    fprintf (stream, "[%c] Memory protection\n", memory ? '+' : '-');
+    fprintf (stream, "[%c] Canary protection\n", canary ? '+' : '-');
+    fprintf (stream, "[%c] Hash protection\n",   (hash_func != nullptr) ? '+' : '-');
+    if (hash_func != nullptr)
+    {
+        const char *hash_func_name = hash_name (hash_func);
+        fprintf (stream, "    hash function: %s\n", (hash_func_name != nullptr) ? hash_func_name : "custom");
+    }
+    fprintf (stream, "[%c] Poison protection\n", ksp    ? '+' : '-');
+}
+
+// ------------------------------------------------------------------------------------
+
+void stack_dump_data (FILE *stream, const void *data, size_t size, size_t capacity, size_t obj_size,
+                      elem_print_f print_func, bool ksp)
+{
+    assert (stream     != nullptr && "pointer can't be null");
+    assert (print_func != nullptr && "pointer can't be null");
+
+    fprintf (stream, "\nStack data[%p]\n", data);
+
+    if (data == nullptr || size > capacity) return;
+
+    #if VERBOSE_DUMP_LEVEL
+        size_t max_index = capacity;
+    #else
+        size_t max_index = size;
+    #endif
+
+    for (size_t i = 0; i < max_index; ++i)
+    {
+        const char *elem = (const char *) data + i*obj_size;
+
+        fprintf (stream, "%c data[%03lu]: ", (i<size ? '*' : ' '), i);
+        print_func (elem, obj_size, stream);
+
+        if (ksp && poison_is_range (elem, obj_size))
+        {
+            fprintf (stream, "%s (POISON)" D, (i < size) ? R : Cyan);
+        }
+
+        fputc ('\n', stream);
+    }
+}
+
+// ------------------------------------------------------------------------------------
+
+void stack_canaries_set (void *data, size_t data_bytes)
+{
+    assert (data != nullptr && "pointer can't be null");
+
+    // Trailing canary may be unaligned (data_bytes % 8 != 0)
+    memcpy ((char *) data - sizeof (dungeon_master_t), &dungeon_master_val, sizeof (dungeon_master_t));
+    memcpy ((char *) data + data_bytes,                &dungeon_master_val, sizeof (dungeon_master_t));
+}
+
+// ------------------------------------------------------------------------------------
+
+bool stack_canaries_ok (const void *data, size_t data_bytes)
+{
+    assert (data != nullptr && "pointer can't be null");
+
+    dungeon_master_t front = 0, back = 0;
+    memcpy (&front, (const char *) data - sizeof (dungeon_master_t), sizeof (dungeon_master_t));
+    memcpy (&back,  (const char *) data + data_bytes,                sizeof (dungeon_master_t));
+
+    return front == dungeon_master_val && back == dungeon_master_val;
+}
+
+// ------------------------------------------------------------------------------------
+
+size_t stack_page_size ()
+{
+    #if STACK_HAS_MMAP
+        static const size_t pagesize = (size_t) sysconf (_SC_PAGESIZE);
+        return pagesize;
+    #else
+        return 1;
+    #endif
+}
+
+// ------------------------------------------------------------------------------------
+
+void *stack_pages_alloc (size_t bytes)
+{
+    #if STACK_HAS_MMAP
+        void *mem = mmap (nullptr, bytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        return (mem == MAP_FAILED) ? nullptr : mem;
+    #else
+        return calloc (bytes, 1);
+    #endif
+}
+
+// ------------------------------------------------------------------------------------
+
+void *stack_pages_realloc (void *mem, size_t old_bytes, size_t new_bytes)
+{
+    assert (mem != nullptr && "pointer can't be null"); // Due to mremap limitations
+
+    #if STACK_HAS_MMAP
+        void *new_mem = mremap (mem, old_bytes, new_bytes, MREMAP_MAYMOVE);
+        return (new_mem == MAP_FAILED) ? nullptr : new_mem;
+    #else
+        (void) old_bytes;
+        return realloc (mem, new_bytes);
+    #endif
+}
+
+// ------------------------------------------------------------------------------------
+
+void stack_pages_free (void *mem, size_t bytes)
+{
+    #if STACK_HAS_MMAP
+        munmap (mem, bytes);
+    #else
+        (void) bytes;
+        free (mem);
+    #endif
+}
+
+// ------------------------------------------------------------------------------------
+
+void stack_pages_protect (void *mem, size_t bytes, bool writable)
+{
+    #if STACK_HAS_MMAP
+        mprotect (mem, bytes, writable ? PROT_READ|PROT_WRITE : PROT_READ);
+    #else
+        (void) mem;
+        (void) bytes;
+        (void) writable;
+    #endif
+}
+
+// ------------------------------------------------------------------------------------
+
 static inline void unlock_copy (stack_t *stk)
 {
     assert (stk != nullptr && "pointer can't be null");
 
-    #if STACK_MEMORY_PROTECT
-        mprotect (stk->struct_copy, sizeof (stack_t), PROT_READ | PROT_WRITE);
-    #endif
+    if (stk->write_depth == 0) set_copy_access (stk, true);
 }
 
 // ------------------------------------------------------------------------------------
@@ -603,9 +1410,7 @@ static inline void lock_copy (stack_t *stk)
 {
     assert (stk != nullptr && "pointer can't be null");
 
-    #if STACK_MEMORY_PROTECT
-        mprotect (stk->struct_copy, sizeof (stack_t), PROT_READ);
-    #endif
+    if (stk->write_depth == 0) set_copy_access (stk, false);
 }
 
 // ------------------------------------------------------------------------------------
@@ -614,21 +1419,38 @@ static inline void unlock_data (stack_t *stk)
 {
     assert (stk != nullptr && "pointer can't be null");
 
+    if (stk->write_depth == 0) set_data_access (stk, true);
+}
+
+// ------------------------------------------------------------------------------------
+
+static inline void lock_data (stack_t *stk)
+{
+    assert (stk != nullptr && "pointer can't be null");
+
+    if (stk->write_depth == 0) set_data_access (stk, false);
+}
+
+// ------------------------------------------------------------------------------------
+
+static inline void set_copy_access (stack_t *stk, bool writable)
+{
+    assert (stk != nullptr && "pointer can't be null");
+
     #if STACK_MEMORY_PROTECT
-        size_t data_size = stk->capacity*stk->obj_size;
-        char * data = (char *) stk->data;
-        #if STACK_DUNGEON_MASTER_PROTECT
-            data_size += 2*sizeof (dungeon_master_t);
-            data      -=   sizeof (dungeon_master_t);
-        #endif
+        PROFILE_LAYER (stk, PROFILE_MEMORY, sizeof (stack_t));
 
-        mprotect (data, data_size, PROT_READ | PROT_WRITE);
+        // Shadow page is shared: unlocks nest, the last lock makes it read-only again
+        if (writable) shadow_unlock (stk->copy_page);
+        else          shadow_lock   (stk->copy_page);
+    #else
+        (void) writable;
     #endif
 }
 
 // ------------------------------------------------------------------------------------
 
-static inline void lock_data (stack_t *stk)
+static inline void set_data_access (stack_t *stk, bool writable)
 {
     assert (stk != nullptr && "pointer can't be null");
 
@@ -640,7 +1462,12 @@ static inline void lock_data (stack_t *stk)
             data      -=   sizeof (dungeon_master_t);
         #endif
 
-        mprotect (data, data_size, PROT_READ);
+        PROFILE_LAYER (stk, PROFILE_MEMORY, commit_round (stk, data_size));
+
+        // Huge page mappings can be protected only by whole huge pages
+        stack_pages_protect (data, commit_round (stk, data_size), writable);
+    #else
+        (void) writable;
     #endif
 }
 
@@ -648,108 +1475,1265 @@ static inline void lock_data (stack_t *stk)
 
 static inline void update_hash (stack_t *stk)
 {
-    assert ((stack_verify (stk) & ~(DATA_CORRUPTED | STRUCT_CORRUPTED)) == OK);
+    if (stk->write_depth > 0) return; // Rehashed on commit
+
+    #if STACK_HASH_PROTECT
+        stk->data_hash = data_hash_calc (stk);
+    #endif
+
+    update_struct_hash (stk);
+}
+
+// ------------------------------------------------------------------------------------
+
+static inline void update_hash_range (stack_t *stk, size_t first, size_t count, hash_t old_range_hash)
+{
+    assert (stk != nullptr && "pointer can't be null");
+    assert (first + count <= stk->capacity && "invalid slot range");
+
+    if (stk->write_depth > 0) return; // Rehashed on commit
+
+    #if STACK_HASH_PROTECT
+        #if STACK_HASH_INCREMENTAL
+            stk->data_hash += range_hash (stk, first, count) - old_range_hash;
+        #else
+            (void) old_range_hash;
+            stk->data_hash = data_hash_calc (stk);
+        #endif
+    #else
+        (void) first;
+        (void) old_range_hash;
+    #endif
+
+    update_struct_hash (stk);
+}
+
+// ------------------------------------------------------------------------------------
+
+static inline void update_struct_hash (stack_t *stk)
+{
+    if (stk->write_depth > 0) return; // Rehashed on commit
+
+    assert ((level_verify (stk) & ~(DATA_CORRUPTED | STRUCT_CORRUPTED)) == OK);
 
     #if STACK_HASH_PROTECT
+    {
+        PROFILE_LAYER (stk, PROFILE_HASH, PROTECTED_STRUCT_SIZE);
+
         stk->struct_hash = 0;
-        stk->data_hash   = stk->hash_func (stk->data, stk->capacity * stk->obj_size);
-        stk->struct_hash = stk->hash_func (stk, sizeof (stk));
+        stk->struct_hash = hash_fixed<PROTECTED_STRUCT_SIZE> (stk);
+    }
 
         #if STACK_MEMORY_PROTECT
             unlock_copy (stk);
-            stk->struct_copy->data_hash   = stk->data_hash;
-            stk->struct_copy->struct_hash = stk->struct_hash;
+            COPY_FIELD (stk, data_hash)   = stk->data_hash;
+            COPY_FIELD (stk, struct_hash) = stk->struct_hash;
             lock_copy (stk);
         #endif
     #endif
 
-    assert (stack_verify (stk) == OK);
+    file_header_update (stk);
+
+    assert (level_verify (stk) == OK);
 }
 
 // ------------------------------------------------------------------------------------
 
-static size_t get_data_size (size_t capacity, size_t obj_size)
+static inline void sync_struct_copy (stack_t *stk)
 {
-    size_t data_size = capacity*obj_size;
-    #if STACK_DUNGEON_MASTER_PROTECT
-        data_size += 2*sizeof (dungeon_master_t);
-    #endif
+    assert (stk != nullptr && "pointer can't be null");
 
-    return data_size;
+    #if STACK_MEMORY_PROTECT
+        PROFILE_LAYER (stk, PROFILE_MEMORY, PROTECTED_STRUCT_SIZE);
+
+        // Unlocked in write session too: the copy stays read-only between syncs
+        set_copy_access (stk, true);
+        memcpy (stk->struct_copy, stk, PROTECTED_STRUCT_SIZE);
+        set_copy_access (stk, false);
+    #endif
 }
 
 // ------------------------------------------------------------------------------------
 
-static void *cust_realloc (void *prev_ptr, size_t prev_size, size_t new_size)
+/// Shrink capacity by growth policy (at most one resize) after popped elements were popped
+static err_flags auto_shrink (stack_t *stk, size_t popped)
 {
-    assert (prev_ptr != nullptr && "pointer can't be null"); // Due to mremap limitations
+    assert (stk != nullptr && "pointer can't be null");
 
-    #if STACK_MEMORY_PROTECT
-        void *new_ptr = mremap (prev_ptr, prev_size, new_size, MREMAP_MAYMOVE);
-        if (new_ptr == MAP_FAILED) return nullptr;
-    #else
-        void *new_ptr = realloc (prev_ptr, new_size); // Не заполняет нулями
-    #endif
+    size_t new_capacity = stack_growth_shrink (&stk->growth, &stk->runtime.growth_state,
+                                               stk->size, stk->capacity, stk->reserved, popped);
+    if (new_capacity == stk->capacity)
+    {
+        return res::OK;
+    }
 
-    return new_ptr;
+    return stack_resize (stk, new_capacity);
 }
 
 // ------------------------------------------------------------------------------------
 
-static void init_dungeon_master_protection (stack_t *stk)
+/// Grow capacity by growth policy until it fits min_capacity (one resize), count pushed elements
+static err_flags auto_grow (stack_t *stk, size_t min_capacity)
 {
-    assert (stk       != nullptr);
-    assert (stk->data != nullptr);
+    assert (stk != nullptr && "pointer can't be null");
 
-    #if STACK_DUNGEON_MASTER_PROTECT
-        stk->two_blocks_up   = dungeon_master_val;
-        stk->two_blocks_down = dungeon_master_val;
+    size_t new_capacity = 0;
+    UNWRAP (stack_growth_grow (&stk->growth, &stk->runtime.growth_state, stk->size, stk->capacity,
+                               stk->max_capacity, min_capacity, &new_capacity));
+    if (new_capacity == stk->capacity)
+    {
+        return res::OK;
+    }
 
-        *(dungeon_master_t*)stk->data = dungeon_master_val;
-        stk->data = (dungeon_master_t*)stk->data + 1;
-        * (dungeon_master_t *) ((char *)stk->data + stk->capacity * stk->obj_size) = dungeon_master_val;
-    #endif
+    return stack_resize (stk, new_capacity);
 }
 
 // ------------------------------------------------------------------------------------
 
-static err_flags stack_data_init (stack_t *stk, size_t reserved, size_t obj_size)
+size_t stack_growth_shrink (const stack_growth_t *growth, stack_growth_state_t *state,
+                            size_t size, size_t capacity, size_t reserved, size_t popped)
 {
-    assert (stk != nullptr && "pointer can't be null");
-    assert (obj_size > 0   && "invalid obj size");
+    assert (growth != nullptr && "pointer can't be null");
+    assert (state  != nullptr && "pointer can't be null");
 
-    stk->obj_size = obj_size;
+    state->ops_since_grow += popped;
 
-    #if STACK_MEMORY_PROTECT
-        ssize_t pagesize = sysconf (_SC_PAGESIZE);
-        // As the sysconf man says the only error is EINVAL (invalid name) and I'm sure _SC_PAGESIZE is the correct value.
-        assert (pagesize != -1);
-        size_t objects_in_mempage = ((size_t) pagesize) / obj_size;
-        reserved = (reserved > objects_in_mempage) ? reserved : objects_in_mempage;
-    #endif
+    if (growth->shrink_ratio == 0)
+    {
+        return capacity;
+    }
 
-    size_t data_size = get_data_size (reserved, obj_size);
+    size_t new_capacity = capacity;
 
-    #if STACK_MEMORY_PROTECT
-        void *mem_ptr        =             mmap (nullptr, data_size,        PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
-        stack_t *struct_copy = (stack_t *) mmap (nullptr, sizeof (stack_t), PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    while (new_capacity / growth->shrink_ratio >= size && new_capacity > reserved)
+    {
+        size_t shrunk = new_capacity * growth->grow_den / growth->grow_num;
+        new_capacity  = (shrunk > reserved) ? shrunk : reserved;
+    }
 
-        if (struct_copy == MAP_FAILED) { return res::NOMEM; }
-        if (mem_ptr == MAP_FAILED) { return res::NOMEM; }
-    #else
-        void *mem_ptr = calloc (data_size, 1); // Works even with capacity = 0
-        if (mem_ptr == nullptr) { return res::NOMEM; }
-    #endif
+    if (new_capacity == capacity)
+    {
+        state->shrink_pending = 0;
+        return capacity;
+    }
 
-    // Set data pointer
-    stk->data = mem_ptr;
-    stk->capacity = reserved;
-    stk->reserved = reserved;
-    stk->size     = 0;
+    state->shrink_pending += popped;
 
-    #if STACK_MEMORY_PROTECT
-    stk->struct_copy = struct_copy;
-    #endif
-    
-    return res::OK;
-}
\ No newline at end of file
+    if (state->shrink_pending <= growth->shrink_delay ||
+        state->ops_since_grow <  growth->shrink_interval)
+    {
+        return capacity;
+    }
+
+    state->shrink_pending = 0;
+
+    return new_capacity;
+}
+
+// ------------------------------------------------------------------------------------
+
+err_flags stack_growth_grow (const stack_growth_t *growth, stack_growth_state_t *state, size_t size, size_t capacity,
+                             size_t max_capacity, size_t min_capacity, size_t *new_capacity)
+{
+    assert (growth       != nullptr && "pointer can't be null");
+    assert (state        != nullptr && "pointer can't be null");
+    assert (new_capacity != nullptr && "pointer can't be null");
+    assert (min_capacity > size && "nothing to push");
+
+    *new_capacity = capacity;
+
+    if (max_capacity != 0 && min_capacity > max_capacity)
+    {
+        return res::NOMEM;
+    }
+
+    state->ops_since_grow += min_capacity - size;
+    state->shrink_pending  = 0;
+
+    if (min_capacity <= capacity)
+    {
+        return res::OK;
+    }
+
+    while (*new_capacity < min_capacity)
+    {
+        size_t grown  = *new_capacity * growth->grow_num / growth->grow_den;
+        *new_capacity = (grown > *new_capacity) ? grown : *new_capacity + 1;
+    }
+
+    if (max_capacity != 0 && *new_capacity > max_capacity)
+    {
+        *new_capacity = max_capacity;
+    }
+
+    state->ops_since_grow = 0;
+
+    return res::OK;
+}
+
+// ------------------------------------------------------------------------------------
+
+bool stack_growth_is_valid (const stack_growth_t *growth)
+{
+    assert (growth != nullptr && "pointer can't be null");
+
+    return growth->grow_den > 0 && growth->grow_num > growth->grow_den;
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Verification by level without sampling: VERIFY_SAMPLED (and any level inside write session) is treated as VERIFY_CHEAP
+static err_flags level_verify (stack_t *stk)
+{
+    assert (stk != nullptr && "pointer can't be null");
+
+    if (stk->write_depth > 0 && stk->verify.level != VERIFY_OFF)
+    {
+        return stack_verify_fast (stk); // Hashes are stale until commit
+    }
+
+    switch (stk->verify.level)
+    {
+        case VERIFY_OFF:        return res::OK;
+        case VERIFY_CHEAP:      return stack_verify_fast (stk);
+        case VERIFY_SAMPLED:    return stack_verify_fast (stk);
+        case VERIFY_FULL:       return stack_verify (stk);
+        default:                return res::STRUCT_CORRUPTED;
+    }
+}
+
+// ------------------------------------------------------------------------------------
+
+/// VERIFY_SAMPLED check: cheap one, full one every period_ops checks or period_us microseconds
+static err_flags sampled_verify (stack_t *stk)
+{
+    assert (stk != nullptr && "pointer can't be null");
+
+    if (stack_verify_due (&stk->verify, &stk->runtime.verify_state) == VERIFY_FULL)
+    {
+        return stack_verify (stk);
+    }
+
+    return stack_verify_fast (stk);
+}
+
+// ------------------------------------------------------------------------------------
+
+verify_level stack_verify_due (const stack_verify_cfg_t *cfg, stack_verify_state_t *state)
+{
+    assert (cfg   != nullptr && "pointer can't be null");
+    assert (state != nullptr && "pointer can't be null");
+
+    if (cfg->level != VERIFY_SAMPLED)
+    {
+        return cfg->level;
+    }
+
+    bool full_check = false;
+    state->checks++;
+
+    if (cfg->period_ops != 0 && state->checks >= cfg->period_ops)
+    {
+        full_check = true;
+    }
+
+    uint64_t now = 0;
+    if (cfg->period_us != 0)
+    {
+        now = monotonic_us ();
+        if (now - state->last_us >= cfg->period_us) full_check = true;
+    }
+
+    if (!full_check)
+    {
+        return VERIFY_CHEAP;
+    }
+
+    state->checks  = 0;
+    state->last_us = now;
+
+    return VERIFY_FULL;
+}
+
+// ------------------------------------------------------------------------------------
+
+static uint64_t monotonic_us ()
+{
+    struct timespec ts = {};
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+// ------------------------------------------------------------------------------------
+
+static inline void trace_hook (const stack_t *stk, trace_op op, size_t count, uint32_t fingerprint, err_flags errors)
+{
+    assert (stk != nullptr && "pointer can't be null");
+
+    #if STACK_TRACE
+        if (stk->trace == nullptr) return;
+
+        trace_record (stk->trace, stk, op, stk->size, stk->capacity, stk->obj_size, count, fingerprint, errors);
+    #else
+        (void) stk;
+        (void) op;
+        (void) count;
+        (void) fingerprint;
+        (void) errors;
+    #endif
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Fingerprint of top element for recorder (0 without recorder or elements)
+static inline uint32_t trace_top (const stack_t *stk)
+{
+    assert (stk != nullptr && "pointer can't be null");
+
+    #if STACK_TRACE
+        if (stk->trace == nullptr || stk->size == 0) return 0;
+
+        return trace_fingerprint ((const char *) stk->data + (stk->size - 1)*stk->obj_size, stk->obj_size);
+    #else
+        (void) stk;
+        return 0;
+    #endif
+}
+
+// ------------------------------------------------------------------------------------
+
+static inline void stats_init (stack_t *stk)
+{
+    #if STACK_STATS
+        stk->runtime.stats         = {};
+        stk->runtime.registry_prev = nullptr;
+        stk->runtime.registry_next = nullptr;
+        stk->runtime.registered    = false;
+    #else
+        (void) stk;
+    #endif
+}
+
+// ------------------------------------------------------------------------------------
+
+static inline void stats_push (stack_t *stk, size_t pushed)
+{
+    #if STACK_STATS
+        stk->runtime.stats.pushes += pushed;
+        if (stk->size > stk->runtime.stats.peak_size) stk->runtime.stats.peak_size = stk->size;
+    #else
+        (void) stk;
+        (void) pushed;
+    #endif
+}
+
+// ------------------------------------------------------------------------------------
+
+static inline void stats_pop (stack_t *stk, size_t popped)
+{
+    #if STACK_STATS
+        stk->runtime.stats.pops += popped;
+    #else
+        (void) stk;
+        (void) popped;
+    #endif
+}
+
+// ------------------------------------------------------------------------------------
+
+static inline void stats_resize (stack_t *stk, size_t bytes_copied)
+{
+    #if STACK_STATS
+        stk->runtime.stats.resizes++;
+        stk->runtime.stats.bytes_copied += bytes_copied;
+    #else
+        (void) stk;
+        (void) bytes_copied;
+    #endif
+}
+
+// ------------------------------------------------------------------------------------
+
+static inline void stats_check (stack_t *stk, err_flags check_res)
+{
+    #if STACK_STATS
+        stk->runtime.stats.verify_calls++;
+        if (check_res != res::OK) stk->runtime.stats.verify_failures++;
+    #else
+        (void) stk;
+        (void) check_res;
+    #endif
+}
+
+// ------------------------------------------------------------------------------------
+
+static void registry_add (stack_t *stk)
+{
+    #if STACK_STATS
+        pthread_mutex_lock (&registry_lock);
+
+        stk->runtime.registry_prev = nullptr;
+        stk->runtime.registry_next = registry_head;
+        if (registry_head != nullptr) registry_head->runtime.registry_prev = stk;
+        registry_head = stk;
+
+        stk->runtime.registered = true;
+
+        pthread_mutex_unlock (&registry_lock);
+    #else
+        (void) stk;
+    #endif
+}
+
+// ------------------------------------------------------------------------------------
+
+static void registry_remove (stack_t *stk)
+{
+    #if STACK_STATS
+        if (!stk->runtime.registered) return;
+
+        pthread_mutex_lock (&registry_lock);
+
+        if (stk->runtime.registry_prev != nullptr) stk->runtime.registry_prev->runtime.registry_next = stk->runtime.registry_next;
+        else                                       registry_head = stk->runtime.registry_next;
+
+        if (stk->runtime.registry_next != nullptr) stk->runtime.registry_next->runtime.registry_prev = stk->runtime.registry_prev;
+
+        stk->runtime.registry_prev = nullptr;
+        stk->runtime.registry_next = nullptr;
+        stk->runtime.registered    = false;
+
+        pthread_mutex_unlock (&registry_lock);
+    #else
+        (void) stk;
+    #endif
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Per-stack profiler counters (runtime state, so const functions write them too)
+static inline stack_profile_t *profile_of (const stack_t *stk)
+{
+    #if STACK_PROFILE
+        return (stk != nullptr) ? const_cast<stack_profile_t *>(&stk->runtime.profile) : nullptr;
+    #else
+        (void) stk;
+        return nullptr;
+    #endif
+}
+
+// ------------------------------------------------------------------------------------
+
+static inline void profile_init (stack_t *stk)
+{
+    #if STACK_PROFILE
+        stk->runtime.profile = {};
+    #else
+        (void) stk;
+    #endif
+}
+
+// ------------------------------------------------------------------------------------
+
+/// poison_fill charged to poison layer
+static inline void poison_range (const stack_t *stk, void *mem, size_t size)
+{
+    PROFILE_LAYER (stk, PROFILE_POISON, size);
+
+    poison_fill (mem, size);
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Incremental hash part of slots [first, first+count) (0 if hash is not incremental)
+static inline hash_t range_hash (const stack_t *stk, size_t first, size_t count)
+{
+    assert (stk != nullptr && "pointer can't be null");
+
+    #if STACK_HASH_PROTECT && STACK_HASH_INCREMENTAL
+        if (stk->write_depth > 0) return 0;
+
+        PROFILE_LAYER (stk, PROFILE_HASH, count*stk->obj_size);
+
+        return slots_hash (stk->hash_func, stk->data, first, count, stk->obj_size);
+    #else
+        (void) first;
+        (void) count;
+        return 0;
+    #endif
+}
+
+// ------------------------------------------------------------------------------------
+
+#if STACK_HASH_PROTECT
+static hash_t data_hash_calc (const stack_t *stk)
+{
+    assert (stk != nullptr && "pointer can't be null");
+
+    PROFILE_LAYER (stk, PROFILE_HASH, stk->capacity * stk->obj_size);
+
+    #if STACK_HASH_INCREMENTAL
+        return slots_hash (stk->hash_func, stk->data, 0, stk->capacity, stk->obj_size);
+    #else
+        return stk->hash_func (stk->data, stk->capacity * stk->obj_size);
+    #endif
+}
+#endif
+
+// ------------------------------------------------------------------------------------
+
+static size_t get_data_size (size_t capacity, size_t obj_size)
+{
+    size_t data_size = capacity*obj_size;
+    #if STACK_DUNGEON_MASTER_PROTECT
+        data_size += 2*sizeof (dungeon_master_t);
+    #endif
+
+    return data_size;
+}
+
+/// Size of whole address range of BACKING_RESERVED stack
+static size_t get_reserve_size (const stack_t *stk)
+{
+    assert (stk != nullptr && "pointer can't be null");
+
+    return commit_round (stk, get_data_size (stk->max_capacity, stk->obj_size));
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Size rounded up to commit granularity of data mapping (stack_t::page_size)
+static size_t commit_round (const stack_t *stk, size_t size)
+{
+    assert (stk != nullptr && "pointer can't be null");
+    assert (stk->page_size > 0 && "backing is not set");
+
+    return (size + stk->page_size - 1) / stk->page_size * stk->page_size;
+}
+
+// ------------------------------------------------------------------------------------
+
+/**
+ * @brief      Set obtained backing of fresh data and its commit granularity
+ * 
+ * Granularity is fixed for the life of mapping: THP advice failure later clears BACKING_THP
+ * for the dump only, mapping stays sized and protected in huge pages.
+ */
+static void set_backing (stack_t *stk, unsigned int backing)
+{
+    assert (stk != nullptr && "pointer can't be null");
+
+    stk->backing   = backing;
+    stk->page_size = 1;
+
+    #if STACK_HAS_MMAP
+        if      (backing & (BACKING_HUGETLB | BACKING_THP)) stk->page_size = huge_page_size ();
+        else if (backing & BACKING_MMAP)                    stk->page_size = stack_page_size ();
+    #endif
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Default huge page size of system (Hugepagesize of /proc/meminfo, MAP_HUGETLB pages have it), STACK_HUGE_PAGE_SIZE if unknown
+static size_t huge_page_size ()
+{
+    static const size_t size = [] ()
+    {
+        size_t kb = 0;
+
+        FILE *meminfo = fopen ("/proc/meminfo", "r");
+        if (meminfo != nullptr)
+        {
+            char line[128] = "";
+            while (fgets (line, sizeof (line), meminfo) != nullptr)
+            {
+                if (sscanf (line, "Hugepagesize: %zu kB", &kb) == 1) break;
+            }
+
+            fclose (meminfo);
+        }
+
+        return (kb != 0) ? kb << 10 : STACK_HUGE_PAGE_SIZE;
+    } ();
+
+    return size;
+}
+
+// ------------------------------------------------------------------------------------
+
+static void *cust_realloc (const stack_t *stk, void *prev_ptr, size_t prev_size, size_t new_size)
+{
+    assert (stk      != nullptr && "pointer can't be null");
+    assert (prev_ptr != nullptr && "pointer can't be null"); // Due to mremap limitations
+
+    #if STACK_HAS_MMAP
+        if (stk->backing & BACKING_MMAP)
+        {
+            return stack_pages_realloc (prev_ptr, commit_round (stk, prev_size), commit_round (stk, new_size));
+        }
+    #endif
+
+    return realloc (prev_ptr, new_size); // Не заполняет нулями
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Resize pool block: in place within its size class, else move data to a block of new class
+static void *pool_realloc (stack_t *stk, void *data_start, size_t prev_size, size_t new_size)
+{
+    assert (stk        != nullptr && "pointer can't be null");
+    assert (data_start != nullptr && "pointer can't be null");
+
+    unlock_data (stk); // Old block is poisoned below
+
+    if (stack_pool_same_block (prev_size, new_size))
+    {
+        #if STACK_KSP_PROTECT
+            // Unused slots are poisoned already, old trailing canary is not
+            if (new_size < prev_size) poison_range (stk, (char *) data_start + new_size, prev_size - new_size);
+        #endif
+
+        return data_start;
+    }
+
+    void *new_ptr = stack_pool_alloc (data_pool (stk), new_size);
+    if (new_ptr == nullptr)
+    {
+        lock_data (stk);
+        return nullptr;
+    }
+
+    memcpy (new_ptr, data_start, (prev_size < new_size) ? prev_size : new_size);
+    stack_pool_free (data_pool (stk), data_start, prev_size, prev_size);
+
+    return new_ptr;
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Pool of BACKING_POOL stack data
+static stack_pool_t *data_pool (const stack_t *stk)
+{
+    assert (stk != nullptr && "pointer can't be null");
+
+    return (stk->pool != nullptr) ? stk->pool : stack_pool_local ();
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Commit pages of reservation up to new_size, decommit pages past it (data_start doesn't change)
+static void *reserve_commit (const stack_t *stk, void *data_start, size_t prev_size, size_t new_size)
+{
+    assert (stk        != nullptr && "pointer can't be null");
+    assert (data_start != nullptr && "pointer can't be null");
+
+    #if STACK_HAS_MMAP
+        size_t prev_commit = commit_round (stk, prev_size);
+        size_t new_commit  = commit_round (stk, new_size);
+
+        if (new_commit < prev_commit)
+        {
+            // Decommitted pages are zero-filled on the next commit
+            char *tail = (char *) data_start + new_commit;
+            madvise  (tail, prev_commit - new_commit, MADV_DONTNEED);
+            mprotect (tail, prev_commit - new_commit, PROT_NONE);
+        }
+
+        if (new_commit > 0 && mprotect (data_start, new_commit, PROT_READ|PROT_WRITE) != 0)
+        {
+            return nullptr;
+        }
+
+        return data_start;
+    #else
+        (void) stk;
+        (void) prev_size;
+        (void) new_size;
+        return nullptr;
+    #endif
+}
+
+// ------------------------------------------------------------------------------------
+
+/**
+ * @brief      Allocate data_size bytes of data as stk->alloc_flags requests, set stk->backing
+ * 
+ * STACK_ALLOC_HUGETLB falls back to transparent huge pages if the huge page pool can't
+ * back the reservation, flags needing mmap turn heap data into anonymous mapping.
+ */
+static void *data_alloc (stack_t *stk, size_t data_size)
+{
+    assert (stk != nullptr && "pointer can't be null");
+
+    if ((stk->alloc_flags & STACK_ALLOC_POOL) && !(stk->alloc_flags & (STACK_ALLOC_RESERVE | STACK_ALLOC_HUGETLB)))
+    {
+        // Memory protected pool blocks are mappings
+        set_backing (stk, BACKING_POOL | (STACK_MEMORY_PROTECT ? BACKING_MMAP : BACKING_HEAP));
+        return stack_pool_alloc (data_pool (stk), data_size);
+    }
+
+    #if STACK_HAS_MMAP
+        unsigned int flags = stk->alloc_flags;
+
+        if (flags & STACK_ALLOC_HUGETLB)
+        {
+            // Huge page mappings can't be mremap'ed: they always grow in reservation
+            set_backing (stk, BACKING_MMAP | BACKING_RESERVED | BACKING_HUGETLB);
+
+            void *mem_ptr = data_reserve (stk, data_size, MAP_HUGETLB);
+            if (mem_ptr != nullptr) return mem_ptr;
+
+            flags |= STACK_ALLOC_RESERVE | STACK_ALLOC_THP;
+        }
+
+        set_backing (stk, BACKING_MMAP | ((flags & STACK_ALLOC_THP) ? BACKING_THP : 0));
+
+        if (flags & STACK_ALLOC_RESERVE)
+        {
+            stk->backing |= BACKING_RESERVED;
+            return data_reserve (stk, data_size, MAP_NORESERVE);
+        }
+
+        if (STACK_MEMORY_PROTECT || (flags & (STACK_ALLOC_THP | STACK_ALLOC_POPULATE)))
+        {
+            void *mem_ptr = stack_pages_alloc (commit_round (stk, data_size));
+            if (mem_ptr == nullptr) return nullptr;
+
+            // Advise before faulting pages in, so they are faulted in as huge ones
+            data_advise (stk, mem_ptr, commit_round (stk, data_size));
+            if (stk->backing & BACKING_POPULATED) prefault (mem_ptr, data_size);
+
+            return mem_ptr;
+        }
+    #endif
+
+    set_backing (stk, BACKING_HEAP);
+    return calloc (data_size, 1); // Works even with capacity = 0
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Reserve address range for max_capacity (PROT_NONE) and commit data_size bytes of it
+static void *data_reserve (stack_t *stk, size_t data_size, int map_flags)
+{
+    assert (stk != nullptr && "pointer can't be null");
+
+    #if STACK_HAS_MMAP
+        void *mem_ptr = mmap (nullptr, get_reserve_size (stk), PROT_NONE,
+                              MAP_PRIVATE|MAP_ANONYMOUS|map_flags, -1, 0);
+        if (mem_ptr == MAP_FAILED) return nullptr;
+
+        if (reserve_commit (stk, mem_ptr, 0, data_size) == nullptr)
+        {
+            munmap (mem_ptr, get_reserve_size (stk));
+            return nullptr;
+        }
+
+        data_advise (stk, mem_ptr, get_reserve_size (stk));
+        if (stk->backing & BACKING_POPULATED) prefault (mem_ptr, data_size);
+
+        return mem_ptr;
+    #else
+        (void) data_size;
+        (void) map_flags;
+        return nullptr;
+    #endif
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Apply huge page & populate requests to fresh mapping, keep only obtained ones in stk->backing (page_size is kept)
+static void data_advise (stack_t *stk, void *mem, size_t size)
+{
+    assert (stk != nullptr && "pointer can't be null");
+
+    #if STACK_HAS_MMAP
+        if ((stk->backing & BACKING_THP) && madvise (mem, size, MADV_HUGEPAGE) != 0)
+        {
+            stk->backing &= ~(unsigned int) BACKING_THP;
+        }
+
+        if (stk->alloc_flags & STACK_ALLOC_POPULATE)
+        {
+            stk->backing |= BACKING_POPULATED;
+        }
+    #else
+        (void) mem;
+        (void) size;
+    #endif
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Fault in writable pages of range
+static void prefault (void *mem, size_t size)
+{
+    #if STACK_HAS_MMAP
+        #ifdef MADV_POPULATE_WRITE
+            uintptr_t pagesize = (uintptr_t) sysconf (_SC_PAGESIZE);
+            uintptr_t begin    = (uintptr_t) mem / pagesize * pagesize;
+
+            if (madvise ((void *) begin, (uintptr_t) mem + size - begin, MADV_POPULATE_WRITE) == 0) return;
+        #endif
+
+        // Older kernels: touch every page (data is poisoned right after)
+        volatile char *bytes = (volatile char *) mem;
+        for (size_t i = 0; i < size; i += 4096)
+        {
+            bytes[i] = bytes[i];
+        }
+    #else
+        (void) mem;
+        (void) size;
+    #endif
+}
+
+// ------------------------------------------------------------------------------------
+
+static void data_free (stack_t *stk, void *data_start)
+{
+    assert (stk != nullptr && "pointer can't be null");
+
+    if (stk->backing & BACKING_FILE)
+    {
+        file_release (stk);
+        return;
+    }
+
+    if (stk->backing & BACKING_POOL)
+    {
+        size_t data_size = get_data_size (stk->capacity, stk->obj_size);
+        stack_pool_free (data_pool (stk), data_start, data_size, data_size);
+        return;
+    }
+
+    #if STACK_HAS_MMAP
+        if (stk->backing & BACKING_RESERVED)
+        {
+            munmap (data_start, get_reserve_size (stk));
+            return;
+        }
+
+        if (stk->backing & BACKING_MMAP)
+        {
+            stack_pages_free (data_start, commit_round (stk, get_data_size (stk->capacity, stk->obj_size)));
+            return;
+        }
+    #endif
+
+    free (data_start);
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Set struct canaries and skip leading data canary, data_canaries = false keeps canaries of reopened file for the check
+static void init_dungeon_master_protection (stack_t *stk, bool data_canaries)
+{
+    assert (stk       != nullptr);
+    assert (stk->data != nullptr);
+
+    #if STACK_DUNGEON_MASTER_PROTECT
+        PROFILE_LAYER (stk, PROFILE_CANARY, 4*sizeof (dungeon_master_t));
+
+        stk->two_blocks_up   = dungeon_master_val;
+        stk->two_blocks_down = dungeon_master_val;
+
+        stk->data = (dungeon_master_t*)stk->data + 1;
+        if (data_canaries) stack_canaries_set (stk->data, stk->capacity * stk->obj_size);
+    #else
+        (void) data_canaries;
+    #endif
+}
+
+// ------------------------------------------------------------------------------------
+
+static err_flags stack_data_init (stack_t *stk, size_t reserved, size_t obj_size, const stack_alloc_t *alloc, bool *adopted)
+{
+    assert (stk     != nullptr && "pointer can't be null");
+    assert (adopted != nullptr && "pointer can't be null");
+    assert (obj_size > 0   && "invalid obj size");
+
+    stk->obj_size     = obj_size;
+    stk->alloc_flags  = (alloc != nullptr) ? alloc->flags        : (unsigned int) STACK_ALLOC_DEFAULT;
+    stk->max_capacity = (alloc != nullptr) ? alloc->max_capacity : 0;
+    stk->pool         = (alloc != nullptr) ? alloc->pool         : nullptr;
+    stk->file_fd      = -1;
+    stk->file_header  = nullptr;
+
+    #if STACK_TRACE
+    stk->trace        = nullptr;
+    #endif
+
+    #if STACK_MEMORY_PROTECT
+        ssize_t pagesize = sysconf (_SC_PAGESIZE);
+        // As the sysconf man says the only error is EINVAL (invalid name) and I'm sure _SC_PAGESIZE is the correct value.
+        assert (pagesize != -1);
+        size_t objects_in_mempage = ((size_t) pagesize) / obj_size;
+        reserved = (reserved > objects_in_mempage) ? reserved : objects_in_mempage;
+    #endif
+
+    // Huge page stacks grow in reservation too (file backing ignores both flags)
+    if ((stk->alloc_flags & (STACK_ALLOC_RESERVE | STACK_ALLOC_HUGETLB)) && !(stk->alloc_flags & STACK_ALLOC_FILE) &&
+        stk->max_capacity == 0)
+    {
+        stk->max_capacity = STACK_DEFAULT_RESERVE_SIZE / obj_size;
+    }
+
+    if (stk->max_capacity != 0 && stk->max_capacity < reserved)
+    {
+        stk->max_capacity = reserved;
+    }
+
+    stk->capacity = reserved;
+    stk->size     = 0;
+
+    void *mem_ptr = nullptr;
+
+    if (stk->alloc_flags & STACK_ALLOC_FILE)
+    {
+        assert (alloc->path != nullptr && "pointer can't be null");
+
+        // Reopened file brings its own size & capacity
+        UNWRAP (file_open (stk, alloc->path, &mem_ptr, adopted));
+    }
+    else
+    {
+        mem_ptr = data_alloc (stk, get_data_size (reserved, obj_size));
+        if (mem_ptr == nullptr) { return res::NOMEM; }
+    }
+
+    #if STACK_MEMORY_PROTECT
+        shadow_page_t *copy_page = nullptr;
+        unsigned char *struct_copy = (unsigned char *) shadow_alloc (PROTECTED_STRUCT_SIZE, &copy_page);
+
+        if (struct_copy == nullptr)
+        {
+            data_free (stk, mem_ptr); // Releases file (fd, mapping & lock) of file backing too
+            return res::NOMEM;
+        }
+    #endif
+
+    // Set data pointer
+    stk->data = mem_ptr;
+    stk->reserved = (stk->capacity < reserved) ? stk->capacity : reserved;
+
+    #if STACK_MEMORY_PROTECT
+    stk->struct_copy = struct_copy;
+    stk->copy_page   = copy_page;
+    #endif
+    
+    return res::OK;
+}
+
+// ------------------------------------------------------------------------------------
+
+/**
+ * @brief      Open (create) and lock file of STACK_ALLOC_FILE stack, map it shared
+ * 
+ * Empty file gets header of reserved capacity stack. Existing file is mapped as it is (zero-copy)
+ * after file_header_read, its data is checked by file_attach at the end of construction.
+ *
+ * @param[out] mem_ptr  Data start (leading canary) in mapping
+ * @param[out] adopted  Existing stack was reopened
+ *
+ * @return     Error flags (bitor of res enum)
+ */
+static err_flags file_open (stack_t *stk, const char *path, void **mem_ptr, bool *adopted)
+{
+    assert (stk     != nullptr && "pointer can't be null");
+    assert (path    != nullptr && "pointer can't be null");
+    assert (mem_ptr != nullptr && "pointer can't be null");
+    assert (adopted != nullptr && "pointer can't be null");
+
+    #if STACK_HAS_MMAP
+        set_backing (stk, BACKING_MMAP | BACKING_FILE);
+
+        int fd = open (path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd == -1) return res::IO_ERROR;
+
+        // One stack per file
+        struct stat file_stat = {};
+        if (flock (fd, LOCK_EX | LOCK_NB) != 0 || fstat (fd, &file_stat) != 0)
+        {
+            close (fd);
+            return res::IO_ERROR;
+        }
+
+        *adopted = (file_stat.st_size != 0);
+
+        if (*adopted)
+        {
+            err_flags header_res = file_header_read (stk, fd, (size_t) file_stat.st_size);
+            if (header_res != res::OK)
+            {
+                close (fd);
+                return header_res;
+            }
+        }
+        else if (ftruncate (fd, (off_t) file_map_size (stk, stk->capacity)) != 0)
+        {
+            close (fd);
+            return res::IO_ERROR;
+        }
+
+        size_t map_size = file_map_size (stk, stk->capacity);
+
+        void *base = mmap (nullptr, map_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED)
+        {
+            close (fd);
+            return res::NOMEM;
+        }
+
+        stk->file_fd     = fd;
+        stk->file_header = (stack_file_header_t *) base;
+
+        if (!*adopted)
+        {
+            // The rest of header is zero-filled by ftruncate, dynamic fields follow stack
+            stk->file_header->magic       = STACK_FILE_MAGIC;
+            stk->file_header->version     = STACK_FILE_VERSION;
+            stk->file_header->layout      = file_layout ();
+            stk->file_header->header_size = file_header_size ();
+            stk->file_header->obj_size    = stk->obj_size;
+            stk->file_header->canary      = dungeon_master_val;
+        }
+
+        *mem_ptr = (char *) base + file_header_size ();
+
+        data_advise (stk, *mem_ptr, map_size - file_header_size ());
+        if (stk->backing & BACKING_POPULATED) prefault (*mem_ptr, map_size - file_header_size ());
+
+        return res::OK;
+    #else
+        (void) path;
+        *mem_ptr = nullptr;
+        *adopted = false;
+        return res::IO_ERROR;
+    #endif
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Check header of existing file against stack being constructed, take size, capacity & data hash from it
+static err_flags file_header_read (stack_t *stk, int fd, size_t file_size)
+{
+    assert (stk != nullptr && "pointer can't be null");
+
+    #if STACK_HAS_MMAP
+        stack_file_header_t header = {};
+        if (pread (fd, &header, sizeof (header), 0) != (ssize_t) sizeof (header)) return res::STRUCT_CORRUPTED;
+
+        const hash_t header_hash = header.header_hash;
+        header.header_hash = 0;
+
+        // Files of other protection sets or page sizes have other data layout
+        if (header.magic       != STACK_FILE_MAGIC   || header.version != STACK_FILE_VERSION ||
+            header.layout      != file_layout ()     || header.canary  != dungeon_master_val ||
+            header.header_size != file_header_size () ||
+            header.hash_name[sizeof (header.hash_name) - 1] != '\0' ||
+            hash_fixed<sizeof (stack_file_header_t)> (&header) != header_hash)
+        {
+            return res::STRUCT_CORRUPTED;
+        }
+
+        if (header.obj_size != stk->obj_size) return res::INVALID_OBJ_SIZE;
+        if (header.size > header.capacity)    return res::INVALID_SIZE;
+
+        stk->size     = header.size;
+        stk->capacity = header.capacity;
+
+        // File is cut: mapping would fault past its end
+        if (file_size < file_map_size (stk, stk->capacity)) return res::DATA_CORRUPTED;
+
+        #if STACK_HASH_PROTECT
+            stk->data_hash = header.data_hash;
+        #endif
+
+        return res::OK;
+    #else
+        (void) fd;
+        (void) file_size;
+        return res::IO_ERROR;
+    #endif
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Finish construction of file backed stack: full check of reopened data, header takes hash function name
+static err_flags file_attach (stack_t *stk, bool adopted, verify_level level)
+{
+    assert (stk              != nullptr && "pointer can't be null");
+    assert (stk->file_header != nullptr && "pointer can't be null");
+
+    if (adopted)
+    {
+        // Reopened file is trusted only after full check, whatever the verification level
+        err_flags check_res = stack_verify (stk);
+        if (check_res != res::OK)
+        {
+            log (log::ERR, "Failed check of reopened stack file with err flags: ");
+            stack_perror (check_res, get_log_stream(), "->");
+
+            file_release (stk); // File is left as it was
+            stk->data = nullptr;
+
+            #if STACK_MEMORY_PROTECT
+                shadow_free (stk->struct_copy, stk->copy_page);
+            #endif
+
+            return check_res;
+        }
+
+        stk->verify.level = level;
+        sync_struct_copy (stk);
+    }
+
+    #if STACK_HASH_PROTECT
+        const char *name = hash_name (stk->hash_func);
+        memset (stk->file_header->hash_name, 0, sizeof (stk->file_header->hash_name));
+        if (name != nullptr) strncpy (stk->file_header->hash_name, name, sizeof (stk->file_header->hash_name) - 1);
+    #endif
+
+    update_struct_hash (stk);
+
+    return res::OK;
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Resize file and its mapping, header moves with data
+static void *file_realloc (stack_t *stk, void *data_start, size_t prev_size, size_t new_size)
+{
+    assert (stk        != nullptr && "pointer can't be null");
+    assert (data_start != nullptr && "pointer can't be null");
+
+    #if STACK_HAS_MMAP
+        size_t header_size = file_header_size ();
+        size_t prev_map    = header_size + commit_round (stk, prev_size);
+        size_t new_map     = header_size + commit_round (stk, new_size);
+
+        // mremap moves single mapping only: read-only data and writable header must be merged back
+        unlock_data (stk);
+
+        // File grows before mapping and shrinks after it, so mapped pages always have file behind them
+        if (new_map > prev_map && ftruncate (stk->file_fd, (off_t) new_map) != 0)
+        {
+            lock_data (stk);
+            return nullptr;
+        }
+
+        void *base = mremap ((char *) data_start - header_size, prev_map, new_map, MREMAP_MAYMOVE);
+        if (base == MAP_FAILED)
+        {
+            // File stays longer than its stack needs, which reopen allows
+            lock_data (stk);
+            return nullptr;
+        }
+
+        if (new_map < prev_map && ftruncate (stk->file_fd, (off_t) new_map) != 0)
+        {
+            log (log::WRN, "Stack file is not truncated, its tail stays unused");
+        }
+
+        stk->file_header = (stack_file_header_t *) base;
+        return (char *) base + header_size;
+    #else
+        (void) prev_size;
+        (void) new_size;
+        return nullptr;
+    #endif
+}
+
+// ------------------------------------------------------------------------------------
+
+/// msync header & data of BACKING_FILE stack (OK for other backings)
+static err_flags file_sync (const stack_t *stk)
+{
+    assert (stk != nullptr && "pointer can't be null");
+
+    #if STACK_HAS_MMAP
+        if (stk->file_header == nullptr) return res::OK;
+
+        if (msync (stk->file_header, file_map_size (stk, stk->capacity), MS_SYNC) != 0)
+        {
+            return res::IO_ERROR;
+        }
+    #endif
+
+    return res::OK;
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Unmap and unlock file, its contents stay as they are
+static void file_release (stack_t *stk)
+{
+    assert (stk != nullptr && "pointer can't be null");
+
+    #if STACK_HAS_MMAP
+        munmap (stk->file_header, file_map_size (stk, stk->capacity));
+        close (stk->file_fd);
+    #endif
+
+    stk->file_fd     = -1;
+    stk->file_header = nullptr;
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Header follows stack: a few stores to page cache on every change, no syscalls
+static inline void file_header_update (stack_t *stk)
+{
+    assert (stk != nullptr && "pointer can't be null");
+
+    stack_file_header_t *header = stk->file_header;
+    if (header == nullptr) return;
+
+    header->size     = stk->size;
+    header->capacity = stk->capacity;
+
+    #if STACK_HASH_PROTECT
+        header->data_hash = stk->data_hash;
+    #endif
+
+    header->header_hash = 0;
+    header->header_hash = hash_fixed<sizeof (stack_file_header_t)> (header);
+}
+
+// ------------------------------------------------------------------------------------
+
+/// File offset of data: header takes whole page, so data mapping can be protected
+static size_t file_header_size ()
+{
+    #if STACK_HAS_MMAP
+        static const size_t pagesize = (size_t) sysconf (_SC_PAGESIZE);
+        return pagesize;
+    #else
+        return sizeof (stack_file_header_t);
+    #endif
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Size of file (and its mapping) holding stack of capacity
+static size_t file_map_size (const stack_t *stk, size_t capacity)
+{
+    assert (stk != nullptr && "pointer can't be null");
+
+    return file_header_size () + commit_round (stk, get_data_size (capacity, stk->obj_size));
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Protection macros file data layout depends on: canaries, poisoned slots & data hash
+static uint32_t file_layout ()
+{
+    return (uint32_t) ((STACK_KSP_PROTECT                             ? 1 << 0 : 0) |
+                       (STACK_DUNGEON_MASTER_PROTECT                  ? 1 << 1 : 0) |
+                       (STACK_HASH_PROTECT                            ? 1 << 2 : 0) |
+                       (STACK_HASH_PROTECT && STACK_HASH_INCREMENTAL  ? 1 << 3 : 0));
+}
+
+STACK_NAMESPACE_END
@@ -29,11 +29,28 @@
 /**
  * @brief Hash protection
  * 
- * Method: Structure stores its own hash and data hash. The hashes are computed using a given hash function or, if none given, using djb2.
+ * Method: Structure stores its own hash and data hash. Data hash is computed using a given hash function or,
+ * if none given, using STACK_DEFAULT_HASH. Struct hash covers all protected fields with fixed-size hash_fixed kernel.
  */
 #define STACK_HASH_PROTECT              1
 #endif
 
+#ifndef STACK_DEFAULT_HASH
+/// Data hash function of stacks constructed without one (see hash_find for others)
+#define STACK_DEFAULT_HASH              word_hash
+#endif
+
+#ifndef STACK_HASH_INCREMENTAL
+/**
+ * @brief Incremental data hash (used only with STACK_HASH_PROTECT)
+ * 
+ * Method: Data hash is a sum of position-keyed slot hashes (see slot_hash), so push & pop update it
+ * from the changed slot only in O(obj_size). Full rescans in stack_verify still hash every slot.
+ * With 0 data hash is a one-shot hash_func of the whole buffer, recomputed after every change.
+ */
+#define STACK_HASH_INCREMENTAL          1
+#endif
+
 /**
  * @brief Memory protection
  * 
@@ -50,15 +67,87 @@
 #endif
 #endif
 
+#ifndef STACK_TRACE
+/**
+ * @brief Flight recorder support (see trace.h, stack_set_trace)
+ * 
+ * Stacks with recorder attached write a record on every push, pop, resize, failed check and destruction.
+ * Stacks without recorder pay one branch per operation.
+ */
+#define STACK_TRACE                     1
+#endif
+
+#ifndef STACK_STATS
+/**
+ * @brief Operation counters & registry of live stacks (see stack_registry_stats)
+ * 
+ * Counters are plain increments of runtime state, registry costs one mutex lock in constructor & destructor.
+ * Registry lock guards only the list: totals read other stacks' fields without synchronization.
+ */
+#define STACK_STATS                     1
+#endif
+
+#ifndef STACK_PROFILE
+/**
+ * @brief Protection cost profiler (see profile.h, stack_profile_enable)
+ * 
+ * Public operations and protection layers are timed with trace_clock when profiling is enabled
+ * at runtime. Disabled profiler costs one relaxed atomic load per operation and per layer call.
+ */
+#define STACK_PROFILE                   1
+#endif
+
+#ifndef STACK_DEFAULT_VERIFY_LEVEL
+/**
+ * @brief Verification level of new stacks (see enum verify_level)
+ * 
+ * Full verification in debug builds, none in release builds.
+ */
+#ifndef NDEBUG
+    #define STACK_DEFAULT_VERIFY_LEVEL  VERIFY_FULL
+#else
+    #define STACK_DEFAULT_VERIFY_LEVEL  VERIFY_OFF
+#endif
+#endif
+
+#ifndef STACK_DEFAULT_VERIFY_PERIOD
+/// Full check period (in checks) for VERIFY_SAMPLED stacks with no period given
+#define STACK_DEFAULT_VERIFY_PERIOD     64
+#endif
+
+#ifndef STACK_DEFAULT_SHRINK_INTERVAL
+/// Elements pushed & popped after the last growth before default policy lets stack shrink (see stack_growth_t)
+#define STACK_DEFAULT_SHRINK_INTERVAL   64
+#endif
+
+#ifndef STACK_DEFAULT_RESERVE_SIZE
+/// Address space reserved by STACK_ALLOC_RESERVE stacks constructed without max_capacity (bytes)
+#define STACK_DEFAULT_RESERVE_SIZE      (1ul << 30)
+#endif
+
+#ifndef STACK_HUGE_PAGE_SIZE
+/// Huge page size of huge page backed stacks if /proc/meminfo has no Hugepagesize
+#define STACK_HUGE_PAGE_SIZE            (2ul << 20)
+#endif
+
 #ifndef VERBOSE_DUMP_LEVEL
 #define VERBOSE_DUMP_LEVEL              0
 #endif
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <assert.h>
 #include "log.h"
 #include "hash.h"
+#include "poison.h"
+#include "stack_pool.h"
+#include "shadow.h"
+#include "trace.h"
+#include "profile.h"
+#include "variant.h"
+
+STACK_NAMESPACE_BEGIN
 
 // ---------------- Types ----------------
 /// Return type. Bit OR of errors (enum res)
@@ -94,9 +183,206 @@ enum res
     /// Invalid func (hash_func or print_func)
     INVALID_FUNC        = 1 << 9,   
     /// Data pointer is null
-    DATA_NULL           = 1 << 10   
+    DATA_NULL           = 1 << 10,  
+    /// File operation failed (open, lock, ftruncate, msync of STACK_ALLOC_FILE data)
+    IO_ERROR            = 1 << 11   
+};
+
+/// Verification level used by stack_assert in public operations
+enum verify_level
+{
+    /// No checks
+    VERIFY_OFF          = 0,
+    /// O(1) checks only: bounds, struct & data canaries, poisoned data pointer (stack_verify_fast)
+    VERIFY_CHEAP        = 1,
+    /// Full stack_verify on every check
+    VERIFY_FULL         = 2,
+    /// Cheap checks on every check, full stack_verify every period_ops checks and/or every period_us microseconds
+    VERIFY_SAMPLED      = 3
+};
+
+/// Verification settings (part of the protected struct)
+struct stack_verify_cfg_t
+{
+    verify_level level;             /// Verification level
+    unsigned int period_ops;        /// VERIFY_SAMPLED: full check every period_ops checks (0 -> disabled)
+    uint64_t     period_us;         /// VERIFY_SAMPLED: full check every period_us microseconds (0 -> disabled)
+};
+
+/**
+ * @brief Capacity growth & shrink policy (part of the protected struct)
+ * 
+ * Full stack grows to capacity * grow_num / grow_den (at least +1). After pops stack shrinks
+ * by the same factor while capacity >= shrink_ratio * size, never below reserved capacity.
+ * Shrink waits for shrink_delay pops with shrink condition held and for shrink_interval
+ * elements pushed & popped since the last growth, so stack oscillating around one boundary
+ * does not resize on every operation.
+ */
+struct stack_growth_t
+{
+    unsigned int grow_num;          /// Growth factor numerator (grow_num > grow_den)
+    unsigned int grow_den;          /// Growth factor denominator (> 0)
+    unsigned int shrink_ratio;      /// Shrink when capacity >= shrink_ratio * size (0 -> never shrink)
+    unsigned int shrink_delay;      /// Pops with shrink condition held before shrink
+    size_t       shrink_interval;   /// Elements pushed & popped since the last growth before shrink
+};
+
+/// Allocation flags (stack_alloc_t::flags)
+enum stack_alloc_flags
+{
+    /// calloc/realloc data (mmap/mremap with STACK_MEMORY_PROTECT)
+    STACK_ALLOC_DEFAULT = 0,
+    /// Reserve max_capacity of address space (PROT_NONE) in constructor, resize only commits & decommits pages in it
+    STACK_ALLOC_RESERVE = 1 << 0,
+    /// Advise transparent huge pages (madvise MADV_HUGEPAGE) for data mapping
+    STACK_ALLOC_THP     = 1 << 1,
+    /// Explicit huge pages (MAP_HUGETLB) in reservation, falls back to STACK_ALLOC_THP if the pool is short
+    STACK_ALLOC_HUGETLB = 1 << 2,
+    /// Pre-fault data pages on allocation and growth
+    STACK_ALLOC_POPULATE = 1 << 3,
+    /// Take data buffer from pool (stack_alloc_t::pool), return it on destruction (ignored with reservation)
+    STACK_ALLOC_POOL     = 1 << 4,
+    /// Map data from file (stack_alloc_t::path) shared, reopen its stack if file exists (other flags but populate are ignored)
+    STACK_ALLOC_FILE     = 1 << 5
+};
+
+/// Obtained data backing (bitor, stack_t::backing)
+enum stack_backing
+{
+    /// calloc/realloc
+    BACKING_HEAP        = 0,
+    /// Anonymous mmap
+    BACKING_MMAP        = 1 << 0,
+    /// Reserved address range, data never moves
+    BACKING_RESERVED    = 1 << 1,
+    /// Transparent huge pages advised
+    BACKING_THP         = 1 << 2,
+    /// MAP_HUGETLB pages
+    BACKING_HUGETLB     = 1 << 3,
+    /// Pages are pre-faulted
+    BACKING_POPULATED   = 1 << 4,
+    /// Pool block, resizes within its size class are in place
+    BACKING_POOL        = 1 << 5,
+    /// Shared mapping of file, data outlives stack
+    BACKING_FILE        = 1 << 6
+};
+
+/// Allocation options of constructor
+struct stack_alloc_t
+{
+    unsigned int flags;             /// Bitor of stack_alloc_flags
+    size_t max_capacity;            /// Capacity limit (0 -> unlimited, STACK_DEFAULT_RESERVE_SIZE bytes for STACK_ALLOC_RESERVE & STACK_ALLOC_HUGETLB)
+    stack_pool_t *pool;             /// Pool for STACK_ALLOC_POOL (nullptr -> pool of thread calling stack functions)
+    const char *path;               /// File for STACK_ALLOC_FILE
+};
+
+/// "STKFILE" + format version byte
+const uint64_t STACK_FILE_MAGIC   = 0x31454C49464B5453;
+const uint32_t STACK_FILE_VERSION = 1;
+
+/**
+ * @brief On-disk header of STACK_ALLOC_FILE stack: first page of file
+ * 
+ * Data with its canaries follows header (file offset header_size) in the same layout as in memory.
+ * Header follows stack after every change, its hash and data hash are checked on reopen.
+ */
+struct stack_file_header_t
+{
+    uint64_t magic;                     /// STACK_FILE_MAGIC
+    uint32_t version;                   /// STACK_FILE_VERSION
+    uint32_t layout;                    /// Protection macros data layout depends on (bitor of 1 << KSP, canary, hash, incremental)
+    uint64_t header_size;               /// Data offset (page size of writer)
+    uint64_t obj_size;                  /// Object size
+    uint64_t size;                      /// Stack size
+    uint64_t capacity;                  /// Stack capacity
+    dungeon_master_t canary;            /// dungeon_master_val
+    hash_t data_hash;                   /// Data hash (0 without STACK_HASH_PROTECT)
+    char hash_name[16];                 /// Registered name of data hash function ("" -> custom)
+    hash_t header_hash;                 /// hash_fixed of header with header_hash = 0
+};
+
+/// Operation counters (STACK_STATS)
+struct stack_stats_t
+{
+    size_t pushes;                      /// Elements pushed
+    size_t pops;                        /// Elements popped
+    size_t resizes;                     /// Capacity changes
+    size_t bytes_copied;                /// Element bytes moved by resizes that changed data address
+    size_t peak_size;                   /// Max size
+    size_t verify_calls;                /// stack_check calls
+    size_t verify_failures;             /// Failed stack_check calls
+};
+
+/// Memory of one stack (see stack_memory)
+struct stack_memory_t
+{
+    size_t used;                        /// Bytes of elements (size * obj_size)
+    size_t committed;                   /// Bytes of data, canaries, page rounding and struct copy slot
+};
+
+/// Totals of live stacks (see stack_registry_stats)
+struct stack_registry_stats_t
+{
+    size_t stacks;                      /// Live stacks
+    size_t used_bytes;                  /// Sum of stack_memory_t::used
+    size_t committed_bytes;             /// Sum of stack_memory_t::committed
+    double wasted;                      /// Committed bytes fraction not used by elements
+    stack_stats_t ops;                  /// Sums of counters (peak_size is the max)
+};
+
+/// Sampling state of VERIFY_SAMPLED checks (see stack_verify_due)
+struct stack_verify_state_t
+{
+    size_t   checks;                    /// Checks since last full check
+    uint64_t last_us;                   /// Time of last full check (monotonic, us)
+};
+
+/// Hysteresis state of growth policy (see stack_growth_shrink)
+struct stack_growth_state_t
+{
+    size_t ops_since_grow;              /// Elements pushed & popped since the last growth
+    size_t shrink_pending;              /// Pops since shrink condition started to hold
+};
+
+struct stack_t;
+
+/**
+ * @brief Mutable runtime state of stack
+ * 
+ * Is not covered by struct hash and memory protection: it changes on every check,
+ * and its corruption can only change the moment of the next full check.
+ */
+struct stack_runtime_t
+{
+    stack_verify_state_t verify_state;  /// VERIFY_SAMPLED state
+    stack_growth_state_t growth_state;  /// Growth policy state
+
+    #if STACK_TRACE
+    uint32_t pop_fingerprint;           /// Top fingerprint taken by stack_pop_slot_poison for its commit
+    #endif
+
+    #if STACK_STATS
+    stack_stats_t stats;                /// Operation counters
+    stack_t *registry_prev;             /// Previous live stack
+    stack_t *registry_next;             /// Next live stack
+    bool registered;                    /// Stack is in registry
+    #endif
+
+    #if STACK_PROFILE
+    stack_profile_t profile;            /// Protection costs of this stack
+    #endif
 };
 
+// ---------------- Consts ----------------
+/// Canary value
+const dungeon_master_t dungeon_master_val = 0x1000DEAD7;
+
+/// Growth policy of stacks constructed without one: doubling, halving at 1/4 load after STACK_DEFAULT_SHRINK_INTERVAL
+const stack_growth_t STACK_DEFAULT_GROWTH = {2, 1, 4, 0, STACK_DEFAULT_SHRINK_INTERVAL};
+
+/// Growth policy that never gives memory back (only stack_resize & stack_shrink_to_fit shrink)
+const stack_growth_t STACK_NEVER_SHRINK = {2, 1, 0, 0, 0};
+
 #ifndef NDEBUG
 /// Struct for debug data
 struct stack_debug_t
@@ -120,6 +406,21 @@ struct stack_t
     size_t capacity;                    /// Stack allocated capacity
     size_t obj_size;                    /// Stack object size
     size_t reserved;                    /// Reserved capacity
+    size_t max_capacity;                /// Capacity limit (0 -> unlimited)
+    unsigned int alloc_flags;           /// Requested allocation (bitor of stack_alloc_flags)
+    unsigned int backing;               /// Obtained data backing (bitor of stack_backing)
+    size_t page_size;                   /// Commit & memory protection granularity of data mapping (1 -> heap)
+    stack_pool_t *pool;                 /// Pool of BACKING_POOL data (nullptr -> stack_pool_local)
+    int file_fd;                        /// Locked file of BACKING_FILE data (-1 -> none)
+    stack_file_header_t *file_header;   /// Header of BACKING_FILE data, start of file mapping (nullptr -> none)
+
+    #if STACK_TRACE
+    stack_trace_t *trace;               /// Flight recorder (nullptr -> not recorded)
+    #endif
+
+    stack_verify_cfg_t verify;          /// Verification settings
+    stack_growth_t growth;              /// Growth & shrink policy
+    size_t write_depth;                 /// Nesting depth of write sessions (see stack_write_begin)
 
     #ifndef NDEBUG
     elem_print_f print_func;            /// Function for printing elements
@@ -133,12 +434,15 @@ struct stack_t
     #endif
 
     #if STACK_MEMORY_PROTECT
-    stack_t *struct_copy;               /// Struct copy without own data
+    unsigned char *struct_copy;         /// Copy of protected struct part (slot of shared read-only page)
+    shadow_page_t *copy_page;           /// Shadow page of struct copy
     #endif
 
     #if STACK_DUNGEON_MASTER_PROTECT
     dungeon_master_t two_blocks_down;   /// Struct canary
     #endif
+
+    stack_runtime_t runtime;            /// Runtime state, must be the last field (not protected)
 };
 
 // ---------------- Functions ----------------
@@ -149,15 +453,22 @@ struct stack_t
  * @param[in]  obj_size    Object size
  * @param[in]  capacity    Reserved capacity
  * @param[in]  print_func  Function for printing elements (can be nullptr -> per byte print)
- * @param[in]  hash_func   Hash function (can be nullptr -> djb2)
+ * @param[in]  hash_func   Hash function (can be nullptr -> STACK_DEFAULT_HASH, hash_find gives one by name)
+ * @param[in]  level       Verification level (see stack_set_verify_level)
+ * @param[in]  growth      Growth policy (can be nullptr -> STACK_DEFAULT_GROWTH, see stack_set_growth)
+ * @param[in]  alloc       Allocation options (can be nullptr -> STACK_ALLOC_DEFAULT without capacity limit)
  *
  * @return     Error flags (bitor of res enum)
  */
-err_flags __stack_ctor (stack_t *stk, size_t obj_size, size_t capacity = 0, elem_print_f print_func = nullptr, hash_f hash_func = nullptr);
+err_flags __stack_ctor (stack_t *stk, size_t obj_size, size_t capacity = 0, elem_print_f print_func = nullptr, hash_f hash_func = nullptr,
+                        verify_level level = STACK_DEFAULT_VERIFY_LEVEL, const stack_growth_t *growth = nullptr,
+                        const stack_alloc_t *alloc = nullptr);
 
 #ifndef NDEBUG
     err_flags __stack_ctor_with_debug (stack_t *stk, const stack_debug_t *debug_data,
-                                    size_t obj_size, size_t capacity = 0, elem_print_f print_func = nullptr, hash_f hash_func = nullptr);
+                                    size_t obj_size, size_t capacity = 0, elem_print_f print_func = nullptr, hash_f hash_func = nullptr,
+                                    verify_level level = STACK_DEFAULT_VERIFY_LEVEL, const stack_growth_t *growth = nullptr,
+                                    const stack_alloc_t *alloc = nullptr);
 
     #define stack_ctor(stk, obj_size, ...)                                          \
     {                                                                               \
@@ -175,6 +486,14 @@ err_flags __stack_ctor (stack_t *stk, size_t obj_size, size_t capacity = 0, elem
 
 #endif
 
+/**
+ * @brief      Change stack capacity
+ * 
+ * BACKING_RESERVED stacks commit or decommit pages of their reservation in place,
+ * so data pointer never changes, others realloc (mremap) data.
+ *
+ * @return     Error flags (bitor of res enum), BAD_CAPACITY if new_capacity < reserved, NOMEM if > max_capacity
+ */
 err_flags stack_resize (stack_t *stk, size_t new_capacity);
 
 err_flags stack_shrink_to_fit (stack_t *stk);
@@ -183,8 +502,99 @@ err_flags stack_push (stack_t *stk, const void *value);
 
 err_flags stack_pop (stack_t *stk, void *value);
 
+/**
+ * @brief      First half of stack_push: grow if needed and give writable slot for the new top
+ * 
+ * Caller writes obj_size bytes to *slot and calls stack_push_commit, no other operations on stk in between.
+ * Lets typed front ends (typed_stack.h) copy elements with compile-time size.
+ *
+ * @param      stk   Stack
+ * @param[out] slot  Slot for the new element
+ *
+ * @return     Error flags (bitor of res enum)
+ */
+err_flags stack_push_slot (stack_t *stk, void **slot);
+
+/// Second half of stack_push: lock data, update size, hashes & struct copy
+err_flags stack_push_commit (stack_t *stk);
+
+/**
+ * @brief      First half of stack_pop: give top element to read before stack_pop_commit
+ *
+ * @param      stk   Stack
+ * @param[out] slot  Top element
+ *
+ * @return     Error flags (bitor of res enum), EMPTY on empty stack
+ */
+err_flags stack_pop_slot (stack_t *stk, const void **slot);
+
+/// Second half of stack_pop: drop top element (poison, rehash, shrink)
+err_flags stack_pop_commit (stack_t *stk);
+
+/**
+ * @brief      stack_pop_slot for callers poisoning the top slot themselves
+ * 
+ * Gives writable top slot: caller reads it, fills obj_size bytes of it with POISON_BYTE (with STACK_KSP_PROTECT)
+ * and calls stack_pop_commit_poisoned, no other operations on stk in between.
+ * Lets typed front ends (typed_stack.h) poison with compile-time size.
+ *
+ * @return     Error flags (bitor of res enum), EMPTY on empty stack
+ */
+err_flags stack_pop_slot_poison (stack_t *stk, void **slot);
+
+/// Second half of stack_pop_slot_poison: lock data, update size, hashes & struct copy, shrink
+err_flags stack_pop_commit_poisoned (stack_t *stk);
+
+/**
+ * @brief      Push n elements from src (src[0] is pushed first)
+ * 
+ * Resizes at most once, copies with one memcpy and updates hashes once.
+ *
+ * @return     Error flags (bitor of res enum)
+ */
+err_flags stack_push_n (stack_t *stk, const void *src, size_t n);
+
+/**
+ * @brief      Pop n elements to dst in LIFO order (dst[0] is the former top)
+ * 
+ * Poisons vacated range in one pass and shrinks at most once. Pops nothing if size < n.
+ *
+ * @return     Error flags (bitor of res enum), EMPTY if size < n
+ */
+err_flags stack_pop_n (stack_t *stk, void *dst, size_t n);
+
 err_flags stack_dtor (stack_t *stk);
 
+/**
+ * @brief      Durability point of STACK_ALLOC_FILE stack: msync header & data (no-op for other backings)
+ * 
+ * File header follows every operation in page cache, so stack survives crash of its process.
+ * Only synced states survive power loss, destructor syncs too.
+ *
+ * @return     Error flags (bitor of res enum), IO_ERROR if msync failed
+ */
+err_flags stack_sync (stack_t *stk);
+
+/**
+ * @brief      Begin write session
+ * 
+ * Unlocks data once (STACK_MEMORY_PROTECT) and defers hash & struct copy updates until
+ * stack_write_commit, so a batch of pushes & pops costs no mprotect calls and no rehashing.
+ * Struct copy stays read-only: its shadow page holds copies of other stacks too.
+ * Inside session only O(1) checks are done, full stack_verify reports stale hashes & copy.
+ * Sessions can be nested, the outermost commit finishes the session.
+ *
+ * @return     Error flags (bitor of res enum)
+ */
+err_flags stack_write_begin (stack_t *stk);
+
+/**
+ * @brief      Finish write session: rehash, lock memory and verify stack once
+ *
+ * @return     Error flags (bitor of res enum)
+ */
+err_flags stack_write_commit (stack_t *stk);
+
 void stack_dump (stack_t *stk, FILE *stream);
 
 ///@brief      Print errors description with given prefix to stream
@@ -192,32 +602,151 @@ void stack_perror (err_flags errors, FILE *stream, const char *prefix = nullptr)
 
 err_flags stack_verify (stack_t *stk_mutable); // We need mutable stk for hash
 
+/// O(1) subset of stack_verify: bounds, canaries and poisoned data pointer
+err_flags stack_verify_fast (const stack_t *stk);
+
+/**
+ * @brief      Verify stack according to its verification level (used by stack_assert)
+ * 
+ * VERIFY_SAMPLED stacks count every call (two per public operation) and run full stack_verify
+ * when period_ops calls or period_us microseconds have passed since the last full check.
+ *
+ * @return     Error flags (bitor of res enum)
+ */
+err_flags stack_check (stack_t *stk);
+
+/**
+ * @brief      Check due now by verification settings (shared with policy_stack)
+ * 
+ * VERIFY_SAMPLED counts the call and gives VERIFY_FULL when period_ops calls or period_us microseconds
+ * have passed since the last full check (resetting state), VERIFY_CHEAP otherwise. Other levels are returned as they are.
+ */
+verify_level stack_verify_due (const stack_verify_cfg_t *cfg, stack_verify_state_t *state);
+
+/**
+ * @brief      Change stack verification level
+ *
+ * @param      stk         Stack
+ * @param[in]  level       New verification level
+ * @param[in]  period_ops  VERIFY_SAMPLED: full check period in checks (0 and period_us = 0 -> STACK_DEFAULT_VERIFY_PERIOD)
+ * @param[in]  period_us   VERIFY_SAMPLED: full check period in microseconds (0 -> disabled)
+ *
+ * @return     Error flags (bitor of res enum)
+ */
+err_flags stack_set_verify_level (stack_t *stk, verify_level level, unsigned int period_ops = 0, uint64_t period_us = 0);
+
+/**
+ * @brief      Change stack growth & shrink policy
+ * 
+ * Takes effect on the next push or pop, current capacity is kept.
+ *
+ * @param      stk     Stack
+ * @param[in]  growth  New policy (grow_num > grow_den > 0)
+ *
+ * @return     Error flags (bitor of res enum), BAD_CAPACITY on invalid growth factor
+ */
+err_flags stack_set_growth (stack_t *stk, const stack_growth_t *growth);
+
+/**
+ * @brief      Attach flight recorder to stack (STACK_TRACE)
+ * 
+ * Several stacks can share one recorder (stack_trace_global). Attaching writes TRACE_ATTACH record
+ * with current size & capacity, so replay starts from the right state.
+ *
+ * @param      stk    Stack
+ * @param      trace  Recorder (nullptr -> detach), must outlive stack or be detached
+ *
+ * @return     Error flags (bitor of res enum)
+ */
+err_flags stack_set_trace (stack_t *stk, stack_trace_t *trace);
+
+/**
+ * @brief      Memory committed by stack
+ * 
+ * Committed bytes include canaries, page rounding of mmap backed data (minimum capacity of
+ * STACK_MEMORY_PROTECT), pool size class rounding and shadow slot of struct copy, not stack_t itself.
+ */
+stack_memory_t stack_memory (const stack_t *stk);
+
+/**
+ * @brief      Totals of all live stacks (STACK_STATS, zeros without it)
+ *
+ * Sizes, capacities and counters of stacks are plain fields of their owners: totals are exact
+ * only when no other thread operates on registered stacks during the call.
+ */
+stack_registry_stats_t stack_registry_stats ();
+
+/// Print live stacks with their memory & counters, then totals (STACK_STATS, same restriction as stack_registry_stats)
+void stack_registry_dump (FILE *stream);
+
 /// Print element bytes
 void byte_fprintf (const void *elem, size_t elem_size, FILE *stream);
 
-// ---------------- Macros ----------------
+// ---------------- Shared layers ----------------
+// Layout-independent parts of stack_t protections, reused by other front ends (policy_stack)
 
-#ifndef NDEBUG
+/**
+ * @brief      Capacity fitting min_capacity by growth policy, counts pushed elements in state
+ *
+ * @param[out] new_capacity  Capacity to resize to (capacity if it fits already)
+ *
+ * @return     Error flags (bitor of res enum), NOMEM if min_capacity > max_capacity (0 -> unlimited)
+ */
+err_flags stack_growth_grow (const stack_growth_t *growth, stack_growth_state_t *state, size_t size, size_t capacity,
+                             size_t max_capacity, size_t min_capacity, size_t *new_capacity);
 
-    #define stack_assert(stk)                                   \
-    {                                                           \
-        err_flags check_res = stack_verify(stk);                \
-        if (check_res != res::OK)                               \
-        {                                                       \
-            log(log::ERR,                                       \
-                "Failed stack check with err flags: ");         \
-            stack_perror (check_res, get_log_stream(), "->");   \
-            stack_dump(stk, get_log_stream());                  \
-            return check_res;                                   \
-        }                                                       \
-    }                                   
+/// Capacity to shrink to after popped elements by growth policy & hysteresis (capacity -> keep it)
+size_t stack_growth_shrink (const stack_growth_t *growth, stack_growth_state_t *state,
+                            size_t size, size_t capacity, size_t reserved, size_t popped);
 
-#else
+/// Growth factor check: grow_num > grow_den > 0
+bool stack_growth_is_valid (const stack_growth_t *growth);
 
-    #define stack_assert(stk) {;}
+/// Write canaries before data and after its data_bytes (may be unaligned)
+void stack_canaries_set (void *data, size_t data_bytes);
 
-#endif
+/// Both canaries around data of data_bytes are intact
+bool stack_canaries_ok (const void *data, size_t data_bytes);
+
+/// "Enabled security options" part of dump (hash_func = nullptr -> hash protection disabled)
+void stack_dump_protection (FILE *stream, bool memory, bool canary, hash_f hash_func, bool ksp);
+
+/// Data part of dump: used elements (all slots with VERBOSE_DUMP_LEVEL), poisoned ones marked if ksp
+void stack_dump_data (FILE *stream, const void *data, size_t size, size_t capacity, size_t obj_size,
+                      elem_print_f print_func, bool ksp);
+
+/// Page size (1 without mmap)
+size_t stack_page_size ();
+
+/// Anonymous read-write mapping (calloc without mmap), nullptr on failure
+void *stack_pages_alloc (size_t bytes);
+
+/// Resize mapping, data may move (realloc without mmap), nullptr on failure
+void *stack_pages_realloc (void *mem, size_t old_bytes, size_t new_bytes);
+
+/// Unmap (free without mmap)
+void stack_pages_free (void *mem, size_t bytes);
+
+/// mprotect mapping read-only or read-write (no-op without mmap)
+void stack_pages_protect (void *mem, size_t bytes, bool writable);
+
+// ---------------- Macros ----------------
 
-#define UNWRAP(val) { if (val != res::OK) { return val; } }
+#define stack_assert(stk)                                   \
+{                                                           \
+    err_flags check_res = stack_check(stk);                 \
+    if (check_res != res::OK)                               \
+    {                                                       \
+        log(log::ERR,                                       \
+            "Failed stack check with err flags: ");         \
+        stack_perror (check_res, get_log_stream(), "->");   \
+        stack_dump(stk, get_log_stream());                  \
+        return check_res;                                   \
+    }                                                       \
+}
+
+#define UNWRAP(val) { err_flags unwrap_res = (val); if (unwrap_res != res::OK) { return unwrap_res; } }
+
+STACK_NAMESPACE_END
 
 #endif // STACK_H
\ No newline at end of file
@@ -0,0 +1,355 @@
+#include <assert.h>
+#include <string.h>
+#include "stack.h"
+
+#if (__linux__ || __unix__)
+#define STACK_HAS_MMAP 1
+#include <sys/mman.h>
+#else
+#define STACK_HAS_MMAP 0
+#endif
+
+STACK_NAMESPACE_BEGIN
+
+// ---- ---- ---- --- CONSTS ---- ---- ---- ----
+
+/// Size class of blocks bigger than the largest class
+const size_t NO_CLASS = STACK_POOL_CLASSES;
+
+/// Front canary laid in every block
+const size_t BLOCK_CANARY_SIZE = STACK_DUNGEON_MASTER_PROTECT ? sizeof (dungeon_master_t) : 0;
+
+// ---- ---- ---- --- PROTOTYPES ---- ---- ---- ----
+
+static size_t size_class  (size_t size);
+static size_t block_bytes (size_t cls, size_t size);
+
+static void *block_new    (size_t bytes);
+static void  block_delete (void *block, size_t bytes);
+
+static void *pool_take (stack_pool_t *pool, size_t cls);
+static bool  pool_put  (stack_pool_t *pool, size_t cls, void *block);
+
+static inline void pool_lock   (stack_pool_t *pool);
+static inline void pool_unlock (stack_pool_t *pool);
+
+static stack_pool_t *shared_pool_init ();
+
+// ---- ---- ---- --- THREAD-LOCAL POOL ---- ---- ---- ----
+
+namespace
+{
+    /// Holder of this thread is destroyed (trivial type: readable in any later destructor)
+    thread_local bool local_pool_gone = false;
+
+    /// Pool of one thread, flushed to shared pool on thread exit
+    struct local_pool_holder
+    {
+        stack_pool_t pool;
+
+        local_pool_holder (): pool ()
+        {
+            stack_pool_ctor (&pool, stack_pool_shared ());
+        }
+
+        local_pool_holder (const local_pool_holder &) = delete;
+        local_pool_holder &operator= (const local_pool_holder &) = delete;
+
+        ~local_pool_holder ()
+        {
+            local_pool_gone = true;
+            stack_pool_dtor (&pool);
+        }
+    };
+}
+
+// ------------------------------------------------------------------------------------
+
+void stack_pool_ctor (stack_pool_t *pool, stack_pool_t *fallback, bool shared)
+{
+    assert (pool != nullptr && "pointer can't be null");
+    assert (pool != fallback && "pool can't be its own fallback");
+
+    memset (pool->counts, 0, sizeof (pool->counts));
+    pool->fallback = fallback;
+    pool->shared   = shared;
+    pool->stats    = {};
+
+    if (shared) pthread_mutex_init (&pool->lock, nullptr);
+}
+
+// ------------------------------------------------------------------------------------
+
+void stack_pool_dtor (stack_pool_t *pool)
+{
+    assert (pool != nullptr && "pointer can't be null");
+
+    for (size_t cls = 0; cls < STACK_POOL_CLASSES; ++cls)
+    {
+        for (size_t i = 0; i < pool->counts[cls]; ++i)
+        {
+            void *block = pool->blocks[cls][i];
+
+            if (pool->fallback == nullptr || !pool_put (pool->fallback, cls, block))
+            {
+                block_delete (block, block_bytes (cls, 0));
+            }
+        }
+
+        pool->counts[cls] = 0;
+    }
+
+    pool->stats.cached_blocks = 0;
+    pool->stats.cached_bytes  = 0;
+
+    if (pool->shared) pthread_mutex_destroy (&pool->lock);
+}
+
+// ------------------------------------------------------------------------------------
+
+stack_pool_t *stack_pool_local ()
+{
+    // Stacks destroyed after thread exit (static ones, other TLS destructors) return buffers to shared pool
+    if (local_pool_gone) return stack_pool_shared ();
+
+    static thread_local local_pool_holder holder;
+
+    return &holder.pool;
+}
+
+// ------------------------------------------------------------------------------------
+
+stack_pool_t *stack_pool_shared ()
+{
+    // Never destroyed: stacks destructed at exit still return their buffers into it
+    static stack_pool_t *const shared = shared_pool_init ();
+
+    return shared;
+}
+
+// ------------------------------------------------------------------------------------
+
+void *stack_pool_alloc (stack_pool_t *pool, size_t size)
+{
+    assert (pool != nullptr && "pointer can't be null");
+
+    size_t cls = size_class (size);
+    void *block = nullptr;
+
+    if (cls != NO_CLASS)
+    {
+        block = pool_take (pool, cls);
+
+        if (block == nullptr && pool->fallback != nullptr)
+        {
+            block = pool_take (pool->fallback, cls);
+        }
+    }
+
+    pool_lock (pool);
+    if (block != nullptr) pool->stats.hits++;
+    else                  pool->stats.misses++;
+    pool_unlock (pool);
+
+    if (block != nullptr) return block;
+
+    return block_new (block_bytes (cls, size));
+}
+
+// ------------------------------------------------------------------------------------
+
+void stack_pool_free (stack_pool_t *pool, void *block, size_t size, size_t used)
+{
+    assert (pool  != nullptr && "pointer can't be null");
+    assert (block != nullptr && "pointer can't be null");
+
+    size_t cls = size_class (size);
+
+    #if STACK_KSP_PROTECT
+        used = (used < block_bytes (cls, size)) ? used : block_bytes (cls, size);
+        if (used > BLOCK_CANARY_SIZE)
+        {
+            poison_fill ((char *) block + BLOCK_CANARY_SIZE, used - BLOCK_CANARY_SIZE);
+        }
+    #else
+        (void) used;
+    #endif
+
+    if (cls == NO_CLASS)
+    {
+        block_delete (block, size);
+        return;
+    }
+
+    if (pool_put (pool, cls, block)) return;
+    if (pool->fallback != nullptr && pool_put (pool->fallback, cls, block)) return;
+
+    block_delete (block, block_bytes (cls, size));
+}
+
+// ------------------------------------------------------------------------------------
+
+bool stack_pool_same_block (size_t size1, size_t size2)
+{
+    size_t cls = size_class (size1);
+
+    return (cls != NO_CLASS) ? cls == size_class (size2) : size1 == size2;
+}
+
+// ------------------------------------------------------------------------------------
+
+size_t stack_pool_block_size (size_t size)
+{
+    return block_bytes (size_class (size), size);
+}
+
+// ------------------------------------------------------------------------------------
+
+stack_pool_stats_t stack_pool_stats (stack_pool_t *pool)
+{
+    assert (pool != nullptr && "pointer can't be null");
+
+    pool_lock (pool);
+    stack_pool_stats_t stats = pool->stats;
+    pool_unlock (pool);
+
+    return stats;
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Smallest class with blocks of at least size bytes (NO_CLASS if there is none)
+static size_t size_class (size_t size)
+{
+    size_t cls = 0;
+
+    while (cls < STACK_POOL_CLASSES && ((size_t) STACK_POOL_MIN_BLOCK << cls) < size)
+    {
+        cls++;
+    }
+
+    return cls;
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Block size of class (size itself for NO_CLASS)
+static size_t block_bytes (size_t cls, size_t size)
+{
+    return (cls != NO_CLASS) ? (size_t) STACK_POOL_MIN_BLOCK << cls : size;
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Allocate poisoned block with front canary (page aligned mapping for memory protection)
+static void *block_new (size_t bytes)
+{
+    #if STACK_MEMORY_PROTECT && STACK_HAS_MMAP
+        void *block = mmap (nullptr, bytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (block == MAP_FAILED) return nullptr;
+    #else
+        void *block = calloc (bytes, 1);
+        if (block == nullptr) return nullptr;
+    #endif
+
+    #if STACK_KSP_PROTECT
+        poison_fill (block, bytes);
+    #endif
+
+    #if STACK_DUNGEON_MASTER_PROTECT
+        memcpy (block, &dungeon_master_val, sizeof (dungeon_master_t));
+    #endif
+
+    return block;
+}
+
+// ------------------------------------------------------------------------------------
+
+static void block_delete (void *block, size_t bytes)
+{
+    #if STACK_MEMORY_PROTECT && STACK_HAS_MMAP
+        munmap (block, bytes);
+    #else
+        (void) bytes;
+        free (block);
+    #endif
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Take cached block of class (nullptr if there is none)
+static void *pool_take (stack_pool_t *pool, size_t cls)
+{
+    assert (pool != nullptr && "pointer can't be null");
+    assert (cls < STACK_POOL_CLASSES);
+
+    void *block = nullptr;
+
+    pool_lock (pool);
+
+    if (pool->counts[cls] > 0)
+    {
+        block = pool->blocks[cls][--pool->counts[cls]];
+
+        pool->stats.cached_blocks--;
+        pool->stats.cached_bytes -= block_bytes (cls, 0);
+    }
+
+    pool_unlock (pool);
+
+    return block;
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Cache block of class (false if class cache is full)
+static bool pool_put (stack_pool_t *pool, size_t cls, void *block)
+{
+    assert (pool  != nullptr && "pointer can't be null");
+    assert (block != nullptr && "pointer can't be null");
+    assert (cls < STACK_POOL_CLASSES);
+
+    bool cached = false;
+
+    pool_lock (pool);
+
+    if (pool->counts[cls] < STACK_POOL_DEPTH)
+    {
+        pool->blocks[cls][pool->counts[cls]++] = block;
+
+        pool->stats.cached_blocks++;
+        pool->stats.cached_bytes += block_bytes (cls, 0);
+        cached = true;
+    }
+
+    pool_unlock (pool);
+
+    return cached;
+}
+
+// ------------------------------------------------------------------------------------
+
+static inline void pool_lock (stack_pool_t *pool)
+{
+    if (pool->shared) pthread_mutex_lock (&pool->lock);
+}
+
+// ------------------------------------------------------------------------------------
+
+static inline void pool_unlock (stack_pool_t *pool)
+{
+    if (pool->shared) pthread_mutex_unlock (&pool->lock);
+}
+
+// ------------------------------------------------------------------------------------
+
+static stack_pool_t *shared_pool_init ()
+{
+    static stack_pool_t shared_pool = {};
+
+    stack_pool_ctor (&shared_pool, nullptr, true);
+
+    return &shared_pool;
+}
+
+STACK_NAMESPACE_END
@@ -0,0 +1,97 @@
+#ifndef STACK_POOL_H
+#define STACK_POOL_H
+
+#include <stdlib.h>
+#include <pthread.h>
+#include "variant.h"
+
+STACK_NAMESPACE_BEGIN
+
+#ifndef STACK_POOL_MIN_BLOCK
+/// Smallest pooled block (bytes), size classes are STACK_POOL_MIN_BLOCK << class
+#define STACK_POOL_MIN_BLOCK            64
+#endif
+
+#ifndef STACK_POOL_CLASSES
+/// Size classes count: bigger blocks are allocated and freed directly
+#define STACK_POOL_CLASSES              16
+#endif
+
+#ifndef STACK_POOL_DEPTH
+/// Cached blocks per size class in one pool, surplus goes to fallback pool or is freed
+#define STACK_POOL_DEPTH                32
+#endif
+
+/// Pool statistics
+struct stack_pool_stats_t
+{
+    size_t hits;                        /// Allocations served from cache (own or fallback pool one)
+    size_t misses;                      /// Allocations of new blocks
+    size_t cached_blocks;               /// Blocks in cache
+    size_t cached_bytes;                /// Bytes in cache
+};
+
+/**
+ * @brief Pool of stack data buffers
+ *
+ * Keeps freed data buffers in per size class caches instead of unmapping them. Cached blocks are
+ * fully poisoned (STACK_KSP_PROTECT) with front canary already in place (STACK_DUNGEON_MASTER_PROTECT),
+ * so stack constructed from pool neither allocates nor poisons its buffer.
+ * Private pools are not thread safe, shared ones lock a mutex. Empty private pool takes blocks from
+ * its fallback pool and gives surplus to it.
+ */
+struct stack_pool_t
+{
+    void *blocks[STACK_POOL_CLASSES][STACK_POOL_DEPTH];     /// Cached blocks by size class
+    size_t counts[STACK_POOL_CLASSES];                      /// Cached blocks count by size class
+    stack_pool_t *fallback;                                 /// Pool for misses & surplus (can be nullptr)
+    bool shared;                                            /// Is locked by mutex
+    pthread_mutex_t lock;                                   /// Mutex of shared pool
+    stack_pool_stats_t stats;                               /// Statistics
+};
+
+/**
+ * @brief      Pool constructor
+ *
+ * @param[out] pool      Pool
+ * @param[in]  fallback  Pool for misses & surplus (can be nullptr)
+ * @param[in]  shared    Lock pool by mutex for use from several threads
+ */
+void stack_pool_ctor (stack_pool_t *pool, stack_pool_t *fallback = nullptr, bool shared = false);
+
+/// Give cached blocks to fallback pool (free them if there is none)
+void stack_pool_dtor (stack_pool_t *pool);
+
+/// Pool of calling thread (falls back to stack_pool_shared, flushed to it on thread exit, replaced by it after)
+stack_pool_t *stack_pool_local ();
+
+/// Process-wide shared pool
+stack_pool_t *stack_pool_shared ();
+
+/**
+ * @brief      Take block of at least size bytes
+ *
+ * Blocks bigger than the largest size class are allocated directly (counted as misses).
+ *
+ * @return     Poisoned block with front canary or nullptr if out of memory
+ */
+void *stack_pool_alloc (stack_pool_t *pool, size_t size);
+
+/**
+ * @brief      Return block taken with stack_pool_alloc (size is the same as given to it or in the same class)
+ *
+ * @param[in]  used  Bytes from block start that can be non-poisoned
+ */
+void stack_pool_free (stack_pool_t *pool, void *block, size_t size, size_t used);
+
+/// Are size1 and size2 served by one block
+bool stack_pool_same_block (size_t size1, size_t size2);
+
+/// Bytes of block serving size (size class or size itself)
+size_t stack_pool_block_size (size_t size);
+
+stack_pool_stats_t stack_pool_stats (stack_pool_t *pool);
+
+STACK_NAMESPACE_END
+
+#endif // STACK_POOL_H
@@ -1,5 +1,17 @@
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <thread>
+#include <atomic>
 #include "stack.h"
+#include "typed_stack.h"
+#include "policy_stack.h"
+#include "seg_stack.h"
+#include "small_stack.h"
+#include "cstack.h"
+#include "ws_deque.h"
 #include "test.h"
 
 #define R "\033[91m"
@@ -47,6 +59,13 @@
 
 // ----- TESTS ------
 
+/// Thread-local pool stack destroyed after pool holder of its thread (constructed before it)
+struct late_pool_stack
+{
+    stack_t stk = {};
+    ~late_pool_stack () { stack_dtor (&stk); }
+};
+
 int test_stack_ctor_notinit ()
 {
     stack_t stk;
@@ -186,6 +205,1441 @@ int test_stack_push_pop_auto_shrink ()
     return 0;
 }
 
+int test_stack_hash_detects_corruption ()
+{
+    stack_t stk = {};
+    stack_ctor (&stk, sizeof (int), 4);
+
+    for (int i = 0; i < 100; ++i)
+    {
+        _ASSERT (stack_push (&stk, &i) == res::OK);
+    }
+
+    int tmp = 0;
+    for (int i = 0; i < 50; ++i)
+    {
+        _ASSERT (stack_pop (&stk, &tmp) == res::OK);
+    }
+
+    _ASSERT (stack_verify (&stk) == res::OK);
+
+    #if STACK_HASH_PROTECT
+        int *slot = (int *) stk.data + 10;
+
+        // Data is read-only between operations: open the slot's page for the corruption
+        #if STACK_MEMORY_PROTECT
+            void *page = (void *) ((uintptr_t) slot / stk.page_size * stk.page_size);
+            stack_pages_protect (page, stk.page_size, true);
+        #endif
+
+        *slot ^= 1;
+        _ASSERT (stack_verify (&stk) & res::DATA_CORRUPTED);
+        *slot ^= 1;
+
+        #if STACK_MEMORY_PROTECT
+            stack_pages_protect (page, stk.page_size, false);
+        #endif
+
+        _ASSERT (stack_verify (&stk) == res::OK);
+    #endif
+
+    stack_dtor (&stk);
+    return 0;
+}
+
+int test_stack_verify_levels ()
+{
+    stack_t stk = {};
+    stack_ctor (&stk, sizeof (int), 4, nullptr, nullptr, VERIFY_SAMPLED);
+
+    _ASSERT (stk.verify.level == VERIFY_SAMPLED);
+    _ASSERT (stk.verify.period_ops == STACK_DEFAULT_VERIFY_PERIOD);
+
+    for (int i = 0; i < 100; ++i)
+    {
+        _ASSERT (stack_push (&stk, &i) == res::OK);
+    }
+
+    _ASSERT (stack_set_verify_level (&stk, VERIFY_CHEAP) == res::OK);
+    _ASSERT (stack_verify (&stk) == res::OK);
+
+    int tmp = 0;
+    for (int i = 99; i >= 50; --i)
+    {
+        _ASSERT (stack_pop (&stk, &tmp) == res::OK);
+        _ASSERT (tmp == i);
+    }
+
+    #if STACK_HASH_PROTECT
+        // Sampled full check catches corruption of an untouched slot within one period
+        const unsigned int period = 8;
+        _ASSERT (stack_set_verify_level (&stk, VERIFY_SAMPLED, period) == res::OK);
+
+        int *slot = (int *) stk.data + 10;
+        #if STACK_MEMORY_PROTECT
+            void *page = (void *) ((uintptr_t) slot / stk.page_size * stk.page_size);
+            stack_pages_protect (page, stk.page_size, true);
+        #endif
+        *slot ^= 1;
+
+        unsigned int ops = 0;
+        err_flags check_res = res::OK;
+        while (check_res == res::OK && ops < period)
+        {
+            check_res = (ops % 2 == 0) ? stack_push (&stk, &tmp) : stack_pop (&stk, &tmp);
+            ops++;
+        }
+        _ASSERT (check_res & res::DATA_CORRUPTED);
+
+        // Operations lock data again
+        #if STACK_MEMORY_PROTECT
+            stack_pages_protect (page, stk.page_size, true);
+        #endif
+        *slot ^= 1;
+        #if STACK_MEMORY_PROTECT
+            stack_pages_protect (page, stk.page_size, false);
+        #endif
+        _ASSERT (stack_verify (&stk) == res::OK);
+    #endif
+
+    _ASSERT (stack_set_verify_level (&stk, VERIFY_SAMPLED, 0, 1000) == res::OK);
+    _ASSERT (stk.verify.period_ops == 0);
+    _ASSERT (stack_push (&stk, &tmp) == res::OK);
+
+    _ASSERT (stack_set_verify_level (&stk, VERIFY_OFF) == res::OK);
+    _ASSERT (stack_push (&stk, &tmp) == res::OK);
+    _ASSERT (stack_verify (&stk) == res::OK);
+
+    stack_dtor (&stk);
+    return 0;
+}
+
+int test_stack_write_session ()
+{
+    stack_t stk = {};
+    stack_ctor (&stk, sizeof (int), 4);
+
+    _ASSERT (stack_write_begin (&stk) == res::OK);
+
+    for (int i = 0; i < 300; ++i)
+    {
+        _ASSERT (stack_push (&stk, &i) == res::OK);
+    }
+
+    // Shared shadow page of struct copy stays read-only during session
+    _ASSERT_IFMEM (stk.copy_page->writers == 0);
+
+    _ASSERT (stack_write_begin  (&stk) == res::OK);
+    _ASSERT (stack_write_commit (&stk) == res::OK);
+
+    int tmp = 0;
+    for (int i = 299; i >= 100; --i)
+    {
+        _ASSERT (stack_pop (&stk, &tmp) == res::OK);
+        _ASSERT (tmp == i);
+    }
+
+    _ASSERT (stack_write_commit (&stk) == res::OK);
+    _ASSERT (stk.write_depth == 0);
+    _ASSERT (stk.size == 100);
+    _ASSERT (stack_verify (&stk) == res::OK);
+
+    _ASSERT (stack_pop (&stk, &tmp) == res::OK);
+    _ASSERT (tmp == 99);
+
+    stack_dtor (&stk);
+    return 0;
+}
+
+int test_stack_push_pop_n ()
+{
+    stack_t stk = {};
+    stack_ctor (&stk, sizeof (int), 4);
+
+    const int count = 500;
+    int src[count] = {};
+    for (int i = 0; i < count; ++i) src[i] = i;
+
+    _ASSERT (stack_push_n (&stk, src, count) == res::OK);
+    _ASSERT (stk.size == count);
+    _ASSERT_IFNMEM (stk.capacity == 512);
+
+    int dst[count] = {};
+    _ASSERT (stack_pop_n (&stk, dst, 10) == res::OK);
+    for (int i = 0; i < 10; ++i)
+    {
+        _ASSERT (dst[i] == count - 1 - i);
+    }
+
+    _ASSERT (stack_pop_n (&stk, dst, count) == res::EMPTY);
+    _ASSERT (stk.size == count - 10);
+
+    _ASSERT (stack_pop_n (&stk, dst, count - 20) == res::OK);
+    _ASSERT (stk.size == 10);
+    _ASSERT (dst[count - 21] == 10);
+    _ASSERT_IFNMEM (stk.capacity == 32);
+
+    int tmp = 0;
+    _ASSERT (stack_pop (&stk, &tmp) == res::OK);
+    _ASSERT (tmp == 9);
+
+    stack_dtor (&stk);
+    return 0;
+}
+
+int test_stack_growth_policy ()
+{
+    int tmp = 0;
+
+    // Growth factor 3/2
+    const stack_growth_t slow_growth = {3, 2, 4, 0, 0};
+    stack_t grow_stk = {};
+    stack_ctor (&grow_stk, sizeof (int), 4, nullptr, nullptr, STACK_DEFAULT_VERIFY_LEVEL, &slow_growth);
+
+    for (int i = 0; i < 7; ++i)
+    {
+        _ASSERT (stack_push (&grow_stk, &i) == res::OK);
+    }
+    _ASSERT_IFNMEM (grow_stk.capacity == 9);
+    stack_dtor (&grow_stk);
+
+    // Shrink delay: shrink only after the third pop with 1/4 load
+    stack_t stk = {};
+    stack_ctor (&stk, sizeof (int), 4);
+
+    const stack_growth_t delayed = {2, 1, 4, 2, 0};
+    _ASSERT (stack_set_growth (&stk, &delayed) == res::OK);
+
+    for (int i = 0; i < 32; ++i)
+    {
+        _ASSERT (stack_push (&stk, &i) == res::OK);
+    }
+    _ASSERT_IFNMEM (stk.capacity == 32);
+
+    while (stk.size > 7)
+    {
+        _ASSERT (stack_pop (&stk, &tmp) == res::OK);
+    }
+    _ASSERT_IFNMEM (stk.capacity == 32);
+
+    _ASSERT (stack_pop (&stk, &tmp) == res::OK);
+    _ASSERT (tmp == 6);
+    _ASSERT_IFNMEM (stk.capacity == 16);
+
+    // Shrink interval: no shrink right after growth
+    const stack_growth_t lazy = {2, 1, 4, 0, 100};
+    _ASSERT (stack_set_growth (&stk, &lazy) == res::OK);
+
+    for (int i = 0; i < 26; ++i)
+    {
+        _ASSERT (stack_push (&stk, &i) == res::OK);
+    }
+    _ASSERT_IFNMEM (stk.capacity == 32);
+
+    while (stk.size > 0)
+    {
+        _ASSERT (stack_pop (&stk, &tmp) == res::OK);
+    }
+    _ASSERT_IFNMEM (stk.capacity == 32);
+
+    // Never shrink
+    _ASSERT (stack_set_growth (&stk, &STACK_NEVER_SHRINK) == res::OK);
+    for (int i = 0; i < 64; ++i)
+    {
+        _ASSERT (stack_push (&stk, &i) == res::OK);
+    }
+    for (int i = 0; i < 64; ++i)
+    {
+        _ASSERT (stack_pop (&stk, &tmp) == res::OK);
+    }
+    _ASSERT_IFNMEM (stk.capacity == 64);
+
+    const stack_growth_t invalid = {1, 1, 4, 0, 0};
+    _ASSERT (stack_set_growth (&stk, &invalid) == res::BAD_CAPACITY);
+    _ASSERT (stack_verify (&stk) == res::OK);
+
+    stack_dtor (&stk);
+    return 0;
+}
+
+int test_stack_reserve ()
+{
+    const size_t max_capacity = 1 << 16;
+    const stack_alloc_t alloc = {STACK_ALLOC_RESERVE, max_capacity, nullptr, nullptr};
+
+    stack_t stk = {};
+    stack_ctor (&stk, sizeof (int), 4, nullptr, nullptr, STACK_DEFAULT_VERIFY_LEVEL, nullptr, &alloc);
+    _ASSERT (stk.backing & BACKING_RESERVED);
+    _ASSERT (stk.max_capacity == max_capacity);
+
+    const void *data = stk.data;
+    const int count = 5000;
+
+    for (int round = 0; round < 2; ++round)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            _ASSERT (stack_push (&stk, &i) == res::OK);
+        }
+        _ASSERT (stk.data == data);
+        _ASSERT (stk.capacity >= (size_t) count);
+
+        int tmp = 0;
+        for (int i = count - 1; i >= 0; --i)
+        {
+            _ASSERT (stack_pop (&stk, &tmp) == res::OK);
+            _ASSERT (tmp == i);
+        }
+        _ASSERT (stk.data == data);
+    }
+
+    _ASSERT (stack_resize (&stk, max_capacity)     == res::OK);
+    _ASSERT (stack_resize (&stk, max_capacity + 1) == res::NOMEM);
+    _ASSERT (stk.data == data);
+    _ASSERT (stack_verify (&stk) == res::OK);
+
+    stack_dtor (&stk);
+
+    // Capacity limit without reservation
+    const stack_alloc_t limited = {STACK_ALLOC_DEFAULT, 8, nullptr, nullptr};
+    stack_t small = {};
+    stack_ctor (&small, sizeof (int), 4, nullptr, nullptr, STACK_DEFAULT_VERIFY_LEVEL, nullptr, &limited);
+
+    for (int i = 0; i < 8; ++i)
+    {
+        _ASSERT (stack_push (&small, &i) == res::OK);
+    }
+    _ASSERT_IFNMEM (small.capacity == 8);
+    int extra = 8;
+    err_flags over_limit = stack_push (&small, &extra);
+    _ASSERT_IFNMEM (over_limit == res::NOMEM);
+    _ASSERT_IFMEM  (over_limit == res::OK);
+    _ASSERT (stack_verify (&small) == res::OK);
+
+    stack_dtor (&small);
+    return 0;
+}
+
+int test_stack_huge_pages ()
+{
+    const int count = 3000;
+    int tmp = 0;
+
+    // Transparent huge pages and pre-faulting on plain mapping
+    const stack_alloc_t thp = {STACK_ALLOC_THP | STACK_ALLOC_POPULATE, 0, nullptr, nullptr};
+    stack_t stk = {};
+    stack_ctor (&stk, sizeof (int), 4, nullptr, nullptr, STACK_DEFAULT_VERIFY_LEVEL, nullptr, &thp);
+    _ASSERT (stk.backing & BACKING_MMAP);
+    _ASSERT (stk.backing & BACKING_POPULATED);
+
+    for (int i = 0; i < count; ++i)
+    {
+        _ASSERT (stack_push (&stk, &i) == res::OK);
+    }
+    for (int i = count - 1; i >= 0; --i)
+    {
+        _ASSERT (stack_pop (&stk, &tmp) == res::OK);
+        _ASSERT (tmp == i);
+    }
+    stack_dtor (&stk);
+
+    // Explicit huge pages (or transparent ones without huge page pool) always grow in reservation
+    const stack_alloc_t huge = {STACK_ALLOC_HUGETLB | STACK_ALLOC_POPULATE, 1 << 20, nullptr, nullptr};
+    stack_t huge_stk = {};
+    stack_ctor (&huge_stk, sizeof (int), 4, nullptr, nullptr, STACK_DEFAULT_VERIFY_LEVEL, nullptr, &huge);
+    _ASSERT (huge_stk.backing & BACKING_RESERVED);
+
+    const void *data = huge_stk.data;
+    for (int i = 0; i < count; ++i)
+    {
+        _ASSERT (stack_push (&huge_stk, &i) == res::OK);
+    }
+    _ASSERT (huge_stk.data == data);
+    for (int i = count - 1; i >= 0; --i)
+    {
+        _ASSERT (stack_pop (&huge_stk, &tmp) == res::OK);
+        _ASSERT (tmp == i);
+    }
+    _ASSERT (stack_verify (&huge_stk) == res::OK);
+    stack_dtor (&huge_stk);
+
+    // Without max_capacity reservation is STACK_DEFAULT_RESERVE_SIZE, not one huge page
+    const stack_alloc_t huge_unlimited = {STACK_ALLOC_HUGETLB, 0, nullptr, nullptr};
+    huge_stk = {};
+    stack_ctor (&huge_stk, sizeof (int), 4, nullptr, nullptr, VERIFY_CHEAP, nullptr, &huge_unlimited);
+    _ASSERT (huge_stk.max_capacity == STACK_DEFAULT_RESERVE_SIZE / sizeof (int));
+
+    const size_t past_huge_page = STACK_HUGE_PAGE_SIZE / sizeof (int) + 1024;
+    int *values = (int *) calloc (past_huge_page, sizeof (int));
+    _ASSERT (values != nullptr);
+
+    err_flags push_res = stack_push_n (&huge_stk, values, past_huge_page);
+    free (values);
+    _ASSERT (push_res == res::OK);
+    _ASSERT (huge_stk.size == past_huge_page);
+    _ASSERT (stack_verify (&huge_stk) == res::OK);
+    stack_dtor (&huge_stk);
+
+    return 0;
+}
+
+int test_stack_pool ()
+{
+    stack_pool_t pool = {};
+    stack_pool_ctor (&pool);
+    const stack_alloc_t alloc = {STACK_ALLOC_POOL, 0, &pool, nullptr};
+
+    const int count = 1000;
+    int tmp = 0;
+    size_t first_misses = 0;
+
+    // Second stack takes all its buffers from cache
+    for (int round = 0; round < 2; ++round)
+    {
+        stack_t stk = {};
+        stack_ctor (&stk, sizeof (int), 4, nullptr, nullptr, STACK_DEFAULT_VERIFY_LEVEL, nullptr, &alloc);
+        _ASSERT (stk.backing & BACKING_POOL);
+
+        for (int i = 0; i < count; ++i)
+        {
+            _ASSERT (stack_push (&stk, &i) == res::OK);
+        }
+        for (int i = count - 1; i >= 0; --i)
+        {
+            _ASSERT (stack_pop (&stk, &tmp) == res::OK);
+            _ASSERT (tmp == i);
+        }
+        _ASSERT (stack_verify (&stk) == res::OK);
+        stack_dtor (&stk);
+
+        if (round == 0) first_misses = stack_pool_stats (&pool).misses;
+    }
+
+    stack_pool_stats_t stats = stack_pool_stats (&pool);
+    _ASSERT (stats.misses == first_misses);
+    _ASSERT (stats.hits > 0);
+    _ASSERT (stats.cached_blocks > 0);
+    _ASSERT (stats.cached_bytes >= stats.cached_blocks * STACK_POOL_MIN_BLOCK);
+
+    stack_pool_dtor (&pool);
+    _ASSERT (stack_pool_stats (&pool).cached_bytes == 0);
+
+    // Default pool is the one of calling thread
+    const stack_alloc_t local = {STACK_ALLOC_POOL, 0, nullptr, nullptr};
+    size_t local_hits = stack_pool_stats (stack_pool_local ()).hits;
+
+    for (int round = 0; round < 2; ++round)
+    {
+        stack_t stk = {};
+        stack_ctor (&stk, sizeof (int), 4, nullptr, nullptr, STACK_DEFAULT_VERIFY_LEVEL, nullptr, &local);
+        _ASSERT (stack_push (&stk, &round) == res::OK);
+        _ASSERT (stack_pop  (&stk, &tmp)   == res::OK);
+        stack_dtor (&stk);
+    }
+    _ASSERT (stack_pool_stats (stack_pool_local ()).hits > local_hits);
+
+    // Stack freed after thread pool is gone returns its block to shared pool
+    size_t shared_cached = 0;
+    std::thread late ([&local, &shared_cached]
+    {
+        static thread_local late_pool_stack late_stk;
+        stack_ctor (&late_stk.stk, sizeof (int), 4, nullptr, nullptr, STACK_DEFAULT_VERIFY_LEVEL, nullptr, &local);
+        shared_cached = stack_pool_stats (stack_pool_shared ()).cached_blocks;
+    });
+    late.join ();
+    _ASSERT (stack_pool_stats (stack_pool_shared ()).cached_blocks == shared_cached + 1);
+
+    return 0;
+}
+
+int test_shadow_registry ()
+{
+    const int count = 8;
+    stack_t stks[count] = {};
+    size_t pages = shadow_pages ();
+
+    for (int i = 0; i < count; ++i)
+    {
+        stack_ctor (&stks[i], sizeof (int));
+    }
+
+    // Struct copies share pages
+    _ASSERT_IFMEM  (shadow_pages () - pages <= 1);
+    _ASSERT_IFNMEM (shadow_pages () == pages);
+
+    for (int round = 0; round < 100; ++round)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            _ASSERT (stack_push (&stks[i], &round) == res::OK);
+        }
+    }
+
+    int tmp = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        _ASSERT (stack_verify (&stks[i]) == res::OK);
+        _ASSERT (stack_pop (&stks[i], &tmp) == res::OK);
+        _ASSERT (tmp == 99);
+    }
+
+    #if STACK_MEMORY_PROTECT
+        // Copy in shared page still catches struct corruption
+        stks[0].reserved++;
+        _ASSERT (stack_verify (&stks[0]) & res::STRUCT_CORRUPTED);
+        stks[0].reserved--;
+        _ASSERT (stack_verify (&stks[0]) == res::OK);
+    #endif
+
+    for (int i = 0; i < count; ++i)
+    {
+        stack_dtor (&stks[i]);
+    }
+    _ASSERT (shadow_pages () == pages);
+
+    return 0;
+}
+
+int test_seg_stack ()
+{
+    seg_stack_t stk = {};
+    stack_ctor (&stk, sizeof (int), 16);
+    _ASSERT (stk.chunk_capacity == 16);
+
+    const int count = 1000;
+    for (int i = 0; i < count; ++i)
+    {
+        _ASSERT (stack_push (&stk, &i) == res::OK);
+    }
+    _ASSERT (stk.size == count);
+    _ASSERT (stk.chunks == (count + 15) / 16);
+    _ASSERT (stack_verify (&stk) == res::OK);
+
+    // Pop & push around chunk boundary reuse the spare chunk
+    int tmp = 0;
+    for (int i = count - 1; i >= 992; --i)
+    {
+        _ASSERT (stack_pop (&stk, &tmp) == res::OK);
+        _ASSERT (tmp == i);
+    }
+    _ASSERT (stk.spare != nullptr);
+
+    const stack_chunk_t *spare = stk.spare;
+    _ASSERT (stack_push (&stk, &tmp) == res::OK);
+    _ASSERT (stk.top == spare);
+    _ASSERT (stack_pop (&stk, &tmp) == res::OK);
+
+    #if STACK_HASH_PROTECT
+        int *elem = (int *) (stk.top->prev + 1);
+        *elem ^= 1;
+        _ASSERT (stack_verify (&stk) & res::DATA_CORRUPTED);
+        *elem ^= 1;
+    #endif
+    _ASSERT (stack_verify (&stk) == res::OK);
+
+    for (int i = 991; i >= 0; --i)
+    {
+        _ASSERT (stack_pop (&stk, &tmp) == res::OK);
+        _ASSERT (tmp == i);
+    }
+    _ASSERT (stk.chunks == 0);
+    _ASSERT (stack_pop (&stk, &tmp) == res::EMPTY);
+
+    stack_dtor (&stk);
+    return 0;
+}
+
+/// Pushes & pops of one thread of test_cstack: every pop follows own push, so it never sees empty stack
+static void cstack_worker (cstack_t *stk, int first, int count, std::atomic<long> *popped_sum, std::atomic<int> *errors)
+{
+    long sum = 0;
+    int tmp  = 0;
+
+    for (int i = first; i < first + count; ++i)
+    {
+        if (stack_push (stk, &i)   != res::OK) (*errors)++;
+        if (stack_pop  (stk, &tmp) != res::OK) (*errors)++;
+        sum += tmp;
+    }
+
+    *popped_sum += sum;
+}
+
+int test_cstack ()
+{
+    cstack_t stk = {};
+    stack_ctor (&stk, sizeof (int));
+
+    int tmp = 0;
+    for (int i = 0; i < 300; ++i)
+    {
+        _ASSERT (stack_push (&stk, &i) == res::OK);
+    }
+    for (int i = 299; i >= 0; --i)
+    {
+        _ASSERT (stack_pop (&stk, &tmp) == res::OK);
+        _ASSERT (tmp == i);
+    }
+    _ASSERT (stack_pop (&stk, &tmp) == res::EMPTY);
+    _ASSERT (stack_verify (&stk) == res::OK);
+
+    // Concurrent pushes & pops lose and duplicate nothing
+    const int threads = 4;
+    const int count   = 20000;
+    std::atomic<long> popped_sum = 0;
+    std::atomic<int>  errors     = 0;
+
+    std::thread workers[threads];
+    for (int t = 0; t < threads; ++t)
+    {
+        workers[t] = std::thread (cstack_worker, &stk, t*count, count, &popped_sum, &errors);
+    }
+    for (int t = 0; t < threads; ++t)
+    {
+        workers[t].join ();
+    }
+
+    long total = (long) threads*count;
+    _ASSERT (errors == 0);
+    _ASSERT (popped_sum == total*(total - 1) / 2);
+    _ASSERT (stk.size == 0);
+    _ASSERT (stack_verify (&stk) == res::OK);
+
+    #if STACK_DUNGEON_MASTER_PROTECT
+        // Corrupted node is reported by the pop that takes it
+        _ASSERT (stack_push (&stk, &tmp) == res::OK);
+
+        char *elem = nullptr;
+        for (uint32_t i = 0; i < stk.next_node; ++i)
+        {
+            // The only used node is the top one: find it among segment 0 nodes
+            cstack_node_t *node = (cstack_node_t *) (void *) (stk.segments[0].load () + i*stk.node_size);
+            if ((stk.head.load () & UINT32_MAX) == i) elem = (char *) (node + 1);
+        }
+        _ASSERT (elem != nullptr);
+
+        elem[stk.obj_size] ^= 1;
+        _ASSERT (stack_pop (&stk, &tmp) & res::DATA_CORRUPTED);
+        elem[stk.obj_size] ^= 1;
+        _ASSERT (stack_verify (&stk) == res::OK);
+    #endif
+
+    stack_dtor (&stk);
+    return 0;
+}
+
+/// Thief of test_ws_deque: steals until owner is done and deque is empty
+static void ws_thief (ws_deque_t *dq, const std::atomic<bool> *done, std::atomic<long> *taken_sum)
+{
+    long sum = 0;
+    int tmp  = 0;
+
+    while (!done->load () || dq->bottom.load () < dq->top.load ())
+    {
+        if (stack_steal (dq, &tmp) == res::OK) sum += tmp;
+    }
+
+    *taken_sum += sum;
+}
+
+int test_ws_deque ()
+{
+    ws_deque_t dq = {};
+    stack_ctor (&dq, sizeof (int), 4);
+
+    // Owner end is LIFO, steal end is FIFO, buffer grows
+    int tmp = 0;
+    for (int i = 0; i < 100; ++i)
+    {
+        _ASSERT (stack_push (&dq, &i) == res::OK);
+    }
+    _ASSERT (dq.buffer.load ()->capacity >= 100);
+    _ASSERT (stack_steal (&dq, &tmp) == res::OK && tmp == 0);
+    _ASSERT (stack_steal (&dq, &tmp) == res::OK && tmp == 1);
+    _ASSERT (stack_pop   (&dq, &tmp) == res::OK && tmp == 99);
+    _ASSERT (stack_verify (&dq) == res::OK);
+
+    for (int i = 98; i >= 2; --i)
+    {
+        _ASSERT (stack_pop (&dq, &tmp) == res::OK);
+        _ASSERT (tmp == i);
+    }
+    _ASSERT (stack_pop   (&dq, &tmp) == res::EMPTY);
+    _ASSERT (stack_steal (&dq, &tmp) == res::EMPTY);
+    _ASSERT (stack_verify (&dq) == res::OK);
+
+    // Every element is taken exactly once by owner or thieves
+    const int thieves = 3;
+    const int count   = 100000;
+    std::atomic<bool> done      = false;
+    std::atomic<long> taken_sum = 0;
+
+    std::thread workers[thieves];
+    for (int t = 0; t < thieves; ++t)
+    {
+        workers[t] = std::thread (ws_thief, &dq, &done, &taken_sum);
+    }
+
+    long owner_sum = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        _ASSERT (stack_push (&dq, &i) == res::OK);
+        if (i % 3 == 0 && stack_pop (&dq, &tmp) == res::OK) owner_sum += tmp;
+    }
+    while (stack_pop (&dq, &tmp) == res::OK) owner_sum += tmp;
+
+    done = true;
+    for (int t = 0; t < thieves; ++t)
+    {
+        workers[t].join ();
+    }
+
+    _ASSERT (owner_sum + taken_sum == (long) count*(count - 1) / 2);
+
+    // The last owner operation poisons stolen slots
+    _ASSERT (stack_pop (&dq, &tmp) == res::EMPTY);
+    _ASSERT (stack_verify (&dq) == res::OK);
+
+    stack_dtor (&dq);
+    return 0;
+}
+
+int test_typed_stack ()
+{
+    struct point_t { double x; double y; };
+
+    typed_stack<point_t> stk (2);
+    _ASSERT (stk.status () == res::OK);
+
+    for (int i = 0; i < 100; ++i)
+    {
+        _ASSERT (stk.push ({(double) i, (double) -i}) == res::OK);
+    }
+
+    _ASSERT (stk.emplace (point_t {0.5, 0.5}) == res::OK);
+    _ASSERT (stk.size () == 101);
+    _ASSERT (stk.verify () == res::OK);
+
+    point_t p = {};
+    _ASSERT (stk.pop (&p) == res::OK);
+    _ASSERT (p.x > 0.4 && p.x < 0.6);
+
+    #if STACK_KSP_PROTECT
+        // Popped slot is poisoned by typed pop itself
+        _ASSERT (poison_is_range ((const char *) stk.raw ()->data + stk.size ()*sizeof (point_t), sizeof (point_t)));
+    #endif
+    _ASSERT (stk.verify () == res::OK);
+
+    for (int i = 99; i >= 0; --i)
+    {
+        _ASSERT (stk.pop (&p) == res::OK);
+        _ASSERT ((int) p.x == i && (int) p.y == -i);
+    }
+
+    _ASSERT (stk.empty ());
+    _ASSERT (stk.pop (&p) == res::EMPTY);
+
+    // Over-aligned elements: slots are only 8-byte aligned
+    struct alignas (32) wide_t { double lanes[4]; };
+
+    typed_stack<wide_t> wide;
+    for (int i = 0; i < 5; ++i)
+    {
+        _ASSERT (wide.emplace (wide_t {{(double) i, 0, 0, (double) -i}}) == res::OK);
+    }
+
+    wide_t w = {};
+    _ASSERT (wide.pop (&w) == res::OK);
+    _ASSERT ((int) w.lanes[0] == 4 && (int) w.lanes[3] == -4);
+
+    return 0;
+}
+
+/// Data pointer of policy_stack (first field after optional struct canary)
+template <stack_protection P>
+static int *policy_data (const policy_stack<int, P> *stk)
+{
+    int *data = nullptr;
+    memcpy (&data, (const char *) stk + (P.canary ? sizeof (dungeon_master_t) : 0), sizeof (data));
+    return data;
+}
+
+int test_policy_stack ()
+{
+    static_assert (sizeof (policy_stack<int, STACK_PROTECT_NONE>) == sizeof (int *) + 3*sizeof (size_t) +
+                   sizeof (stack_growth_t) + sizeof (stack_growth_state_t), "disabled protections must take no space");
+
+    policy_stack<int, STACK_PROTECT_ALL>    hardened;
+    policy_stack<int, STACK_PROTECT_CANARY> canary (4);
+    policy_stack<int, STACK_PROTECT_NONE>   plain;
+
+    _ASSERT (hardened.status () == res::OK);
+    _ASSERT (plain.status ()    == res::OK);
+
+    for (int i = 0; i < 300; ++i)
+    {
+        _ASSERT (hardened.push (i) == res::OK);
+        _ASSERT (canary.push (i)   == res::OK);
+        _ASSERT (plain.push (i)    == res::OK);
+    }
+
+    _ASSERT (hardened.verify () == res::OK);
+    _ASSERT (canary.verify ()   == res::OK);
+    _ASSERT (plain.verify ()    == res::OK);
+
+    int a = 0, b = 0, c = 0;
+    for (int i = 299; i >= 0; --i)
+    {
+        _ASSERT (hardened.pop (&a) == res::OK);
+        _ASSERT (canary.pop (&b)   == res::OK);
+        _ASSERT (plain.pop (&c)    == res::OK);
+        _ASSERT (a == i && b == i && c == i);
+    }
+
+    _ASSERT (plain.pop (&c) == res::EMPTY);
+    _ASSERT (canary.get_capacity () == 4);
+
+    // Growth & shrink follow stack_growth_t as in stack_t
+    policy_stack<int, STACK_PROTECT_CANARY> never_shrink (4, nullptr, &STACK_NEVER_SHRINK);
+    for (int i = 0; i < 100; ++i)
+    {
+        _ASSERT (never_shrink.push (i) == res::OK);
+    }
+
+    size_t grown_capacity = never_shrink.get_capacity ();
+    for (int i = 0; i < 100; ++i)
+    {
+        _ASSERT (never_shrink.pop (&c) == res::OK);
+    }
+    _ASSERT (never_shrink.get_capacity () == grown_capacity);
+
+    // Every enabled layer flags corruption of what it guards
+    constexpr stack_protection CANARY_ONLY = {false, true,  false, false, VERIFY_OFF};
+    constexpr stack_protection KSP_ONLY    = {true,  false, false, false, VERIFY_OFF};
+    constexpr stack_protection HASH_ONLY   = {false, false, true,  false, VERIFY_OFF};
+
+    policy_stack<int, CANARY_ONLY> canary_only;
+    _ASSERT (canary_only.push (1) == res::OK);
+
+    unsigned char *front = (unsigned char *) policy_data (&canary_only) - sizeof (dungeon_master_t);
+    *front ^= 1;
+    _ASSERT (canary_only.verify () & res::DATA_CORRUPTED);
+    *front ^= 1;
+
+    unsigned char *struct_canary = (unsigned char *) &canary_only;
+    *struct_canary ^= 1;
+    _ASSERT (canary_only.verify () & res::STRUCT_CORRUPTED);
+    *struct_canary ^= 1;
+    _ASSERT (canary_only.verify () == res::OK);
+
+    policy_stack<int, KSP_ONLY> ksp_only (4);
+    _ASSERT (ksp_only.push (1) == res::OK);
+    int *ksp_data = policy_data (&ksp_only);
+
+    unsigned char *free_slot = (unsigned char *) (ksp_data + 1);
+    *free_slot ^= 1;
+    _ASSERT (ksp_only.verify () & res::DATA_CORRUPTED);
+    *free_slot ^= 1;
+
+    poison_fill (ksp_data, sizeof (int));
+    _ASSERT (ksp_only.verify () & res::POISONED);
+    ksp_data[0] = 1;
+    _ASSERT (ksp_only.verify () == res::OK);
+
+    policy_stack<int, HASH_ONLY> hash_only;
+    _ASSERT (hash_only.push (1) == res::OK);
+    int *hash_data = policy_data (&hash_only);
+
+    hash_data[0] ^= 2;
+    _ASSERT (hash_only.verify () & res::DATA_CORRUPTED);
+    hash_data[0] ^= 2;
+    _ASSERT (hash_only.verify () == res::OK);
+
+    // Operations check by policy level, not by NDEBUG: sampled one catches corruption within a period
+    constexpr stack_protection KSP_SAMPLED = {true, false, false, false, VERIFY_SAMPLED};
+    const size_t sampled_capacity = 4*STACK_DEFAULT_VERIFY_PERIOD;
+
+    policy_stack<int, KSP_SAMPLED> sampled (sampled_capacity);
+    policy_data (&sampled)[sampled_capacity - 1] ^= 1;
+
+    err_flags sampled_res = res::OK;
+    for (int i = 0; i < STACK_DEFAULT_VERIFY_PERIOD && sampled_res == res::OK; ++i)
+    {
+        sampled_res = sampled.push (i);
+    }
+    _ASSERT (sampled_res & res::DATA_CORRUPTED);
+    policy_data (&sampled)[sampled_capacity - 1] ^= 1;
+
+    #if POLICY_STACK_HAS_MMAP
+        // Struct copy: reserved field (after data, size & capacity) changed behind its back
+        constexpr stack_protection MEMORY_ONLY = {false, false, false, true, VERIFY_OFF};
+
+        policy_stack<int, MEMORY_ONLY> memory_only;
+        _ASSERT (memory_only.push (1) == res::OK);
+
+        unsigned char *reserved = (unsigned char *) &memory_only + sizeof (int *) + 2*sizeof (size_t);
+        *reserved ^= 1;
+        _ASSERT (memory_only.verify () & res::STRUCT_CORRUPTED);
+        *reserved ^= 1;
+        _ASSERT (memory_only.verify () == res::OK);
+    #endif
+
+    return 0;
+}
+
+int test_small_stack ()
+{
+    static_assert (sizeof (small_stack<int, 4, STACK_PROTECT_NONE>) == 2*sizeof (uint32_t) + sizeof (int *) + 4*sizeof (int),
+                   "small stack header must be compact");
+
+    small_stack<int, 4> stk;
+    _ASSERT (stk.is_inline ());
+    _ASSERT (stk.verify () == res::OK);
+
+    for (int i = 0; i < 4; ++i)
+    {
+        _ASSERT (stk.push (i) == res::OK);
+    }
+    _ASSERT (stk.is_inline ());
+    _ASSERT (stk.get_capacity () == 4);
+
+    for (int i = 4; i < 100; ++i)
+    {
+        _ASSERT (stk.push (i) == res::OK);
+    }
+    _ASSERT (!stk.is_inline ());
+    _ASSERT (stk.get_capacity () == 128);
+    _ASSERT (stk.verify () == res::OK);
+
+    int tmp = 0;
+    for (int i = 99; i >= 0; --i)
+    {
+        _ASSERT (stk.pop (&tmp) == res::OK);
+        _ASSERT (tmp == i);
+    }
+    _ASSERT (stk.pop (&tmp) == res::EMPTY);
+
+    // Inline storage is guarded by the trailing struct canary and hash
+    small_stack<int, 3> inline_stk;
+    _ASSERT (inline_stk.push (1) == res::OK);
+
+    int *inline_elem = (int *) (void *) ((char *) &inline_stk + sizeof (inline_stk) - sizeof (dungeon_master_t) - 4*sizeof (int));
+    _ASSERT (*inline_elem == 1);
+
+    *inline_elem ^= 2;
+    _ASSERT (inline_stk.verify () & res::DATA_CORRUPTED);
+    *inline_elem ^= 2;
+    _ASSERT (inline_stk.verify () == res::OK);
+
+    return 0;
+}
+
+int test_poison_kernels ()
+{
+    const size_t buf_size = 1000;
+    unsigned char *buf = (unsigned char *) calloc (buf_size, 1);
+    _ASSERT (buf != nullptr);
+
+    for (size_t offset = 0; offset < 8; ++offset)
+    {
+        for (size_t size = 0; size + offset < buf_size; size += 37)
+        {
+            poison_fill (buf + offset, size);
+            _ASSERT (poison_is_range (buf + offset, size));
+
+            if (size > 0)
+            {
+                buf[offset + size / 2] = 0;
+                _ASSERT (!poison_is_range (buf + offset, size));
+            }
+        }
+    }
+
+    // 25 elements of 7 bytes: only element 19 is fully poisoned
+    const size_t obj_size = 7, count = 25;
+    memset (buf, 0, buf_size);
+    _ASSERT (!poison_has_elem (buf, count, obj_size));
+
+    for (size_t n = 0; n < count; ++n)
+    {
+        poison_fill (buf + n*obj_size, obj_size - (n != 19));
+    }
+    _ASSERT (poison_has_elem (buf, count, obj_size));
+    _ASSERT (!poison_has_elem (buf, 19, obj_size));
+
+    free (buf);
+    return 0;
+}
+
+int test_hash_registry ()
+{
+    const char *names[] = {"djb2", "word", "simd", "crc32c"};
+
+    unsigned char buf[300] = {};
+    for (size_t i = 0; i < sizeof (buf); ++i) buf[i] = (unsigned char) (i * 7);
+
+    for (size_t n = 0; n < sizeof (names) / sizeof (names[0]); ++n)
+    {
+        hash_f func = hash_find (names[n]);
+        _ASSERT (func != nullptr);
+        _ASSERT (strcmp (hash_name (func), names[n]) == 0);
+
+        for (size_t size = 1; size < sizeof (buf); size += 13)
+        {
+            hash_t hash = func (buf, size);
+            _ASSERT (hash == func (buf, size));
+
+            buf[size / 2] ^= 0x10;
+            _ASSERT (hash != func (buf, size));
+            buf[size / 2] ^= 0x10;
+        }
+
+        stack_t stk = {};
+        stack_ctor (&stk, sizeof (int), 0, nullptr, func);
+
+        for (int i = 0; i < 100; ++i)
+        {
+            _ASSERT (stack_push (&stk, &i) == res::OK);
+        }
+
+        #if STACK_HASH_PROTECT && !STACK_MEMORY_PROTECT
+            stk.reserved++;
+            _ASSERT (stack_verify (&stk) & res::STRUCT_CORRUPTED);
+            stk.reserved--;
+        #endif
+
+        _ASSERT (stack_verify (&stk) == res::OK);
+        stack_dtor (&stk);
+    }
+
+    _ASSERT (hash_find ("unknown") == nullptr);
+
+    return 0;
+}
+
+int test_stack_trace ()
+{
+    #if STACK_TRACE
+        stack_trace_t trace = {};
+        _ASSERT (stack_trace_ctor (&trace, 200));
+        _ASSERT (trace.capacity == 256);
+
+        stack_t stk = {};
+        stack_ctor (&stk, sizeof (int));
+        _ASSERT (stack_set_trace (&stk, &trace) == res::OK);
+
+        int values[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+        int tmp = 0;
+        for (int i = 0; i < 100; ++i)
+        {
+            _ASSERT (stack_push (&stk, &i) == res::OK);
+        }
+        for (int i = 0; i < 40; ++i)
+        {
+            _ASSERT (stack_pop (&stk, &tmp) == res::OK);
+        }
+        _ASSERT (stack_push_n (&stk, values, 8) == res::OK);
+        _ASSERT (stack_pop_n  (&stk, values, 3) == res::OK);
+        _ASSERT (stack_resize (&stk, stk.capacity * 2) == res::OK);
+
+        // Every operation is recorded in order
+        size_t count = stack_trace_count (&trace);
+        trace_record_t *records = (trace_record_t *) calloc (trace.capacity, sizeof (trace_record_t));
+        _ASSERT (records != nullptr);
+        _ASSERT (stack_trace_copy (&trace, records) == count);
+
+        size_t pushes = 0;
+        size_t pops   = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (records[i].op == TRACE_PUSH) pushes++;
+            if (records[i].op == TRACE_POP)  pops++;
+        }
+        _ASSERT (records[0].op == TRACE_ATTACH);
+        _ASSERT (records[count - 1].op == TRACE_RESIZE && records[count - 1].capacity == stk.capacity);
+        _ASSERT (pushes == 100 && pops == 40);
+
+        // Replay reproduces sizes and pops
+        trace_replay_t replay = stack_trace_replay (records, count, nullptr);
+        _ASSERT (replay.records == count && replay.stacks == 1);
+        _ASSERT (replay.mismatches == 0 && replay.divergences == 0);
+
+        // Element changed between push and pop is a fingerprint mismatch
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (records[i].op == TRACE_POP) { records[i].fingerprint ^= 1; break; }
+        }
+        replay = stack_trace_replay (records, count, nullptr);
+        _ASSERT (replay.mismatches == 1 && replay.divergences == 0);
+
+        // Trace file keeps records
+        char path[] = "/tmp/stack_trace_XXXXXX";
+        int fd = mkstemp (path);
+        _ASSERT (fd != -1);
+        close (fd);
+
+        size_t loaded_count = 0;
+        _ASSERT (stack_trace_save (&trace, path));
+        trace_record_t *loaded = stack_trace_load (path, &loaded_count);
+        unlink (path);
+
+        _ASSERT (loaded != nullptr && loaded_count == count);
+        _ASSERT (stack_trace_copy (&trace, records) == count);
+        _ASSERT (memcmp (loaded, records, count * sizeof (trace_record_t)) == 0);
+        free (loaded);
+
+        // Header count beyond file length is rejected
+        trace_file_header_t header = {};
+        _ASSERT (stack_trace_save (&trace, path));
+        FILE *file = fopen (path, "r+b");
+        _ASSERT (file != nullptr);
+        _ASSERT (fread (&header, sizeof (header), 1, file) == 1);
+        header.count = UINT64_MAX;
+        _ASSERT (fseek (file, 0, SEEK_SET) == 0 && fwrite (&header, sizeof (header), 1, file) == 1);
+        fclose (file);
+
+        _ASSERT (stack_trace_load (path, &loaded_count) == nullptr && loaded_count == 0);
+        unlink (path);
+
+        // Wrapped ring starts in the middle of history
+        stack_trace_t small = {};
+        _ASSERT (stack_trace_ctor (&small, 16));
+        _ASSERT (stack_set_trace (&stk, &small) == res::OK);
+
+        for (int i = 0; i < 50; ++i)
+        {
+            _ASSERT (stack_push (&stk, &i) == res::OK);
+            if (i % 3 == 0) _ASSERT (stack_pop (&stk, &tmp) == res::OK);
+        }
+        stack_dtor (&stk);
+
+        count = stack_trace_copy (&small, records);
+        _ASSERT (count == 16 && records[count - 1].op == TRACE_DTOR);
+
+        replay = stack_trace_replay (records, count, nullptr);
+        _ASSERT (replay.mismatches == 0 && replay.divergences == 0 && replay.torn == 0);
+
+        // Torn push (size below pushed count) is skipped, not replayed from ~2^64 elements
+        records[0].op   = TRACE_PUSH_N;
+        records[0].size = 0;
+        records[0].count = 3;
+        replay = stack_trace_replay (records, count, nullptr);
+        _ASSERT (replay.torn == 1 && replay.records == count - 1);
+
+        free (records);
+        stack_trace_dtor (&small);
+        stack_trace_dtor (&trace);
+    #endif
+
+    return 0;
+}
+
+int test_stack_registry ()
+{
+    #if STACK_STATS
+        stack_registry_stats_t before = stack_registry_stats ();
+
+        stack_t ints = {};
+        stack_t dbls = {};
+        stack_ctor (&ints, sizeof (int),    4, nullptr, nullptr, VERIFY_FULL);
+        stack_ctor (&dbls, sizeof (double), 4);
+
+        int tmp = 0;
+        for (int i = 0; i < 100; ++i)
+        {
+            _ASSERT (stack_push (&ints, &i) == res::OK);
+        }
+        for (int i = 0; i < 30; ++i)
+        {
+            _ASSERT (stack_pop (&ints, &tmp) == res::OK);
+        }
+        _ASSERT (stack_resize (&ints, ints.capacity * 2) == res::OK);
+
+        double values[10] = {};
+        _ASSERT (stack_push_n (&dbls, values, 10) == res::OK);
+
+        // Counters
+        const stack_stats_t *stats = &ints.runtime.stats;
+        _ASSERT (stats->pushes == 100 && stats->pops == 30 && stats->peak_size == 100);
+        _ASSERT (stats->resizes >= 1 && stats->verify_calls > 0 && stats->verify_failures == 0);
+        _ASSERT (dbls.runtime.stats.pushes == 10);
+
+        #if STACK_DUNGEON_MASTER_PROTECT
+            ints.two_blocks_up ^= 1;
+            _ASSERT (stack_check (&ints) != res::OK);
+            ints.two_blocks_up ^= 1;
+            _ASSERT (stats->verify_failures == 1);
+        #endif
+
+        // Memory accounting
+        stack_memory_t ints_mem = stack_memory (&ints);
+        stack_memory_t dbls_mem = stack_memory (&dbls);
+        _ASSERT (ints_mem.used == 70 * sizeof (int) && dbls_mem.used == 10 * sizeof (double));
+        _ASSERT (ints_mem.committed >= ints.capacity * sizeof (int));
+        _ASSERT_IFMEM (ints_mem.committed >= ints.capacity * sizeof (int) + ints.copy_page->slot_size); // Struct copy slot
+        _ASSERT_IFMEM (ints.copy_page->slot_size < sizeof (stack_t)); // Runtime state is not copied
+
+        stack_registry_stats_t after = stack_registry_stats ();
+        _ASSERT (after.stacks == before.stacks + 2);
+        _ASSERT (after.used_bytes      - before.used_bytes      == ints_mem.used      + dbls_mem.used);
+        _ASSERT (after.committed_bytes - before.committed_bytes == ints_mem.committed + dbls_mem.committed);
+        _ASSERT (after.ops.pushes - before.ops.pushes == 110);
+        _ASSERT (after.wasted > 0 && after.wasted < 1);
+
+        FILE *out = tmpfile ();
+        _ASSERT (out != nullptr);
+        stack_registry_dump (out);
+        _ASSERT (ftell (out) > 0);
+        fclose (out);
+
+        stack_dtor (&ints);
+        _ASSERT (stack_registry_stats ().stacks == before.stacks + 1);
+        stack_dtor (&dbls);
+        _ASSERT (stack_registry_stats ().stacks == before.stacks);
+    #endif
+
+    return 0;
+}
+
+int test_stack_profile ()
+{
+    #if STACK_PROFILE
+        stack_profile_reset ();
+        stack_profile_enable (true);
+
+        stack_t ints = {};
+        stack_ctor (&ints, sizeof (int), 4, nullptr, nullptr, VERIFY_FULL);
+
+        int tmp = 0;
+        for (int i = 0; i < 100; ++i)
+        {
+            _ASSERT (stack_push (&ints, &i) == res::OK);
+        }
+        for (int i = 0; i < 100; ++i)
+        {
+            _ASSERT (stack_pop (&ints, &tmp) == res::OK);
+        }
+        _ASSERT (stack_check (&ints) == res::OK);
+
+        stack_profile_enable (false);
+        _ASSERT (stack_push (&ints, &tmp) == res::OK); // Not counted
+
+        // Only outermost operations are counted: checks inside push are its part
+        stack_profile_t push   = stack_profile_global (PROFILE_PUSH);
+        stack_profile_t pop    = stack_profile_global (PROFILE_POP);
+        stack_profile_t verify = stack_profile_global (PROFILE_VERIFY);
+        _ASSERT (push.calls == 100 && pop.calls == 100 && verify.calls == 1);
+        _ASSERT (stack_profile_global (PROFILE_CTOR).calls == 1);
+        _ASSERT (ints.runtime.profile.calls == 202);
+
+        // Layer time is a part of operation time
+        for (int op = 0; op < PROFILE_OPS; ++op)
+        {
+            stack_profile_t prof = stack_profile_global ((profile_op) op);
+
+            uint64_t layers_ticks = 0;
+            for (uint64_t ticks : prof.layer_ticks) layers_ticks += ticks;
+            _ASSERT (layers_ticks <= prof.ticks);
+        }
+
+        _ASSERT ((pop.layer_bytes[PROFILE_POISON] >= 100 * sizeof (int)) == (bool) STACK_KSP_PROTECT);
+        _ASSERT ((push.layer_ticks[PROFILE_CANARY] > 0) == (bool) STACK_DUNGEON_MASTER_PROTECT);
+        _ASSERT ((push.layer_bytes[PROFILE_HASH]   > 0) == (bool) STACK_HASH_PROTECT);
+        _ASSERT ((push.layer_ticks[PROFILE_MEMORY] > 0) == (bool) STACK_MEMORY_PROTECT);
+
+        FILE *out = tmpfile ();
+        _ASSERT (out != nullptr);
+        stack_profile_report (out);
+        _ASSERT (ftell (out) > 0);
+        fclose (out);
+
+        stack_dtor (&ints);
+        stack_profile_reset ();
+        _ASSERT (stack_profile_global (PROFILE_PUSH).calls == 0);
+    #endif
+
+    return 0;
+}
+
+/// Constructor of int stack in file for test_stack_file (stack_ctor macro drops result)
+static err_flags file_stack_ctor (stack_t *stk, const stack_alloc_t *alloc)
+{
+    #ifndef NDEBUG
+        static const stack_debug_t debug_info = {__PRETTY_FUNCTION__, __FILE__, "file_stk", __LINE__};
+        return __stack_ctor_with_debug (stk, &debug_info, sizeof (int), 4, nullptr, nullptr,
+                                        STACK_DEFAULT_VERIFY_LEVEL, nullptr, alloc);
+    #else
+        return __stack_ctor (stk, sizeof (int), 4, nullptr, nullptr, STACK_DEFAULT_VERIFY_LEVEL, nullptr, alloc);
+    #endif
+}
+
+int test_stack_file ()
+{
+    char path[] = "/tmp/stack_file_XXXXXX";
+    int fd = mkstemp (path);
+    _ASSERT (fd != -1);
+
+    const stack_alloc_t alloc = {STACK_ALLOC_FILE, 0, nullptr, path};
+    const int count = 3000;
+    int tmp = 0;
+
+    stack_t stk = {};
+    _ASSERT (file_stack_ctor (&stk, &alloc) == res::OK);
+    _ASSERT (stk.backing & BACKING_FILE);
+
+    // Growth extends file and remaps it
+    for (int i = 0; i < count; ++i)
+    {
+        _ASSERT (stack_push (&stk, &i) == res::OK);
+    }
+    for (int i = count - 1; i >= count / 2; --i)
+    {
+        _ASSERT (stack_pop (&stk, &tmp) == res::OK);
+        _ASSERT (tmp == i);
+    }
+    _ASSERT (stack_sync (&stk) == res::OK);
+
+    // File holds one stack at a time
+    stack_t other = {};
+    _ASSERT (file_stack_ctor (&other, &alloc) == res::IO_ERROR);
+
+    _ASSERT (stack_dtor (&stk) == res::OK);
+
+    // Reopened stack maps data as it is
+    stk = {};
+    _ASSERT (file_stack_ctor (&stk, &alloc) == res::OK);
+    _ASSERT (stk.size == count / 2);
+    _ASSERT (stack_verify (&stk) == res::OK);
+    _ASSERT (stack_pop (&stk, &tmp) == res::OK);
+    _ASSERT (tmp == count / 2 - 1);
+    _ASSERT (stack_dtor (&stk) == res::OK);
+
+    // Corrupted header fails reopen, file is left as it was
+    unsigned char byte = 0;
+    _ASSERT (pread  (fd, &byte, 1, offsetof (stack_file_header_t, size)) == 1);
+    byte ^= 1;
+    _ASSERT (pwrite (fd, &byte, 1, offsetof (stack_file_header_t, size)) == 1);
+
+    stk = {};
+    _ASSERT (file_stack_ctor (&stk, &alloc) == res::STRUCT_CORRUPTED);
+
+    byte ^= 1;
+    _ASSERT (pwrite (fd, &byte, 1, offsetof (stack_file_header_t, size)) == 1);
+
+    stk = {};
+    _ASSERT (file_stack_ctor (&stk, &alloc) == res::OK);
+    _ASSERT (stk.size == count / 2 - 1);
+    _ASSERT (stack_dtor (&stk) == res::OK);
+
+    #if STACK_HASH_PROTECT
+        // Element changed behind stack's back
+        off_t first = sysconf (_SC_PAGESIZE) + (STACK_DUNGEON_MASTER_PROTECT ? (off_t) sizeof (dungeon_master_t) : 0);
+        int changed = 12345;
+        _ASSERT (pwrite (fd, &changed, sizeof (changed), first) == sizeof (changed));
+
+        stk = {};
+        _ASSERT (file_stack_ctor (&stk, &alloc) & res::DATA_CORRUPTED);
+    #endif
+
+    close  (fd);
+    unlink (path);
+
+    return 0;
+}
+
+/// Logger of test_log_async
+static void log_worker (int id, int count)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        log (log::INF, "worker %d msg %d", id, i);
+    }
+}
+
+int test_log_async ()
+{
+    FILE *old_stream = get_log_stream ();
+    log   old_level  = __LOG_LEVEL;
+
+    FILE *out = tmpfile ();
+    _ASSERT (out != nullptr);
+
+    set_log_stream (out);
+    set_log_level (log::INF);
+
+    // Sync mode writes messages longer than an async record whole
+    char long_msg[4 * LOG_RECORD_MSG] = "";
+    memset (long_msg, 'x', sizeof (long_msg) - 1);
+    log (log::INF, "long %s end", long_msg);
+
+    long written = ftell (out);
+    _ASSERT (written > (long) sizeof (long_msg));
+
+    char long_end[5] = "";
+    fseek (out, written - 4, SEEK_SET);
+    _ASSERT (fread (long_end, 1, 4, out) == 4 && strcmp (long_end, "end\n") == 0);
+    fseek (out, 0, SEEK_END);
+
+    _ASSERT (log_async_start ());
+
+    // Runtime level filter works for async records, direct stream writes keep their order
+    log (log::DBG, "filtered");
+    log (log::INF, "before direct");
+    fprintf (get_log_stream (), "direct\n");
+
+    // More messages than ring holds: full rings are drained by callers
+    const int threads = 4;
+    const int count   = 3 * LOG_RING_RECORDS;
+
+    std::thread workers[threads];
+    for (int t = 0; t < threads; ++t)
+    {
+        workers[t] = std::thread (log_worker, t, count);
+    }
+    for (int t = 0; t < threads; ++t)
+    {
+        workers[t].join ();
+    }
+
+    log_async_stop ();
+    set_log_stream (old_stream);
+    set_log_level (old_level);
+
+    // Every worker's messages are written once and in order
+    rewind (out);
+
+    char line[LOG_RECORD_MSG + 64] = "";
+    int next[threads] = {};
+    bool direct_seen  = false;
+    bool before_seen  = false;
+    bool filtered     = true;
+
+    while (fgets (line, sizeof (line), out) != nullptr)
+    {
+        if (strstr (line, "filtered") != nullptr)      filtered    = false;
+        if (strstr (line, "before direct") != nullptr) before_seen = true;
+        if (strcmp (line, "direct\n") == 0)            direct_seen = before_seen;
+
+        const char *msg = strstr (line, "worker ");
+        int id = 0, i = 0;
+        if (msg != nullptr && sscanf (msg, "worker %d msg %d", &id, &i) == 2)
+        {
+            _ASSERT (id >= 0 && id < threads);
+            _ASSERT (i == next[id]);
+            next[id]++;
+        }
+    }
+    fclose (out);
+
+    _ASSERT (filtered);
+    _ASSERT (direct_seen);
+    for (int t = 0; t < threads; ++t)
+    {
+        _ASSERT (next[t] == count);
+    }
+
+    return 0;
+}
 
 // ----- TEST LOGIC -----
 
@@ -202,6 +1656,28 @@ void run_tests ()
     _TEST (test_stack_push_pop_manual_realloc ());
     _TEST (test_stack_push_pop_auto_realloc ());
     _TEST (test_stack_push_pop_auto_shrink ());
+    _TEST (test_stack_hash_detects_corruption ());
+    _TEST (test_stack_verify_levels ());
+    _TEST (test_stack_write_session ());
+    _TEST (test_stack_push_pop_n ());
+    _TEST (test_stack_growth_policy ());
+    _TEST (test_stack_reserve ());
+    _TEST (test_stack_huge_pages ());
+    _TEST (test_stack_pool ());
+    _TEST (test_shadow_registry ());
+    _TEST (test_seg_stack ());
+    _TEST (test_cstack ());
+    _TEST (test_ws_deque ());
+    _TEST (test_typed_stack ());
+    _TEST (test_policy_stack ());
+    _TEST (test_small_stack ());
+    _TEST (test_poison_kernels ());
+    _TEST (test_hash_registry ());
+    _TEST (test_stack_trace ());
+    _TEST (test_stack_registry ());
+    _TEST (test_log_async ());
+    _TEST (test_stack_profile ());
+    _TEST (test_stack_file ());
 
     log (log::INF, "Tests total: %u, failed %u, success: %u, success ratio: %3.1lf%%",
         failed + success, failed, success, success * 100.0 / (success + failed));
@@ -10,6 +10,28 @@ int test_stack_push_pop_no_resize ();
 int test_stack_push_pop_manual_realloc ();
 int test_stack_push_pop_auto_realloc ();
 int test_stack_push_pop_auto_shrink ();
+int test_stack_hash_detects_corruption ();
+int test_stack_verify_levels ();
+int test_stack_write_session ();
+int test_stack_push_pop_n ();
+int test_stack_growth_policy ();
+int test_stack_reserve ();
+int test_stack_huge_pages ();
+int test_stack_pool ();
+int test_shadow_registry ();
+int test_seg_stack ();
+int test_cstack ();
+int test_ws_deque ();
+int test_typed_stack ();
+int test_policy_stack ();
+int test_small_stack ();
+int test_poison_kernels ();
+int test_hash_registry ();
+int test_stack_trace ();
+int test_stack_registry ();
+int test_stack_profile ();
+int test_stack_file ();
+int test_log_async ();
 
 void run_tests ();
 
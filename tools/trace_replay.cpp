@@ -0,0 +1,54 @@
+/**
+ * @file trace_replay.cpp
+ * @brief Re-executes flight recorder trace file (stack_trace_save) against fresh stacks
+ *
+ * Usage: trace_replay <trace file> [repeats]
+ *
+ * The first run prints fingerprint mismatches, divergences and failed checks, the next runs
+ * are timed only. Exit code is 1 if the trace could not be reproduced cleanly.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../stack.h"
+#include "../trace.h"
+
+int main (int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        fprintf (stderr, "Usage: %s <trace file> [repeats]\n", argv[0]);
+        return 2;
+    }
+
+    long repeats = (argc > 2) ? strtol (argv[2], nullptr, 10) : 1;
+    if (repeats < 1) repeats = 1;
+
+    size_t count = 0;
+    trace_record_t *records = stack_trace_load (argv[1], &count);
+    if (records == nullptr)
+    {
+        fprintf (stderr, "Can't read trace file %s\n", argv[1]);
+        return 2;
+    }
+
+    trace_replay_t first = stack_trace_replay (records, count, stdout);
+    uint64_t best_ns = first.time_ns;
+
+    for (long i = 1; i < repeats; ++i)
+    {
+        trace_replay_t again = stack_trace_replay (records, count, nullptr);
+        if (again.time_ns < best_ns) best_ns = again.time_ns;
+    }
+
+    printf ("records: %zu, torn: %zu, stacks: %zu\n"
+            "mismatches: %zu, divergences: %zu, failed checks: %zu\n"
+            "best time: %.3f ms (%.1f ns per record, %ld runs)\n",
+            first.records, first.torn, first.stacks,
+            first.mismatches, first.divergences, first.failed_checks,
+            (double) best_ns / 1e6, (first.records != 0) ? (double) best_ns / (double) first.records : 0.0, repeats);
+
+    free (records);
+
+    return (first.mismatches == 0 && first.divergences == 0 && first.failed_checks == 0) ? 0 : 1;
+}
@@ -0,0 +1,479 @@
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+#include "stack.h"
+#include "trace.h"
+
+STACK_NAMESPACE_BEGIN
+
+// ---- ---- ---- --- CONSTS ---- ---- ---- ----
+
+static const char TRACE_MAGIC[8] = {'S', 'T', 'K', 'T', 'R', 'A', 'C', 'E'};
+static const uint32_t TRACE_VERSION = 1;
+
+/// Fingerprint of element is known (replay fingerprint stack entries)
+static const uint64_t FP_KNOWN = 1ull << 32;
+
+/// Replay state of one traced stack
+struct replay_stack_t
+{
+    uint64_t id;                        /// Traced stack address
+    stack_t stk;                        /// Fresh stack
+    stack_t fps;                        /// Fingerprints of its elements (FP_KNOWN | fingerprint, 0 - unknown)
+    unsigned char *elem;                /// Element buffer
+};
+
+// ---- ---- ---- --- PROTOTYPES ---- ---- ---- ----
+
+static stack_trace_t *global_trace_init ();
+static uint64_t       file_records      (FILE *file);
+
+static bool            replay_torn   (const trace_record_t *rec);
+static replay_stack_t *replay_create (const trace_record_t *rec);
+static err_flags       replay_ctor   (stack_t *stk, size_t obj_size);
+static void            replay_delete (replay_stack_t *state);
+static void            replay_fill   (replay_stack_t *state, uint32_t fingerprint);
+static bool            replay_record (replay_stack_t *state, const trace_record_t *rec, size_t index,
+                                      trace_replay_t *result, FILE *report);
+
+static uint64_t monotonic_ns ();
+
+// ------------------------------------------------------------------------------------
+
+bool stack_trace_ctor (stack_trace_t *trace, size_t capacity)
+{
+    assert (trace != nullptr && "pointer can't be null");
+
+    size_t rounded = 1;
+    while (rounded < capacity) rounded <<= 1;
+
+    trace->records = (trace_record_t *) calloc (rounded, sizeof (trace_record_t));
+    if (trace->records == nullptr) return false;
+
+    trace->capacity = rounded;
+    trace->next.store (0, std::memory_order_relaxed);
+
+    return true;
+}
+
+// ------------------------------------------------------------------------------------
+
+void stack_trace_dtor (stack_trace_t *trace)
+{
+    assert (trace != nullptr && "pointer can't be null");
+
+    free (trace->records);
+    trace->records  = nullptr;
+    trace->capacity = 0;
+}
+
+// ------------------------------------------------------------------------------------
+
+stack_trace_t *stack_trace_global ()
+{
+    // Never destroyed: stacks destructed at exit still record into it
+    static stack_trace_t *const global = global_trace_init ();
+
+    return global;
+}
+
+// ------------------------------------------------------------------------------------
+
+size_t stack_trace_count (const stack_trace_t *trace)
+{
+    assert (trace != nullptr && "pointer can't be null");
+
+    uint64_t written = trace->next.load (std::memory_order_acquire);
+
+    return (written < trace->capacity) ? written : trace->capacity;
+}
+
+// ------------------------------------------------------------------------------------
+
+size_t stack_trace_copy (const stack_trace_t *trace, trace_record_t *dst)
+{
+    assert (trace != nullptr && "pointer can't be null");
+    assert (dst   != nullptr && "pointer can't be null");
+
+    uint64_t written = trace->next.load (std::memory_order_acquire);
+    size_t count     = (written < trace->capacity) ? written : trace->capacity;
+    uint64_t first   = written - count;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        dst[i] = trace->records[(first + i) & (trace->capacity - 1)];
+    }
+
+    return count;
+}
+
+// ------------------------------------------------------------------------------------
+
+bool stack_trace_save (const stack_trace_t *trace, const char *path)
+{
+    assert (trace != nullptr && "pointer can't be null");
+    assert (path  != nullptr && "pointer can't be null");
+
+    trace_record_t *records = (trace_record_t *) calloc (trace->capacity, sizeof (trace_record_t));
+    if (records == nullptr) return false;
+
+    trace_file_header_t header = {};
+    memcpy (header.magic, TRACE_MAGIC, sizeof (TRACE_MAGIC));
+    header.version     = TRACE_VERSION;
+    header.record_size = sizeof (trace_record_t);
+    header.count       = stack_trace_copy (trace, records);
+
+    FILE *file = fopen (path, "wb");
+    bool ok = file != nullptr;
+
+    if (ok) ok = fwrite (&header, sizeof (header), 1, file) == 1;
+    if (ok) ok = fwrite (records, sizeof (trace_record_t), header.count, file) == header.count;
+    if (file != nullptr && fclose (file) != 0) ok = false;
+
+    free (records);
+    return ok;
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Records that fit in file after header (position is restored), 0 on IO error
+static uint64_t file_records (FILE *file)
+{
+    long pos = ftell (file);
+    if (pos < 0 || fseek (file, 0, SEEK_END) != 0) return 0;
+
+    long end = ftell (file);
+    if (fseek (file, pos, SEEK_SET) != 0 || end < pos) return 0;
+
+    return (uint64_t) (end - pos) / sizeof (trace_record_t);
+}
+
+// ------------------------------------------------------------------------------------
+
+trace_record_t *stack_trace_load (const char *path, size_t *count)
+{
+    assert (path  != nullptr && "pointer can't be null");
+    assert (count != nullptr && "pointer can't be null");
+
+    FILE *file = fopen (path, "rb");
+    if (file == nullptr) return nullptr;
+
+    trace_file_header_t header = {};
+    trace_record_t *records = nullptr;
+
+    if (fread (&header, sizeof (header), 1, file) == 1 &&
+        memcmp (header.magic, TRACE_MAGIC, sizeof (TRACE_MAGIC)) == 0 &&
+        header.version == TRACE_VERSION && header.record_size == sizeof (trace_record_t) &&
+        header.count <= file_records (file))
+    {
+        records = (trace_record_t *) calloc (header.count + 1, sizeof (trace_record_t));
+
+        if (records != nullptr && fread (records, sizeof (trace_record_t), header.count, file) != header.count)
+        {
+            free (records);
+            records = nullptr;
+        }
+    }
+
+    fclose (file);
+
+    *count = (records != nullptr) ? header.count : 0;
+    return records;
+}
+
+// ------------------------------------------------------------------------------------
+
+trace_replay_t stack_trace_replay (const trace_record_t *records, size_t count, FILE *report)
+{
+    assert ((records != nullptr || count == 0) && "pointer can't be null");
+
+    trace_replay_t result = {};
+
+    size_t states_cap = 0;
+    size_t states_cnt = 0;
+    replay_stack_t **states = nullptr;
+
+    uint64_t start = monotonic_ns ();
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const trace_record_t *rec = &records[i];
+        if (replay_torn (rec))
+        {
+            result.torn++;
+            if (report != nullptr) fprintf (report, "#%zu: torn record skipped\n", i);
+            continue;
+        }
+
+        size_t slot = 0;
+        while (slot < states_cnt && states[slot]->id != rec->stack) slot++;
+
+        if (slot == states_cnt)
+        {
+            if (states_cnt == states_cap)
+            {
+                size_t new_cap = (states_cap == 0) ? 8 : states_cap*2;
+                replay_stack_t **grown = (replay_stack_t **) realloc (states, new_cap*sizeof (replay_stack_t *));
+                if (grown == nullptr) break;
+
+                states     = grown;
+                states_cap = new_cap;
+            }
+
+            states[slot] = replay_create (rec);
+            if (states[slot] == nullptr) break;
+
+            states_cnt++;
+            result.stacks++;
+        }
+
+        result.records++;
+
+        if (!replay_record (states[slot], rec, i, &result, report))
+        {
+            // Destroyed: address may be reused by a new stack
+            replay_delete (states[slot]);
+            states[slot] = states[--states_cnt];
+        }
+    }
+
+    result.time_ns = monotonic_ns () - start;
+
+    for (size_t i = 0; i < states_cnt; ++i)
+    {
+        replay_delete (states[i]);
+    }
+    free (states);
+
+    return result;
+}
+
+// ------------------------------------------------------------------------------------
+
+static stack_trace_t *global_trace_init ()
+{
+    stack_trace_t *trace = (stack_trace_t *) calloc (1, sizeof (stack_trace_t));
+    if (trace == nullptr) return nullptr;
+
+    if (!stack_trace_ctor (trace, STACK_TRACE_GLOBAL_RECORDS))
+    {
+        free (trace);
+        return nullptr;
+    }
+
+    return trace;
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Record overwritten during the write (or empty): its size can't be undone by its count
+static bool replay_torn (const trace_record_t *rec)
+{
+    if (rec->obj_size == 0 || rec->size > rec->capacity) return true;
+
+    switch (rec->op)
+    {
+        case TRACE_PUSH:    return rec->size < 1;
+        case TRACE_PUSH_N:  return rec->size < rec->count;
+        case TRACE_POP:     return rec->size == UINT64_MAX;
+        case TRACE_POP_N:   return rec->size > UINT64_MAX - rec->count;
+        default:            return false;
+    }
+}
+
+// ------------------------------------------------------------------------------------
+
+/// stack_ctor for replay stacks, keeping its result
+static err_flags replay_ctor (stack_t *stk, size_t obj_size)
+{
+    // Fresh stacks never shrink by themselves: capacities follow TRACE_RESIZE records
+    #ifndef NDEBUG
+        const static stack_debug_t debug_info = {__PRETTY_FUNCTION__, __FILE__, "replay stack", __LINE__};
+        return __stack_ctor_with_debug (stk, &debug_info, obj_size, 0, nullptr, nullptr,
+                                        STACK_DEFAULT_VERIFY_LEVEL, &STACK_NEVER_SHRINK);
+    #else
+        return __stack_ctor (stk, obj_size, 0, nullptr, nullptr, STACK_DEFAULT_VERIFY_LEVEL, &STACK_NEVER_SHRINK);
+    #endif
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Fresh stack in the state before rec (synthetic elements of unknown fingerprint)
+static replay_stack_t *replay_create (const trace_record_t *rec)
+{
+    replay_stack_t *state = (replay_stack_t *) calloc (1, sizeof (replay_stack_t));
+    if (state == nullptr) return nullptr;
+
+    state->elem = (unsigned char *) calloc (1, rec->obj_size);
+    if (state->elem == nullptr)
+    {
+        free (state);
+        return nullptr;
+    }
+
+    state->id = rec->stack;
+
+    if (replay_ctor (&state->stk, rec->obj_size) != res::OK)
+    {
+        free (state->elem);
+        free (state);
+        return nullptr;
+    }
+
+    if (replay_ctor (&state->fps, sizeof (uint64_t)) != res::OK)
+    {
+        stack_dtor (&state->stk);
+        free (state->elem);
+        free (state);
+        return nullptr;
+    }
+
+    size_t size_before = rec->size;
+    switch (rec->op)
+    {
+        case TRACE_PUSH:    size_before -= 1;           break;
+        case TRACE_PUSH_N:  size_before -= rec->count;  break;
+        case TRACE_POP:     size_before += 1;           break;
+        case TRACE_POP_N:   size_before += rec->count;  break;
+        default:                                        break;
+    }
+
+    // Sizes beyond memory stop at the first failed push, the record then shows up as divergence
+    uint64_t unknown = 0;
+    for (size_t i = 0; i < size_before; ++i)
+    {
+        if (stack_push (&state->stk, state->elem) != res::OK) break;
+        if (stack_push (&state->fps, &unknown)    != res::OK) break;
+    }
+
+    if (rec->op != TRACE_RESIZE && rec->capacity > state->stk.capacity) stack_resize (&state->stk, rec->capacity);
+
+    return state;
+}
+
+// ------------------------------------------------------------------------------------
+
+static void replay_delete (replay_stack_t *state)
+{
+    stack_dtor (&state->stk);
+    stack_dtor (&state->fps);
+    free (state->elem);
+    free (state);
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Synthetic element: fingerprint bytes repeated
+static void replay_fill (replay_stack_t *state, uint32_t fingerprint)
+{
+    for (size_t i = 0; i < state->stk.obj_size; ++i)
+    {
+        state->elem[i] = (unsigned char) (fingerprint >> (8 * (i % sizeof (fingerprint))));
+    }
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Re-execute one record, false after TRACE_DTOR
+static bool replay_record (replay_stack_t *state, const trace_record_t *rec, size_t index,
+                           trace_replay_t *result, FILE *report)
+{
+    stack_t *stk   = &state->stk;
+    uint64_t known = FP_KNOWN | rec->fingerprint;
+    uint64_t fp    = 0;
+
+    switch (rec->op)
+    {
+        case TRACE_PUSH:
+        case TRACE_PUSH_N:
+        {
+            uint64_t unknown = 0;
+            replay_fill (state, 0);
+
+            for (size_t i = 1; i < rec->count; ++i)
+            {
+                stack_push (stk, state->elem);
+                stack_push (&state->fps, &unknown);
+            }
+
+            replay_fill (state, rec->fingerprint);
+            stack_push (stk, state->elem);
+            stack_push (&state->fps, &known);
+            break;
+        }
+
+        case TRACE_POP:
+        case TRACE_POP_N:
+        {
+            if (stk->size < rec->count) break; // Reported as divergence below
+
+            // The former top is popped first
+            stack_pop (stk, state->elem);
+            stack_pop (&state->fps, &fp);
+
+            if ((fp & FP_KNOWN) && fp != known)
+            {
+                result->mismatches++;
+                if (report != nullptr)
+                {
+                    fprintf (report, "record %zu: stack 0x%lx popped element with fingerprint %08x, pushed with %08x\n",
+                             index, rec->stack, rec->fingerprint, (uint32_t) fp);
+                }
+            }
+
+            for (size_t i = 1; i < rec->count; ++i)
+            {
+                stack_pop (stk, state->elem);
+                stack_pop (&state->fps, &fp);
+            }
+            break;
+        }
+
+        case TRACE_RESIZE:
+            if (rec->capacity >= stk->size && rec->capacity >= stk->reserved) stack_resize (stk, rec->capacity);
+            break;
+
+        case TRACE_CHECK_FAILED:
+            result->failed_checks++;
+            if (report != nullptr)
+            {
+                fprintf (report, "record %zu: stack 0x%lx failed check with flags 0x%x at size %lu\n",
+                         index, rec->stack, (unsigned int) rec->errors, rec->size);
+            }
+            break;
+
+        case TRACE_DTOR:
+            return false;
+
+        case TRACE_ATTACH:
+        default:
+            break;
+    }
+
+    // Capacities below fresh stack reserved capacity can't be reproduced
+    bool capacity_diverged = rec->op == TRACE_RESIZE && rec->capacity != stk->capacity && rec->capacity >= stk->reserved;
+
+    if (stk->size != rec->size || capacity_diverged)
+    {
+        result->divergences++;
+        if (report != nullptr)
+        {
+            fprintf (report, "record %zu: stack 0x%lx has size %lu capacity %lu, replay got %zu and %zu\n",
+                     index, rec->stack, rec->size, rec->capacity, stk->size, stk->capacity);
+        }
+    }
+
+    return true;
+}
+
+// ------------------------------------------------------------------------------------
+
+static uint64_t monotonic_ns ()
+{
+    struct timespec ts = {};
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+STACK_NAMESPACE_END
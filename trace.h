@@ -0,0 +1,222 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <atomic>
+#include "variant.h"
+
+#if (__x86_64__ || __i386__)
+#include <x86intrin.h>
+#endif
+
+STACK_NAMESPACE_BEGIN
+
+#ifndef STACK_TRACE_GLOBAL_RECORDS
+/// Records in global flight recorder (power of 2)
+#define STACK_TRACE_GLOBAL_RECORDS      4096
+#endif
+
+#ifndef STACK_TRACE_FINGERPRINT_BYTES
+/// Element bytes covered by record fingerprint
+#define STACK_TRACE_FINGERPRINT_BYTES   16
+#endif
+
+/// Recorded operation
+enum trace_op
+{
+    /// Recorder attached to stack (size & capacity of that moment)
+    TRACE_ATTACH        = 1,
+    /// Push of one element, fingerprint of pushed element
+    TRACE_PUSH          = 2,
+    /// Pop of one element, fingerprint of popped element
+    TRACE_POP           = 3,
+    /// Push of count elements, fingerprint of the new top
+    TRACE_PUSH_N        = 4,
+    /// Pop of count elements, fingerprint of the former top
+    TRACE_POP_N         = 5,
+    /// Capacity change (explicit or by growth policy), capacity is the new one
+    TRACE_RESIZE        = 6,
+    /// Failed stack check, errors are its flags
+    TRACE_CHECK_FAILED  = 7,
+    /// Destructor
+    TRACE_DTOR          = 8
+};
+
+/// Binary record of flight recorder (56 bytes, written to trace files as is)
+struct trace_record_t
+{
+    uint64_t time;                      /// trace_clock ticks
+    uint64_t stack;                     /// Stack address (stack id in trace)
+    uint64_t size;                      /// Size after operation
+    uint64_t capacity;                  /// Capacity after operation
+    uint64_t count;                     /// Elements pushed or popped
+    uint32_t obj_size;                  /// Object size
+    uint32_t fingerprint;               /// Fingerprint of element (see trace_fingerprint)
+    uint16_t op;                        /// Operation (enum trace_op)
+    uint16_t errors;                    /// Error flags of operation (err_flags)
+    uint32_t reserved;                  /// Zero
+};
+
+static_assert (sizeof (trace_record_t) == 56, "trace_record_t is the trace file format");
+
+/**
+ * @brief Flight recorder: fixed-size ring of the last operations of one or several stacks
+ *
+ * Writers take slots with one relaxed fetch_add, so a recorder can be shared by stacks of
+ * different threads (a record overwritten during the write may be torn, the rest are intact).
+ */
+struct stack_trace_t
+{
+    trace_record_t *records;            /// Ring
+    size_t capacity;                    /// Ring size (power of 2)
+    std::atomic<uint64_t> next;         /// Records ever written
+};
+
+/// Trace file header
+struct trace_file_header_t
+{
+    char magic[8];                      /// "STKTRACE"
+    uint32_t version;                   /// 1
+    uint32_t record_size;               /// sizeof (trace_record_t)
+    uint64_t count;                     /// Records after header, oldest first
+};
+
+/// Replay results (see stack_trace_replay)
+struct trace_replay_t
+{
+    size_t records;                     /// Records replayed
+    size_t torn;                        /// Torn records skipped (size can't be undone by count)
+    size_t stacks;                      /// Distinct stacks in trace
+    size_t mismatches;                  /// Pops whose fingerprint differs from the pushed one
+    size_t divergences;                 /// Records whose size or capacity replay could not reproduce
+    size_t failed_checks;               /// TRACE_CHECK_FAILED records
+    uint64_t time_ns;                   /// Time of replayed operations
+};
+
+/// Timestamp source: TSC on x86, monotonic ns elsewhere
+static inline uint64_t trace_clock ()
+{
+    #if (__x86_64__ || __i386__)
+        return __rdtsc ();
+    #else
+        struct timespec ts = {};
+        clock_gettime (CLOCK_MONOTONIC, &ts);
+        return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+    #endif
+}
+
+/// FNV-1a of the first STACK_TRACE_FINGERPRINT_BYTES bytes of element
+static inline uint32_t trace_fingerprint (const void *elem, size_t obj_size)
+{
+    const unsigned char *bytes = (const unsigned char *) elem;
+    size_t len = (obj_size < STACK_TRACE_FINGERPRINT_BYTES) ? obj_size : STACK_TRACE_FINGERPRINT_BYTES;
+
+    uint32_t fp = 2166136261u;
+    for (size_t i = 0; i < len; ++i)
+    {
+        fp = (fp ^ bytes[i]) * 16777619u;
+    }
+
+    return fp;
+}
+
+/**
+ * @brief      Add record to recorder
+ *
+ * @param      trace        Recorder
+ * @param[in]  stack        Stack address
+ * @param[in]  op           Operation
+ * @param[in]  size         Size after operation
+ * @param[in]  capacity     Capacity after operation
+ * @param[in]  obj_size     Object size
+ * @param[in]  count        Elements pushed or popped
+ * @param[in]  fingerprint  Element fingerprint
+ * @param[in]  errors       Error flags
+ */
+static inline void trace_record (stack_trace_t *trace, const void *stack, trace_op op, size_t size, size_t capacity,
+                                 size_t obj_size, size_t count, uint32_t fingerprint, unsigned int errors)
+{
+    uint64_t index = trace->next.fetch_add (1, std::memory_order_relaxed);
+    trace_record_t *rec = &trace->records[index & (trace->capacity - 1)];
+
+    rec->time        = trace_clock ();
+    rec->stack       = (uintptr_t) stack;
+    rec->size        = size;
+    rec->capacity    = capacity;
+    rec->count       = count;
+    rec->obj_size    = (uint32_t) obj_size;
+    rec->fingerprint = fingerprint;
+    rec->op          = (uint16_t) op;
+    rec->errors      = (uint16_t) errors;
+    rec->reserved    = 0;
+}
+
+/**
+ * @brief      Recorder constructor
+ *
+ * @param[out] trace     Recorder
+ * @param[in]  capacity  Records in ring (rounded up to power of 2)
+ *
+ * @return     false if out of memory
+ */
+bool stack_trace_ctor (stack_trace_t *trace, size_t capacity);
+
+/// Recorder destructor (stacks must not use it anymore)
+void stack_trace_dtor (stack_trace_t *trace);
+
+/// Process-wide recorder of STACK_TRACE_GLOBAL_RECORDS records (nullptr if out of memory)
+stack_trace_t *stack_trace_global ();
+
+/// Records in recorder now (<= capacity)
+size_t stack_trace_count (const stack_trace_t *trace);
+
+/**
+ * @brief      Copy records oldest first
+ *
+ * @param[in]  trace  Recorder
+ * @param[out] dst    Buffer of at least stack_trace_count records
+ *
+ * @return     Copied records count
+ */
+size_t stack_trace_copy (const stack_trace_t *trace, trace_record_t *dst);
+
+/**
+ * @brief      Write recorder to binary trace file (header and records, oldest first)
+ *
+ * @return     false on IO or memory error
+ */
+bool stack_trace_save (const stack_trace_t *trace, const char *path);
+
+/**
+ * @brief      Read trace file
+ *
+ * @param[in]  path   File path
+ * @param[out] count  Records count
+ *
+ * @return     Records (free with free()) or nullptr on IO, format or memory error
+ */
+trace_record_t *stack_trace_load (const char *path, size_t *count);
+
+/**
+ * @brief      Re-execute trace against fresh stacks
+ *
+ * Every traced stack gets a fresh stack_t of the same object size. Records taken after the ring wrapped
+ * start from synthetic elements. Pushed elements are filled with their fingerprint, replayed pops check
+ * recorded fingerprints against the pushed ones, so an element changed in place shows up as a mismatch.
+ * Resizes follow recorded capacities (fresh stacks never shrink by themselves). Torn records (size
+ * below pushed count, overflowing popped count) are skipped and counted.
+ *
+ * @param[in]  records  Records, oldest first
+ * @param[in]  count    Records count
+ * @param[out] report   Stream for mismatches & divergences (nullptr -> silent)
+ *
+ * @return     Replay results
+ */
+trace_replay_t stack_trace_replay (const trace_record_t *records, size_t count, FILE *report);
+
+STACK_NAMESPACE_END
+
+#endif // TRACE_H
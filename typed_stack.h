@@ -0,0 +1,166 @@
+#ifndef TYPED_STACK_H
+#define TYPED_STACK_H
+
+#include <string.h>
+#include <type_traits>
+#include <utility>
+#include <new>
+#include "stack.h"
+#include "variant.h"
+
+STACK_NAMESPACE_BEGIN
+
+// ---------------- Element printing ----------------
+
+/**
+ * @brief      Element print function for typed_stack<T> dumps
+ *
+ * Arithmetic types and pointers are printed as values, other types per byte (byte_fprintf).
+ */
+template <typename T>
+void typed_elem_print (const void *elem, size_t elem_size, FILE *stream)
+{
+    assert (elem   != nullptr && "pointer can't be null");
+    assert (stream != nullptr && "pointer can't be null");
+
+    if constexpr (std::is_arithmetic_v<T> || std::is_pointer_v<T>)
+    {
+        T value;
+        memcpy (&value, elem, sizeof (T));
+
+        if constexpr (std::is_same_v<T, bool>)
+        {
+            fprintf (stream, "%s", value ? "true" : "false");
+        }
+        else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>)
+        {
+            fprintf (stream, "%lld", (long long) value);
+        }
+        else if constexpr (std::is_integral_v<T>)
+        {
+            fprintf (stream, "%llu", (unsigned long long) value);
+        }
+        else if constexpr (std::is_floating_point_v<T>)
+        {
+            fprintf (stream, "%lg", (double) value);
+        }
+        else
+        {
+            fprintf (stream, "%p", (const void *) value);
+        }
+    }
+    else
+    {
+        byte_fprintf (elem, elem_size, stream);
+    }
+}
+
+// ---------------- Typed stack ----------------
+
+/**
+ * @brief      Type-safe front end of stack_t with compile-time element size
+ *
+ * Elements are copied and popped slots poisoned with sizeof (T) known at compile time, so both are inlined,
+ * all protections of stack_t work as usual. T must be trivially copyable:
+ * stack data is moved with realloc/mremap and poisoned bytewise.
+ */
+template <typename T>
+class typed_stack
+{
+    static_assert (std::is_trivially_copyable_v<T>, "typed_stack element must be trivially copyable");
+
+public:
+    explicit typed_stack (size_t capacity = 0, hash_f hash_func = nullptr, verify_level level = STACK_DEFAULT_VERIFY_LEVEL):
+        stk (),
+        ctor_errors (res::OK)
+    {
+        #ifndef NDEBUG
+            const static stack_debug_t debug_info = {__PRETTY_FUNCTION__, __FILE__, "typed_stack", __LINE__};
+            ctor_errors = __stack_ctor_with_debug (&stk, &debug_info, sizeof (T), capacity, typed_elem_print<T>, hash_func, level);
+        #else
+            ctor_errors = __stack_ctor (&stk, sizeof (T), capacity, typed_elem_print<T>, hash_func, level);
+        #endif
+    }
+
+    typed_stack (const typed_stack &) = delete;
+    typed_stack &operator= (const typed_stack &) = delete;
+
+    ~typed_stack ()
+    {
+        // Failed constructor leaves stack null or half-built
+        if (ctor_errors == res::OK) stack_dtor (&stk);
+    }
+
+    err_flags push (const T &value)
+    {
+        void *slot = nullptr;
+        UNWRAP (stack_push_slot (&stk, &slot));
+
+        memcpy (slot, &value, sizeof (T));
+
+        return stack_push_commit (&stk);
+    }
+
+    err_flags push (T &&value)
+    {
+        return emplace (std::move (value));
+    }
+
+    /// Construct element in place (over-aligned types are constructed aside and copied: slots are 8-byte aligned)
+    template <typename... Args>
+    err_flags emplace (Args&&... args)
+    {
+        void *slot = nullptr;
+        UNWRAP (stack_push_slot (&stk, &slot));
+
+        if constexpr (alignof (T) <= alignof (dungeon_master_t))
+        {
+            ::new (slot) T (std::forward<Args> (args)...);
+        }
+        else
+        {
+            T value (std::forward<Args> (args)...);
+            memcpy (slot, &value, sizeof (T));
+        }
+
+        return stack_push_commit (&stk);
+    }
+
+    err_flags pop (T *value)
+    {
+        assert (value != nullptr && "pointer can't be null");
+
+        void *slot = nullptr;
+        UNWRAP (stack_pop_slot_poison (&stk, &slot));
+
+        memcpy (value, slot, sizeof (T));
+
+        #if STACK_KSP_PROTECT
+            memset (slot, POISON_BYTE, sizeof (T));
+        #endif
+
+        return stack_pop_commit_poisoned (&stk);
+    }
+
+    size_t size     () const { return stk.size;     }
+    size_t capacity () const { return stk.capacity; }
+    bool   empty    () const { return stk.size == 0; }
+
+    /// Errors of construction (bitor of res enum)
+    err_flags status () const { return ctor_errors; }
+
+    err_flags verify () { return stack_verify (&stk); }
+
+    void dump (FILE *stream) { stack_dump (&stk, stream); }
+
+    /// Underlying C stack for the rest of stack API
+    stack_t *raw () { return &stk; }
+
+private:
+    stack_t stk;
+    err_flags ctor_errors;
+};
+
+STACK_NAMESPACE_END
+
+#endif // TYPED_STACK_H
@@ -0,0 +1,21 @@
+#ifndef VARIANT_H
+#define VARIANT_H
+
+/**
+ * @brief Library variant namespace
+ *
+ * Layout of stack_t and behavior of every function depend on protection macros, so library variants
+ * built with different ones (see make lib) put all their types & functions into inline namespace
+ * STACK_VARIANT. Symbols of variants differ, and several variants can be linked into one process
+ * (every translation unit uses the variant whose STACK_VARIANT & protection macros it is compiled with).
+ * Without STACK_VARIANT everything stays in the global namespace.
+ */
+#ifdef STACK_VARIANT
+    #define STACK_NAMESPACE_BEGIN   inline namespace STACK_VARIANT {
+    #define STACK_NAMESPACE_END     }
+#else
+    #define STACK_NAMESPACE_BEGIN
+    #define STACK_NAMESPACE_END
+#endif
+
+#endif // VARIANT_H
@@ -0,0 +1,567 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "log.h"
+#include "ws_deque.h"
+
+STACK_NAMESPACE_BEGIN
+
+// ---- ---- ---- --- CONSTS ---- ---- ---- ----
+
+/// Size of struct part covered by struct hash
+#if STACK_HASH_PROTECT
+const size_t WS_PROTECTED_STRUCT_SIZE = offsetof (ws_deque_t, struct_hash);
+#endif
+
+// ---- ---- ---- --- MACROS ---- ---- ---- ----
+
+/// stack_assert without stack_dump: dump verifies buffers and slots, which thieves may be reading
+#define ws_deque_assert(dq)                                         \
+{                                                                   \
+    err_flags check_res = stack_check(dq);                          \
+    if (check_res != res::OK)                                       \
+    {                                                               \
+        log(log::ERR,                                               \
+            "Failed work-stealing deque check with err flags: ");   \
+        stack_perror (check_res, get_log_stream(), "->");           \
+        return check_res;                                           \
+    }                                                               \
+}
+
+// ---- ---- ---- --- PROTOTYPES ---- ---- ---- ----
+
+static inline char *slot (const ws_deque_t *dq, const ws_buffer_t *buf, int64_t index);
+static inline char *buffer_data (const ws_buffer_t *buf);
+
+static ws_buffer_t *buffer_new   (const ws_deque_t *dq, size_t capacity);
+static err_flags    buffer_grow  (ws_deque_t *dq, int64_t bottom, int64_t top);
+static void         buffer_check (const ws_deque_t *dq, const ws_buffer_t *buf, err_flags *errs);
+
+static inline void slot_load   (void *value, const char *elem, size_t size);
+static inline void slot_store  (char *elem, const void *value, size_t size);
+static inline void slot_poison (char *elem, size_t size);
+
+static inline void poison_stolen (ws_deque_t *dq, int64_t bottom);
+
+static inline hash_t calc_struct_hash (const ws_deque_t *dq);
+
+// ---- ---- ---- --- IMPLEMENTATIONS ---- ---- ---- ----
+
+err_flags __stack_ctor (ws_deque_t *dq, size_t obj_size, size_t capacity, elem_print_f print_func)
+{
+    assert (obj_size > 0  && "object size cant be 0");
+    assert (dq != nullptr && "pointer can't be null");
+
+    size_t pow2_capacity = 2;
+    while (pow2_capacity < capacity || (capacity == 0 && pow2_capacity < WS_DEQUE_DEFAULT_CAPACITY))
+    {
+        pow2_capacity *= 2;
+    }
+
+    dq->obj_size = obj_size;
+
+    ws_buffer_t *buf = buffer_new (dq, pow2_capacity);
+    if (buf == nullptr) return res::NOMEM;
+
+    dq->top.store    (0, std::memory_order_relaxed);
+    dq->bottom.store (0, std::memory_order_relaxed);
+    dq->buffer.store (buf, std::memory_order_relaxed);
+    dq->poisoned_to = 0;
+
+    #ifndef NDEBUG
+        dq->print_func = (print_func != nullptr) ? print_func : byte_fprintf;
+    #else
+        (void) print_func;
+    #endif
+
+    #if STACK_DUNGEON_MASTER_PROTECT
+        dq->two_blocks_up   = dungeon_master_val;
+        dq->two_blocks_down = dungeon_master_val;
+    #endif
+
+    #if STACK_HASH_PROTECT
+        dq->struct_hash = calc_struct_hash (dq);
+    #endif
+
+    stack_assert (dq);
+    return res::OK;
+}
+
+// ------------------------------------------------------------------------------------
+
+#ifndef NDEBUG
+err_flags __stack_ctor_with_debug (ws_deque_t *dq, const stack_debug_t *debug_data,
+                                size_t obj_size, size_t capacity, elem_print_f print_func)
+{
+    assert (dq != nullptr && "pointer can't be NULL");
+
+    dq->debug_data = debug_data;
+
+    return __stack_ctor (dq, obj_size, capacity, print_func);
+}
+#endif
+
+// ------------------------------------------------------------------------------------
+
+err_flags stack_push (ws_deque_t *dq, const void *value)
+{
+    ws_deque_assert (dq);
+    assert (value != nullptr && "pointer can't be null");
+
+    int64_t top    = dq->top.load    (std::memory_order_relaxed);
+    int64_t bottom = dq->bottom.load (std::memory_order_acquire);
+
+    poison_stolen (dq, bottom);
+
+    ws_buffer_t *buf = dq->buffer.load (std::memory_order_relaxed);
+    if (top - bottom >= (int64_t) buf->capacity - 1)
+    {
+        UNWRAP (buffer_grow (dq, bottom, top));
+        buf = dq->buffer.load (std::memory_order_relaxed);
+    }
+
+    slot_store (slot (dq, buf, top), value, dq->obj_size);
+
+    // Element is visible to thieves together with the new top
+    dq->top.store (top + 1, std::memory_order_release);
+
+    return res::OK;
+}
+
+// ------------------------------------------------------------------------------------
+
+err_flags stack_pop (ws_deque_t *dq, void *value)
+{
+    ws_deque_assert (dq);
+    assert (value != nullptr && "pointer can't be NULL");
+
+    int64_t top = dq->top.load (std::memory_order_relaxed) - 1;
+    ws_buffer_t *buf = dq->buffer.load (std::memory_order_relaxed);
+
+    // Claim the top element before looking at the bottom: thieves see it claimed or we see their steal
+    dq->top.store (top, std::memory_order_relaxed);
+    std::atomic_thread_fence (std::memory_order_seq_cst);
+    int64_t bottom = dq->bottom.load (std::memory_order_relaxed);
+
+    if (top < bottom)
+    {
+        dq->top.store (bottom, std::memory_order_relaxed);
+        poison_stolen (dq, bottom);
+        return res::EMPTY;
+    }
+
+    char *elem = slot (dq, buf, top);
+    memcpy (value, elem, dq->obj_size);
+
+    if (top > bottom)
+    {
+        #if STACK_KSP_PROTECT
+            slot_poison (elem, dq->obj_size);
+        #endif
+
+        poison_stolen (dq, bottom);
+        return res::OK;
+    }
+
+    // The last element: race with thieves for it
+    bool won = dq->bottom.compare_exchange_strong (bottom, bottom + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    dq->top.store (top + 1, std::memory_order_relaxed);
+
+    if (!won) return res::EMPTY;
+
+    #if STACK_KSP_PROTECT
+        slot_poison (elem, dq->obj_size);
+    #endif
+
+    poison_stolen (dq, top + 1);
+    return res::OK;
+}
+
+// ------------------------------------------------------------------------------------
+
+err_flags stack_steal (ws_deque_t *dq, void *value)
+{
+    ws_deque_assert (dq);
+    assert (value != nullptr && "pointer can't be NULL");
+
+    int64_t bottom = dq->bottom.load (std::memory_order_acquire);
+    std::atomic_thread_fence (std::memory_order_seq_cst);
+    int64_t top = dq->top.load (std::memory_order_acquire);
+
+    if (bottom >= top) return res::EMPTY;
+
+    // Buffer read after top holds the element: replaced buffers are copies and stay allocated
+    ws_buffer_t *buf = dq->buffer.load (std::memory_order_acquire);
+    slot_load (value, slot (dq, buf, bottom), dq->obj_size);
+
+    if (!dq->bottom.compare_exchange_strong (bottom, bottom + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+    {
+        return res::EMPTY;
+    }
+
+    return res::OK;
+}
+
+// ------------------------------------------------------------------------------------
+
+err_flags stack_dtor (ws_deque_t *dq)
+{
+    if (dq == nullptr) { return res::OK; }
+
+    #ifndef NDEBUG
+        err_flags check_res = stack_verify (dq);
+        if (check_res != OK) log(log::WRN, "Destructor called on invalid object with error flags: 0x%x, see stack_perror", check_res);
+    #endif
+
+    ws_buffer_t *buf = dq->buffer.exchange (nullptr, std::memory_order_relaxed);
+    while (buf != nullptr)
+    {
+        ws_buffer_t *retired = buf->retired;
+
+        #if STACK_KSP_PROTECT
+            poison_fill (buffer_data (buf), buf->capacity*dq->obj_size);
+        #endif
+
+        free (buf);
+        buf = retired;
+    }
+
+    #if STACK_KSP_PROTECT
+        // Poisoning
+        dq->top.store    (-1, std::memory_order_relaxed);
+        dq->bottom.store ( 0, std::memory_order_relaxed);
+        dq->obj_size = 0;
+    #endif
+
+    return res::OK;
+}
+
+// ------------------------------------------------------------------------------------
+
+void stack_dump (ws_deque_t *dq, FILE *stream)
+{
+    fprintf (stream, R Bold "\n======== WORK-STEALING DEQUE DUMP =======\n" Plain D);
+
+    if (dq == nullptr)
+    {
+        fprintf (stream, "Deque ptr is nullptr\n");
+        return;
+    }
+
+    err_flags check_res = stack_verify (dq);
+
+    if (check_res != OK)
+    {
+        fprintf (stream, "Deque has errors: \n");
+        stack_perror(check_res, stream, "-> ");
+    }
+
+    if (check_res & (res::POISONED | res::INVALID_SIZE | res::INVALID_OBJ_SIZE | res::STRUCT_CORRUPTED | res::DATA_NULL)) { return; }
+
+    #ifndef NDEBUG
+        fprintf (stream, "Deque[%p] with name " Bold "%s" Plain
+            " allocated at " Bold "%s" Plain " at file " Bold "%s:(%u)\n" Plain,
+            dq, dq->debug_data->var_name, dq->debug_data->func_name, dq->debug_data->file, dq->debug_data->line
+        );
+    #else
+        fprintf (stream, "Deque[%p]\n", dq);
+    #endif
+
+    const ws_buffer_t *buf = dq->buffer.load ();
+    int64_t top    = dq->top.load ();
+    int64_t bottom = dq->bottom.load ();
+
+    fprintf (stream, "Parameters:\n"
+                     "    bottom: %ld\n"
+                     "    top: %ld\n"
+                     "    capacity: %lu\n"
+                     "    object size: %lu\n\n",
+                     bottom, top, buf->capacity, dq->obj_size);
+
+    for (int64_t i = top - 1; i >= bottom; --i)
+    {
+        fprintf (stream, "* data[%03ld]: ", i);
+
+        #ifndef NDEBUG
+            dq->print_func (slot (dq, buf, i), dq->obj_size, stream);
+        #else
+            byte_fprintf (slot (dq, buf, i), dq->obj_size, stream);
+        #endif
+
+        fputc ('\n', stream);
+    }
+
+    fprintf (stream, R Bold "======== END WORK-STEALING DEQUE DUMP =======\n\n" Plain D);
+}
+
+// ------------------------------------------------------------------------------------
+
+err_flags stack_check (ws_deque_t *dq)
+{
+    if (dq == nullptr) return res::NULLPTR;
+
+    err_flags ret = res::OK;
+
+    if (dq->obj_size == 0) return res::INVALID_OBJ_SIZE;
+
+    #ifndef NDEBUG
+        if (dq->print_func == nullptr) ret |= res::INVALID_FUNC;
+    #endif
+
+    #if STACK_DUNGEON_MASTER_PROTECT
+        if (dq->two_blocks_up != dungeon_master_val || dq->two_blocks_down != dungeon_master_val)
+        {
+            ret |= res::STRUCT_CORRUPTED;
+        }
+    #endif
+
+    #if STACK_HASH_PROTECT
+        if (calc_struct_hash (dq) != dq->struct_hash) ret |= res::STRUCT_CORRUPTED;
+    #endif
+
+    if (ret != res::OK) return ret;
+
+    const ws_buffer_t *buf = dq->buffer.load (std::memory_order_acquire);
+    if (buf == nullptr) return res::DATA_NULL;
+
+    buffer_check (dq, buf, &ret);
+    return ret;
+}
+
+// ------------------------------------------------------------------------------------
+
+err_flags stack_verify (ws_deque_t *dq)
+{
+    err_flags ret = stack_check (dq);
+    if (ret != res::OK) return ret;
+
+    const ws_buffer_t *buf = dq->buffer.load ();
+    int64_t top    = dq->top.load ();
+    int64_t bottom = dq->bottom.load ();
+
+    if (top < bottom || top - bottom > (int64_t) buf->capacity) return ret | res::INVALID_SIZE;
+    if (dq->poisoned_to > bottom)                                return ret | res::STRUCT_CORRUPTED;
+
+    for (const ws_buffer_t *old = buf->retired; old != nullptr; old = old->retired)
+    {
+        buffer_check (dq, old, &ret);
+    }
+
+    #if STACK_KSP_PROTECT
+        // Stolen slots above poisoned_to are poisoned by the next owner operation
+        for (int64_t i = top; i < dq->poisoned_to + (int64_t) buf->capacity; ++i)
+        {
+            if (!poison_is_range (slot (dq, buf, i), dq->obj_size)) ret |= res::DATA_CORRUPTED;
+        }
+
+        for (int64_t i = bottom; i < top; ++i)
+        {
+            if (poison_has_elem (slot (dq, buf, i), 1, dq->obj_size)) ret |= res::POISONED;
+        }
+    #endif
+
+    return ret;
+}
+
+// ------------------------------------------------------------------------------------
+
+static inline char *buffer_data (const ws_buffer_t *buf)
+{
+    assert (buf != nullptr && "pointer can't be null");
+
+    return (char *) const_cast<ws_buffer_t *>(buf + 1);
+}
+
+// ------------------------------------------------------------------------------------
+
+static inline char *slot (const ws_deque_t *dq, const ws_buffer_t *buf, int64_t index)
+{
+    return buffer_data (buf) + ((size_t) index & (buf->capacity - 1))*dq->obj_size;
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Buffer with canaries and poisoned slots
+static ws_buffer_t *buffer_new (const ws_deque_t *dq, size_t capacity)
+{
+    assert (dq != nullptr && "pointer can't be null");
+
+    size_t data_size = capacity*dq->obj_size;
+    size_t buf_size  = sizeof (ws_buffer_t) + data_size;
+    #if STACK_DUNGEON_MASTER_PROTECT
+        buf_size += sizeof (dungeon_master_t);
+    #endif
+
+    ws_buffer_t *buf = (ws_buffer_t *) calloc (buf_size, 1);
+    if (buf == nullptr) return nullptr;
+
+    buf->canary   = dungeon_master_val;
+    buf->capacity = capacity;
+    buf->retired  = nullptr;
+
+    #if STACK_DUNGEON_MASTER_PROTECT
+        // Trailing canary may be unaligned (capacity * obj_size % 8 != 0)
+        memcpy (buffer_data (buf) + data_size, &dungeon_master_val, sizeof (dungeon_master_t));
+    #endif
+
+    #if STACK_KSP_PROTECT
+        poison_fill (buffer_data (buf), data_size);
+    #endif
+
+    return buf;
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Owner: replace buffer with twice bigger copy of [bottom, top), old one is kept for thieves
+static err_flags buffer_grow (ws_deque_t *dq, int64_t bottom, int64_t top)
+{
+    ws_buffer_t *old = dq->buffer.load (std::memory_order_relaxed);
+
+    ws_buffer_t *buf = buffer_new (dq, old->capacity*2);
+    if (buf == nullptr) return res::NOMEM;
+
+    for (int64_t i = bottom; i < top; ++i)
+    {
+        memcpy (slot (dq, buf, i), slot (dq, old, i), dq->obj_size);
+    }
+
+    buf->retired = old;
+    dq->buffer.store (buf, std::memory_order_release);
+
+    return res::OK;
+}
+
+// ------------------------------------------------------------------------------------
+
+static void buffer_check (const ws_deque_t *dq, const ws_buffer_t *buf, err_flags *errs)
+{
+    assert (dq   != nullptr && "pointer can't be null");
+    assert (buf  != nullptr && "pointer can't be null");
+    assert (errs != nullptr && "pointer can't be null");
+
+    if (buf->capacity == 0 || (buf->capacity & (buf->capacity - 1)) != 0)
+    {
+        *errs |= res::BAD_CAPACITY;
+        return;
+    }
+
+    #if STACK_DUNGEON_MASTER_PROTECT
+        dungeon_master_t back = 0;
+        memcpy (&back, buffer_data (buf) + buf->capacity*dq->obj_size, sizeof (dungeon_master_t));
+
+        if (buf->canary != dungeon_master_val || back != dungeon_master_val) *errs |= res::DATA_CORRUPTED;
+    #else
+        (void) dq;
+    #endif
+}
+
+// ------------------------------------------------------------------------------------
+
+/**
+ * @brief      Copy of element from slot by relaxed atomic words (bytes where unaligned)
+ *
+ * Thief reads the slot before its CAS, so a thief that loses may still be reading while
+ * the owner poisons or reuses the slot: all slot accesses racing with it are atomic.
+ */
+static inline void slot_load (void *value, const char *elem, size_t size)
+{
+    assert (value != nullptr && "pointer can't be null");
+    assert (elem  != nullptr && "pointer can't be null");
+
+    size_t i = 0;
+    if ((uintptr_t) elem % sizeof (uint64_t) == 0)
+    {
+        for (; i + sizeof (uint64_t) <= size; i += sizeof (uint64_t))
+        {
+            uint64_t word = __atomic_load_n ((const uint64_t *) (const void *) (elem + i), __ATOMIC_RELAXED);
+            memcpy ((char *) value + i, &word, sizeof (uint64_t));
+        }
+    }
+
+    for (; i < size; ++i)
+    {
+        ((char *) value)[i] = __atomic_load_n (elem + i, __ATOMIC_RELAXED);
+    }
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Owner: element into slot by relaxed atomic words (see slot_load)
+static inline void slot_store (char *elem, const void *value, size_t size)
+{
+    assert (elem  != nullptr && "pointer can't be null");
+    assert (value != nullptr && "pointer can't be null");
+
+    size_t i = 0;
+    if ((uintptr_t) elem % sizeof (uint64_t) == 0)
+    {
+        for (; i + sizeof (uint64_t) <= size; i += sizeof (uint64_t))
+        {
+            uint64_t word = 0;
+            memcpy (&word, (const char *) value + i, sizeof (uint64_t));
+            __atomic_store_n ((uint64_t *) (void *) (elem + i), word, __ATOMIC_RELAXED);
+        }
+    }
+
+    for (; i < size; ++i)
+    {
+        __atomic_store_n (elem + i, ((const char *) value)[i], __ATOMIC_RELAXED);
+    }
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Owner: poison_fill of slot by relaxed atomic words (see slot_load)
+static inline void slot_poison (char *elem, size_t size)
+{
+    assert (elem != nullptr && "pointer can't be null");
+
+    uint64_t poison_word = 0;
+    memset (&poison_word, POISON_BYTE, sizeof (uint64_t));
+
+    size_t i = 0;
+    if ((uintptr_t) elem % sizeof (uint64_t) == 0)
+    {
+        for (; i + sizeof (uint64_t) <= size; i += sizeof (uint64_t))
+        {
+            __atomic_store_n ((uint64_t *) (void *) (elem + i), poison_word, __ATOMIC_RELAXED);
+        }
+    }
+
+    for (; i < size; ++i)
+    {
+        __atomic_store_n (elem + i, (char) POISON_BYTE, __ATOMIC_RELAXED);
+    }
+}
+
+// ------------------------------------------------------------------------------------
+
+/// Owner: poison slots stolen since the last owner operation (losing thieves may still read them, see slot_load)
+static inline void poison_stolen (ws_deque_t *dq, int64_t bottom)
+{
+    #if STACK_KSP_PROTECT
+        ws_buffer_t *buf = dq->buffer.load (std::memory_order_relaxed);
+
+        for (int64_t i = dq->poisoned_to; i < bottom; ++i)
+        {
+            slot_poison (slot (dq, buf, i), dq->obj_size);
+        }
+    #endif
+
+    if (bottom > dq->poisoned_to) dq->poisoned_to = bottom;
+}
+
+// ------------------------------------------------------------------------------------
+
+static inline hash_t calc_struct_hash (const ws_deque_t *dq)
+{
+    #if STACK_HASH_PROTECT
+        return hash_fixed<WS_PROTECTED_STRUCT_SIZE> (dq);
+    #else
+        (void) dq;
+        return 0;
+    #endif
+}
+
+STACK_NAMESPACE_END
@@ -0,0 +1,109 @@
+#ifndef WS_DEQUE_H
+#define WS_DEQUE_H
+
+#include <atomic>
+#include "stack.h"
+#include "variant.h"
+
+STACK_NAMESPACE_BEGIN
+
+#ifndef WS_DEQUE_DEFAULT_CAPACITY
+/// Initial capacity of deques constructed without one
+#define WS_DEQUE_DEFAULT_CAPACITY       64
+#endif
+
+/**
+ * @brief Ring buffer of work-stealing deque
+ *
+ * Header is followed by capacity slots and trailing canary (STACK_DUNGEON_MASTER_PROTECT).
+ * Buffers replaced by growth stay allocated until the destructor: thieves may still read them.
+ */
+struct ws_buffer_t
+{
+    dungeon_master_t canary;            /// Buffer header canary
+    size_t capacity;                    /// Slots count (power of 2)
+    ws_buffer_t *retired;               /// Buffer replaced by this one (nullptr for the first one)
+};
+
+/**
+ * @brief Chase-Lev work-stealing deque
+ *
+ * Owner thread uses it as a stack: stack_push & stack_pop work at the top without CAS
+ * (only the pop of the last element races with thieves). Any thread takes the oldest element
+ * from the bottom with stack_steal (one CAS). Buffer grows like stack_t data: by doubling.
+ *
+ * Unused slots are poisoned (STACK_KSP_PROTECT): popped ones at once, stolen ones by the next owner
+ * operation (thieves never write to buffer). Slots are accessed by relaxed atomic words, as a thief
+ * that lost its CAS may still be reading a slot the owner rewrites. Buffers and struct have canaries, struct hash covers
+ * immutable fields, so stack_check is thread safe (operations log its failures, never dump).
+ * stack_verify & stack_dump need no concurrent operations.
+ */
+struct ws_deque_t
+{
+    #if STACK_DUNGEON_MASTER_PROTECT
+    dungeon_master_t two_blocks_up;     /// Struct canary
+    #endif
+
+    size_t obj_size;                    /// Stack object size
+
+    #ifndef NDEBUG
+    elem_print_f print_func;            /// Function for printing elements
+    const stack_debug_t *debug_data;    /// Debug data
+    #endif
+
+    #if STACK_DUNGEON_MASTER_PROTECT
+    dungeon_master_t two_blocks_down;   /// Struct canary
+    #endif
+
+    #if STACK_HASH_PROTECT
+    hash_t struct_hash;                 /// Hash of fields above (they never change, so it is checked without locks)
+    #endif
+
+    // Shared state, not protected
+    alignas (64) std::atomic<int64_t> top;          /// Index after the newest element (written by owner only)
+    int64_t poisoned_to;                            /// Owner: slots below are poisoned or stolen before it
+    std::atomic<ws_buffer_t *> buffer;              /// Current buffer (replaced by owner only)
+    alignas (64) std::atomic<int64_t> bottom;       /// Index of the oldest element
+};
+
+/**
+ * @brief      Work-stealing deque constructor (not thread safe)
+ *
+ * @param[out] dq          Pointer to deque
+ * @param[in]  obj_size    Object size
+ * @param[in]  capacity    Initial capacity (rounded up to power of 2, 0 -> WS_DEQUE_DEFAULT_CAPACITY)
+ * @param[in]  print_func  Function for printing elements (can be nullptr -> per byte print)
+ *
+ * @return     Error flags (bitor of res enum)
+ */
+err_flags __stack_ctor (ws_deque_t *dq, size_t obj_size, size_t capacity = 0, elem_print_f print_func = nullptr);
+
+#ifndef NDEBUG
+    err_flags __stack_ctor_with_debug (ws_deque_t *dq, const stack_debug_t *debug_data,
+                                    size_t obj_size, size_t capacity = 0, elem_print_f print_func = nullptr);
+#endif
+
+/// Owner: push to the top
+err_flags stack_push (ws_deque_t *dq, const void *value);
+
+/// Owner: pop from the top (EMPTY if deque is empty or a thief took the last element)
+err_flags stack_pop (ws_deque_t *dq, void *value);
+
+/// Any thread: take the oldest element (EMPTY if deque is empty or another thread took it, value is garbage then)
+err_flags stack_steal (ws_deque_t *dq, void *value);
+
+/// Destructor (not thread safe)
+err_flags stack_dtor (ws_deque_t *dq);
+
+/// Dump (no concurrent operations)
+void stack_dump (ws_deque_t *dq, FILE *stream);
+
+/// Full check of struct, buffers & slots (no concurrent operations)
+err_flags stack_verify (ws_deque_t *dq);
+
+/// Thread safe O(1) check: struct & current buffer canaries, struct hash
+err_flags stack_check (ws_deque_t *dq);
+
+STACK_NAMESPACE_END
+
+#endif // WS_DEQUE_H